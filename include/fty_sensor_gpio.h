@@ -26,6 +26,8 @@
 #include <sstream>
 #include <cstddef>
 #include <map>
+#include <memory>
+#include <vector>
 
 using namespace std;
 
@@ -35,43 +37,79 @@ using namespace std;
 //  Add your own public definitions here, if you need them
 #define FTY_SENSOR_GPIO_AGENT "fty-sensor-gpio"
 #define DEFAULT_POLL_INTERVAL 2000
+#define DEFAULT_EDGE_CHECK_INTERVAL 60000
+#define DEFAULT_HEARTBEAT_INTERVAL 100000 // well inside the 300 s status TTL
 #define DEFAULT_STATEFILE_PATH "/var/lib/fty/fty-sensor-gpio/state"
 #define DEFAULT_LOG_CONFIG "/etc/fty/ftylog.cfg"
 
 // TODO: get from config
 #define TIMEOUT_MS -1   //wait infinitely
 
+//  Runtime state of a monitored GPx, only changed by the server actor
+typedef struct _gpx_state_s {
+    int current_state;          // opened | closed
+    bool alert_triggered;       // flag to remember if an alert has been fired
+    int last_published_state;   // last status published, to only publish changes
+    int64_t last_published;     // monotonic time (msec) of the last publication
+} _gpx_state_t;
+
 //  Structure to store information on a monitored GPI
-//  This includes both the template and configuration information
+//  This includes both the template and configuration information,
+//  which never change once the sensor is published in a table version.
+//  The descriptive strings repeated from sensor to sensor are interned:
+//  equal strings are stored once, and shared by the sensors (const)
 
 // Structure of unitary monitored GPx
 typedef struct _gpx_info_s {
-    char* manufacturer;   // sensor manufacturer name
     char* asset_name;     // sensor asset name
     char* ext_name;       // sensor name
-    char* part_number;    // GPI sensor part number
-    char* type;           // GPI sensor type (door-contact, ...)
-    char* parent;         // Parent name, i.e. IPC, to which the GPIO is attached (parent_name.1)
-    char* location;       // Location, i.e. Room/Row/Rack/..., where the GPIO is deployed (logical_asset)
+    const char* manufacturer;   // sensor manufacturer name (interned)
+    const char* part_number;    // GPI sensor part number (interned)
+    const char* type;           // GPI sensor type (door-contact, ...) (interned)
+    const char* parent;         // Parent name, i.e. IPC, to which the GPIO is attached (parent_name.1) (interned)
+    const char* location;       // Location, i.e. Room/Row/Rack/..., where the GPIO is deployed (logical_asset) (interned)
     int normal_state;     // opened | closed
-    int current_state;    // opened | closed
     int gpx_number;       // GPIO number
     int pin_number;       // Pin number for this GPIO
     int gpx_direction;    // GPI(n) or GPO(ut)
-    char* power_source;   // empty for internal, GPO number for externally powered
-    char* alarm_message;  // Alert message to publish
-    char* alarm_severity; // Applied severity
-    bool alert_triggered;   //flag to remember if an alert has been fired
+    const char* power_source;   // empty for internal, GPO number for externally powered (interned)
+    const char* alarm_message;  // Alert message to publish (interned)
+    const char* alarm_severity; // Applied severity (interned)
+    bool restored;        // restored from the snapshot, not yet confirmed by the asset agent
+    _gpx_state_t *state;  // runtime state, kept outside of the published information
 } _gpx_info_t;
 
+//  Version of the table of monitored GPx. A published version is never
+//  modified: each change publishes a new version, sharing the unchanged
+//  sensors, while the readers keep the version they got until they drop it.
+//  A sensor id is its index in sensors, for this version only. The fields
+//  the polling cycle works on are copied into contiguous arrays by sensor
+//  id, so that it only touches a sensor to process its changes
+typedef struct _gpx_table_s {
+    std::vector<std::shared_ptr<_gpx_info_t>> sensors; // in order of addition
+    std::map<std::string, _gpx_info_t *> by_name;      // index by asset name
+    std::map<std::string, _gpx_info_t *> by_ext_name;  // index by external name
+    std::vector<int> gpx_number;        // GPIO number, by sensor id
+    std::vector<int> gpx_direction;     // GPI(n) or GPO(ut), by sensor id
+    std::vector<int> normal_state;      // opened | closed, by sensor id
+    std::vector<int> power_gpo;         // GPO powering the sensor, -1 for internal, by sensor id
+    std::vector<_gpx_state_t *> state;  // runtime state, by sensor id
+    std::vector<uint64_t> gpi_pins;     // GPIs polled through pin snapshots (bitmask,
+                                        // see libgpio_read_snapshot)
+    std::vector<int> by_gpi;            // id of the sensor of these GPIs by GPI number, -1 if none
+    std::vector<int> polled;            // ids of the other sensors, polled one at a time
+    uint64_t generation;  // incremented by each published version
+} _gpx_table_t;
+
+typedef std::shared_ptr<const _gpx_table_t> gpx_table_ptr;
+
 // Config file accessors
 const char* s_get (zconfig_t *config, const char* key, std::string &dfl);
 const char* s_get (zconfig_t *config, const char* key, const char*dfl);
 
 // Implemented in assets actor
-extern zlistx_t *_gpx_list;
-extern zlistx_t * get_gpx_list();
-extern pthread_mutex_t gpx_list_mutex;
+extern gpx_table_ptr get_gpx_table ();
+extern _gpx_info_t * get_gpx_info (const gpx_table_ptr &table, const char *name);
 
 // Implemented in server actor
 extern bool hw_cap_inited;
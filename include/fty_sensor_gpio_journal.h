@@ -0,0 +1,83 @@
+/*  =========================================================================
+    fty_sensor_gpio_journal - 42ITy GPO state journal
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SENSOR_GPIO_JOURNAL_H_INCLUDED
+#define FTY_SENSOR_GPIO_JOURNAL_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  @interface
+//  State of a GPO, as recorded in the journal
+typedef struct _fty_sensor_gpio_gpo_record_s {
+    int gpo_number;       // GPO number
+    int default_state;    // state to apply when not driven
+    int last_action;      // state the GPO was last driven to
+} fty_sensor_gpio_gpo_record_t;
+
+//  Open the journal of state_file, and replay state_file and the journal.
+//  If the journal can't be written, the GPO states are only kept in memory
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_journal_t *
+    fty_sensor_gpio_journal_new (const char *state_file);
+
+//  Sync and compact the journal, then close it
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_journal_destroy (fty_sensor_gpio_journal_t **self_p);
+
+//  Return the GPO states, asset name -> fty_sensor_gpio_gpo_record_t.
+//  The journal keeps ownership of the states
+FTY_SENSOR_GPIO_EXPORT zhashx_t *
+    fty_sensor_gpio_journal_states (fty_sensor_gpio_journal_t *self);
+
+//  Record the state of the GPO asset_name, or its deletion if record is
+//  NULL. Nothing is recorded if the state didn't change.
+//  Return 0 if OK, -1 on write error
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_journal_append (fty_sensor_gpio_journal_t *self, const char *asset_name,
+        const fty_sensor_gpio_gpo_record_t *record);
+
+//  Return the time (zclock_mono) at which the records appended since the
+//  last sync are due to be synced, or 0 if there are none
+FTY_SENSOR_GPIO_EXPORT int64_t
+    fty_sensor_gpio_journal_sync_deadline (fty_sensor_gpio_journal_t *self);
+
+//  Sync the records appended since the last sync to disk, and compact the
+//  journal once it is long enough. Return 0 if OK, -1 on error
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_journal_sync (fty_sensor_gpio_journal_t *self);
+
+//  Rewrite the state file with the current GPO states, and empty the
+//  journal. Return 0 if OK, -1 on error
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_journal_compact (fty_sensor_gpio_journal_t *self);
+
+//  Self test of this class
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_journal_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
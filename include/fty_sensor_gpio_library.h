@@ -81,12 +81,30 @@ typedef struct _fty_sensor_gpio_assets_t fty_sensor_gpio_assets_t;
 #define FTY_SENSOR_GPIO_ASSETS_T_DEFINED
 typedef struct _fty_sensor_gpio_server_t fty_sensor_gpio_server_t;
 #define FTY_SENSOR_GPIO_SERVER_T_DEFINED
+typedef struct _fty_sensor_gpio_templates_t fty_sensor_gpio_templates_t;
+#define FTY_SENSOR_GPIO_TEMPLATES_T_DEFINED
+typedef struct _fty_sensor_gpio_journal_t fty_sensor_gpio_journal_t;
+#define FTY_SENSOR_GPIO_JOURNAL_T_DEFINED
+typedef struct _fty_sensor_gpio_wheel_t fty_sensor_gpio_wheel_t;
+#define FTY_SENSOR_GPIO_WHEEL_T_DEFINED
+typedef struct _fty_sensor_gpio_rules_t fty_sensor_gpio_rules_t;
+#define FTY_SENSOR_GPIO_RULES_T_DEFINED
+typedef struct _fty_sensor_gpio_stats_t fty_sensor_gpio_stats_t;
+#define FTY_SENSOR_GPIO_STATS_T_DEFINED
+typedef struct _fty_sensor_gpio_sim_t fty_sensor_gpio_sim_t;
+#define FTY_SENSOR_GPIO_SIM_T_DEFINED
 
 
 //  Public classes, each with its own header file
 #include "libgpio.h"
 #include "fty_sensor_gpio_assets.h"
 #include "fty_sensor_gpio_server.h"
+#include "fty_sensor_gpio_templates.h"
+#include "fty_sensor_gpio_journal.h"
+#include "fty_sensor_gpio_wheel.h"
+#include "fty_sensor_gpio_rules.h"
+#include "fty_sensor_gpio_stats.h"
+#include "fty_sensor_gpio_sim.h"
 
 #ifdef FTY_SENSOR_GPIO_BUILD_DRAFT_API
 
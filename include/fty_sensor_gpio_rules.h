@@ -0,0 +1,82 @@
+/*  =========================================================================
+    fty_sensor_gpio_rules - 42ITy GPI to GPO reflex rules
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SENSOR_GPIO_RULES_H_INCLUDED
+#define FTY_SENSOR_GPIO_RULES_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  @interface
+//  Actions of the reflex rules on their GPO
+#define FTY_SENSOR_GPIO_RULE_SET    0   // drive the GPO to a state, maybe after a delay
+#define FTY_SENSOR_GPIO_RULE_PULSE  1   // pulse the GPO
+#define FTY_SENSOR_GPIO_RULE_BLINK  2   // blink the GPO
+#define FTY_SENSOR_GPIO_RULE_CANCEL 3   // cancel the timed action in progress on the GPO
+
+//  Compiled reflex rule. The names are interned, and owned by the rules
+typedef struct _fty_sensor_gpio_rule_s {
+    const char *name;       // rule name
+    const char *gpi;        // GPI asset or ext name, which change triggers the rule
+    int        trigger;     // state entered by the GPI
+    const char *gpo;        // GPO asset or ext name, acted on
+    int        action;      // FTY_SENSOR_GPIO_RULE_*
+    int        state;       // state to drive the GPO to (SET)
+    int        delay;       // msec before driving the GPO, 0 for right away (SET)
+    int        period;      // msec between the toggles (BLINK), or duration (PULSE)
+    int        duration;    // msec of the pulse or blink (PULSE, BLINK)
+    const char *if_gpi;     // GPI which state is checked first, NULL if none
+    int        if_state;    // state if_gpi must be in
+} fty_sensor_gpio_rule_t;
+
+//  Compile the reflex rules of a config section, one child per rule.
+//  Invalid rules are logged and skipped. config may be NULL
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_rules_t *
+    fty_sensor_gpio_rules_new (zconfig_t *config);
+
+//  Destroy the rules
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_rules_destroy (fty_sensor_gpio_rules_t **self_p);
+
+//  Return the number of compiled rules, a rule triggered by any change of
+//  its GPI counting twice
+FTY_SENSOR_GPIO_EXPORT size_t
+    fty_sensor_gpio_rules_size (fty_sensor_gpio_rules_t *self);
+
+//  Return the rules triggered by the GPI named gpi entering state, which
+//  are contiguous, in the order of the config, and set count to their
+//  number. Return NULL if there are none
+FTY_SENSOR_GPIO_EXPORT const fty_sensor_gpio_rule_t *
+    fty_sensor_gpio_rules_dispatch (fty_sensor_gpio_rules_t *self, const char *gpi,
+        int state, size_t *count);
+
+//  Self test of this class
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_rules_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+/*  =========================================================================
+    fty_sensor_gpio_sim - Simulated in-memory GPIO chipset
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SENSOR_GPIO_SIM_H_INCLUDED
+#define FTY_SENSOR_GPIO_SIM_H_INCLUDED
+
+// Default number of virtual pins of the simulated chipset
+#define FTY_SENSOR_GPIO_SIM_PINS 4096
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  @interface
+//  Create a simulated chipset with pins virtual pins, numbered from 0, all
+//  closed and without waveform
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_sim_t *
+    fty_sensor_gpio_sim_new (int pins);
+
+//  Destroy the simulated chipset
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_sim_destroy (fty_sensor_gpio_sim_t **self_p);
+
+//  Return the number of virtual pins
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_sim_size (fty_sensor_gpio_sim_t *self);
+
+//  Set the clock driving the waveforms (msec), to make the simulation
+//  deterministic. -1 (the default) follows zclock_mono ()
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_sim_set_clock (fty_sensor_gpio_sim_t *self, int64_t now);
+
+//  Script the waveform of the pins first to last. spec is a list of
+//  key=value, separated by spaces:
+//      level=0|1       - initial value (0)
+//      toggle=<msec>   - time between two toggles, 0 for a constant level (0)
+//      burst=<count>   - toggles per burst, 0 for a continuous toggling (0)
+//      gap=<msec>      - quiet time between two bursts (0)
+//      noise=<permil>  - chance that a read returns a glitch (0)
+//      phase=<msec>    - delay of the waveform of the first pin (0)
+//      stagger=<msec>  - delay added for each next pin of the range (0)
+//  The waveforms start now. Return 0 on success, -1 on an invalid spec or
+//  range
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_sim_waveform (fty_sensor_gpio_sim_t *self, int first, int last,
+        const char *spec);
+
+//  Read a virtual pin. Return its value, or -1 if out of range
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_sim_read (fty_sensor_gpio_sim_t *self, int pin);
+
+//  Write a virtual pin, which stops its waveform. Return 0 on success, -1
+//  if out of range
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_sim_write (fty_sensor_gpio_sim_t *self, int pin, int value);
+
+//  Account the edges of a virtual pin in the events. Return 0 on success,
+//  -1 if out of range
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_sim_watch (fty_sensor_gpio_sim_t *self, int pin);
+
+//  Return the number of edges of the watched pins since the previous call
+FTY_SENSOR_GPIO_EXPORT int
+    fty_sensor_gpio_sim_events (fty_sensor_gpio_sim_t *self);
+
+//  Self test of this class
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_sim_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
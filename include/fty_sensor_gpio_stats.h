@@ -0,0 +1,109 @@
+/*  =========================================================================
+    fty_sensor_gpio_stats - 42ITy GPIO runtime statistics
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SENSOR_GPIO_STATS_H_INCLUDED
+#define FTY_SENSOR_GPIO_STATS_H_INCLUDED
+
+// Counters
+#define STATS_SENSOR_READS              0   // sensors read
+#define STATS_SENSOR_READ_FAILURES      1   // sensors which couldn't be read
+#define STATS_GPO_WRITES                2   // GPO written
+#define STATS_GPO_WRITE_FAILURES        3   // GPO which couldn't be written
+#define STATS_PUBLISHED                 4   // sensor statuses published
+#define STATS_PUBLISH_FAILURES          5   // sensor statuses which couldn't be published
+#define STATS_GPIO_EVENTS               6   // GPI changes notified by edge detection
+#define STATS_COUNTERS                  7
+
+// Latency histograms (usec)
+#define STATS_POLL_CYCLE                0   // polling cycle, from start to last read
+#define STATS_SENSOR_READ               1   // sensor read, by the GPIO I/O worker
+#define STATS_GPO_WRITE                 2   // GPO write, by the GPIO I/O worker
+#define STATS_GPIO_LOCK_WAIT            3   // wait for the GPIO access, by the GPIO I/O worker
+#define STATS_PUBLISH                   4   // sensor status publication
+#define STATS_MAILBOX_GPO_INTERACTION   5   // mailbox requests, by subject
+#define STATS_MAILBOX_GPIO_MANIFEST     6
+#define STATS_MAILBOX_GPIO_MANIFEST_SUMMARY 7
+#define STATS_MAILBOX_GPIO_TEMPLATE_ADD 8
+#define STATS_MAILBOX_GPOSTATE          9
+#define STATS_MAILBOX_GPIO_STATS        10
+#define STATS_MAILBOX_OTHER             11
+#define STATS_HISTOGRAMS                12
+
+// Gauges, with their highest value
+#define STATS_URGENT_QUEUE              0   // urgent jobs queued to the GPIO I/O worker
+#define STATS_BULK_QUEUE                1   // bulk jobs queued to the GPIO I/O worker
+#define STATS_TIMED_ACTIONS             2   // timed GPO actions in progress
+#define STATS_GAUGES                    3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  @interface
+//  Create new statistics, all zero
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_stats_t *
+    fty_sensor_gpio_stats_new (void);
+
+//  Destroy the statistics
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_stats_destroy (fty_sensor_gpio_stats_t **self_p);
+
+//  Add value to a counter. Lock-free, can be called from any thread
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_stats_count (fty_sensor_gpio_stats_t *self, int counter, uint64_t value);
+
+//  Record a latency (usec) in a histogram. Lock-free, can be called from
+//  any thread
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_stats_record (fty_sensor_gpio_stats_t *self, int histogram, int64_t usec);
+
+//  Set the current value of a gauge. Lock-free, can be called from any thread
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_stats_gauge (fty_sensor_gpio_stats_t *self, int gauge, int64_t value);
+
+//  Return the value of a counter
+FTY_SENSOR_GPIO_EXPORT uint64_t
+    fty_sensor_gpio_stats_counter (fty_sensor_gpio_stats_t *self, int counter);
+
+//  Return the number of latencies recorded in a histogram
+FTY_SENSOR_GPIO_EXPORT uint64_t
+    fty_sensor_gpio_stats_samples (fty_sensor_gpio_stats_t *self, int histogram);
+
+//  Return the latency (usec) below which percent % of the latencies of a
+//  histogram are, rounded up to a power of 2, or 0 if there are none
+FTY_SENSOR_GPIO_EXPORT int64_t
+    fty_sensor_gpio_stats_percentile (fty_sensor_gpio_stats_t *self, int histogram, int percent);
+
+//  Append the statistics to msg, as name / value string frames
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_stats_report (fty_sensor_gpio_stats_t *self, zmsg_t *msg);
+
+//  Self test of this class
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_stats_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+/*  =========================================================================
+    fty_sensor_gpio_templates - 42ITy GPIO sensors templates cache
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SENSOR_GPIO_TEMPLATES_H_INCLUDED
+#define FTY_SENSOR_GPIO_TEMPLATES_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  @interface
+//  Content of a sensor template file. Missing values are empty strings
+typedef struct _fty_sensor_gpio_template_s {
+    char *part_number;    // template name, i.e. asset model
+    char *manufacturer;   // sensor manufacturer name
+    char *type;           // type of sensor
+    char *normal_state;   // normal state (opened / closed)
+    char *gpx_direction;  // GPI or GPO
+    char *power_source;   // internal or external
+    char *alarm_severity; // severity of the alert
+    char *alarm_message;  // message of the alert
+} fty_sensor_gpio_template_t;
+
+//  Get the templates cache of template_dir, shared by all the callers
+//  using the same directory. Return NULL on error.
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_templates_t *
+    fty_sensor_gpio_templates_new (const char *template_dir);
+
+//  Release the templates cache, which is destroyed with its last user
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_templates_destroy (fty_sensor_gpio_templates_t **self_p);
+
+//  Return a copy of the template of part_number, or NULL if there is none.
+//  Caller owns the returned template
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_template_t *
+    fty_sensor_gpio_templates_lookup (fty_sensor_gpio_templates_t *self, const char *part_number);
+
+//  Return a copy of all the templates, sorted by part number.
+//  Caller owns the returned list
+FTY_SENSOR_GPIO_EXPORT zlistx_t *
+    fty_sensor_gpio_templates_list (fty_sensor_gpio_templates_t *self);
+
+//  Store the template of part_number, freshly saved from config
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_templates_update (fty_sensor_gpio_templates_t *self, const char *part_number, zconfig_t *config);
+
+//  Return the generation of the cache, which changes with any template
+FTY_SENSOR_GPIO_EXPORT uint64_t
+    fty_sensor_gpio_templates_generation (fty_sensor_gpio_templates_t *self);
+
+//  Destroy a template returned by the cache
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_template_destroy (fty_sensor_gpio_template_t **self_p);
+
+//  Self test of this class
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_templates_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+/*  =========================================================================
+    fty_sensor_gpio_wheel - 42ITy GPIO hierarchical timing wheel
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SENSOR_GPIO_WHEEL_H_INCLUDED
+#define FTY_SENSOR_GPIO_WHEEL_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  @interface
+//  Create a new timing wheel, with a resolution of tick msec, starting at
+//  time now (zclock_mono)
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_wheel_t *
+    fty_sensor_gpio_wheel_new (int tick, int64_t now);
+
+//  Destroy the timing wheel. The items of the pending timers are not
+//  destroyed
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_wheel_destroy (fty_sensor_gpio_wheel_t **self_p);
+
+//  Add a timer expiring item at time when (zclock_mono). Return the timer
+//  handle, valid until the timer expires or is cancelled
+FTY_SENSOR_GPIO_EXPORT void *
+    fty_sensor_gpio_wheel_add (fty_sensor_gpio_wheel_t *self, int64_t when, void *item);
+
+//  Cancel a pending timer, and return its item
+FTY_SENSOR_GPIO_EXPORT void *
+    fty_sensor_gpio_wheel_cancel (fty_sensor_gpio_wheel_t *self, void **handle_p);
+
+//  Return the item of the next timer expired at time now, or NULL if there
+//  is none
+FTY_SENSOR_GPIO_EXPORT void *
+    fty_sensor_gpio_wheel_expire (fty_sensor_gpio_wheel_t *self, int64_t now);
+
+//  Return the time by which the wheel needs to be called again, which is
+//  no later than the next timer expires, or -1 if there are no timers
+FTY_SENSOR_GPIO_EXPORT int64_t
+    fty_sensor_gpio_wheel_next (fty_sensor_gpio_wheel_t *self);
+
+//  Return the number of pending timers
+FTY_SENSOR_GPIO_EXPORT size_t
+    fty_sensor_gpio_wheel_size (fty_sensor_gpio_wheel_t *self);
+
+//  Self test of this class
+FTY_SENSOR_GPIO_EXPORT void
+    fty_sensor_gpio_wheel_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
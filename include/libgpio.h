@@ -25,6 +25,14 @@
 // Default target address of the GPIO chipset (gpiochip488 on IPC3000)
 #define GPIO_BASE_INDEX    488
 
+// Default GPIO character device of the chipset
+#define GPIO_CHIP_DEFAULT  "/dev/gpiochip0"
+
+// Backends
+#define GPIO_BACKEND_SYSFS   0   // legacy /sys/class/gpio interface
+#define GPIO_BACKEND_CDEV    1   // GPIO character device (v2 uAPI)
+#define GPIO_BACKEND_SIM     2   // simulated in-memory chipset, for load testing
+
 // Directions
 #define GPIO_DIRECTION_IN    0
 #define GPIO_DIRECTION_OUT   1
@@ -40,6 +48,10 @@
 #define GPIO_VALUE_MAX      64 // 30
 #define GPIO_MAX_RETRY       3
 
+// Number of words of a pin snapshot bitmask covering the GPx up to GPx_max
+// (see libgpio_read_snapshot)
+#define GPIO_SNAPSHOT_WORDS(GPx_max) ((GPx_max) / 64 + 1)
+
 #define GPIO_POWERED_SELF        1
 #define GPIO_POWERED_EXTERNAL    2
 
@@ -67,6 +79,58 @@ FTY_SENSOR_GPIO_EXPORT int
 FTY_SENSOR_GPIO_EXPORT int
     libgpio_write (libgpio_t *self_p, int GPO_number, int value);
 
+//  @interface
+//  Read count GPI or GPO statuses at once into values, -1 for those which
+//  couldn't be read. Return the number of statuses read
+FTY_SENSOR_GPIO_EXPORT int
+    libgpio_read_many (libgpio_t *self, const int *GPx_numbers, int count,
+        int direction, int *values);
+
+//  @interface
+//  Write count GPO at once to values. results, if not NULL, gets 0 for each
+//  GPO written and -1 for the others. Return the number of GPO written
+FTY_SENSOR_GPIO_EXPORT int
+    libgpio_write_many (libgpio_t *self, const int *GPO_numbers, const int *values,
+        int count, int *results);
+
+//  @interface
+//  Read at once the GPx of a direction set in the pins bitmask, of words
+//  64 bits words (bit n % 64 of word n / 64 for GPx n), as the snapshot of
+//  this direction. values gets the bitmask of the GPx opened, unknown the
+//  one of the GPx which couldn't be read, and changed the one of the GPx
+//  whose status differs from the previous snapshot (or which were not in
+//  it), found with a word-wide XOR. Any of them may be NULL.
+//  Return the number of GPx read, -1 on error
+FTY_SENSOR_GPIO_EXPORT int
+    libgpio_read_snapshot (libgpio_t *self, int direction, const uint64_t *pins,
+        int words, uint64_t *values, uint64_t *unknown, uint64_t *changed);
+
+//  @interface
+//  Get a file descriptor which becomes readable when a watched GPI changes,
+//  to be added to the caller's poller. Return -1 if not supported
+FTY_SENSOR_GPIO_EXPORT int
+    libgpio_get_event_fd (libgpio_t *self);
+
+//  @interface
+//  Enable edge detection on a GPI, so that its changes wake up the events
+//  file descriptor. Return 0 on success, -1 otherwise
+FTY_SENSOR_GPIO_EXPORT int
+    libgpio_watch (libgpio_t *self, int GPI_number);
+
+//  @interface
+//  Acknowledge the pending GPI changes, without blocking.
+//  Return the number of changes, or -1 on error
+FTY_SENSOR_GPIO_EXPORT int
+    libgpio_get_events (libgpio_t *self);
+
+//  @interface
+//  Get the access counters: system calls issued, pins which couldn't be
+//  exported and retries to set a pin direction. Any pointer may be NULL.
+//  This can be called while the GPIOs are accessed from another thread
+FTY_SENSOR_GPIO_EXPORT void
+    libgpio_get_stats (libgpio_t *self, uint64_t *syscalls,
+        uint64_t *export_failures, uint64_t *direction_retries);
+
 //  @interface
 //  Get the textual name for a status
 FTY_SENSOR_GPIO_EXPORT const string
@@ -122,6 +186,27 @@ FTY_SENSOR_GPIO_EXPORT void
 FTY_SENSOR_GPIO_EXPORT void
     libgpio_add_gpo_mapping (libgpio_t *self, int port_num, int pin_num);
 
+//  @interface
+//  Set the backend used to access the GPIO chipset (GPIO_BACKEND_xxx)
+FTY_SENSOR_GPIO_EXPORT void
+    libgpio_set_backend (libgpio_t *self, int backend);
+
+//  @interface
+//  Set the GPIO character device of the chipset (cdev backend)
+FTY_SENSOR_GPIO_EXPORT void
+    libgpio_set_chip_path (libgpio_t *self, const char *chip_path);
+
+//  @interface
+//  Get the simulated chipset (sim backend), to script its waveforms. Its
+//  pins are the HW pin numbers. Owned by libgpio, created on first use
+FTY_SENSOR_GPIO_EXPORT fty_sensor_gpio_sim_t *
+    libgpio_get_sim (libgpio_t *self);
+
+//  @interface
+//  Get the numeric value for a backend name (sysfs | cdev | sim), -1 if unknown
+FTY_SENSOR_GPIO_EXPORT int
+    libgpio_get_backend_value (const char* backend_name);
+
 //  @interface
 //  Set the test mode
 FTY_SENSOR_GPIO_EXPORT void
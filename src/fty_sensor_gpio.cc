@@ -27,6 +27,7 @@
 */
 
 #include "fty_sensor_gpio_classes.h"
+#include <signal.h>
 
 // TODO:
 // * Smart update of existing entries
@@ -39,8 +40,6 @@
 // * cleanup, final cppcheck, fix all FIXMEs...
 // To be discussed:
 // * Check for convergence with other dry-contacts (on EMP001 and fty-sensor-env, EMP002,
-// * Add 'int last_state' to '_gpx_info_t' and only publish state change?
-//   (i.e. last_state != current_state)
 // * i18n for alerts and $status
 
 void
@@ -53,24 +52,29 @@ usage(){
 
 }
 
-// Send an update request over the MQ to check for GPIO status
-static int
-s_update_event (zloop_t *loop, int timer_id, void *output)
+// Send the local hardware profile of type (gpi or gpo) from the config file
+// to the server, in the HW_CAP reply format, so that monitoring starts
+// without waiting for fty-info
+static void
+s_send_hw_profile (zactor_t *server, zconfig_t *config, const char *type)
 {
-    zstr_send (output, "UPDATE");
-    return 0;
-}
+    std::string prefix = std::string ("hardware/") + type;
+    const char *count = zconfig_get (config, (prefix + "_count").c_str (), NULL);
+    if (!count)
+        return;
 
-// Schedule HW_CAP request to do the initial configuration for local GPI/GPO
-static int
-s_request_hwcap_event (zloop_t *loop, int timer_id, void *output)
-{
-    if (!hw_cap_inited) {
-        zstr_send (output, "HW_CAP");
-        return 0;
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, "HW_PROFILE");
+    zmsg_addstr (msg, type);
+    zmsg_addstr (msg, count);
+    zmsg_addstr (msg, s_get (config, "hardware/gpio_base_address", "0"));
+    zmsg_addstr (msg, s_get (config, (prefix + "_offset").c_str (), "0"));
+    zconfig_t *mapping = zconfig_locate (config, (prefix + "_mapping").c_str ());
+    for (zconfig_t *item = mapping ? zconfig_child (mapping) : NULL; item; item = zconfig_next (item)) {
+        zmsg_addstr (msg, zconfig_name (item));
+        zmsg_addstr (msg, zconfig_value (item) ? zconfig_value (item) : "0");
     }
-    else // we can stop this timer, valid reply received
-        return zloop_timer_end (loop, timer_id);
+    zmsg_send (&msg, server);
 }
 
 // Condition asset actor on the successful configuration of server actor (HW_CAP)
@@ -96,9 +100,21 @@ int main (int argc, char *argv [])
     char* endpoint = NULL;
     const char* str_poll_interval = NULL;
     int poll_interval = DEFAULT_POLL_INTERVAL;
+    bool edge_detection = false;
+    const char* str_edge_check_interval = NULL;
+    const char* str_heartbeat_interval = NULL;
     bool verbose = false;
     int argn;
     char *log_config = NULL;
+    char *gpio_backend = NULL;
+    char *gpio_chip = NULL;
+
+    // SIGUSR1 dumps the server statistics, which the server gets through a
+    // signalfd: block it first, so that all the threads inherit the mask
+    sigset_t signals;
+    sigemptyset (&signals);
+    sigaddset (&signals, SIGUSR1);
+    pthread_sigmask (SIG_BLOCK, &signals, NULL);
 
     ManageFtyLog::setInstanceFtylog(FTY_SENSOR_GPIO_AGENT);
 
@@ -151,11 +167,22 @@ int main (int argc, char *argv [])
         if (str_poll_interval) {
             poll_interval = atoi(str_poll_interval);
         }
+        // GPI edge detection, with a slower polling of the watched GPIs as
+        // a safety net
+        if (streq (s_get (config, "server/edge_detection", "false"), "true")) {
+            edge_detection = true;
+            str_edge_check_interval = s_get (config, "server/edge_check_interval", NULL);
+        }
         log_debug ("Polling interval set to %i", poll_interval);
+        // Publication interval of unchanged sensors status
+        str_heartbeat_interval = s_get (config, "server/heartbeat_interval", NULL);
         if (endpoint) zstr_free(&endpoint);
         endpoint = strdup(s_get (config, "malamute/endpoint", NULL));
         actor_name = strdup(s_get (config, "malamute/address", NULL));
         log_config = strdup(s_get (config, "log/config", DEFAULT_LOG_CONFIG));
+        // GPIO access method
+        gpio_backend = strdup(s_get (config, "hardware/backend", "sysfs"));
+        gpio_chip = strdup(s_get (config, "hardware/chip", GPIO_CHIP_DEFAULT));
     }
     if (actor_name == NULL)
         actor_name = strdup(FTY_SENSOR_GPIO_AGENT);
@@ -217,20 +244,39 @@ int main (int argc, char *argv [])
     zstr_sendx (server, "CONNECT", endpoint, NULL);
     zstr_sendx (server, "PRODUCER", FTY_PROTO_STREAM_METRICS_SENSOR, NULL);
     zstr_sendx (server, "TEMPLATE_DIR", template_dir, NULL);
-    //zstr_sendx (server, "HW_CAP", NULL);
+    if (gpio_backend)
+        zstr_sendx (server, "BACKEND", gpio_backend, gpio_chip, NULL);
+    if (edge_detection)
+        zstr_sendx (server, "EDGE_DETECTION", "true", NULL);
+    if (str_edge_check_interval)
+        zstr_sendx (server, "EDGE_CHECK_INTERVAL", str_edge_check_interval, NULL);
+    if (str_heartbeat_interval)
+        zstr_sendx (server, "HEARTBEAT", str_heartbeat_interval, NULL);
+    if (config) {
+        s_send_hw_profile (server, config, "gpi");
+        s_send_hw_profile (server, config, "gpo");
+        // Local GPI to GPO reflex rules
+        if (zconfig_locate (config, "rules"))
+            zstr_sendx (server, "RULES", config_file, NULL);
+        // Waveforms of the simulated pins
+        zconfig_t *simulation = zconfig_locate (config, "hardware/simulation");
+        for (zconfig_t *item = simulation ? zconfig_child (simulation) : NULL; item; item = zconfig_next (item))
+            zstr_sendx (server, "SIMULATE", zconfig_name (item), zconfig_value (item), NULL);
+    }
+    // The server polls the GPIO status on its own schedule
+    zstr_sendx (server, "POLL_INTERVAL", std::to_string (poll_interval).c_str (), NULL);
     zstr_sendx (server, "STATEFILE", state_file, NULL);
+    // Refresh the local hardware profile and the snapshot from fty-info,
+    // the server retries on its own until it answers
+    zstr_sendx (server, "HW_CAP", NULL);
 
     // 2nd stream to handle assets
     zstr_sendx (assets, "TEMPLATE_DIR", template_dir, NULL);
     zstr_sendx (assets, "CONNECT", endpoint, NULL);
 
     // Setup:
-    // * an update event message every x microseconds, to check GPI status
-    // * a request event message every 5 seconds, to request local HW capabilities
-    // * asset actor production/consumption when server actor has received local HW capabilities
+    // * asset actor production/consumption when server actor has local HW capabilities
     zloop_t *gpio_events = zloop_new();
-    zloop_timer (gpio_events, poll_interval, 0, s_update_event, server);
-    zloop_timer (gpio_events, 5000, 0, s_request_hwcap_event, server);
     zloop_timer (gpio_events, 2000, 0, s_server_ready_event, assets);
     zloop_start (gpio_events);
 
@@ -243,6 +289,8 @@ int main (int argc, char *argv [])
     zstr_free(&endpoint);
     zstr_free(&state_file);
     zstr_free(&log_config);
+    zstr_free(&gpio_backend);
+    zstr_free(&gpio_chip);
     zconfig_destroy (&config);
 
     return 0;
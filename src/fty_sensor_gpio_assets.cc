@@ -28,99 +28,233 @@
 
 #include "fty_sensor_gpio_classes.h"
 
-// List of monitored GPx
-zlistx_t *_gpx_list = NULL;
-// GPx list protection mutex
-pthread_mutex_t gpx_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define BOOTSTRAP_WINDOW 32     // ASSET_DETAIL requests in flight at startup
+#define BOOTSTRAP_TIMEOUT 5000  // msec without reply before giving up requests
+
+// Interned descriptive strings of the sensors -> number of uses
+static std::map<std::string, int> interned_strings;
+// Serializes the accesses to interned_strings, as the last table version
+// using a sensor may be dropped by another actor
+static pthread_mutex_t interned_strings_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Published version of the table of monitored GPx, swapped atomically
+static gpx_table_ptr _gpx_table;
+// Serializes the writers of new table versions, readers never take it
+static pthread_mutex_t gpx_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Generation of the last published table version (under gpx_table_mutex)
+static uint64_t gpx_table_generation = 0;
 
 //  Structure of our class
 
 struct _fty_sensor_gpio_assets_t {
     char               *name;         // actor name
     mlm_client_t       *mlm;          // malamute client
-    zlistx_t           *gpx_list;     // List of monitored GPx _gpx_info_t (10xGPI / 5xGPO on IPC3000)
     char               *template_dir; // Location of the template files
+    fty_sensor_gpio_templates_t *templates; // Parsed template files
+    char               *bootstrap_uuid; // Pending GPIO sensors list request
+    zlistx_t           *bootstrap_pending; // GPIO sensors to request the details of
+    zhashx_t           *bootstrap_requests; // zuuid -> GPIO sensor, details requests in flight
+    int64_t            bootstrap_expiry; // Time at which pending requests are given up
     bool               test_mode;     // true if we are in test mode, false otherwise
 };
 
 
 //  --------------------------------------------------------------------------
-//  Return the list of monitored sensors without transfering ownership
+//  Return the current version of the monitored sensors table, which the
+//  caller can use without locking as long as it holds it. Return an empty
+//  pointer if no sensor was ever monitored
 
-zlistx_t *
-get_gpx_list()
+gpx_table_ptr
+get_gpx_table ()
 {
-    if (!_gpx_list)
-        log_debug ("GPx list not initialized, skipping");
-    //return zlistx_dup (_gpx_list);
-    return _gpx_list;
+    return std::atomic_load (&_gpx_table);
 }
 
 //  --------------------------------------------------------------------------
-//  zlist handling -- destroy an item
+//  Return the monitored sensor of table which asset name, or else external
+//  name, is 'name', or NULL if there is none
 
-void sensor_free(void **item)
+_gpx_info_t *
+get_gpx_info (const gpx_table_ptr &table, const char *name)
 {
-    _gpx_info_t *gpx_info = (_gpx_info_t *)*item;
+    if (!table || !name)
+        return NULL;
 
-    if (!gpx_info)
-        return;
+    auto it = table->by_name.find (name);
+    if (it != table->by_name.end ())
+        return it->second;
+    it = table->by_ext_name.find (name);
+    return (it != table->by_ext_name.end ()) ? it->second : NULL;
+}
 
-    if (gpx_info->manufacturer)
-        free(gpx_info->manufacturer);
+//  --------------------------------------------------------------------------
+//  Return a copy of the current table version, to be changed and published.
+//  Caller must hold gpx_table_mutex
 
-    if (gpx_info->asset_name)
-        free(gpx_info->asset_name);
+static _gpx_table_t *
+s_table_copy ()
+{
+    gpx_table_ptr current = get_gpx_table ();
+    if (current)
+        return new _gpx_table_t (*current);
 
-    if (gpx_info->ext_name)
-        free(gpx_info->ext_name);
+    _gpx_table_t *table = new _gpx_table_t ();
+    table->generation = 0;
+    return table;
+}
+
+//  --------------------------------------------------------------------------
+//  Rebuild the arrays of the fields used by the polling cycle, and its
+//  indexes, of the table version being built: the internally powered GPIs
+//  are read at once through pin snapshots, the other sensors one at a time
 
-    if (gpx_info->part_number)
-        free(gpx_info->part_number);
+static void
+s_table_index (_gpx_table_t *table)
+{
+    size_t count = table->sensors.size ();
+    table->gpx_number.resize (count);
+    table->gpx_direction.resize (count);
+    table->normal_state.resize (count);
+    table->power_gpo.resize (count);
+    table->state.resize (count);
+    table->gpi_pins.clear ();
+    table->by_gpi.clear ();
+    table->polled.clear ();
+    for (size_t id = 0; id < count; id++) {
+        _gpx_info_t *gpx_info = table->sensors [id].get ();
+        table->gpx_number [id] = gpx_info->gpx_number;
+        table->gpx_direction [id] = gpx_info->gpx_direction;
+        table->normal_state [id] = gpx_info->normal_state;
+        table->power_gpo [id] = (gpx_info->power_source && !streq (gpx_info->power_source, "")) ?
+            atoi (gpx_info->power_source) : -1;
+        table->state [id] = gpx_info->state;
+    }
+    for (size_t id = 0; id < count; id++) {
+        int number = table->gpx_number [id];
+        if ((table->gpx_direction [id] != GPIO_DIRECTION_IN)
+            || (table->power_gpo [id] != -1)
+            || (number < 0)
+            || ((number < (int) table->by_gpi.size ()) && (table->by_gpi [number] != -1))) {
+            table->polled.push_back (id);
+            continue;
+        }
+        if (number >= (int) table->by_gpi.size ()) {
+            table->by_gpi.resize (number + 1, -1);
+            table->gpi_pins.resize (GPIO_SNAPSHOT_WORDS (number), 0);
+        }
+        table->by_gpi [number] = id;
+        table->gpi_pins [number / 64] |= 1ULL << (number % 64);
+    }
+}
 
-    if (gpx_info->type)
-        free(gpx_info->type);
+//  --------------------------------------------------------------------------
+//  Publish table as the current version, which takes ownership of it.
+//  Caller must hold gpx_table_mutex
 
-    if (gpx_info->parent)
-        free(gpx_info->parent);
+static void
+s_table_publish (_gpx_table_t *table)
+{
+    s_table_index (table);
+    table->generation = ++gpx_table_generation;
+    std::atomic_store (&_gpx_table, gpx_table_ptr (table));
+}
 
-    if (gpx_info->location)
-        free(gpx_info->location);
+//  --------------------------------------------------------------------------
+//  Remove the sensor from the table version being built
 
-    if (gpx_info->power_source)
-        free(gpx_info->power_source);
+static void
+s_table_remove (_gpx_table_t *table, _gpx_info_t *gpx_info)
+{
+    table->by_name.erase (gpx_info->asset_name);
+    // Another sensor may share the same external name
+    if (gpx_info->ext_name) {
+        auto it = table->by_ext_name.find (gpx_info->ext_name);
+        if ((it != table->by_ext_name.end ()) && (it->second == gpx_info))
+            table->by_ext_name.erase (it);
+    }
+    for (auto it = table->sensors.begin (); it != table->sensors.end (); ++it) {
+        if (it->get () == gpx_info) {
+            table->sensors.erase (it);
+            break;
+        }
+    }
+}
 
-    if (gpx_info->alarm_message)
-        free(gpx_info->alarm_message);
+//  --------------------------------------------------------------------------
+//  Return the interned copy of string, shared with the other sensors, to be
+//  released with s_string_release. NULL gives NULL
 
-    if (gpx_info->alarm_severity)
-        free(gpx_info->alarm_severity);
+static const char *
+s_string_intern (const char *string)
+{
+    if (!string)
+        return NULL;
 
-    free(gpx_info);
+    pthread_mutex_lock (&interned_strings_mutex);
+    auto it = interned_strings.emplace (string, 0).first;
+    it->second++;
+    pthread_mutex_unlock (&interned_strings_mutex);
+    // Nodes never move, so the copy stays valid until its last release
+    return it->first.c_str ();
 }
 
 //  --------------------------------------------------------------------------
-//  zlist handling -- duplicate an item
+//  Release an interned string, freed with its last use
 
-static void *sensor_dup(const void *item)
+static void
+s_string_release (const char *string)
 {
-    // Simply return item itself
-    return (void*)item;
+    if (!string)
+        return;
+
+    pthread_mutex_lock (&interned_strings_mutex);
+    auto it = interned_strings.find (string);
+    if ((it != interned_strings.end ()) && (--it->second == 0))
+        interned_strings.erase (it);
+    pthread_mutex_unlock (&interned_strings_mutex);
 }
 
 //  --------------------------------------------------------------------------
-//  zlist handling - compare two items, for sorting
+//  Sensors handling -- destroy an item
 
-static int sensor_cmp(const void *item1, const void *item2)
+void sensor_free(void **item)
 {
-    _gpx_info_t *gpx_info1 = (_gpx_info_t *)item1;
-    _gpx_info_t *gpx_info2 = (_gpx_info_t *)item2;
+    _gpx_info_t *gpx_info = (_gpx_info_t *)*item;
 
-    // Compare on asset_name
-    if ( streq(gpx_info1->asset_name, gpx_info2->asset_name) )
-        return 0;
-    else
-        return 1;
+    if (!gpx_info)
+        return;
+
+    if (gpx_info->asset_name)
+        free(gpx_info->asset_name);
+
+    if (gpx_info->ext_name)
+        free(gpx_info->ext_name);
+
+    s_string_release (gpx_info->manufacturer);
+    s_string_release (gpx_info->part_number);
+    s_string_release (gpx_info->type);
+    s_string_release (gpx_info->parent);
+    s_string_release (gpx_info->location);
+    s_string_release (gpx_info->power_source);
+    s_string_release (gpx_info->alarm_message);
+    s_string_release (gpx_info->alarm_severity);
+
+    free(gpx_info->state);
+    free(gpx_info);
+    *item = NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Add the sensor to the table version being built, which then shares its
+//  ownership with the other versions
+
+static void
+s_table_add (_gpx_table_t *table, _gpx_info_t *gpx_info)
+{
+    table->sensors.push_back (std::shared_ptr<_gpx_info_t> (gpx_info,
+        [] (_gpx_info_t *item) { sensor_free ((void **) &item); }));
+    table->by_name [gpx_info->asset_name] = gpx_info;
+    if (gpx_info->ext_name)
+        table->by_ext_name [gpx_info->ext_name] = gpx_info;
 }
 
 //  --------------------------------------------------------------------------
@@ -134,6 +268,12 @@ _gpx_info_t *sensor_new()
         log_error ("Can't allocate gpx_info!");
         return NULL;
     }
+    gpx_info->state = (_gpx_state_t *)malloc(sizeof(_gpx_state_t));
+    if (!gpx_info->state) {
+        log_error ("Can't allocate gpx_info!");
+        free(gpx_info);
+        return NULL;
+    }
 
     gpx_info->manufacturer = NULL;
     gpx_info->asset_name = NULL;
@@ -143,14 +283,17 @@ _gpx_info_t *sensor_new()
     gpx_info->parent = NULL;
     gpx_info->location = NULL;
     gpx_info->normal_state = GPIO_STATE_UNKNOWN;
-    gpx_info->current_state = GPIO_STATE_UNKNOWN;
     gpx_info->gpx_number = -1;
     gpx_info->pin_number = -1;
     gpx_info->gpx_direction = GPIO_DIRECTION_IN; // Default to GPI
     gpx_info->power_source = NULL;
     gpx_info->alarm_message = NULL;
     gpx_info->alarm_severity = NULL;
-    gpx_info->alert_triggered = false;
+    gpx_info->restored = false;
+    gpx_info->state->current_state = GPIO_STATE_UNKNOWN;
+    gpx_info->state->alert_triggered = false;
+    gpx_info->state->last_published_state = GPIO_STATE_UNKNOWN;
+    gpx_info->state->last_published = 0;
 
     return gpx_info;
 }
@@ -158,6 +301,9 @@ _gpx_info_t *sensor_new()
 //  --------------------------------------------------------------------------
 //  Sensors handling
 //  Add a new entry to our zlist of monitored sensors
+//  The "restore" operation adds a sensor from the snapshot, which is then
+//  replaced by the first information from the asset agent.
+//  self may be NULL when not called from the assets actor.
 //  Returns 1 on error, 0 otherwise
 
 //static
@@ -173,7 +319,7 @@ add_sensor(fty_sensor_gpio_assets_t *self, const char* operation,
     int gpx_number = atoi(sensor_gpx_number);
     // FIXME: libgpio should be shared with -asset too
     // Sanity check on the sensor_gpx_number Vs number of supported (count)
-    if (!self->test_mode) {
+    if (!self || !self->test_mode) {
         if ( streq (sensor_gpx_direction, "GPO" ) ) {
             if (gpx_number > libgpio_get_gpo_count ()) {
                 log_error ("GPO number is higher than the number of supported GPO");
@@ -187,22 +333,22 @@ add_sensor(fty_sensor_gpio_assets_t *self, const char* operation,
             }
         }
     }
-    _gpx_info_t *prev_gpx_info = NULL;
     _gpx_info_t *gpx_info = sensor_new();
     if (!gpx_info) {
         log_error ("Can't allocate gpx_info!");
         return 1;
     }
 
-    gpx_info->manufacturer = strdup(manufacturer);
+    gpx_info->manufacturer = s_string_intern(manufacturer);
     gpx_info->asset_name = strdup(assetname);
     gpx_info->ext_name = strdup(extname);
-    gpx_info->part_number = strdup(asset_subtype);
-    gpx_info->type = strdup(sensor_type);
+    gpx_info->part_number = s_string_intern(asset_subtype);
+    gpx_info->type = s_string_intern(sensor_type);
     if (libgpio_get_status_value (sensor_normal_state) != GPIO_STATE_UNKNOWN)
         gpx_info->normal_state = libgpio_get_status_value (sensor_normal_state);
     else {
         log_error ("provided normal_state '%s' is not valid!", sensor_normal_state);
+        sensor_free ((void**)&gpx_info);
         return 1;
     }
     gpx_info->gpx_number = gpx_number;
@@ -215,45 +361,42 @@ add_sensor(fty_sensor_gpio_assets_t *self, const char* operation,
     else {
         gpx_info->gpx_direction = GPIO_DIRECTION_IN;
     }
-    if (sensor_parent)
-        gpx_info->parent = strdup(sensor_parent);
-    if (sensor_location)
-        gpx_info->location = strdup(sensor_location);
+    gpx_info->parent = s_string_intern(sensor_parent);
+    gpx_info->location = s_string_intern(sensor_location);
     // Note: If there is a GPO power source, -server will enable
     // it in the next status update loop...
-    if (sensor_power_source)
-        gpx_info->power_source = strdup(sensor_power_source);
-    if (sensor_alarm_message)
-        gpx_info->alarm_message = strdup(sensor_alarm_message);
-    if (sensor_alarm_severity)
-        gpx_info->alarm_severity = strdup(sensor_alarm_severity);
+    gpx_info->power_source = s_string_intern(sensor_power_source);
+    gpx_info->alarm_message = s_string_intern(sensor_alarm_message);
+    gpx_info->alarm_severity = s_string_intern(sensor_alarm_severity);
+    gpx_info->restored = streq (operation, "restore");
 
-    pthread_mutex_lock (&gpx_list_mutex);
+    pthread_mutex_lock (&gpx_table_mutex);
 
     // Check for an already existing entry for this asset
-    prev_gpx_info = (_gpx_info_t*)zlistx_find (_gpx_list, (void *) gpx_info);
+    _gpx_table_t *table = s_table_copy ();
+    auto prev = table->by_name.find (assetname);
 
-    if ( prev_gpx_info != NULL) {
-        // In case of update, we remove the previous entry, and create a new one
-        if ( streq (operation, "update" ) ) {
+    if ( prev != table->by_name.end ()) {
+        // In case of update, or of a sensor restored from the snapshot,
+        // we remove the previous entry, and create a new one
+        if ( streq (operation, "update" ) || (prev->second->restored && !gpx_info->restored) ) {
             // FIXME: we may lose some data, check for merging entries prior to deleting
-            if (zlistx_delete (_gpx_list, (void *)prev_gpx_info) == -1) {
-                log_error ("Update: error deleting the previous GPx record for '%s'!", assetname);
-                pthread_mutex_unlock (&gpx_list_mutex);
-                return -1;
-            }
+            s_table_remove (table, prev->second);
         }
         else {
             log_debug ("Sensor '%s' is already monitored. Skipping!", assetname);
-            pthread_mutex_unlock (&gpx_list_mutex);
+            pthread_mutex_unlock (&gpx_table_mutex);
+            delete table;
+            sensor_free ((void**)&gpx_info);
             return 0;
         }
     }
-    zlistx_add_end (_gpx_list, (void *) gpx_info);
+    s_table_add (table, gpx_info);
+    s_table_publish (table);
 
-    pthread_mutex_unlock (&gpx_list_mutex);
+    pthread_mutex_unlock (&gpx_table_mutex);
 
-    // Don't free gpx_info, it will be done at TERM time
+    // Don't free gpx_info, it will be done with the last table version using it
 
     log_debug ("%s sensor '%s' (%s) %sd with\n\tmanufacturer: %s\n\tmodel: %s \
     \n\ttype: %s\n\tnormal-state: %s\n\t%s number: %s\n\tparent: %s\n\tlocation: %s \
@@ -271,66 +414,46 @@ add_sensor(fty_sensor_gpio_assets_t *self, const char* operation,
 static int
 delete_sensor(fty_sensor_gpio_assets_t *self, const char* assetname)
 {
-    int retval = 0;
-
-    // We need to find out GPx direction
-    // And we cannot use gpx_info_result because it contains garbage on `gpx_direction` position
-    _gpx_info_t *info = (_gpx_info_t *)zlistx_first (_gpx_list);
-    while (info != NULL) {
-        char *info_name = info->asset_name;
-        if (streq (info_name, assetname)) {
-            int direction = info->gpx_direction;
-            if (direction ==  GPIO_DIRECTION_OUT) {
-                zmsg_t *request = zmsg_new ();
-                zmsg_addstr (request, assetname);
-                zmsg_addstr (request, "-1");
-                mlm_client_sendto (self->mlm, FTY_SENSOR_GPIO_AGENT, "GPOSTATE", NULL, 1000, &request);
-            }
-            break;
-        }
-        info = (_gpx_info_t *)zlistx_next (_gpx_list);
-    }
+    int direction = GPIO_DIRECTION_IN;
 
-    _gpx_info_t *gpx_info_result = NULL;
-    _gpx_info_t *gpx_info = sensor_new();
+    pthread_mutex_lock (&gpx_table_mutex);
 
-    if (gpx_info)
-        gpx_info->asset_name = strdup(assetname);
-    else {
-        log_error ("Can't allocate gpx_info!");
+    _gpx_table_t *table = s_table_copy ();
+    auto it = table->by_name.find (assetname);
+    if (it == table->by_name.end ()) {
+        pthread_mutex_unlock (&gpx_table_mutex);
+        delete table;
         return 1;
     }
-
-    pthread_mutex_lock (&gpx_list_mutex);
-
-    gpx_info_result = (_gpx_info_t*)zlistx_find (_gpx_list, (void *) gpx_info);
-    sensor_free((void**)&gpx_info);
-
-    if ( gpx_info_result == NULL ) {
-        retval = 1;
+    log_debug ("Deleting '%s'", assetname);
+    direction = it->second->gpx_direction;
+    s_table_remove (table, it->second);
+    s_table_publish (table);
+
+    pthread_mutex_unlock (&gpx_table_mutex);
+
+    // Tell the server to forget the GPO state
+    if (direction == GPIO_DIRECTION_OUT) {
+        zmsg_t *request = zmsg_new ();
+        zmsg_addstr (request, assetname);
+        zmsg_addstr (request, "-1");
+        mlm_client_sendto (self->mlm, FTY_SENSOR_GPIO_AGENT, "GPOSTATE", NULL, 1000, &request);
     }
-    else {
-        log_debug ("Deleting '%s'", assetname);
-        // Delete from zlist
-        zlistx_delete (_gpx_list, (void *)gpx_info_result);
-    }
-    pthread_mutex_unlock (&gpx_list_mutex);
-    return retval;
+    return 0;
 }
 
 //  --------------------------------------------------------------------------
 //  Check if this asset is a GPIO sensor by
 //  * Checking the provided subtype
-//  * Checking for the existence of a template file according to the asset part
+//  * Checking for the existence of a template according to the asset part
 //    nb (provided in model)
-//    If one exists, it's a GPIO sensor, so return the template filename
-//    Otherwise, it's not a GPIO sensor, so return an empty string
+//    If one exists, it's a GPIO sensor, so return the template, which the
+//    caller must destroy
+//    Otherwise, it's not a GPIO sensor, so return NULL
 
-static string
+static fty_sensor_gpio_template_t *
 is_asset_gpio_sensor (fty_sensor_gpio_assets_t *self, string asset_subtype, string asset_model)
 {
-    string template_filename = "";
-
     if ((asset_subtype == "") || (asset_subtype == "N_A")) {
         log_debug ("Asset subtype is not available");
         log_debug ("Verification will be limited to template existence!");
@@ -339,29 +462,34 @@ is_asset_gpio_sensor (fty_sensor_gpio_assets_t *self, string asset_subtype, stri
         // Check if it's a sensor, otherwise no need to continue!
         if (asset_subtype != "sensorgpio" && asset_subtype != "gpo") {
             log_debug ("Asset is not a GPIO sensor, skipping!");
-            return "";
+            return NULL;
         }
     }
 
-    if (asset_model == "")
-        return "";
+    if ((asset_model == "") || !self->templates)
+        return NULL;
 
     // Check if a sensor template exists
-    template_filename = string(self->template_dir) + string(asset_model) + string(".tpl");
-
-    FILE *template_file = fopen(template_filename.c_str(), "r");
-    if (!template_file) {
-        log_debug ("Template config file %s doesn't exist!", template_filename.c_str());
+    fty_sensor_gpio_template_t *sensor_template = fty_sensor_gpio_templates_lookup (self->templates, asset_model.c_str ());
+    if (!sensor_template) {
+        log_debug ("Template %s doesn't exist!", asset_model.c_str());
         log_debug ("Asset is not a GPIO sensor, skipping!");
     }
     else {
-        log_debug ("Template config file %s found!", template_filename.c_str());
+        log_debug ("Template %s found!", asset_model.c_str());
         log_debug ("Asset is a GPIO sensor, processing!");
-        fclose(template_file);
-        return template_filename;
     }
 
-    return "";
+    return sensor_template;
+}
+
+//  --------------------------------------------------------------------------
+//  Return the template value, or dfl if the template has none
+
+static const char *
+s_template_get (const char *value, const char *dfl)
+{
+    return streq (value, "") ? dfl : value;
 }
 
 //  --------------------------------------------------------------------------
@@ -374,7 +502,7 @@ fty_sensor_gpio_handle_asset (fty_sensor_gpio_assets_t *self, fty_proto_t *ftyme
     if (!self || !ftymessage) return;
     if (fty_proto_id (ftymessage) != FTY_PROTO_ASSET) return;
 
-    zconfig_t *config_template = NULL;
+    fty_sensor_gpio_template_t *sensor_template = NULL;
     const char* operation = fty_proto_operation (ftymessage);
     const char* assetname = fty_proto_name (ftymessage);
 
@@ -404,11 +532,6 @@ fty_sensor_gpio_handle_asset (fty_sensor_gpio_assets_t *self, fty_proto_t *ftyme
         if (streq (asset_subtype, "sensorgpio")) {
             const char* asset_model = fty_proto_ext_string (ftymessage, "model", "");
 
-            string config_template_filename = is_asset_gpio_sensor(self, asset_subtype, asset_model);
-            if (config_template_filename == "") {
-                return;
-            }
-
             const char *asset_parent_name1 = fty_proto_aux_string (ftymessage, FTY_PROTO_ASSET_AUX_PARENT_NAME_1, "");
             if (0 != strncmp ("rackcontroller", asset_parent_name1, strlen ("rackcontroller"))) {
                 // This agent should handle only local sensors
@@ -416,28 +539,27 @@ fty_sensor_gpio_handle_asset (fty_sensor_gpio_assets_t *self, fty_proto_t *ftyme
             }
 
             // We have a GPI sensor, process it
-            config_template = zconfig_load (config_template_filename.c_str());
-            if (!config_template) {
-                log_debug ("Can't load sensor template file"); // FIXME: error
+            sensor_template = is_asset_gpio_sensor(self, asset_subtype, asset_model);
+            if (!sensor_template) {
                 return;
             }
 
             // Get static info from template
-            const char *manufacturer = s_get (config_template, "manufacturer", "");
-            const char *sensor_type = s_get (config_template, "type", "");
+            const char *manufacturer = sensor_template->manufacturer;
+            const char *sensor_type = sensor_template->type;
             // FIXME: can come from user config
-            const char *sensor_alarm_message = s_get (config_template, "alarm-message", "");
+            const char *sensor_alarm_message = sensor_template->alarm_message;
             // Get from user config
             const char *sensor_gpx_number = fty_proto_ext_string (ftymessage, "port", "");
             const char* extname = fty_proto_ext_string (ftymessage, "name", "");
             // Get normal state, direction and severity from user config, or fallback to template values
-            const char *sensor_normal_state = s_get (config_template, "normal-state", "");
+            const char *sensor_normal_state = sensor_template->normal_state;
             sensor_normal_state = fty_proto_ext_string (ftymessage, "normal_state", sensor_normal_state);
-            const char *sensor_gpx_direction = s_get (config_template, "gpx-direction", "GPI");
+            const char *sensor_gpx_direction = s_template_get (sensor_template->gpx_direction, "GPI");
             sensor_gpx_direction = fty_proto_ext_string (ftymessage, "gpx_direction", sensor_gpx_direction);
             // And deployment location
             const char *sensor_location = fty_proto_ext_string (ftymessage, "logical_asset", "");
-            const char *sensor_alarm_severity = s_get (config_template, "alarm-severity", "WARNING");
+            const char *sensor_alarm_severity = s_template_get (sensor_template->alarm_severity, "WARNING");
             sensor_alarm_severity = fty_proto_ext_string (ftymessage, "alarm_severity", sensor_alarm_severity);
             // Get the GPO which power us
             const char* power_source = fty_proto_ext_string (ftymessage, "gpo_powersource", "");
@@ -448,12 +570,12 @@ fty_sensor_gpio_handle_asset (fty_sensor_gpio_assets_t *self, fty_proto_t *ftyme
             if (streq (sensor_normal_state, "")) {
                 log_debug ("No sensor normal state found in template nor provided by the user!");
                 log_debug ("Skipping sensor");
-                zconfig_destroy (&config_template);
+                fty_sensor_gpio_template_destroy (&sensor_template);
                 return;
             }
             if (streq (sensor_gpx_number, "")) {
                 log_debug ("No sensor pin (port) provided! Skipping sensor");
-                zconfig_destroy (&config_template);
+                fty_sensor_gpio_template_destroy (&sensor_template);
                 return;
             }
 
@@ -463,7 +585,7 @@ fty_sensor_gpio_handle_asset (fty_sensor_gpio_assets_t *self, fty_proto_t *ftyme
                         sensor_gpx_number, sensor_gpx_direction, asset_parent_name1,
                         sensor_location, power_source, sensor_alarm_message, sensor_alarm_severity);
 
-            zconfig_destroy (&config_template);
+            fty_sensor_gpio_template_destroy (&sensor_template);
         }
         if (streq (asset_subtype, "gpo")) {
             const char *asset_parent_name1 = fty_proto_aux_string (ftymessage, FTY_PROTO_ASSET_AUX_PARENT_NAME_1, "");
@@ -480,12 +602,12 @@ fty_sensor_gpio_handle_asset (fty_sensor_gpio_assets_t *self, fty_proto_t *ftyme
             if (streq (sensor_normal_state, "")) {
                 log_debug ("No sensor normal state found in template nor provided by the user!");
                 log_debug ("Skipping sensor");
-                zconfig_destroy (&config_template);
+                fty_sensor_gpio_template_destroy (&sensor_template);
                 return;
             }
             if (streq (sensor_gpx_number, "")) {
                 log_debug ("No sensor pin (port) provided! Skipping sensor");
-                zconfig_destroy (&config_template);
+                fty_sensor_gpio_template_destroy (&sensor_template);
                 return;
             }
 
@@ -526,6 +648,8 @@ request_sensor_power_source(fty_sensor_gpio_assets_t *self, const char* asset_na
 //  --------------------------------------------------------------------------
 //  Request all 'sensorgpio' assets  from fty-asset, to init our monitoring
 //  structure.
+//  This only sends the assets list request: the replies are processed by
+//  s_handle_bootstrap_reply(), as they arrive in the actor poller.
 
 void
 request_sensor_assets(fty_sensor_gpio_assets_t *self)
@@ -542,82 +666,171 @@ request_sensor_assets(fty_sensor_gpio_assets_t *self)
     int rv = mlm_client_sendto (self->mlm, "asset-agent", "ASSETS", NULL, 5000, &msg);
     if (rv != 0)
         log_error ("%s:\tRequest GPIO sensors list failed", self->name);
-    else
+    else {
         log_debug ("%s:\tGPIO sensors list request sent successfully", self->name);
-    zmsg_destroy (&msg);
-
-    zmsg_t *reply = mlm_client_recv (self->mlm);
-    if (!reply)
-        log_error ("%s: no reply message received", self->name);
-
-    char *uuid_recv = zmsg_popstr(reply);
-
-    if (0 != strcmp (zuuid_str_canonical (uuid), uuid_recv)) {
-        log_debug ("%s:\tGPIO zuuid doesn't match 1", self->name);
-        zmsg_destroy (&reply);
-        zstr_free (&uuid_recv);
-    }
-
-    if (streq (zmsg_popstr (reply), "ERROR"))
-    {
-        char *reason = zmsg_popstr (reply);
-        log_error ("%s: error message received %s", self->name, reason);
+        zstr_free (&self->bootstrap_uuid);
+        self->bootstrap_uuid = strdup (zuuid_str_canonical (uuid));
+        self->bootstrap_expiry = zclock_mono () + BOOTSTRAP_TIMEOUT;
     }
+    zmsg_destroy (&msg);
+    zuuid_destroy (&uuid);
+}
 
-    char *asset = NULL;
-    asset = zmsg_popstr(reply);
+//  --------------------------------------------------------------------------
+//  Send ASSET_DETAIL requests for the pending assets, so that there are up
+//  to BOOTSTRAP_WINDOW requests in flight
 
-    while (asset)
-    {
-        uuid = zuuid_new ();
-        msg = zmsg_new ();
+static void
+s_bootstrap_send_window (fty_sensor_gpio_assets_t *self)
+{
+    while ((zhashx_size (self->bootstrap_requests) < BOOTSTRAP_WINDOW)
+           && (zlistx_size (self->bootstrap_pending) > 0)) {
+        char *asset = (char *) zlistx_first (self->bootstrap_pending);
+        zuuid_t *uuid = zuuid_new ();
+        zmsg_t *msg = zmsg_new ();
         zmsg_addstr (msg, "GET");
         zmsg_addstr (msg, zuuid_str_canonical (uuid));
         zmsg_addstr (msg, asset);
 
-        rv = mlm_client_sendto (self->mlm, "asset-agent", "ASSET_DETAIL", NULL, 5000, &msg);
+        log_debug ("sending ASSET_DETAIL request for %s", asset);
+        int rv = mlm_client_sendto (self->mlm, "asset-agent", "ASSET_DETAIL", NULL, 5000, &msg);
         if (rv != 0)
             log_error ("%s:\tRequest ASSET_DETAIL failed for %s", self->name, asset);
+        else
+            zhashx_insert (self->bootstrap_requests, zuuid_str_canonical (uuid), asset);
+        zmsg_destroy (&msg);
+        zuuid_destroy (&uuid);
+        zlistx_delete (self->bootstrap_pending, zlistx_cursor (self->bootstrap_pending));
+    }
+    if (self->bootstrap_uuid || (zhashx_size (self->bootstrap_requests) > 0))
+        self->bootstrap_expiry = zclock_mono () + BOOTSTRAP_TIMEOUT;
+    else
+        log_debug ("%s:\tGPIO sensors list processed", self->name);
+}
 
-        log_debug ("sending ASSET_DETAIL request");
-        zmsg_t *reply2 = mlm_client_recv (self->mlm);
+//  --------------------------------------------------------------------------
+//  Delete the sensors restored from the snapshot which are no longer known
+//  by the asset agent, i.e. not in the GPIO sensors list to process
 
-        if (reply2)
-        {
-            char *uuid_recv = zmsg_popstr (reply2);
+static void
+s_forget_restored_sensors (fty_sensor_gpio_assets_t *self)
+{
+    zlistx_t *forgotten = zlistx_new ();
+    zlistx_set_duplicator (forgotten, (czmq_duplicator *) strdup);
+    zlistx_set_destructor (forgotten, (czmq_destructor *) zstr_free);
+
+    gpx_table_ptr table = get_gpx_table ();
+    if (table) {
+        for (const auto &gpx_info : table->sensors) {
+            if (gpx_info->restored && !zlistx_find (self->bootstrap_pending, gpx_info->asset_name))
+                zlistx_add_end (forgotten, gpx_info->asset_name);
+        }
+    }
 
-            if (0 != strcmp (zuuid_str_canonical (uuid), uuid_recv)) {
-                log_debug ("%s:\tGPIO zuuid doesn't match 2", self->name);
-                zmsg_destroy (&reply2);
-                continue;
-            }
+    char *asset_name = (char *) zlistx_first (forgotten);
+    while (asset_name) {
+        log_debug ("%s: forgetting restored sensor %s", self->name, asset_name);
+        delete_sensor (self, asset_name);
+        asset_name = (char *) zlistx_next (forgotten);
+    }
+    zlistx_destroy (&forgotten);
+}
 
-            if (fty_proto_is (reply2))
-            {
-                fty_proto_t *fmessage = fty_proto_decode (&reply2);
-                if (fty_proto_id (fmessage) == FTY_PROTO_ASSET)
-                {
-                    log_debug ("%s: Processing sensor %s", self->name, asset);
-                    fty_proto_print (fmessage);
+//  --------------------------------------------------------------------------
+//  Process a mailbox reply to the requests of request_sensor_assets(),
+//  matched by their correlation id
 
-                    fty_sensor_gpio_handle_asset (self, fmessage);
-                }
-                fty_proto_destroy (&fmessage);
+static void
+s_handle_bootstrap_reply (fty_sensor_gpio_assets_t *self, zmsg_t *reply)
+{
+    char *uuid_recv = zmsg_popstr (reply);
+    if (!uuid_recv)
+        return;
+
+    if (self->bootstrap_uuid && streq (self->bootstrap_uuid, uuid_recv)) {
+        // GPIO sensors list
+        zstr_free (&self->bootstrap_uuid);
+        char *status = zmsg_popstr (reply);
+        if (status && streq (status, "ERROR")) {
+            char *reason = zmsg_popstr (reply);
+            log_error ("%s: error message received %s", self->name, reason);
+            zstr_free (&reason);
+        }
+        else {
+            char *asset = zmsg_popstr (reply);
+            while (asset) {
+                zlistx_add_end (self->bootstrap_pending, asset);
+                zstr_free (&asset);
+                asset = zmsg_popstr (reply);
             }
-            else
-            {
-                if (streq (zmsg_popstr (reply2), "ERROR"))
-                    log_debug ("%s: error received %s", self->name, zmsg_popstr (reply2));
+            log_debug ("%s:\t%zu GPIO sensors to process", self->name, zlistx_size (self->bootstrap_pending));
+            s_forget_restored_sensors (self);
+        }
+        zstr_free (&status);
+        s_bootstrap_send_window (self);
+    }
+    else if (zhashx_lookup (self->bootstrap_requests, uuid_recv)) {
+        // One GPIO sensor details
+        if (fty_proto_is (reply)) {
+            fty_proto_t *fmessage = fty_proto_decode (&reply);
+            if (fmessage && (fty_proto_id (fmessage) == FTY_PROTO_ASSET)) {
+                log_debug ("%s: Processing sensor %s", self->name, fty_proto_name (fmessage));
+                fty_sensor_gpio_handle_asset (self, fmessage);
             }
-            asset = zmsg_popstr (reply);
-            zmsg_destroy (&reply2);
+            fty_proto_destroy (&fmessage);
         }
-        zmsg_destroy (&msg);
+        else {
+            char *status = zmsg_popstr (reply);
+            char *reason = zmsg_popstr (reply);
+            if (status && streq (status, "ERROR"))
+                log_debug ("%s: error received %s", self->name, reason);
+            zstr_free (&status);
+            zstr_free (&reason);
+        }
+        zhashx_delete (self->bootstrap_requests, uuid_recv);
+        s_bootstrap_send_window (self);
+    }
+    else
+        log_debug ("%s:\tGPIO zuuid doesn't match any request", self->name);
 
-    } // while
-    zmsg_destroy (&reply);
+    zstr_free (&uuid_recv);
+}
+
+//  --------------------------------------------------------------------------
+//  Return the poller timeout, until the bootstrap requests expire
+
+static int
+s_bootstrap_timeout (fty_sensor_gpio_assets_t *self)
+{
+    if (!self->bootstrap_uuid && (zhashx_size (self->bootstrap_requests) == 0))
+        return TIMEOUT_MS;
 
+    int64_t timeout = self->bootstrap_expiry - zclock_mono ();
+    return (timeout > 0) ? (int) timeout : 0;
 }
+
+//  --------------------------------------------------------------------------
+//  Give up on the bootstrap requests which got no reply in time, and go
+//  on with the remaining assets
+
+static void
+s_bootstrap_expire (fty_sensor_gpio_assets_t *self)
+{
+    if (s_bootstrap_timeout (self) != 0)
+        return;
+
+    if (self->bootstrap_uuid) {
+        log_error ("%s: no reply message received", self->name);
+        zstr_free (&self->bootstrap_uuid);
+    }
+    if (zhashx_size (self->bootstrap_requests) > 0) {
+        log_error ("%s: no reply received for %zu ASSET_DETAIL requests",
+            self->name, zhashx_size (self->bootstrap_requests));
+        zhashx_purge (self->bootstrap_requests);
+    }
+    s_bootstrap_send_window (self);
+}
+
 //  --------------------------------------------------------------------------
 //  Create a new fty_sensor_gpio_assets
 
@@ -631,15 +844,20 @@ fty_sensor_gpio_assets_new (const char* name)
     self->name        = strdup(name);
     self->test_mode   = false;
     self->template_dir = NULL;
-    // Declare our zlist for GPIOs tracking
-    // Instanciated here and provided to all actors
-    _gpx_list = zlistx_new ();
-    assert (_gpx_list);
-
-    // Declare zlist item handlers
-    zlistx_set_duplicator (_gpx_list, (czmq_duplicator *) sensor_dup);
-    zlistx_set_destructor (_gpx_list, (czmq_destructor *) sensor_free);
-    zlistx_set_comparator (_gpx_list, (czmq_comparator *) sensor_cmp);
+    self->templates = NULL;
+    self->bootstrap_uuid = NULL;
+    self->bootstrap_pending = zlistx_new ();
+    assert (self->bootstrap_pending);
+    zlistx_set_duplicator (self->bootstrap_pending, (czmq_duplicator *) strdup);
+    zlistx_set_destructor (self->bootstrap_pending, (czmq_destructor *) zstr_free);
+    zlistx_set_comparator (self->bootstrap_pending, (czmq_comparator *) strcmp);
+    self->bootstrap_requests = zhashx_new ();
+    assert (self->bootstrap_requests);
+    zhashx_set_duplicator (self->bootstrap_requests, (czmq_duplicator *) strdup);
+    zhashx_set_destructor (self->bootstrap_requests, (czmq_destructor *) zstr_free);
+    self->bootstrap_expiry = 0;
+    // The table of monitored GPx is provided to all actors through
+    // get_gpx_table(), and published with the first sensor
 
     return self;
 }
@@ -655,15 +873,19 @@ fty_sensor_gpio_assets_destroy (fty_sensor_gpio_assets_t **self_p)
     if (*self_p) {
         fty_sensor_gpio_assets_t *self = *self_p;
         //  Free class properties
-        zlistx_purge (_gpx_list);
-        zlistx_destroy (&_gpx_list);
-        pthread_mutex_unlock (&gpx_list_mutex);
+        //  Stop monitoring, the sensors are freed with the last table
+        //  version still in use
+        pthread_mutex_lock (&gpx_table_mutex);
+        std::atomic_store (&_gpx_table, gpx_table_ptr ());
+        pthread_mutex_unlock (&gpx_table_mutex);
         zstr_free(&self->name);
         mlm_client_destroy (&self->mlm);
         if (self->template_dir)
             zstr_free(&self->template_dir);
-
-        pthread_mutex_destroy(&gpx_list_mutex);
+        fty_sensor_gpio_templates_destroy (&self->templates);
+        zstr_free (&self->bootstrap_uuid);
+        zlistx_destroy (&self->bootstrap_pending);
+        zhashx_destroy (&self->bootstrap_requests);
         //  Free object itself
         free (self);
         *self_p = NULL;
@@ -693,11 +915,12 @@ fty_sensor_gpio_assets (zsock_t *pipe, void *args)
 
     while (!zsys_interrupted)
     {
-        void *which = zpoller_wait (poller, TIMEOUT_MS);
+        void *which = zpoller_wait (poller, s_bootstrap_timeout (self));
         if (which == NULL) {
             if (zpoller_terminated (poller) || zsys_interrupted) {
                 break;
             }
+            s_bootstrap_expire (self);
         }
         if (which == pipe) {
             zmsg_t *message = zmsg_recv (pipe);
@@ -742,8 +965,12 @@ fty_sensor_gpio_assets (zsock_t *pipe, void *args)
                     log_debug ("TEST=true");
                 }
                 else if (streq (cmd, "TEMPLATE_DIR")) {
+                    zstr_free (&self->template_dir);
+                    fty_sensor_gpio_templates_destroy (&self->templates);
                     self->template_dir = zmsg_popstr (message);
                     log_debug ("fty_sensor_gpio: Using sensors template directory: %s", self->template_dir);
+                    if (self->template_dir)
+                        self->templates = fty_sensor_gpio_templates_new (self->template_dir);
                 }
                 else {
                     log_warning ("\tUnknown API command=%s, ignoring", cmd);
@@ -754,7 +981,10 @@ fty_sensor_gpio_assets (zsock_t *pipe, void *args)
         }
         else if (which == mlm_client_msgpipe (self->mlm)) {
             zmsg_t *message = mlm_client_recv (self->mlm);
-            if (is_fty_proto (message)) {
+            if (streq (mlm_client_command (self->mlm), "MAILBOX DELIVER")) {
+                s_handle_bootstrap_reply (self, message);
+            }
+            else if (is_fty_proto (message)) {
                 fty_proto_t *fmessage = fty_proto_decode (&message);
                 if (fty_proto_id (fmessage) == FTY_PROTO_ASSET) {
                     if (fty_proto_aux_string (fmessage, FTY_PROTO_ASSET_AUX_SUBTYPE, "sensorgpio") ||
@@ -928,13 +1158,12 @@ fty_sensor_gpio_assets_test (bool verbose)
         zmsg_destroy (&msg);
 
         // Check the result list
-        pthread_mutex_lock (&gpx_list_mutex);
-        zlistx_t *test_gpx_list = get_gpx_list();
-        assert (test_gpx_list);
-        int sensors_count = zlistx_size (test_gpx_list);
+        gpx_table_ptr test_gpx_table = get_gpx_table ();
+        assert (test_gpx_table);
+        int sensors_count = test_gpx_table->sensors.size ();
         assert (sensors_count == 3);
         // Test the first sensor
-        _gpx_info_t *gpx_info = (_gpx_info_t *)zlistx_first (test_gpx_list);
+        _gpx_info_t *gpx_info = test_gpx_table->sensors [0].get ();
         assert (gpx_info);
         assert (streq (gpx_info->asset_name, "sensorgpio-10"));
         assert (streq (gpx_info->ext_name, "GPIO-Sensor-Door1"));
@@ -951,7 +1180,7 @@ fty_sensor_gpio_assets_test (bool verbose)
         assert (streq (gpx_info->alarm_message, "Door has been $status"));
 
         // Test the 2nd sensor
-        gpx_info = (_gpx_info_t *)zlistx_next (test_gpx_list);
+        gpx_info = test_gpx_table->sensors [1].get ();
         assert (gpx_info);
         assert (streq (gpx_info->asset_name, "sensorgpio-11"));
         assert (streq (gpx_info->ext_name, "GPIO-Sensor-Waterleak1"));
@@ -966,7 +1195,7 @@ fty_sensor_gpio_assets_test (bool verbose)
         assert (gpx_info->gpx_direction == GPIO_DIRECTION_IN);
 
         // Test the GPO
-        gpx_info = (_gpx_info_t *)zlistx_next (test_gpx_list);
+        gpx_info = test_gpx_table->sensors [2].get ();
         assert (gpx_info);
         assert (streq (gpx_info->asset_name, "gpo-12"));
         assert (streq (gpx_info->ext_name, "GPO-Beacon"));
@@ -975,12 +1204,28 @@ fty_sensor_gpio_assets_test (bool verbose)
         assert (gpx_info->normal_state == GPIO_STATE_CLOSED);
         assert (gpx_info->gpx_direction == GPIO_DIRECTION_OUT);
 
-        pthread_mutex_unlock (&gpx_list_mutex);
+        // The GPIs are polled through pin snapshots, the GPO one at a time
+        assert (test_gpx_table->gpi_pins.size () == 1);
+        assert (test_gpx_table->gpi_pins [0] == ((1ULL << 1) | (1ULL << 2)));
+        assert (test_gpx_table->by_gpi [1] == 0);
+        assert (test_gpx_table->by_gpi [2] == 1);
+        assert (test_gpx_table->polled.size () == 1);
+        assert (test_gpx_table->polled [0] == 2);
+        assert (test_gpx_table->gpx_direction [2] == GPIO_DIRECTION_OUT);
+        assert (test_gpx_table->normal_state [1] == GPIO_STATE_OPENED);
+        assert (test_gpx_table->power_gpo [0] == -1);
+        assert (test_gpx_table->state [2] == gpx_info->state);
+        // The descriptive strings are shared
+        assert (test_gpx_table->sensors [0]->parent == gpx_info->parent);
+        assert (test_gpx_table->sensors [0]->manufacturer == test_gpx_table->sensors [1]->manufacturer);
     }
 
     // Test #2: Using the list of assets from #1, delete asset 3 and check the list
     {
         log_debug ("fty-sensor-gpio-assets-test: Test #2");
+        // Keep the current table version, as the server does for a cycle
+        gpx_table_ptr prev_gpx_table = get_gpx_table ();
+        assert (prev_gpx_table);
         // Asset 1: DCS001
         zhash_t* aux = zhash_new ();
         zhash_t *ext = zhash_new ();
@@ -1003,14 +1248,18 @@ fty_sensor_gpio_assets_test (bool verbose)
         zmsg_destroy (&msg);
 
         // Check the result list
-        pthread_mutex_lock (&gpx_list_mutex);
-        zlistx_t *test_gpx_list = get_gpx_list();
-        assert (test_gpx_list);
-        int sensors_count = zlistx_size (test_gpx_list);
+        gpx_table_ptr test_gpx_table = get_gpx_table ();
+        assert (test_gpx_table);
+        int sensors_count = test_gpx_table->sensors.size ();
         assert (sensors_count == 2);
-        log_debug("test_gpx_list = %i", sensors_count);
-
-        pthread_mutex_unlock (&gpx_list_mutex);
+        log_debug("test_gpx_table = %i", sensors_count);
+        // The previous version is unchanged, and still usable
+        assert (test_gpx_table->generation > prev_gpx_table->generation);
+        assert (prev_gpx_table->sensors.size () == 3);
+        _gpx_info_t *gpx_info = get_gpx_info (prev_gpx_table, "gpo-12");
+        assert (gpx_info);
+        assert (streq (gpx_info->ext_name, "GPO-Beacon"));
+        assert (get_gpx_info (test_gpx_table, "gpo-12") == NULL);
     }
     // Test #3: Using the list of assets from #1, update asset 1 with overriden
     // 'normal-state' and check the list
@@ -1045,15 +1294,14 @@ fty_sensor_gpio_assets_test (bool verbose)
         zmsg_destroy (&msg);
 
         // Check the result list
-        pthread_mutex_lock (&gpx_list_mutex);
-        zlistx_t *test_gpx_list = get_gpx_list();
-        assert (test_gpx_list);
-        int sensors_count = zlistx_size (test_gpx_list);
+        gpx_table_ptr test_gpx_table = get_gpx_table ();
+        assert (test_gpx_table);
+        int sensors_count = test_gpx_table->sensors.size ();
         assert (sensors_count == 2);
         // Only test the first sensor
-        _gpx_info_t *gpx_info = (_gpx_info_t *)zlistx_first (test_gpx_list);
+        _gpx_info_t *gpx_info = test_gpx_table->sensors [0].get ();
         assert (gpx_info);
-        gpx_info = (_gpx_info_t *)zlistx_next (test_gpx_list);
+        gpx_info = test_gpx_table->sensors [1].get ();
         assert (gpx_info);
         assert (streq (gpx_info->asset_name, "sensorgpio-10"));
         assert (streq (gpx_info->ext_name, "GPIO-Sensor-Door1"));
@@ -1069,8 +1317,9 @@ fty_sensor_gpio_assets_test (bool verbose)
         assert (gpx_info->gpx_direction == GPIO_DIRECTION_IN);
         assert (streq (gpx_info->alarm_severity, "WARNING"));
         assert (streq (gpx_info->alarm_message, "Door has been $status"));
-
-        pthread_mutex_unlock (&gpx_list_mutex);
+        // The index points to the updated entry, by asset and ext name
+        assert (get_gpx_info (test_gpx_table, "sensorgpio-10") == gpx_info);
+        assert (get_gpx_info (test_gpx_table, "GPIO-Sensor-Door1") == gpx_info);
     }
 
     // Test #4: Using the list of assets from #1, delete asset 1 and check the list
@@ -1098,18 +1347,18 @@ fty_sensor_gpio_assets_test (bool verbose)
         zmsg_destroy (&msg);
 
         // Check the result list
-        pthread_mutex_lock (&gpx_list_mutex);
-        zlistx_t *test_gpx_list = get_gpx_list();
-        assert (test_gpx_list);
-        int sensors_count = zlistx_size (test_gpx_list);
+        gpx_table_ptr test_gpx_table = get_gpx_table ();
+        assert (test_gpx_table);
+        int sensors_count = test_gpx_table->sensors.size ();
         assert (sensors_count == 1);
-        log_debug("test_gpx_list = %i", sensors_count);
+        log_debug("test_gpx_table = %i", sensors_count);
         // There must remain only 'sensorgpio-11'
-        _gpx_info_t *gpx_info = (_gpx_info_t *)zlistx_first (test_gpx_list);
+        _gpx_info_t *gpx_info = test_gpx_table->sensors [0].get ();
         assert (gpx_info);
         assert (streq (gpx_info->asset_name, "sensorgpio-11"));
-
-        pthread_mutex_unlock (&gpx_list_mutex);
+        assert (get_gpx_info (test_gpx_table, "sensorgpio-11") == gpx_info);
+        assert (get_gpx_info (test_gpx_table, "sensorgpio-10") == NULL);
+        assert (get_gpx_info (test_gpx_table, "GPIO-Sensor-Door1") == NULL);
     }
 
     // Test #5: Using the list of assets from #1, update asset 2 with
@@ -1144,14 +1393,88 @@ fty_sensor_gpio_assets_test (bool verbose)
         zmsg_destroy (&msg);
 
         // Check the result list
-        pthread_mutex_lock (&gpx_list_mutex);
-        zlistx_t *test_gpx_list = get_gpx_list();
-        assert (test_gpx_list);
-        int sensors_count = zlistx_size (test_gpx_list);
-        log_debug("test_gpx_list = %i", sensors_count);
+        gpx_table_ptr test_gpx_table = get_gpx_table ();
+        assert (test_gpx_table);
+        int sensors_count = test_gpx_table->sensors.size ();
+        log_debug("test_gpx_table = %i", sensors_count);
         assert (sensors_count == 0);
+    }
+
+    // Test #6: Bootstrap the monitored assets from the asset agent, which
+    // gets several ASSET_DETAIL requests at once and answers out of order
+    {
+        log_debug ("fty-sensor-gpio-assets-test: Test #6");
+        mlm_client_t *asset_agent = mlm_client_new ();
+        mlm_client_connect (asset_agent, endpoint, 1000, "asset-agent");
+        zstr_sendx (assets, "PRODUCER", FTY_PROTO_STREAM_ASSETS, NULL);
+
+        // GPIO sensors list
+        zmsg_t *request = mlm_client_recv (asset_agent);
+        assert (request);
+        assert (streq (mlm_client_subject (asset_agent), "ASSETS"));
+        char *cmd = zmsg_popstr (request);
+        assert (streq (cmd, "GET"));
+        char *uuid = zmsg_popstr (request);
+        zmsg_t *reply = zmsg_new ();
+        zmsg_addstr (reply, uuid);
+        zmsg_addstr (reply, "OK");
+        zmsg_addstr (reply, "sensorgpio-20");
+        zmsg_addstr (reply, "sensorgpio-21");
+        int rv = mlm_client_sendto (asset_agent, mlm_client_sender (asset_agent), "ASSETS", NULL, 1000, &reply);
+        assert (rv == 0);
+        zstr_free (&cmd);
+        zstr_free (&uuid);
+        zmsg_destroy (&request);
+
+        // Both details are requested without waiting for the replies
+        char *uuids[2];
+        char *names[2];
+        for (int i = 0; i < 2; i++) {
+            request = mlm_client_recv (asset_agent);
+            assert (request);
+            assert (streq (mlm_client_subject (asset_agent), "ASSET_DETAIL"));
+            cmd = zmsg_popstr (request);
+            assert (streq (cmd, "GET"));
+            uuids[i] = zmsg_popstr (request);
+            names[i] = zmsg_popstr (request);
+            zstr_free (&cmd);
+            zmsg_destroy (&request);
+        }
+        assert (!streq (uuids[0], uuids[1]));
+
+        for (int i = 1; i >= 0; i--) {
+            zhash_t *aux = zhash_new ();
+            zhash_t *ext = zhash_new ();
+            zhash_update (aux, "type", (void *) "device");
+            zhash_update (aux, "subtype", (void *) "sensorgpio");
+            zhash_update (aux, "status", (void *) "active");
+            zhash_update (aux, "parent_name.1", (void *) "rackcontroller-1");
+            zhash_update (ext, "name", (void *) names[i]);
+            zhash_update (ext, "port", (void *) (i ? "4" : "3"));
+            zhash_update (ext, "model", (void *) "DCS001");
+            reply = fty_proto_encode_asset (aux, names[i], "inventory", ext);
+            zmsg_pushstr (reply, uuids[i]);
+            rv = mlm_client_sendto (asset_agent, mlm_client_sender (asset_agent), "ASSET_DETAIL", NULL, 1000, &reply);
+            assert (rv == 0);
+            zhash_destroy (&aux);
+            zhash_destroy (&ext);
+            zstr_free (&uuids[i]);
+            zstr_free (&names[i]);
+        }
+        zclock_sleep (1000);
+
+        // Check the result list
+        gpx_table_ptr test_gpx_table = get_gpx_table ();
+        assert (test_gpx_table);
+        assert (test_gpx_table->sensors.size () == 2);
+        _gpx_info_t *gpx_info = get_gpx_info (test_gpx_table, "sensorgpio-20");
+        assert (gpx_info);
+        assert (gpx_info->gpx_number == 3);
+        gpx_info = get_gpx_info (test_gpx_table, "sensorgpio-21");
+        assert (gpx_info);
+        assert (gpx_info->gpx_number == 4);
 
-        pthread_mutex_unlock (&gpx_list_mutex);
+        mlm_client_destroy (&asset_agent);
     }
 
     //  @end
@@ -0,0 +1,518 @@
+/*  =========================================================================
+    fty_sensor_gpio_bench - End-to-end benchmark of the GPIO agent
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_bench - End-to-end benchmark of the GPIO agent
+@discuss
+    Runs the server and assets actors against an in-process malamute
+    broker and the simulated GPIO backend, so that no hardware, fty-info
+    nor asset agent is needed:
+
+    * the GPI and GPO assets are created by publishing synthetic sensorgpio
+      and gpo asset messages, as the asset agent does,
+    * the polling cycles are triggered one after the other, and each
+      sensor status is published on every cycle (no heartbeat filtering),
+    * GPO_INTERACTION requests open and close the GPOs in turn.
+
+    The results are printed as a single JSON object, with flat keys, to be
+    compared between releases:
+
+        assets_per_sec         - assets monitored per second, from their
+                                 publication
+        sensors_per_sec        - statuses published per second of polling
+        publish.p50_us...      - latency between the start of a polling
+                                 cycle and the reception of each status
+        cycle.p50_us...        - duration of the polling cycles, until the
+                                 last status is received
+        interaction.p50_us...  - GPO_INTERACTION round-trip
+        rss_kb, rss_peak_kb    - resident memory of the process
+        server.<name>          - runtime statistics of the agent (GPIO_STATS)
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+#include <algorithm>
+
+#define BENCH_ENDPOINT  "inproc://fty-sensor-gpio-bench"
+#define BENCH_TIMEOUT   10000   // msec without progress before giving up
+
+void
+usage(){
+    puts ("fty-sensor-gpio-bench [options] ...");
+    puts ("  -v|--verbose        verbose output");
+    puts ("  -h|--help           this information");
+    puts ("  -n|--sensors        number of GPI sensors [1000]");
+    puts ("  -g|--gpos           number of GPO [16]");
+    puts ("  -c|--cycles         number of polling cycles [20]");
+    puts ("  -r|--requests       number of GPO_INTERACTION requests [1000]");
+    puts ("  -w|--waveform       waveform of the GPI, see fty-sensor-gpio.cfg [toggle=50 stagger=1]");
+    puts ("  -t|--templates      sensors template directory [guessed]");
+    puts ("  -o|--output         write the results to this file [stdout]");
+}
+
+// Latency samples (usec), with their percentiles
+struct bench_samples_t {
+    std::vector<int64_t> values;
+
+    void add (int64_t value) { values.push_back (value); }
+
+    int64_t percentile (int percent) {
+        if (values.empty ())
+            return 0;
+        std::sort (values.begin (), values.end ());
+        return values [(values.size () - 1) * percent / 100];
+    }
+};
+
+// Results, as a flat JSON object
+struct bench_report_t {
+    std::vector<std::pair<std::string, std::string>> entries;
+
+    void add (const std::string &name, int64_t value) {
+        entries.push_back (std::make_pair (name, std::to_string (value)));
+    }
+    void add (const std::string &name, double value) {
+        char buffer [32];
+        snprintf (buffer, sizeof (buffer), "%.1f", value);
+        entries.push_back (std::make_pair (name, std::string (buffer)));
+    }
+    void add (const std::string &name, bench_samples_t &samples) {
+        int64_t sum = 0;
+        for (int64_t value : samples.values)
+            sum += value;
+        add (name + ".count", (int64_t) samples.values.size ());
+        add (name + ".mean_us", (int64_t) (samples.values.empty () ? 0 : sum / (int64_t) samples.values.size ()));
+        add (name + ".p50_us", samples.percentile (50));
+        add (name + ".p90_us", samples.percentile (90));
+        add (name + ".p99_us", samples.percentile (99));
+        add (name + ".max_us", samples.percentile (100));
+    }
+    void print (FILE *file) {
+        fprintf (file, "{\n");
+        for (size_t i = 0; i < entries.size (); i++) {
+            // Only numbers are reported, except for the strings coming
+            // from the agent, which are quoted
+            const std::string &value = entries [i].second;
+            bool number = !value.empty () && (value.find_first_not_of ("-.0123456789") == std::string::npos);
+            fprintf (file, "    \"%s\": %s%s%s%s\n", entries [i].first.c_str (),
+                number ? "" : "\"", value.c_str (), number ? "" : "\"",
+                (i + 1 < entries.size ()) ? "," : "");
+        }
+        fprintf (file, "}\n");
+    }
+};
+
+//  --------------------------------------------------------------------------
+//  Return a field of /proc/self/status in kB, or -1 if unavailable
+
+static int64_t
+s_proc_status_kb (const char *field)
+{
+    FILE *file = fopen ("/proc/self/status", "r");
+    if (!file)
+        return -1;
+    int64_t value = -1;
+    char line [256];
+    size_t length = strlen (field);
+    while (fgets (line, sizeof (line), file)) {
+        if ((strncmp (line, field, length) == 0) && (line [length] == ':')) {
+            value = atoll (line + length + 1);
+            break;
+        }
+    }
+    fclose (file);
+    return value;
+}
+
+//  --------------------------------------------------------------------------
+//  Guess the sensors template directory, as the agent does
+
+static char *
+s_template_dir (void)
+{
+    const char *candidates [] = {
+        "/usr/share/fty-sensor-gpio/data/", "./selftest-ro/data/", "./src/data/", NULL
+    };
+    for (int i = 0; candidates [i]; i++) {
+        std::string template_filename = std::string (candidates [i]) + "DCS001.tpl";
+        if (zsys_file_exists (template_filename.c_str ()))
+            return strdup (candidates [i]);
+    }
+    return NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Publish a synthetic asset message, as the asset agent does
+
+static int
+s_publish_asset (mlm_client_t *producer, const char *subtype, const char *name, int port)
+{
+    zhash_t *aux = zhash_new ();
+    zhash_t *ext = zhash_new ();
+    zhash_autofree (aux);
+    zhash_autofree (ext);
+    zhash_update (aux, "type", (void *) "device");
+    zhash_update (aux, "subtype", (void *) subtype);
+    zhash_update (aux, "status", (void *) "active");
+    zhash_update (aux, "parent_name.1", (void *) "rackcontroller-0");
+    zhash_update (ext, "name", (void *) name);
+    zhash_update (ext, "port", (void *) std::to_string (port).c_str ());
+    if (streq (subtype, "sensorgpio")) {
+        zhash_update (ext, "model", (void *) "DCS001");
+        zhash_update (ext, "logical_asset", (void *) "Rack1");
+    }
+    zmsg_t *msg = fty_proto_encode_asset (aux, name, FTY_PROTO_ASSET_OP_CREATE, ext);
+    zhash_destroy (&aux);
+    zhash_destroy (&ext);
+    std::string subject = std::string ("device.") + subtype + "@" + name;
+    return mlm_client_send (producer, subject.c_str (), &msg);
+}
+
+//  --------------------------------------------------------------------------
+//  Receive a message on the client, or NULL after timeout msec
+
+static zmsg_t *
+s_recv (mlm_client_t *client, int timeout)
+{
+    zsock_t *msgpipe = mlm_client_msgpipe (client);
+    zmq_pollitem_t item = { zsock_resolve (msgpipe), 0, ZMQ_POLLIN, 0 };
+    if ((zmq_poll (&item, 1, timeout) <= 0) || zsys_interrupted)
+        return NULL;
+    return mlm_client_recv (client);
+}
+
+//  --------------------------------------------------------------------------
+//  Wait until count sensors are monitored. Return the time it took (usec),
+//  or -1 on timeout
+
+static int64_t
+s_wait_sensors (size_t count, int64_t start)
+{
+    int64_t deadline = zclock_mono () + BENCH_TIMEOUT;
+    size_t last = 0;
+    while (!zsys_interrupted) {
+        gpx_table_ptr gpx_table = get_gpx_table ();
+        size_t monitored = gpx_table ? gpx_table->sensors.size () : 0;
+        if (monitored >= count)
+            return zclock_usecs () - start;
+        // Give up only when the assets actor stops progressing
+        if (monitored != last) {
+            last = monitored;
+            deadline = zclock_mono () + BENCH_TIMEOUT;
+        }
+        if (zclock_mono () > deadline)
+            break;
+        zclock_sleep (1);
+    }
+    return -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Trigger the polling cycles, and time the reception of the statuses.
+//  Return the number of statuses received
+
+static int64_t
+s_bench_polling (zactor_t *server, mlm_client_t *listener, int cycles, size_t expected,
+    bench_samples_t &publish, bench_samples_t &cycle)
+{
+    int64_t received = 0;
+    for (int i = 0; (i < cycles) && !zsys_interrupted; i++) {
+        int64_t start = zclock_usecs ();
+        zstr_sendx (server, "UPDATE", NULL);
+        size_t count = 0;
+        while (count < expected) {
+            zmsg_t *msg = s_recv (listener, BENCH_TIMEOUT);
+            if (!msg) {
+                log_error ("fty-sensor-gpio-bench: only %d statuses received in cycle %d",
+                    (int) count, i);
+                return received;
+            }
+            publish.add (zclock_usecs () - start);
+            zmsg_destroy (&msg);
+            count++;
+            received++;
+        }
+        cycle.add (zclock_usecs () - start);
+    }
+    return received;
+}
+
+//  --------------------------------------------------------------------------
+//  Open and close the GPOs in turn, and time the round-trips. Return the
+//  number of requests which failed
+
+static int
+s_bench_interaction (mlm_client_t *client, int gpos, int requests, bench_samples_t &interaction)
+{
+    std::vector<bool> opened (gpos, false);
+    int failures = 0;
+    for (int i = 0; (i < requests) && !zsys_interrupted; i++) {
+        int gpo = i % gpos;
+        zmsg_t *msg = zmsg_new ();
+        zmsg_addstrf (msg, "%d", i);
+        zmsg_addstrf (msg, "gpo-bench-%d", gpo + 1);
+        zmsg_addstr (msg, opened [gpo] ? "close" : "open");
+        int64_t start = zclock_usecs ();
+        if (mlm_client_sendto (client, FTY_SENSOR_GPIO_AGENT, "GPO_INTERACTION", NULL, 1000, &msg) != 0) {
+            failures++;
+            continue;
+        }
+        zmsg_t *reply = s_recv (client, BENCH_TIMEOUT);
+        if (!reply) {
+            log_error ("fty-sensor-gpio-bench: no GPO_INTERACTION reply for request %d", i);
+            failures += requests - i;
+            break;
+        }
+        interaction.add (zclock_usecs () - start);
+        char *zuuid = zmsg_popstr (reply);
+        char *status = zmsg_popstr (reply);
+        if (status && streq (status, "OK"))
+            opened [gpo] = !opened [gpo];
+        else
+            failures++;
+        zstr_free (&zuuid);
+        zstr_free (&status);
+        zmsg_destroy (&reply);
+    }
+    return failures;
+}
+
+//  --------------------------------------------------------------------------
+//  Add the runtime statistics of the agent to the report
+
+static void
+s_bench_server_stats (mlm_client_t *client, bench_report_t &report)
+{
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, "stats");
+    if (mlm_client_sendto (client, FTY_SENSOR_GPIO_AGENT, "GPIO_STATS", NULL, 1000, &msg) != 0)
+        return;
+    zmsg_t *reply = s_recv (client, BENCH_TIMEOUT);
+    if (!reply)
+        return;
+    char *zuuid = zmsg_popstr (reply);
+    char *status = zmsg_popstr (reply);
+    if (status && streq (status, "OK")) {
+        char *name = zmsg_popstr (reply);
+        while (name) {
+            char *value = zmsg_popstr (reply);
+            report.entries.push_back (std::make_pair (std::string ("server.") + name,
+                std::string (value ? value : "")));
+            zstr_free (&value);
+            zstr_free (&name);
+            name = zmsg_popstr (reply);
+        }
+    }
+    zstr_free (&zuuid);
+    zstr_free (&status);
+    zmsg_destroy (&reply);
+}
+
+int main (int argc, char *argv [])
+{
+    int sensors = 1000;
+    int gpos = 16;
+    int cycles = 20;
+    int requests = 1000;
+    const char *waveform = "toggle=50 stagger=1";
+    char *template_dir = NULL;
+    const char *output = NULL;
+    bool verbose = false;
+    int argn;
+
+    ManageFtyLog::setInstanceFtylog("fty-sensor-gpio-bench");
+
+    // Parse command line
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help")
+        ||  streq (argv [argn], "-h")) {
+            usage();
+            return 0;
+        }
+        else if (streq (argv [argn], "--verbose") || streq (argv [argn], "-v")) {
+            verbose = true;
+        }
+        else if (streq (argv [argn], "--sensors") || streq (argv [argn], "-n")) {
+            if (param) sensors = atoi (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--gpos") || streq (argv [argn], "-g")) {
+            if (param) gpos = atoi (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--cycles") || streq (argv [argn], "-c")) {
+            if (param) cycles = atoi (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--requests") || streq (argv [argn], "-r")) {
+            if (param) requests = atoi (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--waveform") || streq (argv [argn], "-w")) {
+            if (param) waveform = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--templates") || streq (argv [argn], "-t")) {
+            if (param) template_dir = strdup (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--output") || streq (argv [argn], "-o")) {
+            if (param) output = param;
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return 1;
+        }
+    }
+
+    // The GPI and then the GPO take the pins of the simulated chipset from 1
+    if ((sensors < 1) || (gpos < 1) || (sensors + gpos >= FTY_SENSOR_GPIO_SIM_PINS)) {
+        printf ("The number of GPI and GPO must be positive, and their sum below %d\n",
+            FTY_SENSOR_GPIO_SIM_PINS);
+        return 1;
+    }
+    if (verbose)
+        ManageFtyLog::getInstanceFtylog()->setVeboseMode();
+
+    if (!template_dir)
+        template_dir = s_template_dir ();
+    if (!template_dir) {
+        log_error ("Can't find sensors template files directory!");
+        return EXIT_FAILURE;
+    }
+
+    zactor_t *broker = zactor_new (mlm_server, (void*) "Malamute");
+    zstr_sendx (broker, "BIND", BENCH_ENDPOINT, NULL);
+
+    // Agent on the simulated chipset, publishing every status it reads
+    zactor_t *server = zactor_new (fty_sensor_gpio_server, (void*) FTY_SENSOR_GPIO_AGENT);
+    zstr_sendx (server, "CONNECT", BENCH_ENDPOINT, NULL);
+    zstr_sendx (server, "PRODUCER", FTY_PROTO_STREAM_METRICS_SENSOR, NULL);
+    zstr_sendx (server, "TEMPLATE_DIR", template_dir, NULL);
+    zstr_sendx (server, "BACKEND", "sim", NULL);
+    zstr_sendx (server, "HEARTBEAT", "0", NULL);
+    zstr_sendx (server, "POLL_INTERVAL", "0", NULL);
+    zstr_sendx (server, "HW_PROFILE", "gpi", std::to_string (sensors).c_str (), "0", "0", NULL);
+    zstr_sendx (server, "HW_PROFILE", "gpo", std::to_string (gpos).c_str (), "0",
+        std::to_string (sensors).c_str (), NULL);
+    zstr_sendx (server, "SIMULATE", ("1-" + std::to_string (sensors)).c_str (), waveform, NULL);
+
+    mlm_client_t *listener = mlm_client_new ();
+    mlm_client_connect (listener, BENCH_ENDPOINT, 1000, "fty-sensor-gpio-bench-listener");
+    mlm_client_set_consumer (listener, FTY_PROTO_STREAM_METRICS_SENSOR, ".*");
+    mlm_client_t *client = mlm_client_new ();
+    mlm_client_connect (client, BENCH_ENDPOINT, 1000, "fty-sensor-gpio-bench-client");
+    mlm_client_t *producer = mlm_client_new ();
+    mlm_client_connect (producer, BENCH_ENDPOINT, 1000, "fty-sensor-gpio-bench-assets");
+    mlm_client_set_producer (producer, FTY_PROTO_STREAM_ASSETS);
+
+    // The assets actor checks the ports against the HW capabilities
+    while (!hw_cap_inited && !zsys_interrupted)
+        zclock_sleep (1);
+    zactor_t *assets = zactor_new (fty_sensor_gpio_assets, (void*) "gpio-assets");
+    zstr_sendx (assets, "TEMPLATE_DIR", template_dir, NULL);
+    zstr_sendx (assets, "CONNECT", BENCH_ENDPOINT, NULL);
+    zstr_sendx (assets, "PRODUCER", FTY_PROTO_STREAM_ASSETS, NULL);
+    zstr_sendx (assets, "CONSUMER", FTY_PROTO_STREAM_ASSETS, ".*", NULL);
+    // Let the subscriptions reach the broker
+    zclock_sleep (500);
+
+    bench_report_t report;
+    bench_samples_t publish;
+    bench_samples_t cycle;
+    bench_samples_t interaction;
+    int rv = 0;
+
+    report.add ("gpi", (int64_t) sensors);
+    report.add ("gpo", (int64_t) gpos);
+
+    // Assets
+    int64_t start = zclock_usecs ();
+    for (int i = 1; i <= sensors; i++)
+        s_publish_asset (producer, "sensorgpio", ("sensorgpio-bench-" + std::to_string (i)).c_str (), i);
+    for (int i = 1; i <= gpos; i++)
+        s_publish_asset (producer, "gpo", ("gpo-bench-" + std::to_string (i)).c_str (), i);
+    int64_t assets_time = s_wait_sensors (sensors + gpos, start);
+    if (assets_time == -1) {
+        log_error ("fty-sensor-gpio-bench: only %d out of %d assets monitored",
+            (int) get_gpx_table ()->sensors.size (), sensors + gpos);
+        rv = 1;
+    }
+    else
+        report.add ("assets_per_sec", (sensors + gpos) * 1000000.0 / std::max (assets_time, (int64_t) 1));
+
+    // Polling, the first cycle only sets the GPOs up
+    if (rv == 0) {
+        bench_samples_t warmup_publish;
+        bench_samples_t warmup_cycle;
+        s_bench_polling (server, listener, 1, sensors + gpos, warmup_publish, warmup_cycle);
+        int64_t received = s_bench_polling (server, listener, cycles, sensors + gpos, publish, cycle);
+        int64_t polling_time = 0;
+        for (int64_t value : cycle.values)
+            polling_time += value;
+        report.add ("cycles", (int64_t) cycle.values.size ());
+        report.add ("sensors_per_sec", received * 1000000.0 / std::max (polling_time, (int64_t) 1));
+        report.add ("publish", publish);
+        report.add ("cycle", cycle);
+        if (received != (int64_t) cycles * (sensors + gpos))
+            rv = 1;
+    }
+
+    // GPO_INTERACTION, once the statuses of the polling are all received
+    if (rv == 0) {
+        int failures = s_bench_interaction (client, gpos, requests, interaction);
+        report.add ("interaction", interaction);
+        report.add ("interaction.failures", (int64_t) failures);
+        if (failures != 0)
+            rv = 1;
+    }
+
+    report.add ("rss_kb", s_proc_status_kb ("VmRSS"));
+    report.add ("rss_peak_kb", s_proc_status_kb ("VmHWM"));
+    s_bench_server_stats (client, report);
+
+    FILE *file = output ? fopen (output, "w") : stdout;
+    if (file) {
+        report.print (file);
+        if (output)
+            fclose (file);
+    }
+    else {
+        log_error ("Can't write results to %s: %m", output);
+        rv = 1;
+    }
+
+    // Cleanup
+    zactor_destroy (&assets);
+    mlm_client_destroy (&producer);
+    mlm_client_destroy (&client);
+    mlm_client_destroy (&listener);
+    zactor_destroy (&server);
+    zactor_destroy (&broker);
+    zstr_free (&template_dir);
+
+    return rv;
+}
@@ -0,0 +1,429 @@
+/*  =========================================================================
+    fty_sensor_gpio_journal - 42ITy GPO state journal
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_journal - 42ITy GPO state journal
+@discuss
+    The GPO states are kept in the state file, one line per GPO:
+        <asset name> <GPO number> <default state> <last action>
+    Each change is appended right away, in the same format, to the journal
+    next to it (<state file>.journal), a GPO number of -1 recording a
+    deletion. The journal is synced to disk by batches, so that a batch of
+    changes costs a single fdatasync, and is compacted into the state file
+    once it gets long. The state file is replaced atomically, and replaying
+    the journal over it is idempotent, so that a crash at any time only
+    loses the changes of the batch not synced yet.
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define JOURNAL_SUFFIX ".journal"
+
+// Delay for the records to be synced with the next ones (msec)
+#define JOURNAL_SYNC_DELAY 200
+// Records synced right away, without waiting for the delay
+#define JOURNAL_SYNC_BATCH 32
+// Records in the journal before it is compacted into the state file
+#define JOURNAL_COMPACT_RECORDS 1024
+
+//  Structure of our class
+
+struct _fty_sensor_gpio_journal_t {
+    char        *state_file;    // GPO states, as of the last compaction
+    char        *journal_file;  // GPO states changes since the last compaction
+    int         fd;             // journal, opened for appending, -1 if not writable
+    zhashx_t    *states;        // asset name -> fty_sensor_gpio_gpo_record_t
+    size_t      pending;        // records appended since the last sync
+    int64_t     pending_since;  // time of the first of them
+    size_t      records;        // records in the journal
+};
+
+
+//  --------------------------------------------------------------------------
+//  zhashx handling -- destroy / duplicate a record
+
+static void
+s_record_free (void **item)
+{
+    if (item && *item) {
+        free (*item);
+        *item = NULL;
+    }
+}
+
+static void *
+s_record_dup (const void *item)
+{
+    fty_sensor_gpio_gpo_record_t *copy = (fty_sensor_gpio_gpo_record_t *) zmalloc (sizeof (fty_sensor_gpio_gpo_record_t));
+    if (copy)
+        memcpy (copy, item, sizeof (fty_sensor_gpio_gpo_record_t));
+    return copy;
+}
+
+//  --------------------------------------------------------------------------
+//  Apply the records of a state file or of a journal to the GPO states.
+//  A torn record, from a crash while appending it, is skipped
+
+static void
+s_replay (fty_sensor_gpio_journal_t *self, const char *filename)
+{
+    FILE *file = fopen (filename, "r");
+    if (!file) {
+        log_debug ("No GPO states in %s", filename);
+        return;
+    }
+    char line [512];
+    char asset_name [256];
+    fty_sensor_gpio_gpo_record_t record;
+    size_t count = 0;
+    while (fgets (line, sizeof (line), file)) {
+        if (sscanf (line, "%255s %d %d %d", asset_name,
+                &record.gpo_number, &record.default_state, &record.last_action) != 4)
+            continue;
+        if (record.gpo_number == -1)
+            zhashx_delete (self->states, asset_name);
+        else
+            zhashx_update (self->states, asset_name, &record);
+        count++;
+    }
+    fclose (file);
+    log_debug ("%zu GPO states records replayed from %s", count, filename);
+}
+
+//  --------------------------------------------------------------------------
+//  Write a record at the end of the journal
+
+static int
+s_write_record (fty_sensor_gpio_journal_t *self, const char *asset_name,
+    const fty_sensor_gpio_gpo_record_t *record)
+{
+    if (self->fd == -1)
+        return -1;
+
+    char *line = record ?
+        zsys_sprintf ("%s %d %d %d\n", asset_name, record->gpo_number, record->default_state, record->last_action) :
+        zsys_sprintf ("%s -1 0 0\n", asset_name);
+    size_t length = strlen (line);
+    size_t written = 0;
+    while (written < length) {
+        ssize_t rv = write (self->fd, line + written, length - written);
+        if (rv == -1) {
+            if (errno == EINTR)
+                continue;
+            log_error ("Failed to append to GPO states journal %s: %m", self->journal_file);
+            zstr_free (&line);
+            return -1;
+        }
+        written += rv;
+    }
+    zstr_free (&line);
+
+    if (self->pending == 0)
+        self->pending_since = zclock_mono ();
+    self->pending++;
+    self->records++;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Open the journal of state_file, and replay state_file and the journal.
+//  If the journal can't be opened, the GPO states are only kept in memory
+
+fty_sensor_gpio_journal_t *
+fty_sensor_gpio_journal_new (const char *state_file)
+{
+    assert (state_file);
+    fty_sensor_gpio_journal_t *self = (fty_sensor_gpio_journal_t *) zmalloc (sizeof (fty_sensor_gpio_journal_t));
+    assert (self);
+
+    self->state_file = strdup (state_file);
+    self->journal_file = zsys_sprintf ("%s%s", state_file, JOURNAL_SUFFIX);
+    self->states = zhashx_new ();
+    zhashx_set_destructor (self->states, s_record_free);
+    zhashx_set_duplicator (self->states, s_record_dup);
+    self->pending = 0;
+    self->pending_since = 0;
+    self->records = 0;
+
+    s_replay (self, self->state_file);
+    s_replay (self, self->journal_file);
+
+    self->fd = open (self->journal_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (self->fd == -1)
+        log_warning ("Can't open GPO states journal %s, GPO states won't be saved: %m", self->journal_file);
+    else
+        // Start from a clean journal, without any torn record
+        fty_sensor_gpio_journal_compact (self);
+
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Sync and compact the journal, then close it
+
+void
+fty_sensor_gpio_journal_destroy (fty_sensor_gpio_journal_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        fty_sensor_gpio_journal_t *self = *self_p;
+        if (self->fd != -1) {
+            fty_sensor_gpio_journal_compact (self);
+            close (self->fd);
+        }
+        zhashx_destroy (&self->states);
+        zstr_free (&self->state_file);
+        zstr_free (&self->journal_file);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the GPO states, asset name -> fty_sensor_gpio_gpo_record_t
+
+zhashx_t *
+fty_sensor_gpio_journal_states (fty_sensor_gpio_journal_t *self)
+{
+    assert (self);
+    return self->states;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Record the state of the GPO asset_name, or its deletion if record is
+//  NULL, unless it didn't change
+
+int
+fty_sensor_gpio_journal_append (fty_sensor_gpio_journal_t *self, const char *asset_name,
+    const fty_sensor_gpio_gpo_record_t *record)
+{
+    assert (self);
+    assert (asset_name);
+
+    fty_sensor_gpio_gpo_record_t *current = (fty_sensor_gpio_gpo_record_t *) zhashx_lookup (self->states, asset_name);
+    if (record) {
+        if (current && (current->gpo_number == record->gpo_number)
+            && (current->default_state == record->default_state)
+            && (current->last_action == record->last_action))
+            return 0;
+        zhashx_update (self->states, asset_name, (void *) record);
+    }
+    else {
+        if (!current)
+            return 0;
+        zhashx_delete (self->states, asset_name);
+    }
+    return s_write_record (self, asset_name, record);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the time at which the records appended since the last sync are
+//  due to be synced, or 0 if there are none
+
+int64_t
+fty_sensor_gpio_journal_sync_deadline (fty_sensor_gpio_journal_t *self)
+{
+    assert (self);
+    if (self->pending == 0)
+        return 0;
+    if (self->pending >= JOURNAL_SYNC_BATCH)
+        return self->pending_since;
+    return self->pending_since + JOURNAL_SYNC_DELAY;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Sync the records appended since the last sync to disk, and compact the
+//  journal once it is long enough
+
+int
+fty_sensor_gpio_journal_sync (fty_sensor_gpio_journal_t *self)
+{
+    assert (self);
+    if ((self->fd == -1) || (self->pending == 0))
+        return 0;
+
+    if (self->records >= JOURNAL_COMPACT_RECORDS)
+        return fty_sensor_gpio_journal_compact (self);
+
+    int rv = fdatasync (self->fd);
+    if (rv == -1)
+        log_error ("Failed to sync GPO states journal %s: %m", self->journal_file);
+    self->pending = 0;
+    return rv;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Rewrite the state file with the current GPO states, and empty the journal
+
+int
+fty_sensor_gpio_journal_compact (fty_sensor_gpio_journal_t *self)
+{
+    assert (self);
+    if (self->fd == -1)
+        return -1;
+
+    std::string tmp_file = std::string (self->state_file) + ".tmp";
+    FILE *file = fopen (tmp_file.c_str (), "w");
+    if (!file) {
+        log_error ("Can't write GPO states file %s: %m", tmp_file.c_str ());
+        return -1;
+    }
+    fty_sensor_gpio_gpo_record_t *record = (fty_sensor_gpio_gpo_record_t *) zhashx_first (self->states);
+    while (record) {
+        const char *asset_name = (const char *) zhashx_cursor (self->states);
+        fprintf (file, "%s %d %d %d\n", asset_name, record->gpo_number, record->default_state, record->last_action);
+        record = (fty_sensor_gpio_gpo_record_t *) zhashx_next (self->states);
+    }
+    int rv = ((fflush (file) == 0) && (fsync (fileno (file)) == 0)) ? 0 : -1;
+    fclose (file);
+    // The state file is replaced at once, and the journal is only emptied
+    // then: replaying it again over the new state file changes nothing
+    if ((rv == -1) || (rename (tmp_file.c_str (), self->state_file) == -1)) {
+        log_error ("Failed to save GPO states file %s: %m", self->state_file);
+        unlink (tmp_file.c_str ());
+        return -1;
+    }
+    std::string state_dir (self->state_file);
+    size_t slash = state_dir.find_last_of ('/');
+    state_dir = (slash == std::string::npos) ? "." : state_dir.substr (0, slash + 1);
+    int dir_fd = open (state_dir.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1) {
+        fsync (dir_fd);
+        close (dir_fd);
+    }
+
+    if (ftruncate (self->fd, 0) == -1) {
+        log_error ("Failed to empty GPO states journal %s: %m", self->journal_file);
+        return -1;
+    }
+    log_debug ("GPO states journal compacted into %s (%zu records)", self->state_file, self->records);
+    self->pending = 0;
+    self->records = 0;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_sensor_gpio_journal_test (bool verbose)
+{
+    printf (" * fty_sensor_gpio_journal: ");
+
+    // Note: If your selftest reads SCMed fixture data, please keep it in
+    // src/selftest-ro; if your test creates filesystem objects, please
+    // do so under src/selftest-rw. They are defined below along with a
+    // usecase for the variables (assert) to make compilers happy.
+    const char *SELFTEST_DIR_RO = "src/selftest-ro";
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    assert (SELFTEST_DIR_RO);
+    assert (SELFTEST_DIR_RW);
+    std::string str_SELFTEST_DIR_RW = std::string(SELFTEST_DIR_RW);
+
+    //  @selftest
+    zsys_dir_create (SELFTEST_DIR_RW);
+    std::string state_file = str_SELFTEST_DIR_RW + "/journal-state";
+    std::string journal_file = state_file + JOURNAL_SUFFIX;
+    zsys_file_delete (state_file.c_str ());
+    zsys_file_delete (journal_file.c_str ());
+
+    // State file from a previous version
+    FILE *file = fopen (state_file.c_str (), "w");
+    assert (file);
+    fprintf (file, "gpo-1 1 %d %d\ngpo-2 2 %d %d\n",
+        GPIO_STATE_CLOSED, GPIO_STATE_CLOSED, GPIO_STATE_OPENED, GPIO_STATE_OPENED);
+    fclose (file);
+
+    fty_sensor_gpio_journal_t *self = fty_sensor_gpio_journal_new (state_file.c_str ());
+    assert (self);
+    assert (zhashx_size (fty_sensor_gpio_journal_states (self)) == 2);
+    assert (fty_sensor_gpio_journal_sync_deadline (self) == 0);
+
+    // Changes are appended, unchanged states are not
+    fty_sensor_gpio_gpo_record_t record = { 1, GPIO_STATE_CLOSED, GPIO_STATE_OPENED };
+    assert (fty_sensor_gpio_journal_append (self, "gpo-1", &record) == 0);
+    assert (fty_sensor_gpio_journal_append (self, "gpo-1", &record) == 0);
+    assert (fty_sensor_gpio_journal_append (self, "gpo-2", NULL) == 0);
+    assert (fty_sensor_gpio_journal_append (self, "gpo-2", NULL) == 0);
+    record.gpo_number = 3;
+    assert (fty_sensor_gpio_journal_append (self, "gpo-3", &record) == 0);
+    assert (self->pending == 3);
+    int64_t deadline = fty_sensor_gpio_journal_sync_deadline (self);
+    assert (deadline > 0 && deadline <= zclock_mono () + JOURNAL_SYNC_DELAY);
+    assert (fty_sensor_gpio_journal_sync (self) == 0);
+    assert (fty_sensor_gpio_journal_sync_deadline (self) == 0);
+    assert (zsys_file_size (journal_file.c_str ()) > 0);
+
+    // Replay after a crash, with a torn record at the end of the journal
+    int fd = open (journal_file.c_str (), O_WRONLY | O_APPEND);
+    assert (fd != -1);
+    assert (write (fd, "gpo-3 3 ", 8) == 8);
+    close (fd);
+    fty_sensor_gpio_journal_t *replayed = fty_sensor_gpio_journal_new (state_file.c_str ());
+    assert (replayed);
+    zhashx_t *states = fty_sensor_gpio_journal_states (replayed);
+    assert (zhashx_size (states) == 2);
+    fty_sensor_gpio_gpo_record_t *replayed_record = (fty_sensor_gpio_gpo_record_t *) zhashx_lookup (states, "gpo-1");
+    assert (replayed_record);
+    assert (replayed_record->last_action == GPIO_STATE_OPENED);
+    assert (zhashx_lookup (states, "gpo-2") == NULL);
+    replayed_record = (fty_sensor_gpio_gpo_record_t *) zhashx_lookup (states, "gpo-3");
+    assert (replayed_record && (replayed_record->gpo_number == 3));
+    // Compacted when opened
+    assert (zsys_file_size (journal_file.c_str ()) == 0);
+    fty_sensor_gpio_journal_destroy (&replayed);
+    assert (replayed == NULL);
+
+    // Long journals are compacted when synced
+    for (int i = 0; i < JOURNAL_COMPACT_RECORDS; i++) {
+        record.last_action = (i % 2) ? GPIO_STATE_OPENED : GPIO_STATE_CLOSED;
+        assert (fty_sensor_gpio_journal_append (self, "gpo-3", &record) == 0);
+    }
+    assert (fty_sensor_gpio_journal_sync_deadline (self) <= zclock_mono ());
+    assert (fty_sensor_gpio_journal_sync (self) == 0);
+    assert (self->records == 0);
+    assert (zsys_file_size (journal_file.c_str ()) == 0);
+    fty_sensor_gpio_journal_destroy (&self);
+    assert (self == NULL);
+
+    // The state file keeps the format of the previous versions
+    self = fty_sensor_gpio_journal_new (state_file.c_str ());
+    states = fty_sensor_gpio_journal_states (self);
+    replayed_record = (fty_sensor_gpio_gpo_record_t *) zhashx_lookup (states, "gpo-3");
+    assert (replayed_record && (replayed_record->last_action == GPIO_STATE_OPENED));
+    fty_sensor_gpio_journal_destroy (&self);
+
+    zsys_file_delete (state_file.c_str ());
+    zsys_file_delete (journal_file.c_str ());
+    //  @end
+    printf ("OK\n");
+}
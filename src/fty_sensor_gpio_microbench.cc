@@ -0,0 +1,367 @@
+/*  =========================================================================
+    fty_sensor_gpio_microbench - Microbenchmarks of libgpio
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_microbench - Microbenchmarks of libgpio
+@discuss
+    Measures the per-call latency and the syscalls of the libgpio read,
+    write, pin mapping and status conversion paths. The sysfs backend runs
+    in test mode against a fake /sys/class/gpio tree, created in a temporary
+    directory of a tmpfs (/dev/shm by default), so that the file system
+    access is as cheap as the kernel makes it, and stable between runs.
+
+    Each benchmark is run for a growing number of iterations, until it lasts
+    at least the minimum time, and reported in the Google Benchmark console
+    format, or as JSON:
+
+        <name>    <time per call> ns    <iterations>    <syscalls per call>
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+
+#define BENCH_PINS      256     // GPI and GPO of the fake chipset
+#define BENCH_GPO_BASE  512     // pin of the GPO #0
+#define BENCH_SYSFS     "src/selftest-rw"   // root of the sysfs tree of libgpio in test mode
+
+// Results of the benchmarked calls, so that they are not optimized out
+static volatile int s_sink;
+
+void
+usage(){
+    puts ("fty-sensor-gpio-microbench [options] ...");
+    puts ("  -v|--verbose        verbose output");
+    puts ("  -h|--help           this information");
+    puts ("  -f|--filter         only run the benchmarks whose name contains this string");
+    puts ("  -m|--min-time       minimum time of each benchmark, in msec [500]");
+    puts ("  -d|--directory      directory of the fake sysfs tree [/dev/shm]");
+    puts ("  -j|--json           report as JSON");
+}
+
+// Benchmark: runs iterations calls on the library
+typedef void (bench_fn) (libgpio_t *gpio, int64_t iterations);
+
+struct bench_result_t {
+    std::string name;
+    int64_t iterations;
+    double ns_per_call;
+    double syscalls_per_call;
+};
+
+//  --------------------------------------------------------------------------
+//  Benchmarks
+
+// Read a held GPI: one pread per call
+static void
+s_read_held (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_read (gpio, 1, GPIO_DIRECTION_IN);
+}
+
+// Read the GPI in turn, as a polling cycle does
+static void
+s_read_cycle (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_read (gpio, 1 + (int) (i % BENCH_PINS), GPIO_DIRECTION_IN);
+}
+
+// Read a held GPO back
+static void
+s_read_gpo (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_read (gpio, 1, GPIO_DIRECTION_OUT);
+}
+
+// Read a pin of the simulated chipset, without any syscall
+static void
+s_read_sim (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_read (gpio, 1 + (int) (i % BENCH_PINS), GPIO_DIRECTION_IN);
+}
+
+// Toggle a held GPO
+static void
+s_write_held (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_write (gpio, 1, (int) (i & 1));
+}
+
+// Toggle the GPO in turn
+static void
+s_write_cycle (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_write (gpio, 1 + (int) (i % BENCH_PINS), (int) (i & 1));
+}
+
+// Pin of an already mapped GPI
+static void
+s_pin_number_mapped (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_compute_pin_number (gpio, 1 + (int) (i % BENCH_PINS), GPIO_DIRECTION_IN);
+}
+
+// Pin of a GPO with a special mapping
+static void
+s_pin_number_special (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_compute_pin_number (gpio, BENCH_PINS + 1, GPIO_DIRECTION_OUT);
+}
+
+static void
+s_status_value_closed (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_get_status_value ("closed");
+}
+
+// Last name checked
+static void
+s_status_value_high (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_get_status_value ("high");
+}
+
+// All the names checked
+static void
+s_status_value_unknown (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = libgpio_get_status_value ("ajar");
+}
+
+static void
+s_status_string (libgpio_t *gpio, int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+        s_sink = (int) libgpio_get_status_string ((int) (i & 1)).size ();
+}
+
+static struct {
+    const char *name;
+    int backend;
+    bench_fn *fn;
+} s_benchmarks [] = {
+    { "libgpio_read/held",                          GPIO_BACKEND_SYSFS, s_read_held },
+    { "libgpio_read/cycle",                         GPIO_BACKEND_SYSFS, s_read_cycle },
+    { "libgpio_read/gpo",                           GPIO_BACKEND_SYSFS, s_read_gpo },
+    { "libgpio_read/sim",                           GPIO_BACKEND_SIM,   s_read_sim },
+    { "libgpio_write/held",                         GPIO_BACKEND_SYSFS, s_write_held },
+    { "libgpio_write/cycle",                        GPIO_BACKEND_SYSFS, s_write_cycle },
+    { "libgpio_compute_pin_number/mapped",          GPIO_BACKEND_SYSFS, s_pin_number_mapped },
+    { "libgpio_compute_pin_number/special",         GPIO_BACKEND_SYSFS, s_pin_number_special },
+    { "libgpio_get_status_value/closed",            GPIO_BACKEND_SYSFS, s_status_value_closed },
+    { "libgpio_get_status_value/high",              GPIO_BACKEND_SYSFS, s_status_value_high },
+    { "libgpio_get_status_value/unknown",           GPIO_BACKEND_SYSFS, s_status_value_unknown },
+    { "libgpio_get_status_string",                  GPIO_BACKEND_SYSFS, s_status_string },
+    { NULL, 0, NULL }
+};
+
+//  --------------------------------------------------------------------------
+//  Create the value file of a pin of the fake sysfs tree, with a valid
+//  value, since the test mode would otherwise create it empty
+
+static int
+s_fake_pin (int pin)
+{
+    std::string dir = std::string (BENCH_SYSFS) + "/sys/class/gpio/gpio" + std::to_string (pin);
+    if (zsys_dir_create (dir.c_str ()) != 0)
+        return -1;
+    int fd = open ((dir + "/value").c_str (), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    int rv = (write (fd, "0\n", 2) == 2) ? 0 : -1;
+    close (fd);
+    return rv;
+}
+
+//  --------------------------------------------------------------------------
+//  Create the library on the fake chipset, with its pins exported and held,
+//  so that the first call of a benchmark is not an outlier
+
+static libgpio_t *
+s_gpio_new (int backend)
+{
+    libgpio_t *gpio = libgpio_new ();
+    libgpio_set_test_mode (gpio, true);
+    libgpio_set_backend (gpio, backend);
+    libgpio_set_gpio_base_address (gpio, 0);
+    libgpio_set_gpi_offset (gpio, 0);
+    libgpio_set_gpo_offset (gpio, BENCH_GPO_BASE);
+    libgpio_set_gpi_count (gpio, BENCH_PINS);
+    libgpio_set_gpo_count (gpio, BENCH_PINS + 1);
+    libgpio_add_gpo_mapping (gpio, BENCH_PINS + 1, BENCH_GPO_BASE - 1);
+    for (int i = 1; i <= BENCH_PINS; i++) {
+        libgpio_read (gpio, i, GPIO_DIRECTION_IN);
+        libgpio_read (gpio, i, GPIO_DIRECTION_OUT);
+    }
+    return gpio;
+}
+
+//  --------------------------------------------------------------------------
+//  Run a benchmark for at least min_time msec
+
+static bench_result_t
+s_run (const char *name, int backend, bench_fn *fn, int min_time)
+{
+    libgpio_t *gpio = s_gpio_new (backend);
+    int64_t iterations = 1;
+    int64_t elapsed = 0;
+    uint64_t syscalls = 0;
+    while (true) {
+        uint64_t syscalls_before = 0;
+        libgpio_get_stats (gpio, &syscalls_before, NULL, NULL);
+        int64_t start = zclock_usecs ();
+        fn (gpio, iterations);
+        elapsed = zclock_usecs () - start;
+        libgpio_get_stats (gpio, &syscalls, NULL, NULL);
+        syscalls -= syscalls_before;
+        if ((elapsed >= min_time * 1000) || (iterations >= ((int64_t) 1 << 40)))
+            break;
+        // Aim at the minimum time, growing at most tenfold, as Google
+        // Benchmark does
+        int64_t next = (elapsed > 0) ? (int64_t) (iterations * 1.4 * min_time * 1000 / elapsed) : iterations * 10;
+        iterations = std::max (iterations + 1, std::min (next, iterations * 10));
+    }
+    libgpio_destroy (&gpio);
+
+    bench_result_t result;
+    result.name = name;
+    result.iterations = iterations;
+    result.ns_per_call = elapsed * 1000.0 / iterations;
+    result.syscalls_per_call = (double) syscalls / iterations;
+    return result;
+}
+
+int main (int argc, char *argv [])
+{
+    const char *filter = NULL;
+    int min_time = 500;
+    const char *directory = "/dev/shm";
+    bool json = false;
+    bool verbose = false;
+    int argn;
+
+    ManageFtyLog::setInstanceFtylog("fty-sensor-gpio-microbench");
+
+    // Parse command line
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help")
+        ||  streq (argv [argn], "-h")) {
+            usage();
+            return 0;
+        }
+        else if (streq (argv [argn], "--verbose") || streq (argv [argn], "-v")) {
+            verbose = true;
+        }
+        else if (streq (argv [argn], "--filter") || streq (argv [argn], "-f")) {
+            if (param) filter = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--min-time") || streq (argv [argn], "-m")) {
+            if (param) min_time = atoi (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--directory") || streq (argv [argn], "-d")) {
+            if (param) directory = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--json") || streq (argv [argn], "-j")) {
+            json = true;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return 1;
+        }
+    }
+    if (verbose)
+        ManageFtyLog::getInstanceFtylog()->setVeboseMode();
+
+    // The test mode of libgpio works under BENCH_SYSFS, relative to the
+    // current directory: move to a fresh directory of the tmpfs
+    if (!zsys_file_exists (directory))
+        directory = "/tmp";
+    std::string bench_dir = std::string (directory) + "/fty-sensor-gpio-microbench.XXXXXX";
+    char *cwd = getcwd (NULL, 0);
+    if (!mkdtemp (&bench_dir [0]) || (chdir (bench_dir.c_str ()) != 0)) {
+        log_error ("Can't create the fake sysfs tree in %s: %m", directory);
+        free (cwd);
+        return EXIT_FAILURE;
+    }
+    int rv = 0;
+    for (int i = 1; (i <= BENCH_PINS) && (rv == 0); i++)
+        rv = s_fake_pin (i) | s_fake_pin (BENCH_GPO_BASE + i);
+    if (rv != 0)
+        log_error ("Can't create the fake sysfs tree in %s: %m", bench_dir.c_str ());
+
+    std::vector<bench_result_t> results;
+    for (int i = 0; s_benchmarks [i].name && (rv == 0); i++) {
+        if (filter && !strstr (s_benchmarks [i].name, filter))
+            continue;
+        results.push_back (s_run (s_benchmarks [i].name, s_benchmarks [i].backend,
+            s_benchmarks [i].fn, min_time));
+        if (!json) {
+            const bench_result_t &result = results.back ();
+            if (results.size () == 1) {
+                printf ("%-44s %12s %12s %12s\n", "Benchmark", "Time", "Iterations", "Syscalls");
+                printf ("%s\n", std::string (83, '-').c_str ());
+            }
+            printf ("%-44s %9.1f ns %12lld %12.2f\n", result.name.c_str (),
+                result.ns_per_call, (long long) result.iterations, result.syscalls_per_call);
+        }
+    }
+    if (json) {
+        printf ("{\n    \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size (); i++)
+            printf ("        { \"name\": \"%s\", \"iterations\": %lld"
+                ", \"real_time\": %.1f, \"time_unit\": \"ns\", \"syscalls\": %.2f }%s\n",
+                results [i].name.c_str (), (long long) results [i].iterations, results [i].ns_per_call,
+                results [i].syscalls_per_call, (i + 1 < results.size ()) ? "," : "");
+        printf ("    ]\n}\n");
+    }
+
+    // Cleanup
+    if (chdir (cwd) != 0)
+        log_error ("Can't go back to %s: %m", cwd);
+    zdir_t *dir = zdir_new (bench_dir.c_str (), NULL);
+    if (dir)
+        zdir_remove (dir, true);
+    zdir_destroy (&dir);
+    free (cwd);
+
+    return (rv == 0) ? 0 : 1;
+}
@@ -0,0 +1,381 @@
+/*  =========================================================================
+    fty_sensor_gpio_rules - 42ITy GPI to GPO reflex rules
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_rules - 42ITy GPI to GPO reflex rules
+@discuss
+    Reflex rules act on a GPO as soon as a GPI changes, within the agent,
+    without waiting for another agent to react to the published metric.
+    They come from the 'rules' section of the configuration file:
+
+        rules
+            <rule name>
+                gpi = <GPI asset or ext name>
+                on = opened | closed | any      (state entered by the GPI)
+                gpo = <GPO asset or ext name>
+                action = open | close | pulse | blink | cancel
+                delay = <msec>                  (open | close, optional)
+                duration = <msec>               (pulse | blink)
+                period = <msec>                 (blink)
+                if_gpi = <GPI asset or ext name> (optional condition...)
+                if_state = opened | closed      (...on the state of another GPI)
+
+    The rules are compiled into a flat table, grouped by GPI and state
+    entered, so that the rules triggered by a change are found with a single
+    lookup, and run in the order of the configuration file.
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+#include <limits.h>
+
+// Rules of a GPI, by state entered (GPIO_STATE_CLOSED, GPIO_STATE_OPENED)
+typedef struct {
+    size_t first [2];   // index of the first rule in the table
+    size_t count [2];   // number of rules
+} rules_slot_t;
+
+//  Structure of our class
+
+struct _fty_sensor_gpio_rules_t {
+    zhashx_t    *names;     // interned names
+    zhashx_t    *slots;     // GPI name -> rules_slot_t
+    fty_sensor_gpio_rule_t *table; // rules, grouped by GPI and state entered
+    size_t      size;       // number of rules in the table
+};
+
+
+//  --------------------------------------------------------------------------
+//  zhashx handling -- destroy an item
+
+static void
+s_item_free (void **item)
+{
+    if (item && *item) {
+        free (*item);
+        *item = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Return the interned copy of name, or NULL if name is NULL or empty
+
+static const char *
+s_intern (fty_sensor_gpio_rules_t *self, const char *name)
+{
+    if (!name || streq (name, ""))
+        return NULL;
+    char *interned = (char *) zhashx_lookup (self->names, name);
+    if (!interned) {
+        interned = strdup (name);
+        zhashx_insert (self->names, name, interned);
+    }
+    return interned;
+}
+
+//  --------------------------------------------------------------------------
+//  Get a duration of a rule, in msec, dfl if not set. Return -1 if it is
+//  not a number of at least min msec
+
+static int
+s_msec (zconfig_t *rule, const char *key, int min, int dfl)
+{
+    const char *value = zconfig_get (rule, key, NULL);
+    if (!value)
+        return dfl;
+    char *end = NULL;
+    long msec = strtol (value, &end, 10);
+    if ((end == value) || (*end != '\0') || (msec < min) || (msec > INT_MAX))
+        return -1;
+    return (int) msec;
+}
+
+//  --------------------------------------------------------------------------
+//  Parse a rule of the config. Return 0 if OK, -1 if it is invalid
+
+static int
+s_parse (fty_sensor_gpio_rules_t *self, zconfig_t *config, fty_sensor_gpio_rule_t *rule)
+{
+    memset (rule, 0, sizeof (fty_sensor_gpio_rule_t));
+    rule->name = s_intern (self, zconfig_name (config));
+    rule->gpi = s_intern (self, zconfig_get (config, "gpi", NULL));
+    rule->gpo = s_intern (self, zconfig_get (config, "gpo", NULL));
+    if (!rule->gpi || !rule->gpo) {
+        log_error ("Reflex rule '%s': missing gpi or gpo", rule->name);
+        return -1;
+    }
+
+    const char *on = zconfig_get (config, "on", "any");
+    rule->trigger = streq (on, "any") ? GPIO_STATE_UNKNOWN : libgpio_get_status_value (on);
+    if (!streq (on, "any") && (rule->trigger == GPIO_STATE_UNKNOWN)) {
+        log_error ("Reflex rule '%s': invalid GPI state '%s'", rule->name, on);
+        return -1;
+    }
+
+    const char *action = zconfig_get (config, "action", "");
+    rule->state = GPIO_STATE_UNKNOWN;
+    if (streq (action, "pulse")) {
+        rule->action = FTY_SENSOR_GPIO_RULE_PULSE;
+        rule->duration = s_msec (config, "duration", 1, -1);
+        rule->period = rule->duration;
+    }
+    else if (streq (action, "blink")) {
+        rule->action = FTY_SENSOR_GPIO_RULE_BLINK;
+        rule->duration = s_msec (config, "duration", 1, -1);
+        rule->period = s_msec (config, "period", 1, -1);
+    }
+    else if (streq (action, "cancel"))
+        rule->action = FTY_SENSOR_GPIO_RULE_CANCEL;
+    else {
+        rule->action = FTY_SENSOR_GPIO_RULE_SET;
+        rule->state = libgpio_get_status_value (action);
+        if (rule->state == GPIO_STATE_UNKNOWN) {
+            log_error ("Reflex rule '%s': invalid action '%s'", rule->name, action);
+            return -1;
+        }
+        rule->delay = s_msec (config, "delay", 0, 0);
+    }
+    if ((rule->delay == -1) || (rule->duration == -1) || (rule->period == -1)) {
+        log_error ("Reflex rule '%s': invalid or missing delay, duration or period", rule->name);
+        return -1;
+    }
+
+    rule->if_gpi = s_intern (self, zconfig_get (config, "if_gpi", NULL));
+    rule->if_state = libgpio_get_status_value (zconfig_get (config, "if_state", ""));
+    if (rule->if_gpi && (rule->if_state == GPIO_STATE_UNKNOWN)) {
+        log_error ("Reflex rule '%s': invalid or missing if_state", rule->name);
+        return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Compile the reflex rules of a config section
+
+fty_sensor_gpio_rules_t *
+fty_sensor_gpio_rules_new (zconfig_t *config)
+{
+    fty_sensor_gpio_rules_t *self = (fty_sensor_gpio_rules_t *) zmalloc (sizeof (fty_sensor_gpio_rules_t));
+    assert (self);
+    self->names = zhashx_new ();
+    zhashx_set_destructor (self->names, s_item_free);
+    self->slots = zhashx_new ();
+    zhashx_set_destructor (self->slots, s_item_free);
+    self->table = NULL;
+    self->size = 0;
+
+    size_t count = 0;
+    for (zconfig_t *child = config ? zconfig_child (config) : NULL; child; child = zconfig_next (child))
+        count++;
+    if (count == 0)
+        return self;
+
+    // Parse the valid rules, and count them by GPI and state entered
+    fty_sensor_gpio_rule_t *rules = (fty_sensor_gpio_rule_t *) zmalloc (count * sizeof (fty_sensor_gpio_rule_t));
+    assert (rules);
+    size_t parsed = 0;
+    for (zconfig_t *child = zconfig_child (config); child; child = zconfig_next (child)) {
+        fty_sensor_gpio_rule_t *rule = &rules [parsed];
+        if (s_parse (self, child, rule) != 0)
+            continue;
+        rules_slot_t *slot = (rules_slot_t *) zhashx_lookup (self->slots, rule->gpi);
+        if (!slot) {
+            slot = (rules_slot_t *) zmalloc (sizeof (rules_slot_t));
+            assert (slot);
+            zhashx_insert (self->slots, rule->gpi, slot);
+        }
+        // A rule triggered by any change goes in both groups
+        for (int state = GPIO_STATE_CLOSED; state <= GPIO_STATE_OPENED; state++) {
+            if ((rule->trigger == GPIO_STATE_UNKNOWN) || (rule->trigger == state)) {
+                slot->count [state]++;
+                self->size++;
+            }
+        }
+        parsed++;
+    }
+
+    // Lay the groups out, then fill them in the order of the config
+    size_t first = 0;
+    for (rules_slot_t *slot = (rules_slot_t *) zhashx_first (self->slots); slot;
+         slot = (rules_slot_t *) zhashx_next (self->slots)) {
+        for (int state = GPIO_STATE_CLOSED; state <= GPIO_STATE_OPENED; state++) {
+            slot->first [state] = first;
+            first += slot->count [state];
+            slot->count [state] = 0;
+        }
+    }
+    self->table = (fty_sensor_gpio_rule_t *) zmalloc ((self->size ? self->size : 1) * sizeof (fty_sensor_gpio_rule_t));
+    assert (self->table);
+    for (size_t i = 0; i < parsed; i++) {
+        rules_slot_t *slot = (rules_slot_t *) zhashx_lookup (self->slots, rules [i].gpi);
+        for (int state = GPIO_STATE_CLOSED; state <= GPIO_STATE_OPENED; state++) {
+            if ((rules [i].trigger == GPIO_STATE_UNKNOWN) || (rules [i].trigger == state)) {
+                fty_sensor_gpio_rule_t *rule = &self->table [slot->first [state] + slot->count [state]++];
+                *rule = rules [i];
+                rule->trigger = state;
+            }
+        }
+    }
+    free (rules);
+    log_debug ("%d reflex rules compiled, %d ignored", (int) parsed, (int) (count - parsed));
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destroy the rules
+
+void
+fty_sensor_gpio_rules_destroy (fty_sensor_gpio_rules_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        fty_sensor_gpio_rules_t *self = *self_p;
+        free (self->table);
+        zhashx_destroy (&self->slots);
+        zhashx_destroy (&self->names);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of compiled rules
+
+size_t
+fty_sensor_gpio_rules_size (fty_sensor_gpio_rules_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the rules triggered by a GPI entering state, or NULL
+
+const fty_sensor_gpio_rule_t *
+fty_sensor_gpio_rules_dispatch (fty_sensor_gpio_rules_t *self, const char *gpi,
+    int state, size_t *count)
+{
+    assert (self);
+    assert (count);
+    *count = 0;
+    if (!gpi || ((state != GPIO_STATE_CLOSED) && (state != GPIO_STATE_OPENED)))
+        return NULL;
+    rules_slot_t *slot = (rules_slot_t *) zhashx_lookup (self->slots, gpi);
+    if (!slot || (slot->count [state] == 0))
+        return NULL;
+    *count = slot->count [state];
+    return &self->table [slot->first [state]];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_sensor_gpio_rules_test (bool verbose)
+{
+    printf (" * fty_sensor_gpio_rules: ");
+
+    //  @selftest
+    // Empty set of rules
+    fty_sensor_gpio_rules_t *self = fty_sensor_gpio_rules_new (NULL);
+    assert (self);
+    assert (fty_sensor_gpio_rules_size (self) == 0);
+    size_t count = 1;
+    assert (fty_sensor_gpio_rules_dispatch (self, "fire-1", GPIO_STATE_OPENED, &count) == NULL);
+    assert (count == 0);
+    fty_sensor_gpio_rules_destroy (&self);
+    assert (self == NULL);
+
+    zconfig_t *config = zconfig_new ("rules", NULL);
+    zconfig_put (config, "countdown/gpi", "fire-1");
+    zconfig_put (config, "countdown/on", "opened");
+    zconfig_put (config, "countdown/gpo", "relay-1");
+    zconfig_put (config, "countdown/action", "open");
+    zconfig_put (config, "countdown/delay", "30000");
+    zconfig_put (config, "countdown/if_gpi", "door-1");
+    zconfig_put (config, "countdown/if_state", "closed");
+    zconfig_put (config, "beacon/gpi", "fire-1");
+    zconfig_put (config, "beacon/gpo", "beacon-1");
+    zconfig_put (config, "beacon/action", "blink");
+    zconfig_put (config, "beacon/period", "500");
+    zconfig_put (config, "beacon/duration", "60000");
+    zconfig_put (config, "abort/gpi", "abort-1");
+    zconfig_put (config, "abort/on", "opened");
+    zconfig_put (config, "abort/gpo", "relay-1");
+    zconfig_put (config, "abort/action", "cancel");
+    // Invalid rules are ignored
+    zconfig_put (config, "no-gpo/gpi", "fire-1");
+    zconfig_put (config, "no-gpo/action", "open");
+    zconfig_put (config, "bad-pulse/gpi", "fire-1");
+    zconfig_put (config, "bad-pulse/gpo", "relay-1");
+    zconfig_put (config, "bad-pulse/action", "pulse");
+    zconfig_put (config, "bad-pulse/duration", "0");
+    zconfig_put (config, "bad-state/gpi", "fire-1");
+    zconfig_put (config, "bad-state/on", "ajar");
+    zconfig_put (config, "bad-state/gpo", "relay-1");
+    zconfig_put (config, "bad-state/action", "close");
+
+    self = fty_sensor_gpio_rules_new (config);
+    assert (self);
+    // 'beacon' is triggered by any change
+    assert (fty_sensor_gpio_rules_size (self) == 4);
+
+    // In the order of the config
+    const fty_sensor_gpio_rule_t *rule = fty_sensor_gpio_rules_dispatch (self, "fire-1", GPIO_STATE_OPENED, &count);
+    assert (rule && (count == 2));
+    assert (streq (rule [0].name, "countdown"));
+    assert (rule [0].action == FTY_SENSOR_GPIO_RULE_SET);
+    assert (rule [0].state == GPIO_STATE_OPENED);
+    assert (rule [0].delay == 30000);
+    assert (streq (rule [0].if_gpi, "door-1"));
+    assert (rule [0].if_state == GPIO_STATE_CLOSED);
+    assert (streq (rule [1].name, "beacon"));
+    assert (rule [1].action == FTY_SENSOR_GPIO_RULE_BLINK);
+    assert ((rule [1].period == 500) && (rule [1].duration == 60000));
+    assert (rule [1].if_gpi == NULL);
+
+    rule = fty_sensor_gpio_rules_dispatch (self, "fire-1", GPIO_STATE_CLOSED, &count);
+    assert (rule && (count == 1));
+    assert (streq (rule [0].name, "beacon"));
+    assert (rule [0].trigger == GPIO_STATE_CLOSED);
+
+    rule = fty_sensor_gpio_rules_dispatch (self, "abort-1", GPIO_STATE_OPENED, &count);
+    assert (rule && (count == 1));
+    assert (rule [0].action == FTY_SENSOR_GPIO_RULE_CANCEL);
+    // The names are shared
+    const fty_sensor_gpio_rule_t *countdown = fty_sensor_gpio_rules_dispatch (self, "fire-1", GPIO_STATE_OPENED, &count);
+    assert (rule [0].gpo == countdown [0].gpo);
+
+    assert (fty_sensor_gpio_rules_dispatch (self, "abort-1", GPIO_STATE_CLOSED, &count) == NULL);
+    assert (fty_sensor_gpio_rules_dispatch (self, "fire-1", GPIO_STATE_UNKNOWN, &count) == NULL);
+    assert (fty_sensor_gpio_rules_dispatch (self, "door-1", GPIO_STATE_OPENED, &count) == NULL);
+
+    fty_sensor_gpio_rules_destroy (&self);
+    zconfig_destroy (&config);
+    //  @end
+    printf ("OK\n");
+}
@@ -43,6 +43,12 @@ all_tests [] = {
     { "libgpio", libgpio_test, true, true, NULL },
     { "fty_sensor_gpio_assets", fty_sensor_gpio_assets_test, true, true, NULL },
     { "fty_sensor_gpio_server", fty_sensor_gpio_server_test, true, true, NULL },
+    { "fty_sensor_gpio_templates", fty_sensor_gpio_templates_test, true, true, NULL },
+    { "fty_sensor_gpio_journal", fty_sensor_gpio_journal_test, true, true, NULL },
+    { "fty_sensor_gpio_wheel", fty_sensor_gpio_wheel_test, true, true, NULL },
+    { "fty_sensor_gpio_rules", fty_sensor_gpio_rules_test, true, true, NULL },
+    { "fty_sensor_gpio_stats", fty_sensor_gpio_stats_test, true, true, NULL },
+    { "fty_sensor_gpio_sim", fty_sensor_gpio_sim_test, true, true, NULL },
     {NULL, NULL, 0, 0, NULL}          //  Sentinel
 };
 
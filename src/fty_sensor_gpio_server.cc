@@ -35,6 +35,17 @@
         <zuuid>/sensor/action              - apply action (open | close) on sensor (asset or ext name)
                                       beside from open and close, enable | enabled |opened | high
                                       and disable | disabled | closed | low are also supported
+        <zuuid>/sensor/action/delay        - apply action after delay msec
+        <zuuid>/sensor/pulse/duration      - drive the sensor opposite to its default state for
+                                      duration msec
+        <zuuid>/sensor/blink/period/duration - toggle the sensor every period msec for
+                                      duration msec
+        <zuuid>/sensor/cancel              - cancel the delayed action, pulse or blink in progress,
+                                      a pulse or blink drives the sensor back to its default state
+
+        Timed actions are replied to once scheduled, and survive restarts. Any
+        new action on a sensor replaces its timed action in progress. At the
+        end of a pulse or blink, the sensor is driven back to its default state
 
     REP:
         subject: "GPO_INTERACTION"
@@ -46,6 +57,7 @@
         where:
             <zuuid> = info for REST API so it could match response to request
             <reason>          = ASSET_NOT_FOUND / SET_VALUE_FAILED / UNKNOWN_VALUE / BAD_COMMAND / ACTION_NOT_APPLICABLE
+                                BAD_COMMAND is also returned for an invalid delay, duration or period
 
      ------------------------------------------------------------------------
     ## GPIO_MANIFEST
@@ -129,12 +141,38 @@
 
     REP:
         none
+
+     ------------------------------------------------------------------------
+    ## GPIO_STATS
+
+    REQ:
+        subject: "GPIO_STATS"
+        Message is a multipart string message: <zuuid>
+
+              - get the runtime statistics of the agent. They are also
+                logged when the agent receives SIGUSR1
+
+    REP:
+        subject: "GPIO_STATS"
+        Message is a multipart message:
+
+        * <zuuid>/OK/<name 1>/<value 1>/.../<name N>/<value N>
+
+        where:
+            <zuuid> = info for REST API so it could match response to request
+            <name>  = counter (sensor_reads, publish_failures, gpio.syscalls...),
+                      latency histogram (<histogram>.count, .mean_us, .p50_us,
+                      .p99_us, .max_us) or gauge (<gauge>, <gauge>.max)
 @end
 */
 
 #include "fty_sensor_gpio_classes.h"
-#include <regex>
 #include <stdio.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
 // Structure for GPO state
 
@@ -151,11 +189,76 @@ struct _fty_sensor_gpio_server_t {
     char               *name;         // actor name
     mlm_client_t       *mlm;          // malamute client
     libgpio_t          *gpio_lib;     // GPIO library handle
+    pthread_mutex_t    gpio_lock;     // Serializes the accesses to gpio_lib
+    zactor_t           *gpio_worker;  // GPIO I/O worker, doing all the hardware accesses
     bool               test_mode;     // true if we are in test mode, false otherwise
     char               *template_dir; // Location of the template files
+    fty_sensor_gpio_templates_t *templates; // Parsed template files, shared with -assets
+    zmsg_t             *manifest;     // GPIO_MANIFEST reply for all the templates, without zuuid
+    zmsg_t             *manifest_summary; // GPIO_MANIFEST_SUMMARY reply for all the templates, without zuuid
+    uint64_t           manifest_generation; // templates generation the replies are built from
+    zconfig_t          *hw_cap_gpi;   // GPI capabilities applied to libgpio
+    zconfig_t          *hw_cap_gpo;   // GPO capabilities applied to libgpio
+    char               *snapshot_path; // Snapshot of the monitored sensors, next to the state file
+    uint64_t           snapshot_generation; // generation of the sensors table in the saved snapshot
+    int64_t            snapshot_save; // time of the next snapshot save, 0 to save at once
+    int                snapshot_backoff; // msec before retrying a failed snapshot save
     zhashx_t           *gpo_states;
+    fty_sensor_gpio_journal_t *journal; // GPO states journal, next to the state file
+    bool               edge_detection; // true to be notified of GPI changes
+    int                edge_check_interval; // msec between checks of the GPIs watched with edge detection
+    int64_t            edge_check_next; // time of the next check of the watched GPIs
+    zhashx_t           *powering;     // asset name -> time at which the externally powered sensor can be read
+    int                heartbeat_interval; // msec between publications of an unchanged status
+    uint64_t           pins_generation; // generation of the sensors table of the last GPIs sweep
+    int64_t            pins_sweep;    // time of the next sweep of all the GPIs, for their heartbeat
+    int                poll_interval; // msec between polling cycles, 0 to only poll on UPDATE
+    int64_t            poll_next;     // time of the next polling cycle
+    int64_t            cycle_start;   // time at which the polling cycle in progress started, 0 if none
+    int                cycle_pending; // reads and power source activations queued by the cycle in progress
+    uint64_t           cycle_count;   // polling cycles done
+    uint64_t           cycle_overruns; // polling cycles skipped, since the previous one was in progress
+    uint64_t           cycle_missed;  // polling ticks coalesced, since the server was busy
+    int64_t            cycle_time_last; // duration of the last polling cycle (msec)
+    int64_t            cycle_time_max; // duration of the longest polling cycle (msec)
+    zhashx_t           *hw_cap_requests; // HW_CAP request zuuid -> "gpi" | "gpo", until negotiated
+    bool               hw_cap_gpi_ok; // GPI capabilities received in this negotiation
+    bool               hw_cap_gpo_ok; // GPO capabilities received in this negotiation
+    int64_t            hw_cap_retry;  // time of the next HW_CAP request round, 0 if none
+    int                hw_cap_backoff; // msec between the last round and the next one
+    fty_sensor_gpio_wheel_t *wheel;   // timers of the timed GPO actions
+    zhashx_t           *timed;        // asset name -> gpo_timed_t, timed GPO action in progress
+    fty_sensor_gpio_rules_t *rules;   // GPI to GPO reflex rules, NULL if none
+    fty_sensor_gpio_stats_t *stats;   // runtime statistics, shared with the GPIO I/O worker
 };
 
+// Timed GPO action in progress: a delayed state change, or a pulse or a
+// blink, which drive the GPO back to its default state when they end
+struct gpo_timed_t {
+    char    *asset_name;
+    int     state;      // state to drive the GPO to at the next step
+    int     period;     // msec between the toggles of a blink (the duration of a pulse)
+    int64_t end;        // time at which the pulse or blink ends, 0 for a delayed state change
+    int64_t next;       // time of the next step
+    void    *timer;     // timer of the next step in the wheel
+};
+
+// Time for an externally powered sensor to be running, once powered (msec)
+#define POWER_SOURCE_SETTLE_DELAY 1000
+
+// Delay before requesting the missing HW capabilities again, doubled after
+// each round without a reply (msec)
+#define HW_CAP_RETRY_MIN 5000
+#define HW_CAP_RETRY_MAX 60000
+
+// Delay between the snapshot saves for the changes of the timed GPO actions,
+// and maximum backoff after failed saves (msec)
+#define SNAPSHOT_SAVE_DELAY 1000
+#define SNAPSHOT_RETRY_MAX 60000
+
+// Resolution of the timed GPO actions (msec)
+#define GPO_TIMED_TICK 10
+
 // Flag to share if HW capabilities were successfully received
 bool hw_cap_inited = false;
 
@@ -192,26 +295,427 @@ static void free_fn (void ** self_ptr)
     free (*self_ptr);
 }
 
-// FIXME: Malamute still lacks that!
-// receive message with timeout
+//  --------------------------------------------------------------------------
+//  GPIO I/O worker: do a read or write job on gpio_lib.
+//  A job is a message:
+//      READ | WATCH | WRITE    - operation, WATCH being a READ which then
+//                                enables edge detection on the GPI
+//      <GPx number>
+//      <direction for READ/WATCH, value for WRITE>
+//      <context>...            - returned as is to the server
+//  The result of the operation is pushed in front of the context, which is
+//  then sent back.
+//  A batch job does the same operation on several GPx, with the fewest
+//  hardware accesses:
+//      READ_MANY | WATCH_MANY | WRITE_MANY
+//      <GPx numbers>           - int array
+//      <directions or values>  - int array
+//      <count> <context>...    - for each GPx, its context and the number
+//                                of frames of it
+//  The results are then sent back as:
+//      MANY
+//      <results>               - int array
+//      <count> <context>...    - as received
+//  A snapshot job reads the GPx of a direction at once, as the pin snapshot
+//  of this direction (see libgpio_read_snapshot):
+//      READ_SNAPSHOT
+//      <direction>
+//      <GPx>                   - bitmask
+//      <GPx to watch>          - bitmask
+//      <context>...            - returned as is to the server
+//  The snapshot is then sent back as:
+//      SNAPSHOT
+//      <GPx> <values> <unknown> <changed>  - bitmasks
+//      <context>...
+
 static zmsg_t *
-my_mlm_client_recv (mlm_client_t *client, int timeout)
+s_gpio_worker_run_snapshot (fty_sensor_gpio_server_t *server, zmsg_t *job)
 {
-    static zpoller_t *poller = NULL;
+    char *direction = zmsg_popstr (job);
+    zframe_t *pins = zmsg_pop (job);
+    zframe_t *watch = zmsg_pop (job);
+    int words = pins ? (int) (zframe_size (pins) / sizeof (uint64_t)) : 0;
+    std::vector<uint64_t> values (words, 0), unknown (words, 0), changed (words, 0);
+
+    if (direction && pins && watch && (zframe_size (watch) == zframe_size (pins))) {
+        const uint64_t *pin = (const uint64_t *) zframe_data (pins);
+        int64_t start = zclock_usecs ();
+        pthread_mutex_lock (&server->gpio_lock);
+        int64_t locked = zclock_usecs ();
+        fty_sensor_gpio_stats_record (server->stats, STATS_GPIO_LOCK_WAIT, locked - start);
+        int count = 0;
+        for (int word = 0; word < words; word++)
+            count += __builtin_popcountll (pin [word]);
+        int read = libgpio_read_snapshot (server->gpio_lib, atoi (direction), pin, words,
+            values.data (), unknown.data (), changed.data ());
+        if (read == -1) {
+            read = 0;
+            unknown.assign (pin, pin + words);
+            changed.assign (pin, pin + words);
+        }
+        if (count > 0)
+            fty_sensor_gpio_stats_record (server->stats, STATS_SENSOR_READ, (zclock_usecs () - locked) / count);
+        fty_sensor_gpio_stats_count (server->stats, STATS_SENSOR_READS, read);
+        fty_sensor_gpio_stats_count (server->stats, STATS_SENSOR_READ_FAILURES, count - read);
+        const uint64_t *to_watch = (const uint64_t *) zframe_data (watch);
+        for (int word = 0; word < words; word++) {
+            for (uint64_t bits = to_watch [word]; bits; bits &= bits - 1)
+                libgpio_watch (server->gpio_lib, word * 64 + __builtin_ctzll (bits));
+        }
+        pthread_mutex_unlock (&server->gpio_lock);
+    }
+    else {
+        log_error ("GPIO worker: malformed job");
+        if (pins) {
+            const uint64_t *pin = (const uint64_t *) zframe_data (pins);
+            unknown.assign (pin, pin + words);
+        }
+    }
 
-    if (zsys_interrupted)
-        return NULL;
+    zmsg_t *result = zmsg_new ();
+    zmsg_addstr (result, "SNAPSHOT");
+    zmsg_addmem (result, pins ? zframe_data (pins) : NULL, words * sizeof (uint64_t));
+    zmsg_addmem (result, values.data (), words * sizeof (uint64_t));
+    zmsg_addmem (result, unknown.data (), words * sizeof (uint64_t));
+    zmsg_addmem (result, changed.data (), words * sizeof (uint64_t));
+    zframe_t *frame = zmsg_pop (job);
+    while (frame) {
+        zmsg_append (result, &frame);
+        frame = zmsg_pop (job);
+    }
+    zstr_free (&direction);
+    zframe_destroy (&pins);
+    zframe_destroy (&watch);
+    zmsg_destroy (&job);
+    return result;
+}
 
-    poller = zpoller_new (mlm_client_msgpipe (client), NULL);
+static zmsg_t *
+s_gpio_worker_run_many (fty_sensor_gpio_server_t *server, const char *op, zmsg_t *job)
+{
+    zframe_t *numbers = zmsg_pop (job);
+    zframe_t *arguments = zmsg_pop (job);
+    int count = numbers ? (int) (zframe_size (numbers) / sizeof (int)) : 0;
+    std::vector<int> results (count, -1);
+
+    if (numbers && arguments && (zframe_size (arguments) == count * sizeof (int))) {
+        const int *number = (const int *) zframe_data (numbers);
+        const int *argument = (const int *) zframe_data (arguments);
+        int64_t start = zclock_usecs ();
+        pthread_mutex_lock (&server->gpio_lock);
+        int64_t locked = zclock_usecs ();
+        fty_sensor_gpio_stats_record (server->stats, STATS_GPIO_LOCK_WAIT, locked - start);
+        if (streq (op, "WRITE_MANY")) {
+            int written = libgpio_write_many (server->gpio_lib, number, argument, count, results.data ());
+            if (count > 0)
+                fty_sensor_gpio_stats_record (server->stats, STATS_GPO_WRITE, (zclock_usecs () - locked) / count);
+            fty_sensor_gpio_stats_count (server->stats, STATS_GPO_WRITES, written);
+            fty_sensor_gpio_stats_count (server->stats, STATS_GPO_WRITE_FAILURES, count - written);
+        }
+        else {
+            // GPIs and GPOs are read apart
+            std::vector<int> gpx (count), values (count);
+            int read = 0;
+            for (int direction : { GPIO_DIRECTION_IN, GPIO_DIRECTION_OUT }) {
+                int size = 0;
+                for (int i = 0; i < count; i++) {
+                    if (argument [i] == direction)
+                        gpx [size++] = number [i];
+                }
+                if (size == 0)
+                    continue;
+                read += libgpio_read_many (server->gpio_lib, gpx.data (), size, direction, values.data ());
+                size = 0;
+                for (int i = 0; i < count; i++) {
+                    if (argument [i] == direction)
+                        results [i] = values [size++];
+                }
+            }
+            if (count > 0)
+                fty_sensor_gpio_stats_record (server->stats, STATS_SENSOR_READ, (zclock_usecs () - locked) / count);
+            fty_sensor_gpio_stats_count (server->stats, STATS_SENSOR_READS, read);
+            fty_sensor_gpio_stats_count (server->stats, STATS_SENSOR_READ_FAILURES, count - read);
+            if (streq (op, "WATCH_MANY")) {
+                for (int i = 0; i < count; i++)
+                    libgpio_watch (server->gpio_lib, number [i]);
+            }
+        }
+        pthread_mutex_unlock (&server->gpio_lock);
+    }
+    else
+        log_error ("GPIO worker: malformed job");
 
-    zsock_t *which = (zsock_t *) zpoller_wait (poller, timeout);
+    zframe_destroy (&numbers);
+    zframe_destroy (&arguments);
+    zmsg_pushmem (job, results.data (), count * sizeof (int));
+    zmsg_pushstr (job, "MANY");
+    return job;
+}
+
+static zmsg_t *
+s_gpio_worker_run (fty_sensor_gpio_server_t *server, zmsg_t *job)
+{
+    char *op = zmsg_popstr (job);
+    if (op && (streq (op, "READ_MANY") || streq (op, "WATCH_MANY") || streq (op, "WRITE_MANY"))) {
+        job = s_gpio_worker_run_many (server, op, job);
+        zstr_free (&op);
+        return job;
+    }
+    if (op && streq (op, "READ_SNAPSHOT")) {
+        zstr_free (&op);
+        return s_gpio_worker_run_snapshot (server, job);
+    }
+    char *number = zmsg_popstr (job);
+    char *argument = zmsg_popstr (job);
+    int result = -1;
+
+    if (op && number && argument) {
+        int64_t start = zclock_usecs ();
+        pthread_mutex_lock (&server->gpio_lock);
+        int64_t locked = zclock_usecs ();
+        fty_sensor_gpio_stats_record (server->stats, STATS_GPIO_LOCK_WAIT, locked - start);
+        if (streq (op, "WRITE")) {
+            result = libgpio_write (server->gpio_lib, atoi (number), atoi (argument));
+            fty_sensor_gpio_stats_record (server->stats, STATS_GPO_WRITE, zclock_usecs () - locked);
+            fty_sensor_gpio_stats_count (server->stats,
+                (result == -1) ? STATS_GPO_WRITE_FAILURES : STATS_GPO_WRITES, 1);
+        }
+        else {
+            result = libgpio_read (server->gpio_lib, atoi (number), atoi (argument));
+            fty_sensor_gpio_stats_record (server->stats, STATS_SENSOR_READ, zclock_usecs () - locked);
+            fty_sensor_gpio_stats_count (server->stats,
+                (result == -1) ? STATS_SENSOR_READ_FAILURES : STATS_SENSOR_READS, 1);
+            if (streq (op, "WATCH"))
+                libgpio_watch (server->gpio_lib, atoi (number));
+        }
+        pthread_mutex_unlock (&server->gpio_lock);
+    }
+    else
+        log_error ("GPIO worker: malformed job");
+
+    zmsg_pushstrf (job, "%d", result);
+    zstr_free (&op);
+    zstr_free (&number);
+    zstr_free (&argument);
+    return job;
+}
+
+//  --------------------------------------------------------------------------
+//  GPIO I/O worker actor, which runs the jobs of the server one at a time.
+//  Jobs are prefixed by their priority: URGENT jobs (GPO actuation, GPI
+//  changes) go ahead of the BULK ones (polling), so that they only wait for
+//  the hardware access in progress
+
+static void
+s_gpio_worker (zsock_t *pipe, void *args)
+{
+    fty_sensor_gpio_server_t *server = (fty_sensor_gpio_server_t *) args;
+    zlistx_t *urgent = zlistx_new ();
+    zlistx_t *bulk = zlistx_new ();
+    assert (urgent && bulk);
+    zlistx_set_destructor (urgent, (czmq_destructor *) zmsg_destroy);
+    zlistx_set_destructor (bulk, (czmq_destructor *) zmsg_destroy);
+    zpoller_t *poller = zpoller_new (pipe, NULL);
+    assert (poller);
+
+    zsock_signal (pipe, 0);
+
+    bool terminated = false;
+    while (!terminated) {
+        // Queue all the jobs received, waiting for one if there is none
+        while (true) {
+            bool idle = (zlistx_size (urgent) == 0) && (zlistx_size (bulk) == 0);
+            if (zpoller_wait (poller, idle ? -1 : 0) != pipe) {
+                terminated = zpoller_terminated (poller);
+                break;
+            }
+            zmsg_t *job = zmsg_recv (pipe);
+            char *priority = job ? zmsg_popstr (job) : NULL;
+            if (!priority || streq (priority, "$TERM")) {
+                terminated = true;
+                zmsg_destroy (&job);
+            }
+            else
+                zlistx_add_end (streq (priority, "URGENT") ? urgent : bulk, job);
+            zstr_free (&priority);
+            if (terminated)
+                break;
+            fty_sensor_gpio_stats_gauge (server->stats, STATS_URGENT_QUEUE, zlistx_size (urgent));
+            fty_sensor_gpio_stats_gauge (server->stats, STATS_BULK_QUEUE, zlistx_size (bulk));
+        }
+        if (terminated)
+            break;
+
+        zmsg_t *job = (zmsg_t *) zlistx_detach (urgent, NULL);
+        if (!job)
+            job = (zmsg_t *) zlistx_detach (bulk, NULL);
+        if (job) {
+            job = s_gpio_worker_run (server, job);
+            zmsg_send (&job, pipe);
+        }
+    }
+
+    // Don't leave the GPOs in the middle of an actuation
+    zmsg_t *job = (zmsg_t *) zlistx_detach (urgent, NULL);
+    while (job) {
+        job = s_gpio_worker_run (server, job);
+        zmsg_destroy (&job);
+        job = (zmsg_t *) zlistx_detach (urgent, NULL);
+    }
     zpoller_destroy (&poller);
-    if (which == mlm_client_msgpipe (client)) {
-        zmsg_t *reply = mlm_client_recv (client);
-        return reply;
+    zlistx_destroy (&urgent);
+    zlistx_destroy (&bulk);
+}
+
+//  --------------------------------------------------------------------------
+//  Create the context of a GPIO job: the kind of job, with the asset it is
+//  done for, to which the caller can add anything needed to process the
+//  result (see s_handle_gpio_result)
+
+static zmsg_t *
+s_gpio_context (const char *kind, const char *asset_name)
+{
+    zmsg_t *context = zmsg_new ();
+    zmsg_addstr (context, kind);
+    zmsg_addstr (context, asset_name);
+    return context;
+}
+
+//  --------------------------------------------------------------------------
+//  Create the context of a GPIO job done for the polling cycle in progress,
+//  tagged with this cycle (0 if none), so that only the results of its own
+//  jobs are accounted (see s_poll_cycle_done)
+
+static zmsg_t *
+s_poll_cycle_context (fty_sensor_gpio_server_t *self, const char *kind, const char *asset_name)
+{
+    zmsg_t *context = s_gpio_context (kind, asset_name);
+    zmsg_addstr (context, std::to_string ((self->cycle_start != 0) ? self->cycle_count : 0).c_str ());
+    return context;
+}
+
+//  --------------------------------------------------------------------------
+//  Account the jobs queued for the polling cycle in progress, if any
+
+static void
+s_poll_cycle_queued (fty_sensor_gpio_server_t *self, int jobs)
+{
+    if (self->cycle_start != 0)
+        self->cycle_pending += jobs;
+}
+
+//  --------------------------------------------------------------------------
+//  Account the result of a job, given the polling cycle it was tagged with
+
+static void
+s_poll_cycle_done (fty_sensor_gpio_server_t *self, const char *cycle)
+{
+    if ((self->cycle_start != 0) && cycle
+        && (strtoull (cycle, NULL, 10) == self->cycle_count) && (self->cycle_pending > 0))
+        self->cycle_pending--;
+}
+
+//  --------------------------------------------------------------------------
+//  Queue a job to the GPIO I/O worker, which takes ownership of the context.
+//  Return 0 on success, -1 otherwise
+
+static int
+s_gpio_submit (fty_sensor_gpio_server_t *self, bool urgent, const char *op,
+               int gpx_number, int argument, zmsg_t **context_p)
+{
+    zmsg_t *job = *context_p;
+    *context_p = NULL;
+    zmsg_pushstrf (job, "%d", argument);
+    zmsg_pushstrf (job, "%d", gpx_number);
+    zmsg_pushstr (job, op);
+    zmsg_pushstr (job, urgent ? "URGENT" : "BULK");
+    if (zmsg_send (&job, self->gpio_worker) != 0) {
+        log_error ("%s:\tCan't queue GPIO %s job", self->name, op);
+        zmsg_destroy (&job);
+        return -1;
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Jobs of the same operation, queued to the GPIO I/O worker as a single
+//  batch job (see s_gpio_batch_submit)
+
+typedef struct {
+    std::vector<int> numbers;
+    std::vector<int> arguments;
+    zmsg_t *contexts = NULL;    // <count> <context>... of each job
+} gpio_batch_t;
+
+//  --------------------------------------------------------------------------
+//  Add a job to a batch, which takes ownership of the context
+
+static void
+s_gpio_batch_add (gpio_batch_t *batch, int gpx_number, int argument, zmsg_t **context_p)
+{
+    zmsg_t *context = *context_p;
+    *context_p = NULL;
+    if (!batch->contexts)
+        batch->contexts = zmsg_new ();
+    batch->numbers.push_back (gpx_number);
+    batch->arguments.push_back (argument);
+    zmsg_addstrf (batch->contexts, "%d", (int) zmsg_size (context));
+    zframe_t *frame = zmsg_pop (context);
+    while (frame) {
+        zmsg_append (batch->contexts, &frame);
+        frame = zmsg_pop (context);
     }
-    return NULL;
+    zmsg_destroy (&context);
 }
+
+//  --------------------------------------------------------------------------
+//  Queue the jobs of a batch to the GPIO I/O worker, op being READ_MANY,
+//  WATCH_MANY or WRITE_MANY. The batch is then empty.
+//  Return the number of jobs queued, 0 if none or on failure
+
+static int
+s_gpio_batch_submit (fty_sensor_gpio_server_t *self, bool urgent, const char *op,
+                     gpio_batch_t *batch)
+{
+    int queued = 0;
+    zmsg_t *job = batch->contexts;
+    batch->contexts = NULL;
+    if (job && !batch->numbers.empty ()) {
+        zmsg_pushmem (job, batch->arguments.data (), batch->arguments.size () * sizeof (int));
+        zmsg_pushmem (job, batch->numbers.data (), batch->numbers.size () * sizeof (int));
+        zmsg_pushstr (job, op);
+        zmsg_pushstr (job, urgent ? "URGENT" : "BULK");
+        if (zmsg_send (&job, self->gpio_worker) != 0)
+            log_error ("%s:\tCan't queue GPIO %s job", self->name, op);
+        else
+            queued = (int) batch->numbers.size ();
+    }
+    zmsg_destroy (&job);
+    batch->numbers.clear ();
+    batch->arguments.clear ();
+    return queued;
+}
+
+//  --------------------------------------------------------------------------
+//  Record the state of a GPO in the journal, or its deletion if state is NULL
+
+static void
+s_journal_gpo_state (fty_sensor_gpio_server_t *self, const char *asset_name, gpo_state_t *state)
+{
+    if (!self->journal)
+        return;
+
+    if (!state) {
+        fty_sensor_gpio_journal_append (self->journal, asset_name, NULL);
+        return;
+    }
+    fty_sensor_gpio_gpo_record_t record;
+    record.gpo_number = state->gpo_number;
+    record.default_state = state->default_state;
+    record.last_action = state->last_action;
+    fty_sensor_gpio_journal_append (self->journal, asset_name, &record);
+}
+
 //  --------------------------------------------------------------------------
 //  Publish status of the pointed GPIO sensor
 
@@ -237,7 +741,7 @@ void publish_status (fty_sensor_gpio_server_t *self, _gpx_info_t *sensor, int tt
             ttl,
             msg_type.c_str (),
             sensor->parent, // sensor->asset_name
-            libgpio_get_status_string(sensor->current_state).c_str(),
+            libgpio_get_status_string(sensor->state->current_state).c_str(),
             "");
         zhash_destroy (&aux);
         if (msg) {
@@ -246,110 +750,911 @@ void publish_status (fty_sensor_gpio_server_t *self, _gpx_info_t *sensor, int tt
 
             log_debug("\tPort: %s, type: %s, status: %s",
                 &port[0], msg_type.c_str(),
-                libgpio_get_status_string(sensor->current_state).c_str());
+                libgpio_get_status_string(sensor->state->current_state).c_str());
 
+            int64_t start = zclock_usecs ();
             int r = mlm_client_send (self->mlm, topic.c_str (), &msg);
+            fty_sensor_gpio_stats_record (self->stats, STATS_PUBLISH, zclock_usecs () - start);
+            fty_sensor_gpio_stats_count (self->stats,
+                (r != 0) ? STATS_PUBLISH_FAILURES : STATS_PUBLISHED, 1);
             if( r != 0 )
                 log_debug("failed to send measurement %s result %", topic.c_str(), r);
+            else {
+                sensor->state->last_published_state = sensor->state->current_state;
+                sensor->state->last_published = zclock_mono ();
+            }
             zmsg_destroy (&msg);
         }
 }
 
 //  --------------------------------------------------------------------------
-//  Check GPIO status and generate alarms if needed
+//  Publish the status of the pointed GPIO sensor, which was just read
+
+static void
+s_publish_read_status(fty_sensor_gpio_server_t *self, _gpx_info_t *gpx_info)
+{
+    if (gpx_info->state->current_state == GPIO_STATE_UNKNOWN) {
+        log_error ("Can't read GPx sensor #%i status", gpx_info->gpx_number);
+    }
+    else {
+        log_debug ("Read '%s' (value: %i) on GPx sensor #%i (%s/%s)",
+            libgpio_get_status_string(gpx_info->state->current_state).c_str(),
+            gpx_info->state->current_state, gpx_info->gpx_number,
+            gpx_info->ext_name, gpx_info->asset_name);
+
+        // Only publish changes, and otherwise a heartbeat within the TTL
+        if ((gpx_info->state->last_published == 0)
+            || (gpx_info->state->current_state != gpx_info->state->last_published_state)
+            || (zclock_mono () - gpx_info->state->last_published >= self->heartbeat_interval))
+            publish_status (self, gpx_info, 300);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Read the status of the pointed GPIO sensor, and publish it once read by
+//  the GPIO I/O worker. The read is added to the reads or watches batch if
+//  any, which the caller counts in the polling cycle once submitted, and
+//  otherwise queued alone
+
+static void
+s_read_and_publish(fty_sensor_gpio_server_t *self, _gpx_info_t *gpx_info,
+                   gpio_batch_t *reads = NULL, gpio_batch_t *watches = NULL)
+{
+    // get the correct GPO status if applicable
+    gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, (void *) gpx_info->asset_name);
+    if ((state && (gpx_info->state->current_state == GPIO_STATE_UNKNOWN))) {
+        gpx_info->state->current_state = state->last_action;
+        log_debug ("changed GPO state from GPIO_STATE_UNKNOWN to %s", libgpio_get_status_string (gpx_info->state->current_state).c_str ());
+    }
+
+    // Get the current sensor status, only for GPIs, or when no status
+    // have been set to GPOs. Otherwise, that reinit GPOs!
+    if ( (gpx_info->gpx_direction != GPIO_DIRECTION_OUT)
+        || (gpx_info->state->current_state == GPIO_STATE_UNKNOWN) ) {
+        // Externally powered sensors are only powered while polled,
+        // so only the other GPIs can notify their changes
+        bool watch = self->edge_detection && (gpx_info->gpx_direction == GPIO_DIRECTION_IN)
+            && (!gpx_info->power_source || streq(gpx_info->power_source, ""));
+        zmsg_t *context = s_poll_cycle_context (self, "STATUS", gpx_info->asset_name);
+        gpio_batch_t *batch = watch ? watches : reads;
+        if (batch)
+            s_gpio_batch_add (batch, gpx_info->gpx_number, gpx_info->gpx_direction, &context);
+        else if (s_gpio_submit (self, false, watch ? "WATCH" : "READ",
+                     gpx_info->gpx_number, gpx_info->gpx_direction, &context) == 0)
+            s_poll_cycle_queued (self, 1);
+    }
+    else
+        s_publish_read_status (self, gpx_info);
+}
+
+//  --------------------------------------------------------------------------
+//  Queue a snapshot job of the internally powered GPIs, which also watches
+//  them if asked, tagged with a polling cycle (0 if none).
+//  Return 0 on success, -1 otherwise
+
+static int
+s_gpio_submit_snapshot (fty_sensor_gpio_server_t *self, bool urgent,
+                        const gpx_table_ptr &gpx_table, bool watch, uint64_t cycle)
+{
+    size_t size = gpx_table->gpi_pins.size () * sizeof (uint64_t);
+    std::vector<uint64_t> none (gpx_table->gpi_pins.size (), 0);
+    zmsg_t *job = zmsg_new ();
+    zmsg_addstr (job, urgent ? "URGENT" : "BULK");
+    zmsg_addstr (job, "READ_SNAPSHOT");
+    zmsg_addstrf (job, "%d", GPIO_DIRECTION_IN);
+    zmsg_addmem (job, gpx_table->gpi_pins.data (), size);
+    zmsg_addmem (job, watch ? gpx_table->gpi_pins.data () : none.data (), size);
+    zmsg_addstr (job, std::to_string (cycle).c_str ());
+    if (zmsg_send (&job, self->gpio_worker) != 0) {
+        log_error ("%s:\tCan't queue GPIO READ_SNAPSHOT job", self->name);
+        zmsg_destroy (&job);
+        return -1;
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Check GPIO status and generate alarms if needed
+
+static void
+s_check_gpio_status(fty_sensor_gpio_server_t *self)
+{
+    // Work on the current version of the monitored sensors for the whole
+    // cycle, without blocking the assets actor
+    gpx_table_ptr gpx_table = get_gpx_table ();
+    if (!gpx_table) {
+        log_debug ("GPx list not initialized, skipping");
+        return;
+    }
+    int sensors_count = gpx_table->sensors.size ();
+
+    if (sensors_count == 0) {
+        log_debug ("No sensors monitored");
+        return;
+    }
+    else
+        log_debug ("%i sensor(s) monitored", sensors_count);
+
+    if(!mlm_client_connected(self->mlm))
+        return;
+
+    // Read the internally powered GPIs at once, as a pin snapshot whose
+    // changes only are processed (see s_handle_gpio_snapshot). With edge
+    // detection, they notify their changes, so they are only checked as a
+    // safety net, and when the sensors changed or their heartbeat is due
+    int64_t now = zclock_mono ();
+    bool gpi_check = !self->edge_detection || (now >= self->edge_check_next)
+        || (gpx_table->generation != self->pins_generation) || (now >= self->pins_sweep);
+    if (!gpx_table->gpi_pins.empty () && gpi_check
+        && (s_gpio_submit_snapshot (self, false, gpx_table, self->edge_detection,
+                (self->cycle_start != 0) ? self->cycle_count : 0) == 0)) {
+        s_poll_cycle_queued (self, 1);
+        if (now >= self->edge_check_next)
+            self->edge_check_next = now + self->edge_check_interval;
+    }
+
+    // Access the hardware once per kind of job for the other sensors
+    gpio_batch_t powers, reads, watches;
+
+    for (int id : gpx_table->polled) {
+        const char *asset_name = gpx_table->sensors [id]->asset_name;
+        log_debug ("Checking status of GPx sensor '%s'", asset_name);
+
+        // If there is a GPO power source, then activate it prior to
+        // accessing the GPI, which is read once powered and running
+        // (see s_check_powered_sensors)
+        if (gpx_table->power_gpo [id] != -1) {
+            if (zhashx_lookup (self->powering, asset_name)) {
+                log_debug ("GPx sensor '%s' is still powering up", asset_name);
+            }
+            else {
+                log_debug ("Activating GPO power source %d", gpx_table->power_gpo [id]);
+
+                // The read is scheduled once the power source is
+                // activated (see s_handle_gpio_result)
+                int64_t *deadline = (int64_t *) zmalloc (sizeof (int64_t));
+                *deadline = zclock_mono () + POWER_SOURCE_SETTLE_DELAY;
+                zhashx_update (self->powering, asset_name, deadline);
+                zmsg_t *context = s_poll_cycle_context (self, "POWER", asset_name);
+                s_gpio_batch_add (&powers, gpx_table->power_gpo [id], GPIO_STATE_OPENED, &context);
+            }
+        }
+        else
+            s_read_and_publish (self, gpx_table->sensors [id].get (), &reads, &watches);
+    }
+    s_poll_cycle_queued (self, s_gpio_batch_submit (self, false, "WRITE_MANY", &powers));
+    s_poll_cycle_queued (self, s_gpio_batch_submit (self, false, "READ_MANY", &reads));
+    s_poll_cycle_queued (self, s_gpio_batch_submit (self, false, "WATCH_MANY", &watches));
+}
+
+//  --------------------------------------------------------------------------
+//  Get the time to wait until the next externally powered sensor is ready,
+//  TIMEOUT_MS if none is powering up
+
+static int
+s_powering_timeout(fty_sensor_gpio_server_t *self)
+{
+    int64_t *deadline = (int64_t *) zhashx_first (self->powering);
+    if (!deadline)
+        return TIMEOUT_MS;
+
+    int64_t next = *deadline;
+    while (deadline) {
+        if (*deadline < next)
+            next = *deadline;
+        deadline = (int64_t *) zhashx_next (self->powering);
+    }
+    int64_t now = zclock_mono ();
+    return (next > now) ? (int) (next - now) : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Read and publish the externally powered sensors which are now running
+
+static void
+s_check_powered_sensors(fty_sensor_gpio_server_t *self)
+{
+    if (zhashx_size (self->powering) == 0)
+        return;
+
+    int64_t now = zclock_mono ();
+
+    gpx_table_ptr gpx_table = get_gpx_table ();
+    if (gpx_table && mlm_client_connected(self->mlm)) {
+        gpio_batch_t reads;
+        for (int id : gpx_table->polled) {
+            if (gpx_table->power_gpo [id] == -1)
+                continue;
+            _gpx_info_t *gpx_info = gpx_table->sensors [id].get ();
+            int64_t *deadline = (int64_t *) zhashx_lookup (self->powering, gpx_info->asset_name);
+            if (deadline && (*deadline <= now))
+                s_read_and_publish (self, gpx_info, &reads);
+        }
+        s_poll_cycle_queued (self, s_gpio_batch_submit (self, false, "READ_MANY", &reads));
+    }
+
+    // Forget the processed sensors, and those which vanished meanwhile
+    zlistx_t *assets = zhashx_keys (self->powering);
+    char *asset_name = (char *) zlistx_first (assets);
+    while (asset_name) {
+        int64_t *deadline = (int64_t *) zhashx_lookup (self->powering, asset_name);
+        if (*deadline <= now)
+            zhashx_delete (self->powering, asset_name);
+        asset_name = (char *) zlistx_next (assets);
+    }
+    zlistx_destroy (&assets);
+}
+
+//  --------------------------------------------------------------------------
+//  Handle GPI changes notified through edge detection, and read the sensors
+//  which may have changed, ahead of the polling: the watched GPIs are read
+//  at once as a pin snapshot, whose changes only are processed
+
+static void
+s_handle_gpio_events(fty_sensor_gpio_server_t *self)
+{
+    pthread_mutex_lock (&self->gpio_lock);
+    int events = libgpio_get_events (self->gpio_lib);
+    pthread_mutex_unlock (&self->gpio_lock);
+    if (events <= 0)
+        return;
+    fty_sensor_gpio_stats_count (self->stats, STATS_GPIO_EVENTS, events);
+
+    gpx_table_ptr gpx_table = get_gpx_table ();
+    if (!gpx_table || !mlm_client_connected(self->mlm))
+        return;
+
+    // Only the internally powered GPIs are watched, and the snapshot is not
+    // part of a polling cycle
+    if (!gpx_table->gpi_pins.empty ())
+        s_gpio_submit_snapshot (self, true, gpx_table, false, 0);
+}
+
+// Run the reflex rules triggered by a GPI change, defined with the GPO actions
+static void
+s_reflex_run (fty_sensor_gpio_server_t *self, _gpx_info_t *gpi_info, int previous_state);
+
+//  --------------------------------------------------------------------------
+//  Process the status read on a sensor while polling
+
+static void
+s_handle_status_read(fty_sensor_gpio_server_t *self, _gpx_info_t *gpx_info, int result)
+{
+    int previous_state = gpx_info->state->current_state;
+    gpx_info->state->current_state = result;
+    gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, gpx_info->asset_name);
+    if (state) {
+        state->last_action = result;
+        s_journal_gpo_state (self, gpx_info->asset_name, state);
+    }
+    // React first, publish then
+    s_reflex_run (self, gpx_info, previous_state);
+    if (mlm_client_connected(self->mlm))
+        s_publish_read_status (self, gpx_info);
+}
+
+//  --------------------------------------------------------------------------
+//  Process a pin snapshot of the GPIs read while polling, or after edge
+//  events. Only the sensors of the GPIs which changed are processed, but
+//  for a sweep of all of them when the sensors changed, and for their
+//  heartbeat
+
+static void
+s_handle_gpio_snapshot(fty_sensor_gpio_server_t *self, zmsg_t *result_msg)
+{
+    zframe_t *pins = zmsg_pop (result_msg);
+    zframe_t *values = zmsg_pop (result_msg);
+    zframe_t *unknown = zmsg_pop (result_msg);
+    zframe_t *changed = zmsg_pop (result_msg);
+    char *cycle = zmsg_popstr (result_msg);
+    s_poll_cycle_done (self, cycle);
+    zstr_free (&cycle);
+    gpx_table_ptr gpx_table = get_gpx_table ();
+
+    if (!pins || !values || !unknown || !changed
+        || (zframe_size (values) != zframe_size (pins))
+        || (zframe_size (unknown) != zframe_size (pins))
+        || (zframe_size (changed) != zframe_size (pins)))
+        log_error ("%s:\tMalformed GPIO snapshot", self->name);
+    else if (gpx_table) {
+        int64_t now = zclock_mono ();
+        bool sweep = (gpx_table->generation != self->pins_generation) || (now >= self->pins_sweep);
+        size_t words = zframe_size (pins) / sizeof (uint64_t);
+        const uint64_t *pin = (const uint64_t *) zframe_data (pins);
+        const uint64_t *value = (const uint64_t *) zframe_data (values);
+        const uint64_t *pin_unknown = (const uint64_t *) zframe_data (unknown);
+        const uint64_t *pin_changed = (const uint64_t *) zframe_data (changed);
+        for (size_t word = 0; word < words; word++) {
+            for (uint64_t bits = sweep ? pin [word] : pin_changed [word]; bits; bits &= bits - 1) {
+                int bit = __builtin_ctzll (bits);
+                size_t number = word * 64 + bit;
+                // The sensor may have vanished meanwhile
+                int id = (number < gpx_table->by_gpi.size ()) ? gpx_table->by_gpi [number] : -1;
+                if (id == -1)
+                    continue;
+                int result = ((pin_unknown [word] >> bit) & 1) ? GPIO_STATE_UNKNOWN :
+                    (((value [word] >> bit) & 1) ? GPIO_STATE_OPENED : GPIO_STATE_CLOSED);
+                // Unchanged statuses are only published for the heartbeat
+                const _gpx_state_t *state = gpx_table->state [id];
+                if ((result == state->current_state) && (state->last_published != 0)
+                    && (result == state->last_published_state)
+                    && (now - state->last_published < self->heartbeat_interval))
+                    continue;
+                s_handle_status_read (self, gpx_table->sensors [id].get (), result);
+            }
+        }
+        // Sweep twice per heartbeat interval, so that a status is published
+        // again at most 1.5 interval after the previous one
+        if (sweep) {
+            self->pins_generation = gpx_table->generation;
+            self->pins_sweep = now + self->heartbeat_interval / 2;
+        }
+    }
+    zframe_destroy (&pins);
+    zframe_destroy (&values);
+    zframe_destroy (&unknown);
+    zframe_destroy (&changed);
+}
+
+//  --------------------------------------------------------------------------
+//  Process the result of a job of the GPIO I/O worker, according to the
+//  kind of job (see s_gpio_context):
+//      STATUS      - sensor status read, to publish, followed by the polling
+//                    cycle (see s_poll_cycle_context)
+//      POWER       - power source activation of an externally powered
+//                    sensor, followed by the polling cycle
+//      INTERACTION - GPO_INTERACTION write, followed by the requester, the
+//                    subject, the zuuid and the requested state
+//      TIMED       - step of a timed GPO action, followed by the written state
+//      DEFAULT     - default state written to a GPO, followed by its number
+//      CLOSE       - no longer used GPO closed, followed by its number
+
+static void
+s_handle_gpio_result(fty_sensor_gpio_server_t *self, zmsg_t *result_msg)
+{
+    char *result_str = zmsg_popstr (result_msg);
+    char *kind = zmsg_popstr (result_msg);
+    char *asset_name = zmsg_popstr (result_msg);
+    if (!result_str || !kind || !asset_name) {
+        log_error ("%s:\tMalformed GPIO job result", self->name);
+        zstr_free (&result_str);
+        zstr_free (&kind);
+        zstr_free (&asset_name);
+        return;
+    }
+    int result = atoi (result_str);
+    gpx_table_ptr gpx_table = get_gpx_table ();
+    // The sensor may have vanished meanwhile
+    _gpx_info_t *gpx_info = get_gpx_info (gpx_table, asset_name);
+    gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, asset_name);
+
+    if (streq (kind, "STATUS")) {
+        char *cycle = zmsg_popstr (result_msg);
+        s_poll_cycle_done (self, cycle);
+        zstr_free (&cycle);
+        if (gpx_info)
+            s_handle_status_read (self, gpx_info, result);
+    }
+    else if (streq (kind, "POWER")) {
+        char *cycle = zmsg_popstr (result_msg);
+        s_poll_cycle_done (self, cycle);
+        zstr_free (&cycle);
+        int64_t *deadline = (int64_t *) zhashx_lookup (self->powering, asset_name);
+        if (result != 0) {
+            log_error ("Failed to activate GPO power source!");
+            zhashx_delete (self->powering, asset_name);
+            if (gpx_info)
+                s_read_and_publish (self, gpx_info);
+        }
+        else if (deadline && gpx_info) {
+            log_debug ("GPO power source successfully activated.");
+            // Save the current state
+            gpx_info->state->current_state = gpx_info->normal_state;
+            // Read once the GPx sensor is powered and running
+            *deadline = zclock_mono () + POWER_SOURCE_SETTLE_DELAY;
+        }
+    }
+    else if (streq (kind, "INTERACTION")) {
+        char *sender = zmsg_popstr (result_msg);
+        char *subject = zmsg_popstr (result_msg);
+        char *zuuid = zmsg_popstr (result_msg);
+        char *status_value = zmsg_popstr (result_msg);
+        zmsg_t *reply = zmsg_new ();
+        zmsg_addstr (reply, zuuid ? zuuid : "");
+        if (result != 0) {
+            log_error ("GPO_INTERACTION: failed to set value!");
+            zmsg_addstr (reply, "ERROR");
+            zmsg_addstr (reply, "SET_VALUE_FAILED");
+        }
+        else {
+            zmsg_addstr (reply, "OK");
+            // Update the GPO state
+            if (gpx_info)
+                gpx_info->state->current_state = atoi (status_value);
+
+            if (state == NULL) {
+                log_debug ("GPO_INTERACTION: can't find sensor '%s'!", asset_name);
+                zmsg_addstr (reply, "ERROR");
+                zmsg_addstr (reply, "ASSET_NOT_FOUND");
+            }
+            else {
+                log_debug ("last action = %d on port %d", state->last_action, state->gpo_number);
+                state->last_action = atoi (status_value);
+                state->in_alert = 1;
+                s_journal_gpo_state (self, asset_name, state);
+            }
+        }
+        // send the reply
+        int rv = mlm_client_sendto (self->mlm, sender, subject, NULL, 5000, &reply);
+        if (rv == -1)
+            log_error ("%s:\tgpio: mlm_client_sendto failed", self->name);
+        zmsg_destroy (&reply);
+        zstr_free (&sender);
+        zstr_free (&subject);
+        zstr_free (&zuuid);
+        zstr_free (&status_value);
+    }
+    else if (streq (kind, "TIMED")) {
+        char *status_value = zmsg_popstr (result_msg);
+        if (result != 0)
+            log_error ("Timed action on GPO '%s': failed to set value!", asset_name);
+        else if (status_value) {
+            if (gpx_info)
+                gpx_info->state->current_state = atoi (status_value);
+            if (state) {
+                state->last_action = atoi (status_value);
+                state->in_alert = (state->last_action != state->default_state);
+                s_journal_gpo_state (self, asset_name, state);
+            }
+        }
+        zstr_free (&status_value);
+    }
+    else if (streq (kind, "DEFAULT")) {
+        char *gpo_number = zmsg_popstr (result_msg);
+        if (result != 0) {
+            log_error ("Error during default action on GPO #%s", gpo_number);
+            // Unless the GPO was changed meanwhile
+            if (state && gpo_number && (state->gpo_number == atoi (gpo_number))) {
+                state->last_action = GPIO_STATE_UNKNOWN;
+                s_journal_gpo_state (self, asset_name, state);
+            }
+        }
+        zstr_free (&gpo_number);
+    }
+    else if (streq (kind, "CLOSE")) {
+        char *gpo_number = zmsg_popstr (result_msg);
+        if (result != 0)
+            log_error ("Error while closing no longer active GPO #%s", gpo_number);
+        zstr_free (&gpo_number);
+    }
+    zstr_free (&result_str);
+    zstr_free (&kind);
+    zstr_free (&asset_name);
+}
+
+//  --------------------------------------------------------------------------
+//  Process a message of the GPIO I/O worker: the result of a job, the
+//  results of a batch job, processed one job at a time, or a pin snapshot
+
+static void
+s_handle_gpio_results(fty_sensor_gpio_server_t *self, zmsg_t *result_msg)
+{
+    zframe_t *first = zmsg_first (result_msg);
+    if (first && zframe_streq (first, "SNAPSHOT")) {
+        first = zmsg_pop (result_msg);
+        zframe_destroy (&first);
+        s_handle_gpio_snapshot (self, result_msg);
+        return;
+    }
+    if (!first || !zframe_streq (first, "MANY")) {
+        s_handle_gpio_result (self, result_msg);
+        return;
+    }
+    first = zmsg_pop (result_msg);
+    zframe_destroy (&first);
+    zframe_t *results = zmsg_pop (result_msg);
+    int count = results ? (int) (zframe_size (results) / sizeof (int)) : 0;
+    const int *result = results ? (const int *) zframe_data (results) : NULL;
+    for (int i = 0; i < count; i++) {
+        char *frames = zmsg_popstr (result_msg);
+        if (!frames) {
+            log_error ("%s:\tMalformed GPIO batch job result", self->name);
+            break;
+        }
+        zmsg_t *job_result = zmsg_new ();
+        zmsg_addstrf (job_result, "%d", result [i]);
+        for (int frame_nbr = atoi (frames); frame_nbr > 0; frame_nbr--) {
+            zframe_t *frame = zmsg_pop (result_msg);
+            if (!frame)
+                break;
+            zmsg_append (job_result, &frame);
+        }
+        s_handle_gpio_result (self, job_result);
+        zmsg_destroy (&job_result);
+        zstr_free (&frames);
+    }
+    zframe_destroy (&results);
+}
+
+//  --------------------------------------------------------------------------
+//  Rebuild the GPIO_MANIFEST and GPIO_MANIFEST_SUMMARY replies for all the
+//  templates, if the templates changed since they were built
+
+static void
+s_update_manifests (fty_sensor_gpio_server_t *self)
+{
+    uint64_t generation = fty_sensor_gpio_templates_generation (self->templates);
+    if (self->manifest && (generation == self->manifest_generation))
+        return;
+
+    log_debug ("%s: templates changed, rebuilding manifests", self->name);
+    zmsg_destroy (&self->manifest);
+    zmsg_destroy (&self->manifest_summary);
+    self->manifest = zmsg_new ();
+    self->manifest_summary = zmsg_new ();
+
+    zlistx_t *templates = fty_sensor_gpio_templates_list (self->templates);
+    fty_sensor_gpio_template_t *sensor_template = (fty_sensor_gpio_template_t *) zlistx_first (templates);
+    if (sensor_template) {
+        zmsg_addstr (self->manifest, "OK");
+        zmsg_addstr (self->manifest_summary, "OK");
+    }
+    while (sensor_template) {
+        zmsg_addstr (self->manifest_summary, sensor_template->part_number);
+        zmsg_addstr (self->manifest_summary, sensor_template->manufacturer);
+
+        zmsg_addstr (self->manifest, sensor_template->part_number);
+        zmsg_addstr (self->manifest, sensor_template->manufacturer);
+        zmsg_addstr (self->manifest, sensor_template->type);
+        zmsg_addstr (self->manifest, sensor_template->normal_state);
+        zmsg_addstr (self->manifest, sensor_template->gpx_direction);
+        zmsg_addstr (self->manifest, sensor_template->power_source);
+        zmsg_addstr (self->manifest, sensor_template->alarm_severity);
+        zmsg_addstr (self->manifest, sensor_template->alarm_message);
+        sensor_template = (fty_sensor_gpio_template_t *) zlistx_next (templates);
+    }
+    zlistx_destroy (&templates);
+    self->manifest_generation = generation;
+}
+
+//  --------------------------------------------------------------------------
+//  Write the default state of a GPO, ahead of the polling. The write is
+//  added to the writes batch if any, and otherwise queued alone
+
+static void
+s_write_default_state (fty_sensor_gpio_server_t *self, const char *asset_name,
+                       int gpo_number, int default_state, gpio_batch_t *writes = NULL)
+{
+    zmsg_t *context = s_gpio_context ("DEFAULT", asset_name);
+    zmsg_addstrf (context, "%d", gpo_number);
+    if (writes)
+        s_gpio_batch_add (writes, gpo_number, default_state, &context);
+    else
+        s_gpio_submit (self, true, "WRITE", gpo_number, default_state, &context);
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy a timed GPO action, once its timer is cancelled or expired
+
+static void
+s_gpo_timed_destroy (void **self_p)
+{
+    gpo_timed_t *timed = (gpo_timed_t *) *self_p;
+    if (timed) {
+        zstr_free (&timed->asset_name);
+        free (timed);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get the state a GPO is driven back to at the end of a pulse or blink
+
+static int
+s_gpo_default_state (fty_sensor_gpio_server_t *self, _gpx_info_t *gpx_info)
+{
+    gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, gpx_info->asset_name);
+    if (state && (state->default_state != GPIO_STATE_UNKNOWN))
+        return state->default_state;
+    if (gpx_info->normal_state != GPIO_STATE_UNKNOWN)
+        return gpx_info->normal_state;
+    return GPIO_STATE_CLOSED;
+}
+
+//  --------------------------------------------------------------------------
+//  Parse the delay, duration or period of a timed GPO action.
+//  Return it in msec, or -1 if it is not valid
+
+static int
+s_gpo_timed_parse (const char *value)
+{
+    if (!value)
+        return -1;
+    char *end = NULL;
+    long msec = strtol (value, &end, 10);
+    if ((end == value) || (*end != '\0') || (msec <= 0) || (msec > INT_MAX))
+        return -1;
+    return (int) msec;
+}
+
+//  --------------------------------------------------------------------------
+//  Save the snapshot again after a change of the timed GPO actions. Their
+//  changes are saved together, at most once per SNAPSHOT_SAVE_DELAY
+
+static void
+s_snapshot_changed (fty_sensor_gpio_server_t *self)
+{
+    self->snapshot_generation = (uint64_t) -1;
+    if (self->snapshot_save == 0)
+        self->snapshot_save = zclock_mono () + SNAPSHOT_SAVE_DELAY;
+}
+
+//  --------------------------------------------------------------------------
+//  Cancel the timed action in progress on a GPO. Return true if there was one
+
+static bool
+s_gpo_timed_cancel (fty_sensor_gpio_server_t *self, const char *asset_name)
+{
+    gpo_timed_t *timed = (gpo_timed_t *) zhashx_lookup (self->timed, asset_name);
+    if (!timed)
+        return false;
+    fty_sensor_gpio_wheel_cancel (self->wheel, &timed->timer);
+    zhashx_delete (self->timed, asset_name);
+    s_snapshot_changed (self);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Schedule a timed action on a GPO, replacing the one in progress:
+//      delayed state change - state at next, end is 0
+//      pulse                - state at next, back to default at end, period is end - next
+//      blink                - state at next, toggled every period, back to default at end
+
+static void
+s_gpo_timed_schedule (fty_sensor_gpio_server_t *self, const char *asset_name,
+                      int state, int period, int64_t end, int64_t next)
+{
+    s_gpo_timed_cancel (self, asset_name);
+    gpo_timed_t *timed = (gpo_timed_t *) zmalloc (sizeof (gpo_timed_t));
+    assert (timed);
+    timed->asset_name = strdup (asset_name);
+    timed->state = state;
+    timed->period = period;
+    timed->end = end;
+    timed->next = next;
+    timed->timer = fty_sensor_gpio_wheel_add (self->wheel, next, timed);
+    zhashx_insert (self->timed, asset_name, timed);
+    s_snapshot_changed (self);
+}
+
+//  --------------------------------------------------------------------------
+//  Stop the timed action in progress on a GPO: a pulse or blink ends right
+//  away, driving the GPO back to its default state. Return true if there was
+//  one
+
+static bool
+s_gpo_timed_stop (fty_sensor_gpio_server_t *self, _gpx_info_t *gpx_info)
+{
+    gpo_timed_t *timed = (gpo_timed_t *) zhashx_lookup (self->timed, gpx_info->asset_name);
+    if (!timed)
+        return false;
+    if (timed->end != 0)
+        s_gpo_timed_schedule (self, gpx_info->asset_name,
+            s_gpo_default_state (self, gpx_info), 0, 0, zclock_mono ());
+    else
+        s_gpo_timed_cancel (self, gpx_info->asset_name);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Drive a GPO for a timed action or a reflex rule, ahead of the polling
 
 static void
-s_check_gpio_status(fty_sensor_gpio_server_t *self)
+s_gpo_timed_write (fty_sensor_gpio_server_t *self, _gpx_info_t *gpx_info, int state)
 {
-    pthread_mutex_lock (&gpx_list_mutex);
+    zmsg_t *context = s_gpio_context ("TIMED", gpx_info->asset_name);
+    zmsg_addstrf (context, "%d", state);
+    s_gpio_submit (self, true, "WRITE", gpx_info->gpx_number, state, &context);
+}
 
-    // number of sensors monitored in gpx_list
-    zlistx_t *gpx_list = get_gpx_list();
-    if (!gpx_list) {
-        log_debug ("GPx list not initialized, skipping");
-        pthread_mutex_unlock (&gpx_list_mutex);
-        return;
+//  --------------------------------------------------------------------------
+//  Do the step of a timed GPO action which is due: drive the GPO, then
+//  prepare the next toggle of a blink or the end of a pulse or blink.
+//  Return false once the action is done
+
+static bool
+s_gpo_timed_step (fty_sensor_gpio_server_t *self, gpo_timed_t *timed, int64_t now)
+{
+    gpx_table_ptr gpx_table = get_gpx_table ();
+    _gpx_info_t *gpx_info = gpx_table ? get_gpx_info (gpx_table, timed->asset_name) : NULL;
+    if (!gpx_info || (gpx_info->gpx_direction != GPIO_DIRECTION_OUT)) {
+        log_debug ("%s:\tGPO '%s' is gone, dropping its timed action", self->name, timed->asset_name);
+        return false;
     }
-    int sensors_count = zlistx_size (gpx_list);
-    _gpx_info_t *gpx_info = NULL;
+    int default_state = s_gpo_default_state (self, gpx_info);
+    // When late (e.g. after a restart), only the end is left
+    if ((timed->end != 0) && (now >= timed->end))
+        timed->state = default_state;
+
+    s_gpo_timed_write (self, gpx_info, timed->state);
+    if ((timed->end == 0) || (now >= timed->end))
+        return false;
+
+    // Next toggle, skipping the missed ones, or the end
+    int64_t missed = (now - timed->next) / timed->period;
+    timed->next += (missed + 1) * timed->period;
+    timed->state = (timed->state == GPIO_STATE_OPENED) ? GPIO_STATE_CLOSED : GPIO_STATE_OPENED;
+    if (timed->next >= timed->end) {
+        timed->next = timed->end;
+        timed->state = default_state;
+    }
+    return true;
+}
 
-    if (sensors_count == 0) {
-        log_debug ("No sensors monitored");
-        pthread_mutex_unlock (&gpx_list_mutex);
+//  --------------------------------------------------------------------------
+//  Apply a reflex rule to its GPO, if its condition holds. The GPO is driven
+//  right away, the next steps of a pulse or blink being timed by the wheel
+
+static void
+s_reflex_apply (fty_sensor_gpio_server_t *self, const fty_sensor_gpio_rule_t *rule)
+{
+    gpx_table_ptr gpx_table = get_gpx_table ();
+    if (rule->if_gpi) {
+        _gpx_info_t *if_info = get_gpx_info (gpx_table, rule->if_gpi);
+        if (!if_info || (if_info->state->current_state != rule->if_state)) {
+            log_debug ("%s:\treflex rule '%s': '%s' is not %s, nothing to do", self->name,
+                rule->name, rule->if_gpi, libgpio_get_status_string (rule->if_state).c_str ());
+            return;
+        }
+    }
+    _gpx_info_t *gpo_info = get_gpx_info (gpx_table, rule->gpo);
+    if (!gpo_info || (gpo_info->gpx_direction != GPIO_DIRECTION_OUT)) {
+        log_warning ("%s:\treflex rule '%s': can't find GPO '%s'", self->name, rule->name, rule->gpo);
         return;
     }
-    else
-        log_debug ("%i sensor(s) monitored", sensors_count);
+    log_debug ("%s:\treflex rule '%s' triggered on '%s'", self->name, rule->name, gpo_info->asset_name);
+
+    int64_t now = zclock_mono ();
+    int default_state = s_gpo_default_state (self, gpo_info);
+    switch (rule->action) {
+        case FTY_SENSOR_GPIO_RULE_SET:
+            if (rule->delay > 0)
+                s_gpo_timed_schedule (self, gpo_info->asset_name, rule->state, 0, 0, now + rule->delay);
+            else {
+                s_gpo_timed_cancel (self, gpo_info->asset_name);
+                s_gpo_timed_write (self, gpo_info, rule->state);
+            }
+            break;
+        case FTY_SENSOR_GPIO_RULE_PULSE:
+        case FTY_SENSOR_GPIO_RULE_BLINK:
+            s_gpo_timed_write (self, gpo_info,
+                (default_state == GPIO_STATE_OPENED) ? GPIO_STATE_CLOSED : GPIO_STATE_OPENED);
+            s_gpo_timed_schedule (self, gpo_info->asset_name, default_state, rule->period,
+                now + rule->duration, now + ((rule->period < rule->duration) ? rule->period : rule->duration));
+            break;
+        case FTY_SENSOR_GPIO_RULE_CANCEL:
+            s_gpo_timed_stop (self, gpo_info);
+            break;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Run the reflex rules triggered by a GPI change, by asset or ext name.
+//  The first read of a GPI, from an unknown state, triggers nothing
 
-    if(!mlm_client_connected(self->mlm)) {
-        pthread_mutex_unlock (&gpx_list_mutex);
+static void
+s_reflex_run (fty_sensor_gpio_server_t *self, _gpx_info_t *gpi_info, int previous_state)
+{
+    int state = gpi_info->state->current_state;
+    if (!self->rules || (gpi_info->gpx_direction != GPIO_DIRECTION_IN)
+        || (previous_state == GPIO_STATE_UNKNOWN) || (state == GPIO_STATE_UNKNOWN)
+        || (previous_state == state))
         return;
-    }
 
-    // Acquire the current sensor
-    gpx_info = (_gpx_info_t *)zlistx_first (gpx_list);
+    const char *names [] = { gpi_info->asset_name, gpi_info->ext_name };
+    for (int i = 0; i < 2; i++) {
+        if (!names [i] || ((i == 1) && streq (names [1], names [0])))
+            continue;
+        size_t count = 0;
+        const fty_sensor_gpio_rule_t *rule = fty_sensor_gpio_rules_dispatch (self->rules, names [i], state, &count);
+        for (size_t j = 0; j < count; j++)
+            s_reflex_apply (self, &rule [j]);
+    }
+}
 
-    // Loop on all sensors
-    for (int cur_sensor_num = 0; cur_sensor_num < sensors_count; cur_sensor_num++) {
+//  --------------------------------------------------------------------------
+//  Get the runtime statistics, as name / value string frames: those
+//  gathered on the fly, with the polling statistics and the libgpio
+//  access counters
 
-        // No processing if not yet init'ed
-        if (gpx_info) {
+static zmsg_t *
+s_stats_report (fty_sensor_gpio_server_t *self)
+{
+    zmsg_t *report = zmsg_new ();
+    fty_sensor_gpio_stats_gauge (self->stats, STATS_TIMED_ACTIONS, zhashx_size (self->timed));
+    fty_sensor_gpio_stats_report (self->stats, report);
+
+    // Without the GPIO lock, not to wait for the I/O worker
+    uint64_t syscalls, export_failures, direction_retries;
+    libgpio_get_stats (self->gpio_lib, &syscalls, &export_failures, &direction_retries);
+
+    const char *names [] = {
+        "poll.cycles", "poll.overruns", "poll.missed", "poll.cycle_max_ms",
+        "gpio.syscalls", "gpio.export_failures", "gpio.direction_retries"
+    };
+    uint64_t values [] = {
+        self->cycle_count, self->cycle_overruns, self->cycle_missed, (uint64_t) self->cycle_time_max,
+        syscalls, export_failures, direction_retries
+    };
+    for (size_t i = 0; i < sizeof (values) / sizeof (values [0]); i++) {
+        zmsg_addstr (report, names [i]);
+        zmsg_addstr (report, std::to_string (values [i]).c_str ());
+    }
+    return report;
+}
 
-            log_debug ("Checking status of GPx sensor '%s'",
-                gpx_info->asset_name);
+//  --------------------------------------------------------------------------
+//  Log the runtime statistics, when SIGUSR1 was received
 
-            // If there is a GPO power source, then activate it prior to
-            // accessing the GPI!
-            if ( gpx_info->power_source && (!streq(gpx_info->power_source, "")) ) {
-                log_debug ("Activating GPO power source %s",
-                    gpx_info->power_source);
+static void
+s_stats_dump (fty_sensor_gpio_server_t *self, int signal_fd)
+{
+    // Drain the signals, several of them give a single dump
+    struct signalfd_siginfo info;
+    while (read (signal_fd, &info, sizeof (info)) == sizeof (info))
+        ;
+
+    zmsg_t *report = s_stats_report (self);
+    log_info ("%s:\truntime statistics:", self->name);
+    char *name = zmsg_popstr (report);
+    while (name) {
+        char *value = zmsg_popstr (report);
+        log_info ("%s:\t  %s = %s", self->name, name, value ? value : "");
+        zstr_free (&name);
+        zstr_free (&value);
+        name = zmsg_popstr (report);
+    }
+    zmsg_destroy (&report);
+}
 
-                if (libgpio_write ( self->gpio_lib,
-                                    atoi(gpx_info->power_source),
-                                    GPIO_STATE_OPENED) != 0) {
-                    log_error ("Failed to activate GPO power source!");
-                }
-                else {
-                    log_debug ("GPO power source successfully activated.");
-                    // Save the current state
-                    gpx_info->current_state = gpx_info->normal_state;
-                    // Sleep for a second to have the GPx sensor powered and running
-                    zclock_sleep (1000);
-                }
-            }
+//  --------------------------------------------------------------------------
+//  Get SIGUSR1, to dump the statistics, through a signalfd. The signal must
+//  be blocked in all the threads (see main), which is done here anyway for
+//  the server thread.
+//  Return the signal file descriptor, -1 if SIGUSR1 can't be handled
 
-            // get the correct GPO status if applicable
-            gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, (void *) gpx_info->asset_name);
-            if ((state && (gpx_info->current_state == GPIO_STATE_UNKNOWN))) {
-                gpx_info->current_state = state->last_action;
-                log_debug ("changed GPO state from GPIO_STATE_UNKNOWN to %s", libgpio_get_status_string (gpx_info->current_state).c_str ());
-            }
+static int
+s_stats_signal_open (void)
+{
+    sigset_t signals;
+    sigemptyset (&signals);
+    sigaddset (&signals, SIGUSR1);
+    pthread_sigmask (SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd (-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1)
+        log_warning ("Can't get the statistics signal (%i), SIGUSR1 is not handled", errno);
+    return signal_fd;
+}
 
-            // Get the current sensor status, only for GPIs, or when no status
-            // have been set to GPOs. Otherwise, that reinit GPOs!
-            if ( (gpx_info->gpx_direction != GPIO_DIRECTION_OUT)
-                || (gpx_info->current_state == GPIO_STATE_UNKNOWN) ) {
-                gpx_info->current_state = libgpio_read( self->gpio_lib,
-                                                        gpx_info->gpx_number,
-                                                        gpx_info->gpx_direction);
-                if (state)
-                    state->last_action = gpx_info->current_state;
-            }
-            if (gpx_info->current_state == GPIO_STATE_UNKNOWN) {
-                log_error ("Can't read GPx sensor #%i status", gpx_info->gpx_number);
-            }
-            else {
-                log_debug ("Read '%s' (value: %i) on GPx sensor #%i (%s/%s)",
-                    libgpio_get_status_string(gpx_info->current_state).c_str(),
-                    gpx_info->current_state, gpx_info->gpx_number,
-                    gpx_info->ext_name, gpx_info->asset_name);
+//  --------------------------------------------------------------------------
+//  Get the histogram of the latency of the mailbox requests with subject
 
-                publish_status (self, gpx_info, 300);
-            }
-        }
-        gpx_info = (_gpx_info_t *)zlistx_next (gpx_list);
-    }
-    pthread_mutex_unlock (&gpx_list_mutex);
+static int
+s_mailbox_histogram (const char *subject)
+{
+    if (streq (subject, "GPO_INTERACTION"))
+        return STATS_MAILBOX_GPO_INTERACTION;
+    if (streq (subject, "GPIO_MANIFEST"))
+        return STATS_MAILBOX_GPIO_MANIFEST;
+    if (streq (subject, "GPIO_MANIFEST_SUMMARY"))
+        return STATS_MAILBOX_GPIO_MANIFEST_SUMMARY;
+    if (streq (subject, "GPIO_TEMPLATE_ADD"))
+        return STATS_MAILBOX_GPIO_TEMPLATE_ADD;
+    if (streq (subject, "GPOSTATE"))
+        return STATS_MAILBOX_GPOSTATE;
+    if (streq (subject, "GPIO_STATS"))
+        return STATS_MAILBOX_GPIO_STATS;
+    return STATS_MAILBOX_OTHER;
 }
 
 //  --------------------------------------------------------------------------
@@ -378,7 +1683,8 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
     //we assume all request command are MAILBOX DELIVER, and subject="gpio"
     if ( (subject != "") && (subject != "GPO_INTERACTION") && (subject != "GPIO_TEMPLATE_ADD")
          && (subject != "GPIO_MANIFEST") && (subject != "GPIO_MANIFEST_SUMMARY")
-         && (subject != "GPIO_TEST") && (subject != "GPOSTATE") && (subject != "ERROR")) {
+         && (subject != "GPIO_TEST") && (subject != "GPOSTATE") && (subject != "GPIO_STATS")
+         && (subject != "ERROR")) {
         log_warning ("%s: Received unexpected subject '%s' from '%s'", self->name, subject.c_str(), mlm_client_sender (self->mlm));
         zmsg_t *reply = zmsg_new ();
         zmsg_addstr(reply, "ERROR");
@@ -396,33 +1702,58 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
             zmsg_addstr (reply, zuuid);
             char *sensor_name = zmsg_popstr (message);
             char *action_name = zmsg_popstr (message);
+            // Delay, duration or period of a timed action
+            char *timing = zmsg_popstr (message);
+            char *blink_duration = zmsg_popstr (message);
             log_debug ("GPO_INTERACTION: do '%s' on '%s'",
                 action_name, sensor_name);
+            bool submitted = false;
             // Get the GPO entry for details
-            pthread_mutex_lock (&gpx_list_mutex);
-            zlistx_t *gpx_list = get_gpx_list();
-            if (gpx_list) {
-                int sensors_count = zlistx_size (gpx_list);
-                _gpx_info_t *gpx_info = (_gpx_info_t *)zlistx_first (gpx_list);
-                gpx_info = (_gpx_info_t *)zlistx_next (gpx_list);
-                for (int cur_sensor_num = 0; cur_sensor_num < sensors_count; cur_sensor_num++) {
-                    // Check both asset and ext name
-                    if (gpx_info && gpx_info->asset_name && gpx_info->ext_name) {
-                        log_debug ("GPO_INTERACTION: checking sensor %s/%s",
-                            gpx_info->asset_name, gpx_info->ext_name);
-                        if ( streq(gpx_info->asset_name, sensor_name)
-                            || streq(gpx_info->ext_name, sensor_name) ) {
-                                break;
-                        }
-                    }
-                    gpx_info = (_gpx_info_t *)zlistx_next (gpx_list);
-                }
-                if ( (gpx_info) && (gpx_info->gpx_direction == GPIO_DIRECTION_OUT)
-                    && ((streq(gpx_info->asset_name, sensor_name)) || streq(gpx_info->ext_name, sensor_name)) ) {
+            gpx_table_ptr gpx_table = get_gpx_table ();
+            if (gpx_table) {
+                // Check both asset and ext name
+                _gpx_info_t *gpx_info = get_gpx_info (gpx_table, sensor_name);
+                if ( (gpx_info) && (gpx_info->gpx_direction == GPIO_DIRECTION_OUT) ) {
                     int status_value = libgpio_get_status_value (action_name);
-                    int current_state = gpx_info->current_state;
+                    int current_state = gpx_info->state->current_state;
+                    int64_t now = zclock_mono ();
 
-                    if (status_value != GPIO_STATE_UNKNOWN) {
+                    if (action_name && streq (action_name, "cancel")) {
+                        if (s_gpo_timed_stop (self, gpx_info))
+                            zmsg_addstr (reply, "OK");
+                        else {
+                            zmsg_addstr (reply, "ERROR");
+                            zmsg_addstr (reply, "ACTION_NOT_APPLICABLE");
+                        }
+                    }
+                    else if (action_name && (streq (action_name, "pulse") || streq (action_name, "blink"))) {
+                        bool pulse = streq (action_name, "pulse");
+                        int period = s_gpo_timed_parse (timing);
+                        int duration = pulse ? period : s_gpo_timed_parse (blink_duration);
+                        if ((period == -1) || (duration == -1)) {
+                            zmsg_addstr (reply, "ERROR");
+                            zmsg_addstr (reply, "BAD_COMMAND");
+                        }
+                        else {
+                            int active_state = (s_gpo_default_state (self, gpx_info) == GPIO_STATE_OPENED) ?
+                                GPIO_STATE_CLOSED : GPIO_STATE_OPENED;
+                            s_gpo_timed_schedule (self, gpx_info->asset_name, active_state,
+                                period, now + duration, now);
+                            zmsg_addstr (reply, "OK");
+                        }
+                    }
+                    else if ((status_value != GPIO_STATE_UNKNOWN) && timing) {
+                        int delay = s_gpo_timed_parse (timing);
+                        if (delay == -1) {
+                            zmsg_addstr (reply, "ERROR");
+                            zmsg_addstr (reply, "BAD_COMMAND");
+                        }
+                        else {
+                            s_gpo_timed_schedule (self, gpx_info->asset_name, status_value, 0, 0, now + delay);
+                            zmsg_addstr (reply, "OK");
+                        }
+                    }
+                    else if (status_value != GPIO_STATE_UNKNOWN) {
                         // check whether this action is allowed in this state
                         if (status_value == current_state) {
                             log_error ("Current state is %s, GPO is requested to become %s",
@@ -432,28 +1763,16 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
                             zmsg_addstr (reply, "ACTION_NOT_APPLICABLE");
                         }
                         else {
-                            if (libgpio_write (self->gpio_lib, gpx_info->gpx_number, status_value) != 0) {
-                                log_error ("GPO_INTERACTION: failed to set value!");
-                                zmsg_addstr (reply, "ERROR");
-                                zmsg_addstr (reply, "SET_VALUE_FAILED");
-                            }
-                            else {
-                                zmsg_addstr (reply, "OK");
-                                // Update the GPO state
-                                gpx_info->current_state = status_value;
-
-                                gpo_state_t *last_state = (gpo_state_t *) zhashx_lookup (self->gpo_states, gpx_info->asset_name);
-                                if (last_state == NULL) {
-                                    log_debug ("GPO_INTERACTION: can't find sensor '%s'!", sensor_name);
-                                    zmsg_addstr (reply, "ERROR");
-                                    zmsg_addstr (reply, "ASSET_NOT_FOUND");
-                                }
-                                else {
-                                    log_debug ("last action = %d on port ", last_state->last_action, last_state->gpo_number);
-                                    last_state->last_action = status_value;
-                                    last_state->in_alert = 1;
-                                }
-                            }
+                            s_gpo_timed_cancel (self, gpx_info->asset_name);
+                            // Reply once written by the GPIO I/O worker,
+                            // ahead of the polling
+                            zmsg_t *context = s_gpio_context ("INTERACTION", gpx_info->asset_name);
+                            zmsg_addstr (context, mlm_client_sender (self->mlm));
+                            zmsg_addstr (context, subject.c_str ());
+                            zmsg_addstr (context, zuuid ? zuuid : "");
+                            zmsg_addstrf (context, "%d", status_value);
+                            s_gpio_submit (self, true, "WRITE", gpx_info->gpx_number, status_value, &context);
+                            submitted = true;
                         }
                     }
                     else {
@@ -467,14 +1786,17 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
                     zmsg_addstr (reply, "ERROR");
                     zmsg_addstr (reply, "ASSET_NOT_FOUND");
                 }
-                // send the reply
-                int rv = mlm_client_sendto (self->mlm, mlm_client_sender (self->mlm), subject.c_str(), NULL, 5000, &reply);
-                if (rv == -1)
-                    log_error ("%s:\tgpio: mlm_client_sendto failed", self->name);
+                // send the reply, unless the GPO is being written
+                if (!submitted) {
+                    int rv = mlm_client_sendto (self->mlm, mlm_client_sender (self->mlm), subject.c_str(), NULL, 5000, &reply);
+                    if (rv == -1)
+                        log_error ("%s:\tgpio: mlm_client_sendto failed", self->name);
+                }
             }
-            pthread_mutex_unlock (&gpx_list_mutex);
             zstr_free(&sensor_name);
             zstr_free(&action_name);
+            zstr_free (&timing);
+            zstr_free (&blink_duration);
             zstr_free (&zuuid);
         }
         else if ( (subject == "GPIO_MANIFEST") || (subject == "GPIO_MANIFEST_SUMMARY") ) {
@@ -487,105 +1809,49 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
             if (asset_partnumber) {
                 while (asset_partnumber) {
                     log_debug ("Asset filter provided: %s", asset_partnumber);
-                    // FIXME: use @datadir@ (how?)!
-                    string template_filename = string(self->template_dir) + string(asset_partnumber) + string(".tpl");
 
                     // We have a GPIO sensor, process it
-                    zconfig_t *sensor_template_file = zconfig_load (template_filename.c_str());
-                    if (!sensor_template_file) {
-                        log_debug ("Can't load sensor template file"); // FIXME: error
+                    fty_sensor_gpio_template_t *sensor_template = self->templates ?
+                        fty_sensor_gpio_templates_lookup (self->templates, asset_partnumber) : NULL;
+                    if (!sensor_template) {
+                        log_debug ("Can't find sensor template"); // FIXME: error
                         zmsg_addstr (reply, "ERROR");
                         zmsg_addstr (reply, "ASSET_NOT_FOUND");
                         // FIXME: should we break for 1 issue or?
+                        zstr_free(&asset_partnumber);
                         break;
                     }
                     else {
-                        log_debug ("Template file found for %s", asset_partnumber);
-                        // Get info from template
-                        const char *manufacturer = s_get (sensor_template_file, "manufacturer", "");
-                        const char *type = s_get (sensor_template_file, "type", "");
-                        const char *normal_state = s_get (sensor_template_file, "normal-state", "");
-                        const char *gpx_direction = s_get (sensor_template_file, "gpx-direction", "");
-                        const char *alarm_severity = s_get (sensor_template_file, "alarm-severity", "");
-                        const char *alarm_message = s_get (sensor_template_file, "alarm-message", "");
+                        log_debug ("Template found for %s", asset_partnumber);
 
                         if (first) {
                             zmsg_addstr (reply, "OK");
                             first = false;
                         }
                         zmsg_addstr (reply, asset_partnumber);
-                        zmsg_addstr (reply, manufacturer);
-                        zmsg_addstr (reply, type);
-                        zmsg_addstr (reply, normal_state);
-                        zmsg_addstr (reply, gpx_direction);
-                        zmsg_addstr (reply, alarm_severity);
-                        zmsg_addstr (reply, alarm_message);
+                        zmsg_addstr (reply, sensor_template->manufacturer);
+                        zmsg_addstr (reply, sensor_template->type);
+                        zmsg_addstr (reply, sensor_template->normal_state);
+                        zmsg_addstr (reply, sensor_template->gpx_direction);
+                        zmsg_addstr (reply, sensor_template->alarm_severity);
+                        zmsg_addstr (reply, sensor_template->alarm_message);
                     }
 
                     // Get the next one, if there is one
-                    zconfig_destroy (&sensor_template_file);
+                    fty_sensor_gpio_template_destroy (&sensor_template);
                     zstr_free(&asset_partnumber);
                     asset_partnumber = zmsg_popstr (message);
                 }
             }
-            else {
-                // Send all templates
-                assert (self->template_dir);
-
-                zdir_t *dir = zdir_new (self->template_dir, "-");
-                if (!dir) {
-                    //log_error ("zdir_new (path = '%s', parent = '-') failed.", self->template_dir);
-                    return;
-                }
-
-                zlist_t *files = zdir_list (dir);
-                if (!files) {
-                    zdir_destroy (&dir);
-                    //log_error ("zdir_list () failed.");
-                    return;
-                }
-
-                std::regex file_rex (".+\\.tpl");
-
-                zfile_t *item = (zfile_t *) zlist_first (files);
-                if (item)
-                    zmsg_addstr (reply, "OK");
-                while (item) {
-                    if (std::regex_match (zfile_filename (item, self->template_dir), file_rex)) {
-                        log_debug ("%s matched", zfile_filename (item, self->template_dir));
-                        string template_filename = zfile_filename (item, NULL);
-
-                        string asset_partnumber = zfile_filename (item, self->template_dir);
-                        asset_partnumber.erase (asset_partnumber.size () - 4);
-
-                        // We have a GPIO sensor, process it
-                        zconfig_t *sensor_template_file = zconfig_load (template_filename.c_str());
-
-                        // Get info from template
-                        const char *manufacturer = s_get (sensor_template_file, "manufacturer", "");
-                        const char *type = s_get (sensor_template_file, "type", "");
-                        const char *normal_state = s_get (sensor_template_file, "normal-state", "");
-                        const char *gpx_direction = s_get (sensor_template_file, "gpx-direction", "");
-                        const char *gpx_power_source = s_get (sensor_template_file, "power-source", "");
-                        const char *alarm_severity = s_get (sensor_template_file, "alarm-severity", "");
-                        const char *alarm_message = s_get (sensor_template_file, "alarm-message", "");
-
-                        zmsg_addstr (reply, asset_partnumber.c_str());
-                        zmsg_addstr (reply, manufacturer);
-                        if (subject == "GPIO_MANIFEST") {
-                            zmsg_addstr (reply, type);
-                            zmsg_addstr (reply, normal_state);
-                            zmsg_addstr (reply, gpx_direction);
-                            zmsg_addstr (reply, gpx_power_source);
-                            zmsg_addstr (reply, alarm_severity);
-                            zmsg_addstr (reply, alarm_message);
-                        }
-                        zconfig_destroy (&sensor_template_file);
-                    }
-                    item = (zfile_t *) zlist_next (files);
+            else if (self->templates) {
+                // Send all templates, from the replies prepared beforehand
+                s_update_manifests (self);
+                zmsg_t *manifest = (subject == "GPIO_MANIFEST") ? self->manifest : self->manifest_summary;
+                zframe_t *frame = zmsg_first (manifest);
+                while (frame) {
+                    zmsg_addmem (reply, zframe_data (frame), zframe_size (frame));
+                    frame = zmsg_next (manifest);
                 }
-                zlist_destroy (&files);
-                zdir_destroy (&dir);
             }
             // send the reply
             int rv = mlm_client_sendto (self->mlm, mlm_client_sender (self->mlm), subject.c_str(), NULL, 5000, &reply);
@@ -646,6 +1912,8 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
 
                     // Save the template
                     int rv = zconfig_save (root, template_filename.c_str());
+                    if ((rv == 0) && self->templates)
+                        fty_sensor_gpio_templates_update (self->templates, sensor_partnumber, root);
                     zconfig_destroy (&root);
 
                     // Prepare our answer
@@ -687,6 +1955,8 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
             // this means DELETE
             if (num_gpo_number == -1) {
                 zhashx_delete (self->gpo_states, (void *) assetname);
+                s_journal_gpo_state (self, assetname, NULL);
+                s_gpo_timed_cancel (self, assetname);
                 zstr_free (&assetname);
                 zstr_free (&gpo_number);
                 return;
@@ -694,6 +1964,9 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
 
             char *default_state = zmsg_popstr (message);
 
+            // GPO writes go ahead of the polling, at once, their errors
+            // are processed by s_handle_gpio_result
+            gpio_batch_t writes;
             gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, (void *) assetname);
             if (state != NULL) {
                 int num_default_state = libgpio_get_status_value (default_state);
@@ -701,30 +1974,20 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
                 if (state->default_state != num_default_state) {
                     state->default_state = num_default_state;
                     if (!state->in_alert) {
-                        int rv = libgpio_write (self->gpio_lib, state->gpo_number, num_default_state);
-                        if (rv) {
-                            log_error ("Error during default action %s on GPO #%d",
-                                        default_state,
-                                        state->gpo_number);
-                        }
+                        s_write_default_state (self, assetname, state->gpo_number, num_default_state, &writes);
                         state->last_action = num_default_state;
                     }
                 }
                 // did the port change?
                 if (state->gpo_number != num_gpo_number) {
                     // turn off the previous port
-                    int rv = libgpio_write (self->gpio_lib, state->gpo_number, GPIO_STATE_CLOSED);
-                    if (rv)
-                        log_error ("Error while closing no longer active GPO #%d", state->gpo_number);
+                    zmsg_t *context = s_gpio_context ("CLOSE", assetname);
+                    zmsg_addstrf (context, "%d", state->gpo_number);
+                    s_gpio_batch_add (&writes, state->gpo_number, GPIO_STATE_CLOSED, &context);
 
                     // do the default action on the new port
                     int num_default_state = libgpio_get_status_value (default_state);
-                    rv = libgpio_write (self->gpio_lib, num_gpo_number, num_default_state);
-                    if (rv) {
-                        log_error ("Error during default action %s on GPO #%d",
-                                    default_state,
-                                    state->gpo_number);
-                    }
+                    s_write_default_state (self, assetname, num_gpo_number, num_default_state, &writes);
                     state->gpo_number = num_gpo_number;
                     state->last_action = num_default_state;
                     state->in_alert = 0;
@@ -735,24 +1998,36 @@ s_handle_mailbox(fty_sensor_gpio_server_t* self, zmsg_t *message)
                 state->gpo_number = atoi (gpo_number);
                 state->default_state = libgpio_get_status_value (default_state);
                 // do the default action
-                int rv = libgpio_write (self->gpio_lib, state->gpo_number, state->default_state);
-                if (rv) {
-                    log_error ("Error during default action %s on GPO #%d",
-                                default_state,
-                                state->gpo_number);
-                    state->last_action = GPIO_STATE_UNKNOWN;
-                }
-                else
-                    state->last_action = libgpio_get_status_value (default_state);
+                s_write_default_state (self, assetname, state->gpo_number, state->default_state, &writes);
+                state->last_action = state->default_state;
                 state->in_alert = 0;
                 zhashx_update (self->gpo_states, (void *) assetname, (void *) state);
             }
+            s_gpio_batch_submit (self, true, "WRITE_MANY", &writes);
+            s_journal_gpo_state (self, assetname, state);
 
             zstr_free (&assetname);
             zstr_free (&gpo_number);
             zstr_free (&default_state);
         }
 
+        else if (subject == "GPIO_STATS") {
+            char *zuuid = zmsg_popstr (message);
+            zmsg_addstr (reply, zuuid ? zuuid : "");
+            zmsg_addstr (reply, "OK");
+            zmsg_t *report = s_stats_report (self);
+            zframe_t *frame = zmsg_pop (report);
+            while (frame) {
+                zmsg_append (reply, &frame);
+                frame = zmsg_pop (report);
+            }
+            zmsg_destroy (&report);
+            int rv = mlm_client_sendto (self->mlm, mlm_client_sender (self->mlm), subject.c_str(), NULL, 5000, &reply);
+            if (rv != 0)
+                log_error ("%s:\tgpio: mlm_client_sendto failed", self->name);
+            zstr_free (&zuuid);
+        }
+
         else if (subject == "GPIO_TEST") {
             ;
         }
@@ -779,238 +2054,768 @@ fty_sensor_gpio_server_new (const char* name)
     self->name         = strdup(name);
     self->test_mode    = false;
     self->template_dir = NULL;
+    self->templates    = NULL;
+    self->manifest     = NULL;
+    self->manifest_summary = NULL;
+    self->manifest_generation = 0;
+    self->hw_cap_gpi   = NULL;
+    self->hw_cap_gpo   = NULL;
+    self->snapshot_path = NULL;
+    self->snapshot_generation = 0;
+    self->snapshot_save = 0;
+    self->snapshot_backoff = SNAPSHOT_SAVE_DELAY;
 // FIXME: we should share access to libgpio for both -server and -asset
 // for the sanity checks on count/offset/...
     self->gpio_lib = libgpio_new ();
     assert (self->gpio_lib);
+    pthread_mutex_init (&self->gpio_lock, NULL);
+    // The GPIO I/O worker accounts its jobs in the statistics
+    self->stats = fty_sensor_gpio_stats_new ();
+    assert (self->stats);
+    self->gpio_worker = zactor_new (s_gpio_worker, self);
+    assert (self->gpio_worker);
     self->gpo_states   = zhashx_new ();
     zhashx_set_destructor (self->gpo_states, free_fn);
+    self->journal      = NULL;
+    self->edge_detection = false;
+    self->edge_check_interval = DEFAULT_EDGE_CHECK_INTERVAL;
+    self->edge_check_next = 0;
+    self->powering     = zhashx_new ();
+    zhashx_set_destructor (self->powering, free_fn);
+    self->heartbeat_interval = DEFAULT_HEARTBEAT_INTERVAL;
+    self->pins_generation = 0;
+    self->pins_sweep = 0;
+    self->poll_interval = 0;
+    self->poll_next = 0;
+    self->cycle_start = 0;
+    self->cycle_pending = 0;
+    self->cycle_count = 0;
+    self->cycle_overruns = 0;
+    self->cycle_missed = 0;
+    self->cycle_time_last = 0;
+    self->cycle_time_max = 0;
+    self->hw_cap_requests = zhashx_new ();
+    zhashx_set_destructor (self->hw_cap_requests, free_fn);
+    self->hw_cap_gpi_ok = false;
+    self->hw_cap_gpo_ok = false;
+    self->hw_cap_retry = 0;
+    self->hw_cap_backoff = HW_CAP_RETRY_MIN;
+    self->wheel = fty_sensor_gpio_wheel_new (GPO_TIMED_TICK, zclock_mono ());
+    assert (self->wheel);
+    self->timed = zhashx_new ();
+    zhashx_set_destructor (self->timed, s_gpo_timed_destroy);
+    self->rules = NULL;
     return self;
 }
 
-
+
+//  --------------------------------------------------------------------------
+//  Destroy the fty_sensor_gpio_server
+
+void
+fty_sensor_gpio_server_destroy (fty_sensor_gpio_server_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        fty_sensor_gpio_server_t *self = *self_p;
+
+        //  Free class properties
+        zactor_destroy (&self->gpio_worker);
+        fty_sensor_gpio_stats_destroy (&self->stats);
+        libgpio_destroy (&self->gpio_lib);
+        pthread_mutex_destroy (&self->gpio_lock);
+        zstr_free(&self->name);
+        mlm_client_destroy (&self->mlm);
+        if (self->template_dir)
+            zstr_free(&self->template_dir);
+        fty_sensor_gpio_templates_destroy (&self->templates);
+        zmsg_destroy (&self->manifest);
+        zmsg_destroy (&self->manifest_summary);
+        zconfig_destroy (&self->hw_cap_gpi);
+        zconfig_destroy (&self->hw_cap_gpo);
+        zstr_free (&self->snapshot_path);
+        zhashx_destroy (&self->gpo_states);
+        fty_sensor_gpio_journal_destroy (&self->journal);
+        zhashx_destroy (&self->powering);
+        zhashx_destroy (&self->hw_cap_requests);
+        // The wheel doesn't own the timed actions
+        zhashx_destroy (&self->timed);
+        fty_sensor_gpio_wheel_destroy (&self->wheel);
+        fty_sensor_gpio_rules_destroy (&self->rules);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Restore the GPO states replayed from the journal of state_file, and keep
+//  recording their changes there
+
+static void
+s_load_state_file (fty_sensor_gpio_server_t *self, const char *state_file)
+{
+    fty_sensor_gpio_journal_destroy (&self->journal);
+    if (!state_file)
+        // no state file - alright
+        return;
+    log_debug ("state file = %s", state_file);
+    self->journal = fty_sensor_gpio_journal_new (state_file);
+
+    // Drive all the GPOs at once
+    gpio_batch_t writes;
+    zhashx_t *records = fty_sensor_gpio_journal_states (self->journal);
+    fty_sensor_gpio_gpo_record_t *record = (fty_sensor_gpio_gpo_record_t *) zhashx_first (records);
+    while (record) {
+        const char *asset_name = (const char *) zhashx_cursor (records);
+        // existing GPO entry came from fty-sensor-gpio-assets, which takes precendence
+        gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, (void *)asset_name);
+
+        if (state != NULL) {
+            // did the port change?
+            if (state->gpo_number != record->gpo_number) {
+                // turn off the port from state file
+                zmsg_t *context = s_gpio_context ("CLOSE", asset_name);
+                zmsg_addstrf (context, "%d", record->gpo_number);
+                s_gpio_batch_add (&writes, record->gpo_number, GPIO_STATE_CLOSED, &context);
+                // default action on the new port was done when adding it
+            }
+        }
+        else {
+            state = (gpo_state_t *) zmalloc (sizeof (gpo_state_t));
+            state->gpo_number = record->gpo_number;
+            state->default_state = record->default_state;
+            // drive the GPO as it was last, which the journal kept up to
+            // date, or do the default action
+            state->last_action = (record->last_action != GPIO_STATE_UNKNOWN) ?
+                record->last_action : record->default_state;
+            state->in_alert = (state->last_action != state->default_state);
+            s_write_default_state (self, asset_name, state->gpo_number, state->last_action, &writes);
+            zhashx_update (self->gpo_states, (void *) asset_name, (void *) state);
+        }
+        record = (fty_sensor_gpio_gpo_record_t *) zhashx_next (records);
+    }
+    s_gpio_batch_submit (self, true, "WRITE_MANY", &writes);
+
+    // Record the GPOs received before the state file
+    gpo_state_t *state = (gpo_state_t *) zhashx_first (self->gpo_states);
+    while (state) {
+        s_journal_gpo_state (self, (const char *) zhashx_cursor (self->gpo_states), state);
+        state = (gpo_state_t *) zhashx_next (self->gpo_states);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Sync the GPO states journal, once its batch is due
+
+static void
+s_journal_sync_if_due (fty_sensor_gpio_server_t *self)
+{
+    if (!self->journal)
+        return;
+    int64_t deadline = fty_sensor_gpio_journal_sync_deadline (self->journal);
+    if ((deadline != 0) && (zclock_mono () >= deadline))
+        fty_sensor_gpio_journal_sync (self->journal);
+}
+
+//  --------------------------------------------------------------------------
+//  Copy the config tree src under parent (or as a new root if NULL)
+
+static zconfig_t *
+s_config_copy (zconfig_t *src, zconfig_t *parent)
+{
+    zconfig_t *copy = zconfig_new (zconfig_name (src), parent);
+    if (zconfig_value (src))
+        zconfig_set_value (copy, "%s", zconfig_value (src));
+    for (zconfig_t *child = zconfig_child (src); child; child = zconfig_next (child))
+        s_config_copy (child, copy);
+    return copy;
+}
+
+//  --------------------------------------------------------------------------
+//  Return true if both config trees have the same items, in the same order
+
+static bool
+s_config_equal (zconfig_t *a, zconfig_t *b)
+{
+    if (!a || !b)
+        return a == b;
+    const char *value_a = zconfig_value (a) ? zconfig_value (a) : "";
+    const char *value_b = zconfig_value (b) ? zconfig_value (b) : "";
+    if (!streq (zconfig_name (a), zconfig_name (b)) || !streq (value_a, value_b))
+        return false;
+    zconfig_t *child_a = zconfig_child (a);
+    zconfig_t *child_b = zconfig_child (b);
+    while (child_a && child_b) {
+        if (!s_config_equal (child_a, child_b))
+            return false;
+        child_a = zconfig_next (child_a);
+        child_b = zconfig_next (child_b);
+    }
+    return (child_a == NULL) && (child_b == NULL);
+}
+
+//  --------------------------------------------------------------------------
+//  Configure libgpio with the GPI or GPO capabilities (named "gpi" or "gpo"):
+//      count = <GPx count>
+//      base_address = <GPIO chipset base address>
+//      offset = <GPx offset>
+//      mapping
+//          p<port> = <pin>
+//  The server takes ownership of the capabilities, to keep them in its snapshot.
+//  libgpio is only reconfigured if they differ from the applied ones
+
+static void
+s_apply_hw_cap (fty_sensor_gpio_server_t *self, zconfig_t *hw_cap)
+{
+    bool gpi = streq (zconfig_name (hw_cap), "gpi");
+    const char *type = zconfig_name (hw_cap);
+    zconfig_t **hw_cap_p = gpi ? &self->hw_cap_gpi : &self->hw_cap_gpo;
+
+    if (s_config_equal (*hw_cap_p, hw_cap)) {
+        log_debug ("%s:\t%s capabilities unchanged", self->name, type);
+        zconfig_destroy (&hw_cap);
+        return;
+    }
+
+    pthread_mutex_lock (&self->gpio_lock);
+
+    // Process the GPx count
+    int ivalue = atoi (zconfig_get (hw_cap, "count", "0"));
+    log_debug ("%s count=%i", type, ivalue);
+    if (gpi)
+        libgpio_set_gpi_count (self->gpio_lib, ivalue);
+    else
+        libgpio_set_gpo_count (self->gpio_lib, ivalue);
+
+    if (ivalue == 0)
+        log_debug ("%s count is 0, no further processing", type);
+    else {
+        // Process the GPIO chipset base address
+        ivalue = atoi (zconfig_get (hw_cap, "base_address", "0"));
+        log_debug ("%s chipset base address: %i", type, ivalue);
+        libgpio_set_gpio_base_address (self->gpio_lib, ivalue);
+
+        // Process the offset of the GPI/O
+        ivalue = atoi (zconfig_get (hw_cap, "offset", "0"));
+        log_debug ("%s offset=%i", type, ivalue);
+        if (gpi)
+            libgpio_set_gpi_offset (self->gpio_lib, ivalue);
+        else
+            libgpio_set_gpo_offset (self->gpio_lib, ivalue);
+
+        // Process port mapping
+        zconfig_t *mapping = zconfig_locate (hw_cap, "mapping");
+        for (zconfig_t *item = mapping ? zconfig_child (mapping) : NULL; item; item = zconfig_next (item)) {
+            // GPx pin name
+            // drop the port descriptor because zconfig is stupid and
+            // doesn't allow number as a key
+            const std::string port_str (zconfig_name (item) + 1, 1);
+            // convert to int
+            int port_num = (int) strtol (port_str.c_str (), NULL, 10);
+            // GPx pin number
+            int pin_num = (int) strtol (zconfig_value (item), NULL, 10);
+            if (gpi)
+                libgpio_add_gpi_mapping (self->gpio_lib, port_num, pin_num);
+            else
+                libgpio_add_gpo_mapping (self->gpio_lib, port_num, pin_num);
+        }
+    }
+    pthread_mutex_unlock (&self->gpio_lock);
+
+    zconfig_destroy (hw_cap_p);
+    *hw_cap_p = hw_cap;
+    // Save the snapshot again
+    self->snapshot_generation = (uint64_t) -1;
+    // Monitoring can start as soon as both GPI and GPO are configured, from
+    // the local hardware profile, the snapshot or fty-info
+    if (self->hw_cap_gpi && self->hw_cap_gpo)
+        hw_cap_inited = true;
+}
+
+//  --------------------------------------------------------------------------
+//  Save the monitored sensors and the HW capabilities into the snapshot, if
+//  they changed since the last save
+
+static void
+s_save_snapshot (fty_sensor_gpio_server_t *self)
+{
+    gpx_table_ptr gpx_table = get_gpx_table ();
+    uint64_t generation = gpx_table ? gpx_table->generation : 0;
+    if (!self->snapshot_path || (self->snapshot_generation == generation))
+        return;
+
+    zconfig_t *root = zconfig_new ("root", NULL);
+    zconfig_set_comment (root, " Generated by fty-sensor-gpio, do not edit");
+    zconfig_t *hw_cap = zconfig_new ("hw_cap", root);
+    if (self->hw_cap_gpi)
+        s_config_copy (self->hw_cap_gpi, hw_cap);
+    if (self->hw_cap_gpo)
+        s_config_copy (self->hw_cap_gpo, hw_cap);
+
+    zconfig_t *sensors = zconfig_new ("sensors", root);
+    for (size_t i = 0; gpx_table && (i < gpx_table->sensors.size ()); i++) {
+        _gpx_info_t *gpx_info = gpx_table->sensors [i].get ();
+        zconfig_t *sensor = zconfig_new (gpx_info->asset_name, sensors);
+        zconfig_put (sensor, "manufacturer", gpx_info->manufacturer ? gpx_info->manufacturer : "");
+        zconfig_put (sensor, "ext_name", gpx_info->ext_name ? gpx_info->ext_name : "");
+        zconfig_put (sensor, "part_number", gpx_info->part_number ? gpx_info->part_number : "");
+        zconfig_put (sensor, "type", gpx_info->type ? gpx_info->type : "");
+        zconfig_put (sensor, "normal_state", libgpio_get_status_string (gpx_info->normal_state).c_str ());
+        zconfig_put (sensor, "gpx_number", std::to_string (gpx_info->gpx_number).c_str ());
+        zconfig_put (sensor, "gpx_direction", (gpx_info->gpx_direction == GPIO_DIRECTION_OUT) ? "GPO" : "GPI");
+        zconfig_put (sensor, "parent", gpx_info->parent ? gpx_info->parent : "");
+        zconfig_put (sensor, "location", gpx_info->location ? gpx_info->location : "");
+        zconfig_put (sensor, "power_source", gpx_info->power_source ? gpx_info->power_source : "");
+        zconfig_put (sensor, "alarm_message", gpx_info->alarm_message ? gpx_info->alarm_message : "");
+        zconfig_put (sensor, "alarm_severity", gpx_info->alarm_severity ? gpx_info->alarm_severity : "");
+    }
+
+    // Timed GPO actions in progress, with wall clock times to survive restarts
+    zconfig_t *timed_actions = zconfig_new ("gpo_timed", root);
+    int64_t wall_offset = zclock_time () - zclock_mono ();
+    gpo_timed_t *timed = (gpo_timed_t *) zhashx_first (self->timed);
+    while (timed) {
+        zconfig_t *action = zconfig_new (timed->asset_name, timed_actions);
+        zconfig_put (action, "state", libgpio_get_status_string (timed->state).c_str ());
+        zconfig_put (action, "period", std::to_string (timed->period).c_str ());
+        zconfig_put (action, "end", std::to_string ((timed->end != 0) ? timed->end + wall_offset : 0).c_str ());
+        zconfig_put (action, "next", std::to_string (timed->next + wall_offset).c_str ());
+        timed = (gpo_timed_t *) zhashx_next (self->timed);
+    }
+
+    // Replace the previous snapshot at once, once written to disk
+    std::string tmp_path = std::string (self->snapshot_path) + ".tmp";
+    char *content = zconfig_str_save (root);
+    FILE *file = content ? fopen (tmp_path.c_str (), "w") : NULL;
+    int rv = -1;
+    if (file) {
+        rv = ((fputs (content, file) >= 0) && (fflush (file) == 0) && (fsync (fileno (file)) == 0)) ? 0 : -1;
+        fclose (file);
+    }
+    zstr_free (&content);
+    if ((rv == -1) || (rename (tmp_path.c_str (), self->snapshot_path) != 0)) {
+        // Retry later, rather than on each change or polling cycle
+        log_error ("%s:\tCan't save snapshot %s, retrying in %d msec", self->name,
+            self->snapshot_path, self->snapshot_backoff);
+        unlink (tmp_path.c_str ());
+        self->snapshot_save = zclock_mono () + self->snapshot_backoff;
+        self->snapshot_backoff *= 2;
+        if (self->snapshot_backoff > SNAPSHOT_RETRY_MAX)
+            self->snapshot_backoff = SNAPSHOT_RETRY_MAX;
+    }
+    else {
+        log_debug ("%s:\tSnapshot %s saved", self->name, self->snapshot_path);
+        self->snapshot_generation = generation;
+        self->snapshot_save = 0;
+        self->snapshot_backoff = SNAPSHOT_SAVE_DELAY;
+    }
+    zconfig_destroy (&root);
+}
+
+//  --------------------------------------------------------------------------
+//  Save the snapshot if it changed, unless its next save is not due yet
+
+static void
+s_save_snapshot_if_due (fty_sensor_gpio_server_t *self)
+{
+    if ((self->snapshot_save == 0) || (zclock_mono () >= self->snapshot_save))
+        s_save_snapshot (self);
+}
+
+//  --------------------------------------------------------------------------
+//  Restore the HW capabilities and the monitored sensors from the snapshot,
+//  so that monitoring resumes before fty-info and the asset agent answer.
+//  Return the number of restored sensors
+
+static int
+s_load_snapshot (fty_sensor_gpio_server_t *self)
+{
+    zconfig_t *root = zconfig_load (self->snapshot_path);
+    if (!root) {
+        log_debug ("%s:\tNo snapshot %s, starting empty", self->name, self->snapshot_path);
+        return 0;
+    }
+
+    zconfig_t *hw_cap = zconfig_locate (root, "hw_cap/gpi");
+    if (hw_cap)
+        s_apply_hw_cap (self, s_config_copy (hw_cap, NULL));
+    hw_cap = zconfig_locate (root, "hw_cap/gpo");
+    if (hw_cap)
+        s_apply_hw_cap (self, s_config_copy (hw_cap, NULL));
+
+    int count = 0;
+    zconfig_t *sensors = zconfig_locate (root, "sensors");
+    for (zconfig_t *sensor = sensors ? zconfig_child (sensors) : NULL; sensor; sensor = zconfig_next (sensor)) {
+        int rv = add_sensor (NULL, "restore",
+            zconfig_get (sensor, "manufacturer", ""), zconfig_name (sensor),
+            zconfig_get (sensor, "ext_name", ""), zconfig_get (sensor, "part_number", ""),
+            zconfig_get (sensor, "type", ""), zconfig_get (sensor, "normal_state", ""),
+            zconfig_get (sensor, "gpx_number", ""), zconfig_get (sensor, "gpx_direction", "GPI"),
+            zconfig_get (sensor, "parent", ""), zconfig_get (sensor, "location", ""),
+            zconfig_get (sensor, "power_source", ""), zconfig_get (sensor, "alarm_message", ""),
+            zconfig_get (sensor, "alarm_severity", ""));
+        if (rv == 0)
+            count++;
+    }
+
+    // Resume the timed GPO actions, those due meanwhile being done first
+    int64_t mono_offset = zclock_mono () - zclock_time ();
+    zconfig_t *timed_actions = zconfig_locate (root, "gpo_timed");
+    for (zconfig_t *action = timed_actions ? zconfig_child (timed_actions) : NULL; action; action = zconfig_next (action)) {
+        int state = libgpio_get_status_value (zconfig_get (action, "state", ""));
+        int period = atoi (zconfig_get (action, "period", "0"));
+        int64_t end = atoll (zconfig_get (action, "end", "0"));
+        int64_t next = atoll (zconfig_get (action, "next", "0"));
+        if ((state == GPIO_STATE_UNKNOWN) || (next == 0) || ((end != 0) && (period <= 0))) {
+            log_warning ("%s:\tInvalid timed action of '%s' in snapshot, ignoring", self->name, zconfig_name (action));
+            continue;
+        }
+        s_gpo_timed_schedule (self, zconfig_name (action), state, period,
+            (end != 0) ? end + mono_offset : 0, next + mono_offset);
+    }
+    zconfig_destroy (&root);
+    log_info ("%s:\t%d sensors restored from snapshot %s", self->name, count, self->snapshot_path);
+
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Apply the GPI/GPO capabilities of a fty-info reply or of the local
+//  hardware profile, from its type frame:
+//      'type'/'count'/'base_address'/'offset'/'mapping1'/'mapping_val1'/...
+//  Return 1 on error, 0 otherwise
+
+static int
+s_hw_cap_apply_reply (fty_sensor_gpio_server_t *self, const char *type, zmsg_t *reply)
+{
+    // sanity check on type requested Vs received
+    char *value = zmsg_popstr (reply);
+    if (!value || !streq (value, type)) {
+        log_error ("%s: mismatch in reply on the type received (should be %s ; is %s)",
+            self->name, type, value ? value : "");
+        zstr_free (&value);
+        return 1;
+    }
+    zstr_free (&value);
+
+    // Convert the GPx count, chipset base address, offset and port mapping
+    zconfig_t *hw_cap = zconfig_new (type, NULL);
+    value = zmsg_popstr (reply);
+    zconfig_put (hw_cap, "count", value ? value : "0");
+    if (atoi (value ? value : "0") != 0) {
+        zstr_free (&value);
+        value = zmsg_popstr (reply);
+        zconfig_put (hw_cap, "base_address", value ? value : "0");
+        zstr_free (&value);
+        value = zmsg_popstr (reply);
+        zconfig_put (hw_cap, "offset", value ? value : "0");
+        zstr_free (&value);
+        // Pop the first pin name
+        value = zmsg_popstr (reply);
+        while (value) {
+            char *pin = zmsg_popstr (reply);
+            zconfig_put (hw_cap, (std::string ("mapping/") + value).c_str (), pin ? pin : "0");
+            zstr_free (&pin);
+            zstr_free (&value);
+            // Pop the next pin name
+            value = zmsg_popstr (reply);
+        }
+    }
+    zstr_free (&value);
+
+    s_apply_hw_cap (self, hw_cap);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Remember that fty-info provided the capabilities of type in this
+//  negotiation
+
+static void
+s_hw_cap_received (fty_sensor_gpio_server_t *self, const char *type)
+{
+    if (streq (type, "gpi"))
+        self->hw_cap_gpi_ok = true;
+    else
+        self->hw_cap_gpo_ok = true;
+}
+
 //  --------------------------------------------------------------------------
-//  Destroy the fty_sensor_gpio_server
+//  End the HW_CAP negotiation once both GPI and GPO capabilities are applied
 
-void
-fty_sensor_gpio_server_destroy (fty_sensor_gpio_server_t **self_p)
+static void
+s_hw_cap_check_done (fty_sensor_gpio_server_t *self)
 {
-    assert (self_p);
-    if (*self_p) {
-        fty_sensor_gpio_server_t *self = *self_p;
+    if (!self->hw_cap_gpi_ok || !self->hw_cap_gpo_ok)
+        return;
 
-        //  Free class properties
-        libgpio_destroy (&self->gpio_lib);
-        zstr_free(&self->name);
-        mlm_client_destroy (&self->mlm);
-        if (self->template_dir)
-            zstr_free(&self->template_dir);
-        zhashx_destroy (&self->gpo_states);
-        //  Free object itself
-        free (self);
-        *self_p = NULL;
-    }
+    log_debug ("HW_CAP request succeeded");
+    // Late replies to the previous rounds are now ignored
+    zhashx_purge (self->hw_cap_requests);
+    self->hw_cap_retry = 0;
+    hw_cap_inited = true;
 }
 
+//  --------------------------------------------------------------------------
+//  Request GPI/GPO capabilities from fty-info, without waiting for the reply.
+//  The request is remembered by its zuuid, to match the reply
+
 static void
-s_load_state_file (fty_sensor_gpio_server_t *self, const char *state_file)
+s_hw_cap_request (fty_sensor_gpio_server_t *self, const char *type)
 {
-    if (!state_file)
-        // no state file - alright
-        return;
-    log_debug ("state file = %s", state_file);
-    FILE *f_state = fopen (state_file, "r");
-    if (!f_state) {
-        log_warning ("Could not load state file, continuing without it...");
-        return;
+    log_debug ("%s:\tRequest GPIO capabilities info for '%s'", self->name, type);
+
+    zuuid_t *uuid = zuuid_new ();
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, "HW_CAP");
+    zmsg_addstr (msg, zuuid_str_canonical (uuid));
+    zmsg_addstr (msg, type);
+
+    int rv = mlm_client_sendto (self->mlm, "fty-info", "info", NULL, 5000, &msg);
+    if (rv != 0) {
+        log_error ("%s:\tRequest %s sensors list failed", self->name, type);
+        zmsg_destroy (&msg);
     }
-    char asset_name[15]; //gpo-[0-9]{10} + terminator, which should be enough for DB UINT
-    int gpo_number = -1;
-    int default_state = -1;
-    int last_action = -1;
-    // line read successfully - all 4 items are there
-    while (fscanf (f_state, "%14s %3d %d %d", asset_name, &gpo_number, &default_state, &last_action) == 4) {
-        // existing GPO entry came from fty-sensor-gpio-assets, which takes precendence
-        gpo_state_t *state = (gpo_state_t *) zhashx_lookup (self->gpo_states, (void *)asset_name);
+    else {
+        log_debug ("%s: %s capability request sent successfully", self->name, type);
+        zhashx_insert (self->hw_cap_requests, zuuid_str_canonical (uuid), strdup (type));
+    }
+    zuuid_destroy (&uuid);
+}
 
-        if (state != NULL) {
-            // did the port change?
-            if (state->gpo_number != gpo_number) {
-                    // turn off the port from state file
-                    int rv = libgpio_write (self->gpio_lib, gpo_number, GPIO_STATE_CLOSED);
-                    if (rv)
-                        log_error ("Error while closing no longer active GPO #%d", state->gpo_number);
-                    // default action on the new port was done when adding it
-                }
-            }
-            else {
-                state = (gpo_state_t *) zmalloc (sizeof (gpo_state_t));
-                state->gpo_number = gpo_number;
-                state->default_state = default_state;
-                // do the default action
-                int rv = libgpio_write (self->gpio_lib, state->gpo_number, state->default_state);
-                if (rv) {
-                    log_error ("Error during default action %s on GPO #%d",
-                                libgpio_get_status_string (default_state).c_str (),
-                                state->gpo_number);
-                    state->last_action = GPIO_STATE_UNKNOWN;
-                }
-                else
-                    state->last_action = default_state;
-                state->in_alert = 0;
+//  --------------------------------------------------------------------------
+//  Request the capabilities not received yet, all at once, and schedule the
+//  next round in case fty-info doesn't answer
 
-                char *asset_name_key = strdup (asset_name);
-                zhashx_update (self->gpo_states, (void *) asset_name_key, (void *) state);
-            }
+static void
+s_hw_cap_negotiate (fty_sensor_gpio_server_t *self)
+{
+    if (self->test_mode) {
+        // Use the forged replies
+        if (!self->hw_cap_gpi_ok && hw_cap_test_reply_gpi
+            && (s_hw_cap_apply_reply (self, "gpi", hw_cap_test_reply_gpi) == 0))
+            s_hw_cap_received (self, "gpi");
+        zmsg_destroy (&hw_cap_test_reply_gpi);
+        if (!self->hw_cap_gpo_ok && hw_cap_test_reply_gpo
+            && (s_hw_cap_apply_reply (self, "gpo", hw_cap_test_reply_gpo) == 0))
+            s_hw_cap_received (self, "gpo");
+        zmsg_destroy (&hw_cap_test_reply_gpo);
+    }
+    else {
+        if (!self->hw_cap_gpi_ok)
+            s_hw_cap_request (self, "gpi");
+        if (!self->hw_cap_gpo_ok)
+            s_hw_cap_request (self, "gpo");
     }
 
-    fclose (f_state);
+    self->hw_cap_retry = zclock_mono () + self->hw_cap_backoff;
+    self->hw_cap_backoff *= 2;
+    if (self->hw_cap_backoff > HW_CAP_RETRY_MAX)
+        self->hw_cap_backoff = HW_CAP_RETRY_MAX;
+    s_hw_cap_check_done (self);
 }
 
+//  --------------------------------------------------------------------------
+//  Start a new HW_CAP negotiation, to (re)configure both GPI and GPO
+
 static void
-s_save_state_file (fty_sensor_gpio_server_t *self, const char *state_file)
+s_hw_cap_start (fty_sensor_gpio_server_t *self)
 {
-    FILE *f_state = fopen (state_file, "w");
+    zhashx_purge (self->hw_cap_requests);
+    self->hw_cap_gpi_ok = false;
+    self->hw_cap_gpo_ok = false;
+    self->hw_cap_backoff = HW_CAP_RETRY_MIN;
+    s_hw_cap_negotiate (self);
+}
 
-    gpo_state_t *state = (gpo_state_t *) zhashx_first (self->gpo_states);
-    while (state != NULL) {
-        const char *asset_name = (const char *) zhashx_cursor (self->gpo_states);
-        fprintf (f_state, "%s %d %d %d\n", asset_name, state->gpo_number, state->default_state, state->last_action);
-        state = (gpo_state_t *) zhashx_next (self->gpo_states);
-    }
+//  --------------------------------------------------------------------------
+//  Request the missing capabilities again, if fty-info didn't answer in time
+
+static void
+s_hw_cap_retry_if_due (fty_sensor_gpio_server_t *self)
+{
+    if ((self->hw_cap_retry == 0) || (zclock_mono () < self->hw_cap_retry))
+        return;
 
-    fclose (f_state);
+    log_debug ("%s:\tno HW_CAP reply for%s%s, requesting again", self->name,
+        self->hw_cap_gpi_ok ? "" : " gpi", self->hw_cap_gpo_ok ? "" : " gpo");
+    s_hw_cap_negotiate (self);
 }
 
 //  --------------------------------------------------------------------------
-//  Request GPI/GPO capabilities from fty-info, to init our structures.
-//  Return 1 on error, 0 otherwise
-int
-request_capabilities_info(fty_sensor_gpio_server_t *self, const char *type)
+//  Process a mailbox message if it is the reply to one of our HW_CAP requests:
+//      'msg-correlation-id'/OK/'type'/...
+//      'msg-correlation-id'/ERROR/'reason'
+//  Replies to earlier rounds are still accepted, as long as the capabilities
+//  are missing. Return true if the message was an HW_CAP reply
+
+static bool
+s_hw_cap_handle_reply (fty_sensor_gpio_server_t *self, zmsg_t *message)
 {
-    log_debug ("%s:\tRequest GPIO capabilities info for '%s'", self->name, type);
-
-    // Sanity check
-    if ((!streq (type, "gpi")) && (!streq (type, "gpo"))) {
-        log_error ("only 'gpi' and 'gpo' are supported");
-        return 1;
+    if (zhashx_size (self->hw_cap_requests) == 0)
+        return false;
+
+    zframe_t *frame = zmsg_first (message);
+    char *uuid_recv = frame ? zframe_strdup (frame) : NULL;
+    const char *type = uuid_recv ? (const char *) zhashx_lookup (self->hw_cap_requests, uuid_recv) : NULL;
+    if (!type) {
+        zstr_free (&uuid_recv);
+        return false;
+    }
+    std::string type_str (type);
+    zhashx_delete (self->hw_cap_requests, uuid_recv);
+    zstr_free (&uuid_recv);
+    // Drop the zuuid, already matched
+    zframe_t *uuid_frame = zmsg_pop (message);
+    zframe_destroy (&uuid_frame);
+
+    char *status = zmsg_popstr (message);
+    if (!status || !streq (status, "OK")) {
+        char *reason = zmsg_popstr (message);
+        log_error ("%s: error message received %s", self->name, reason ? reason : "");
+        zstr_free (&reason);
+    }
+    else if ((type_str == "gpi") ? self->hw_cap_gpi_ok : self->hw_cap_gpo_ok)
+        log_debug ("%s:\t%s capabilities already received, ignoring reply", self->name, type_str.c_str ());
+    else if (s_hw_cap_apply_reply (self, type_str.c_str (), message) == 0) {
+        s_hw_cap_received (self, type_str.c_str ());
+        s_hw_cap_check_done (self);
     }
+    zstr_free (&status);
+    return true;
+}
 
-    zmsg_t *reply;
-    if (!self->test_mode) {
-        // Request HW_CAP info for <type>
-        zmsg_t *msg = zmsg_new ();
-        zuuid_t *uuid = zuuid_new ();
-        zmsg_addstr (msg, "HW_CAP");
-        zmsg_addstr (msg, zuuid_str_canonical (uuid));
-        zmsg_addstr (msg, type);
-
-        int rv = mlm_client_sendto (self->mlm, "fty-info", "info", NULL, 5000, &msg);
-        if (rv != 0) {
-            log_error ("%s:\tRequest %s sensors list failed", self->name, type);
-            zmsg_destroy (&msg);
-            zuuid_destroy (&uuid);
-            return 1;
-        }
-        else
-            log_debug ("%s: %s capability request sent successfully", self->name, type);
+//  --------------------------------------------------------------------------
+//  End the polling cycle in progress if all its reads are done, including
+//  the externally powered sensors, and account its duration
 
-        reply = my_mlm_client_recv (self->mlm, 5000);
-        if (!reply) {
-            log_error ("%s: no reply message received", self->name);
-            return 1;
-        }
+static void
+s_poll_cycle_check_end (fty_sensor_gpio_server_t *self)
+{
+    if ((self->cycle_start == 0) || (self->cycle_pending > 0) || (zhashx_size (self->powering) > 0))
+        return;
 
-        char *uuid_recv = zmsg_popstr(reply);
+    self->cycle_time_last = zclock_mono () - self->cycle_start;
+    if (self->cycle_time_last > self->cycle_time_max)
+        self->cycle_time_max = self->cycle_time_last;
+    fty_sensor_gpio_stats_record (self->stats, STATS_POLL_CYCLE, self->cycle_time_last * 1000);
+    self->cycle_start = 0;
+    log_debug ("%s:\tpolling cycle done in %d msec", self->name, (int) self->cycle_time_last);
+}
 
-        if (0 != strcmp (zuuid_str_canonical (uuid), uuid_recv)) {
-            log_debug ("%s: zuuid reply doesn't match request", self->name);
-            zmsg_destroy (&reply);
-            zstr_free (&uuid_recv);
-            return 1;
-        }
+//  --------------------------------------------------------------------------
+//  Start a polling cycle, unless the previous one is still in progress: the
+//  polling can't go faster than the sensors are read
 
-        if (streq (zmsg_popstr (reply), "ERROR")) {
-            char *reason = zmsg_popstr (reply);
-            log_error ("%s: error message received %s", self->name, reason);
-            return 1;
-        }
-    } else { // TEST mode
-        // Use the forged reply
-        if (streq (type, "gpi")) {
-            reply = hw_cap_test_reply_gpi;
-        } else if (streq (type, "gpo")) {
-            reply = hw_cap_test_reply_gpo;
-        }
+static void
+s_poll_cycle_start (fty_sensor_gpio_server_t *self)
+{
+    if (self->cycle_start != 0) {
+        self->cycle_overruns++;
+        log_warning ("%s:\tpolling cycle still in progress after %d msec, skipping one (%d skipped)",
+            self->name, (int) (zclock_mono () - self->cycle_start), (int) self->cycle_overruns);
+        return;
     }
+    self->cycle_start = zclock_mono ();
+    self->cycle_count++;
+    s_check_gpio_status (self);
+    s_save_snapshot_if_due (self);
+    s_poll_cycle_check_end (self);
+}
 
-    // sanity check on type requested Vs received
-    char *value = zmsg_popstr (reply);
-    if (!streq (value, type)) {
-        log_error ("%s: mismatch in reply on the type received (should be %s ; is %s)",
-            self->name, type, value);
-        zstr_free (&value);
-        return 1;
-    }
-    zstr_free (&value);
+//  --------------------------------------------------------------------------
+//  Start the polling cycle if its time has come. The ticks missed meanwhile
+//  are coalesced into this one, and the next one keeps the same schedule
 
-    // Process the GPx count
-    value = zmsg_popstr (reply);
-    int ivalue = atoi(value);
-    log_debug ("%s count=%i", type, ivalue);
-    if (streq (type, "gpi")) {
-        libgpio_set_gpi_count (self->gpio_lib, ivalue);
-    } else if (streq (type, "gpo")) {
-        libgpio_set_gpo_count (self->gpio_lib, ivalue);
-    }
-    zstr_free (&value);
+static void
+s_poll_if_due (fty_sensor_gpio_server_t *self)
+{
+    if (self->poll_interval <= 0)
+        return;
 
-    if (ivalue == 0) {
-        log_debug ("%s count is 0, no further processing", type);
-        return 0;
+    int64_t now = zclock_mono ();
+    if (now < self->poll_next)
+        return;
+
+    int64_t missed = (now - self->poll_next) / self->poll_interval;
+    if (missed > 0) {
+        self->cycle_missed += missed;
+        log_debug ("%s:\t%d polling ticks missed", self->name, (int) missed);
     }
+    self->poll_next += (missed + 1) * self->poll_interval;
+    s_poll_cycle_start (self);
+}
 
-    // Process the GPIO chipset base address
-    value = zmsg_popstr (reply);
-    ivalue = atoi(value);
-    log_debug ("%s chipset base address: %i", type, ivalue);
-    libgpio_set_gpio_base_address (self->gpio_lib, ivalue);
-    zstr_free (&value);
+//  --------------------------------------------------------------------------
+//  Do the steps of the timed GPO actions which are due
 
-    // Process the offset of the GPI/O
-    value = zmsg_popstr (reply);
-    ivalue = atoi(value);
-    log_debug ("%s offset=%i", type, ivalue);
-    if (streq (type, "gpi")) {
-        libgpio_set_gpi_offset (self->gpio_lib, ivalue);
-    } else if (streq (type, "gpo")) {
-        libgpio_set_gpo_offset (self->gpio_lib, ivalue);
+static void
+s_gpo_timed_run_due (fty_sensor_gpio_server_t *self)
+{
+    int64_t now = zclock_mono ();
+    gpo_timed_t *timed;
+    while ((timed = (gpo_timed_t *) fty_sensor_gpio_wheel_expire (self->wheel, now))) {
+        timed->timer = NULL;
+        if (s_gpo_timed_step (self, timed, now))
+            timed->timer = fty_sensor_gpio_wheel_add (self->wheel, timed->next, timed);
+        else {
+            zhashx_delete (self->timed, timed->asset_name);
+            s_snapshot_changed (self);
+        }
     }
-    zstr_free (&value);
+}
 
-    // Process port mapping
-    value = zmsg_popstr (reply);
-    while (value) {
-        // GPx pin name
-        // drop the port descriptor because zconfig is stupid and
-        // doesn't allow number as a key
-        const std::string port_str (value+1, 1);
-        // convert to int
-        int port_num = (int) strtol (port_str.c_str (), NULL, 10);
-        zstr_free (&value);
-        // GPx pin number
-        value = zmsg_popstr (reply);
-        int pin_num = (int) strtol (value, NULL, 10);
-        if (streq (type, "gpi"))
-            libgpio_add_gpi_mapping (self->gpio_lib, port_num, pin_num);
-        else
-            libgpio_add_gpo_mapping (self->gpio_lib, port_num, pin_num);
-        zstr_free (&value);
-        // Pop the next pin name
-        value = zmsg_popstr (reply);
+//  --------------------------------------------------------------------------
+//  Get the time to wait until the next polling cycle, the next externally
+//  powered sensor is ready, the next HW_CAP request round, the GPO states
+//  journal sync, the next step of a timed GPO action or the next snapshot
+//  save, whichever comes first
+
+static int
+s_server_timeout (fty_sensor_gpio_server_t *self)
+{
+    int timeout = s_powering_timeout (self);
+    int64_t now = zclock_mono ();
+
+    if (self->poll_interval > 0) {
+        int64_t poll_timeout = self->poll_next - now;
+        if (poll_timeout < 0)
+            poll_timeout = 0;
+        if ((timeout == TIMEOUT_MS) || (poll_timeout < timeout))
+            timeout = (int) poll_timeout;
     }
-    zmsg_destroy (&reply);
-    return 0;
+    if (self->hw_cap_retry != 0) {
+        int64_t retry_timeout = self->hw_cap_retry - now;
+        if (retry_timeout < 0)
+            retry_timeout = 0;
+        if ((timeout == TIMEOUT_MS) || (retry_timeout < timeout))
+            timeout = (int) retry_timeout;
+    }
+    int64_t sync_deadline = self->journal ? fty_sensor_gpio_journal_sync_deadline (self->journal) : 0;
+    if (sync_deadline != 0) {
+        int64_t sync_timeout = sync_deadline - now;
+        if (sync_timeout < 0)
+            sync_timeout = 0;
+        if ((timeout == TIMEOUT_MS) || (sync_timeout < timeout))
+            timeout = (int) sync_timeout;
+    }
+    int64_t timed_next = fty_sensor_gpio_wheel_next (self->wheel);
+    if (timed_next != -1) {
+        int64_t timed_timeout = timed_next - now;
+        if (timed_timeout < 0)
+            timed_timeout = 0;
+        if ((timeout == TIMEOUT_MS) || (timed_timeout < timeout))
+            timeout = (int) timed_timeout;
+    }
+    if ((self->snapshot_save != 0) && self->snapshot_path) {
+        int64_t save_timeout = self->snapshot_save - now;
+        if (save_timeout < 0)
+            save_timeout = 0;
+        if ((timeout == TIMEOUT_MS) || (save_timeout < timeout))
+            timeout = (int) save_timeout;
+    }
+    return timeout;
 }
 
 //  --------------------------------------------------------------------------
@@ -1024,26 +2829,53 @@ fty_sensor_gpio_server (zsock_t *pipe, void *args)
         log_error ("Adress for fty-sensor-gpio actor is NULL");
         return;
     }
-    char *state_file_path = NULL;
 
     fty_sensor_gpio_server_t *self = fty_sensor_gpio_server_new(name);
     assert (self);
 
-    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (self->mlm), NULL);
+    // GPIO events file descriptor, only set when edge detection is enabled
+    int gpio_event_fd = -1;
+
+    // SIGUSR1 file descriptor, to dump the statistics
+    int stats_signal_fd = s_stats_signal_open ();
+
+    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (self->mlm), self->gpio_worker, NULL);
     assert (poller);
+    // Raw file descriptors are polled through their address
+    if (stats_signal_fd != -1)
+        zpoller_add (poller, &stats_signal_fd);
 
     zsock_signal (pipe, 0);
     log_info ("%s_server: Started", self->name);
 
     while (!zsys_interrupted)
     {
-        void *which = zpoller_wait (poller, TIMEOUT_MS);
+        void *which = zpoller_wait (poller, s_server_timeout (self));
         if (which == NULL) {
             if (zpoller_terminated (poller) || zsys_interrupted) {
                 break;
             }
         }
-        if (which == pipe) {
+        s_check_powered_sensors (self);
+        s_poll_if_due (self);
+        s_hw_cap_retry_if_due (self);
+        s_journal_sync_if_due (self);
+        s_gpo_timed_run_due (self);
+        s_save_snapshot_if_due (self);
+        if (which == &gpio_event_fd) {
+            s_handle_gpio_events (self);
+        }
+        else if (which == &stats_signal_fd) {
+            s_stats_dump (self, stats_signal_fd);
+        }
+        else if (which == self->gpio_worker) {
+            zmsg_t *result = zmsg_recv (self->gpio_worker);
+            if (result)
+                s_handle_gpio_results (self, result);
+            zmsg_destroy (&result);
+            s_poll_cycle_check_end (self);
+        }
+        else if (which == pipe) {
             zmsg_t *message = zmsg_recv (pipe);
             char *cmd = zmsg_popstr (message);
             if (cmd) {
@@ -1082,30 +2914,155 @@ fty_sensor_gpio_server (zsock_t *pipe, void *args)
                 }
                 else if (streq (cmd, "TEST")) {
                     self->test_mode = true;
+                    pthread_mutex_lock (&self->gpio_lock);
                     libgpio_set_test_mode (self->gpio_lib, self->test_mode);
+                    pthread_mutex_unlock (&self->gpio_lock);
                     log_debug ("fty_sensor_gpio: TEST=true");
                 }
+                else if (streq (cmd, "BACKEND")) {
+                    char *backend = zmsg_popstr (message);
+                    char *chip_path = zmsg_popstr (message);
+                    int backend_value = backend ? libgpio_get_backend_value (backend) : -1;
+                    if (backend_value == -1)
+                        log_error ("%s:\tUnknown GPIO backend '%s'", self->name, backend ? backend : "");
+                    else {
+                        pthread_mutex_lock (&self->gpio_lock);
+                        libgpio_set_backend (self->gpio_lib, backend_value);
+                        if (chip_path && !streq (chip_path, ""))
+                            libgpio_set_chip_path (self->gpio_lib, chip_path);
+                        pthread_mutex_unlock (&self->gpio_lock);
+                        log_debug ("fty_sensor_gpio: using GPIO backend %s", backend);
+                    }
+                    zstr_free (&backend);
+                    zstr_free (&chip_path);
+                }
+                else if (streq (cmd, "SIMULATE")) {
+                    // Waveform of simulated pins: <pin>[-<last pin>] <waveform>
+                    char *pins = zmsg_popstr (message);
+                    char *waveform = zmsg_popstr (message);
+                    int first = -1;
+                    int last = -1;
+                    if (pins && (sscanf (pins, "%d-%d", &first, &last) == 1))
+                        last = first;
+                    pthread_mutex_lock (&self->gpio_lock);
+                    int rv = fty_sensor_gpio_sim_waveform (libgpio_get_sim (self->gpio_lib),
+                        first, last, waveform ? waveform : "");
+                    pthread_mutex_unlock (&self->gpio_lock);
+                    if (rv == -1)
+                        log_error ("%s:\tInvalid simulation of pins '%s'", self->name, pins ? pins : "");
+                    zstr_free (&pins);
+                    zstr_free (&waveform);
+                }
+                else if (streq (cmd, "EDGE_DETECTION")) {
+                    char *enabled = zmsg_popstr (message);
+                    self->edge_detection = enabled && streq (enabled, "true");
+                    // Check the GPIs at once, which watches them
+                    self->edge_check_next = 0;
+                    if (gpio_event_fd != -1)
+                        zpoller_remove (poller, &gpio_event_fd);
+                    pthread_mutex_lock (&self->gpio_lock);
+                    gpio_event_fd = self->edge_detection ? libgpio_get_event_fd (self->gpio_lib) : -1;
+                    pthread_mutex_unlock (&self->gpio_lock);
+                    if (gpio_event_fd != -1)
+                        zpoller_add (poller, &gpio_event_fd);
+                    if (self->edge_detection && (gpio_event_fd == -1))
+                        log_warning ("%s:\tGPI edge detection is not available, polling only", self->name);
+                    log_debug ("fty_sensor_gpio: EDGE_DETECTION=%s", enabled ? enabled : "");
+                    zstr_free (&enabled);
+                }
+                else if (streq (cmd, "HEARTBEAT")) {
+                    char *interval = zmsg_popstr (message);
+                    if (interval) {
+                        self->heartbeat_interval = atoi (interval);
+                        log_debug ("fty_sensor_gpio: HEARTBEAT=%i", self->heartbeat_interval);
+                    }
+                    zstr_free (&interval);
+                }
+                else if (streq (cmd, "EDGE_CHECK_INTERVAL")) {
+                    char *interval = zmsg_popstr (message);
+                    if (interval) {
+                        self->edge_check_interval = atoi (interval);
+                        log_debug ("fty_sensor_gpio: EDGE_CHECK_INTERVAL=%i", self->edge_check_interval);
+                    }
+                    zstr_free (&interval);
+                }
                 else if (streq (cmd, "UPDATE")) {
-                    s_check_gpio_status(self);
+                    // Check all the sensors, the watched GPIs too
+                    self->edge_check_next = 0;
+                    s_poll_cycle_start (self);
+                }
+                else if (streq (cmd, "POLL_INTERVAL")) {
+                    char *interval = zmsg_popstr (message);
+                    if (interval) {
+                        self->poll_interval = atoi (interval);
+                        self->poll_next = zclock_mono () + self->poll_interval;
+                        log_debug ("fty_sensor_gpio: POLL_INTERVAL=%i", self->poll_interval);
+                    }
+                    zstr_free (&interval);
+                }
+                else if (streq (cmd, "STATS")) {
+                    // Reply with the polling statistics
+                    zstr_sendx (pipe,
+                        std::to_string (self->cycle_count).c_str (),
+                        std::to_string (self->cycle_overruns).c_str (),
+                        std::to_string (self->cycle_missed).c_str (),
+                        std::to_string (self->cycle_time_last).c_str (),
+                        std::to_string (self->cycle_time_max).c_str (),
+                        NULL);
                 }
                 else if (streq (cmd, "TEMPLATE_DIR")) {
+                    zstr_free (&self->template_dir);
+                    fty_sensor_gpio_templates_destroy (&self->templates);
                     self->template_dir = zmsg_popstr (message);
                     log_debug ("fty_sensor_gpio: Using sensors template directory: %s", self->template_dir);
+                    if (self->template_dir)
+                        self->templates = fty_sensor_gpio_templates_new (self->template_dir);
+                    zmsg_destroy (&self->manifest);
                 }
-                else if (streq (cmd, "HW_CAP")) {
-                    // Request our config
-                    int rvi = request_capabilities_info(self, "gpi");
-                    int rvo = request_capabilities_info(self, "gpo");
-                    // We can now stop the reschedule loop
-                    if (!rvi && !rvo) {
-                        log_debug ("HW_CAP request succeeded");
-                        hw_cap_inited = true;
+                else if (streq (cmd, "HW_PROFILE")) {
+                    // Local hardware profile, in the HW_CAP reply format
+                    zframe_t *frame = zmsg_first (message);
+                    char *type = frame ? zframe_strdup (frame) : NULL;
+                    if (type && (streq (type, "gpi") || streq (type, "gpo")))
+                        s_hw_cap_apply_reply (self, type, message);
+                    else
+                        log_error ("%s:\tInvalid hardware profile type '%s'", self->name, type ? type : "");
+                    zstr_free (&type);
+                }
+                else if (streq (cmd, "RULES")) {
+                    // Compile the reflex rules of the config file
+                    char *config_file = zmsg_popstr (message);
+                    zconfig_t *config = config_file ? zconfig_load (config_file) : NULL;
+                    fty_sensor_gpio_rules_destroy (&self->rules);
+                    if (config) {
+                        self->rules = fty_sensor_gpio_rules_new (zconfig_locate (config, "rules"));
+                        log_info ("%s:\t%d reflex rules loaded from %s", self->name,
+                            (int) fty_sensor_gpio_rules_size (self->rules), config_file);
                     }
+                    else
+                        log_error ("%s:\tCan't load reflex rules from '%s'", self->name, config_file ? config_file : "");
+                    zconfig_destroy (&config);
+                    zstr_free (&config_file);
+                }
+                else if (streq (cmd, "HW_CAP")) {
+                    // Request our config, the replies come in the mailbox.
+                    // This only refreshes the local profile or the snapshot
+                    s_hw_cap_start (self);
                 }
                 else if (streq (cmd, "STATEFILE")) {
                     char *state_file = zmsg_popstr (message);
+                    // Restore the HW capabilities before acting on GPOs
+                    int restored = 0;
+                    zstr_free (&self->snapshot_path);
+                    if (state_file) {
+                        self->snapshot_path = zsys_sprintf ("%s.snapshot", state_file);
+                        restored = s_load_snapshot (self);
+                    }
                     s_load_state_file (self, state_file);
-                    state_file_path = state_file;
+                    zstr_free (&state_file);
+                    // Resume monitoring right away, as a polling cycle
+                    if (restored > 0)
+                        s_poll_cycle_start (self);
                 }
                 else {
                     log_warning ("\tUnknown API command=%s, ignoring", cmd);
@@ -1117,17 +3074,23 @@ fty_sensor_gpio_server (zsock_t *pipe, void *args)
         else if (which == mlm_client_msgpipe (self->mlm)) {
             zmsg_t *message = mlm_client_recv (self->mlm);
             if (streq (mlm_client_command (self->mlm), "MAILBOX DELIVER")) {
-                // someone is addressing us directly
-                s_handle_mailbox(self, message);
+                // someone is addressing us directly, or fty-info replies
+                if (!s_hw_cap_handle_reply (self, message)) {
+                    int histogram = s_mailbox_histogram (mlm_client_subject (self->mlm));
+                    int64_t start = zclock_usecs ();
+                    s_handle_mailbox(self, message);
+                    fty_sensor_gpio_stats_record (self->stats, histogram, zclock_usecs () - start);
+                }
             }
             zmsg_destroy (&message);
         }
     }
 exit:
-    if (!self->test_mode)
-        s_save_state_file (self, state_file_path);
-    zstr_free (&state_file_path);
+    // The GPO states journal is compacted when destroyed
+    s_save_snapshot (self);
     zpoller_destroy (&poller);
+    if (stats_signal_fd != -1)
+        close (stats_signal_fd);
     fty_sensor_gpio_server_destroy(&self);
 }
 
@@ -1168,6 +3131,12 @@ fty_sensor_gpio_server_test (bool verbose)
     // created template!
     std::string template_dir = str_SELFTEST_DIR_RW + "/data/";
     zsys_dir_create (template_dir.c_str());
+    // SIGUSR1 is blocked in all the threads, as done by main, for the
+    // server to get it through its signalfd
+    sigset_t signals;
+    sigemptyset (&signals);
+    sigaddset (&signals, SIGUSR1);
+    pthread_sigmask (SIG_BLOCK, &signals, NULL);
     zactor_t *server = zactor_new (mlm_server, (void*) "Malamute");
     zstr_sendx (server, "BIND", endpoint, NULL);
 
@@ -1243,18 +3212,16 @@ fty_sensor_gpio_server_test (bool verbose)
     zsys_dir_create (gpo_mapping_sys_dir.c_str());
 
     // Acquire the list of monitored sensors
-    pthread_mutex_lock (&gpx_list_mutex);
-    zlistx_t *test_gpx_list = get_gpx_list();
-    assert (test_gpx_list);
-    int sensors_count = zlistx_size (test_gpx_list);
+    gpx_table_ptr test_gpx_table = get_gpx_table ();
+    assert (test_gpx_table);
+    int sensors_count = test_gpx_table->sensors.size ();
     assert (sensors_count == 2);
     // Test the first sensor
-/*    _gpx_info_t *gpx_info = (_gpx_info_t *)zlistx_first (test_gpx_list);
+/*    _gpx_info_t *gpx_info = test_gpx_table->sensors [0].get ();
     assert (gpx_info);
     // Modify the current_state
-    gpx_info->current_state = GPIO_STATE_OPENED;
+    gpx_info->state->current_state = GPIO_STATE_OPENED;
 */
-    pthread_mutex_unlock (&gpx_list_mutex);
 
     zmsg_t *msg = zmsg_new ();
     zmsg_addstr (msg, "sensorgpio-11");
@@ -1486,7 +3453,58 @@ fty_sensor_gpio_server_test (bool verbose)
         assert ( readbuf[0] == '1' ); // 1 == GPIO_STATE_OPENED
     }
 
-    // Test #7: Disable all GPI/GPO (as on OVA),
+    // Test #7: Add an externally powered GPI, and check that it is published
+    // once powered, after the other sensors of the cycle.
+    // Unchanged sensors are not published again before the heartbeat
+    {
+        rv = add_sensor(assets_self, "create",
+            "Eaton", "sensorgpio-13", "GPIO-Sensor-Powered1",
+            "DCS001", "door-contact-sensor",
+            "closed", "5",
+            "GPI", "IPC1", "Rack1", "1",
+            "Door has been $status", "WARNING");
+        assert (rv == 0);
+
+        // GPI 5 is pin 492
+        std::string gpi5_sys_dir = str_SELFTEST_DIR_RW + "/sys/class/gpio/gpio492";
+        zsys_dir_create (gpi5_sys_dir.c_str());
+        int handle = open ((gpi5_sys_dir + "/value").c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0777);
+        assert (handle >= 0);
+        int rc = write (handle, "1", 1);   // 1 == GPIO_STATE_OPENED
+        assert (rc == 1);
+        close (handle);
+
+        mlm_client_t *metrics_listener = mlm_client_new ();
+        mlm_client_connect (metrics_listener, endpoint, 1000, "fty_sensor_gpio_metrics_listener");
+        mlm_client_set_consumer (metrics_listener, FTY_PROTO_STREAM_METRICS_SENSOR, ".*");
+        zclock_sleep (1000);
+        zstr_sendx (self, "UPDATE", endpoint, NULL);
+
+        // gpo-11 changed and gpo-12 is new, and they don't wait for the
+        // powered sensor, while sensorgpio-10 is unchanged
+        const char *expected[] = { "gpo-11", "gpo-12" };
+        for (int i = 0; i < 2; i++) {
+            zmsg_t *recv = mlm_client_recv (metrics_listener);
+            assert (recv);
+            fty_proto_t *frecv = fty_proto_decode (&recv);
+            assert (frecv);
+            assert (streq (fty_proto_aux_string (frecv, FTY_PROTO_METRICS_SENSOR_AUX_SNAME, NULL), expected[i]));
+            assert (streq (fty_proto_value (frecv), "opened"));
+            fty_proto_destroy (&frecv);
+        }
+        zmsg_t *recv = mlm_client_recv (metrics_listener);
+        assert (recv);
+        fty_proto_t *frecv = fty_proto_decode (&recv);
+        assert (frecv);
+        assert (streq (fty_proto_type (frecv), "status.GPI5"));
+        assert (streq (fty_proto_value (frecv), "opened"));
+        assert (streq (fty_proto_aux_string (frecv, FTY_PROTO_METRICS_SENSOR_AUX_SNAME, NULL), "sensorgpio-13"));
+        fty_proto_destroy (&frecv);
+
+        mlm_client_destroy (&metrics_listener);
+    }
+
+    // Test #8: Disable all GPI/GPO (as on OVA),
     // Create a sensor and verify that it fails
     {
         // Forge the HW_CAP messages
@@ -1510,6 +3528,614 @@ fty_sensor_gpio_server_test (bool verbose)
         assert (rv == 1);
     }
 
+    // Test #9: Restore a sensor and the HW capabilities from the snapshot,
+    // then check that the snapshot is saved with the monitored sensors
+    {
+        std::string state_file = str_SELFTEST_DIR_RW + "/state";
+        std::string snapshot_file = state_file + ".snapshot";
+        zconfig_t *snapshot = zconfig_new ("root", NULL);
+        zconfig_put (snapshot, "hw_cap/gpi/count", "10");
+        zconfig_put (snapshot, "hw_cap/gpi/base_address", "488");
+        zconfig_put (snapshot, "hw_cap/gpi/offset", "-1");
+        zconfig_put (snapshot, "hw_cap/gpo/count", "5");
+        zconfig_put (snapshot, "hw_cap/gpo/base_address", "488");
+        zconfig_put (snapshot, "hw_cap/gpo/offset", "0");
+        zconfig_put (snapshot, "hw_cap/gpo/mapping/p4", "502");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/manufacturer", "Eaton");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/ext_name", "GPIO-Sensor-Door3");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/part_number", "DCS001");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/type", "door-contact-sensor");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/normal_state", "closed");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/gpx_number", "6");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/gpx_direction", "GPI");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/parent", "IPC1");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/alarm_message", "Door has been $status");
+        zconfig_put (snapshot, "sensors/sensorgpio-30/alarm_severity", "WARNING");
+        rv = zconfig_save (snapshot, snapshot_file.c_str ());
+        assert (rv == 0);
+        zconfig_destroy (&snapshot);
+
+        zstr_sendx (self, "STATEFILE", state_file.c_str (), NULL);
+        zclock_sleep (500);
+
+        // Sensors can be added again, since HW capabilities are restored
+        assert (libgpio_get_gpi_count () == 10);
+        gpx_table_ptr gpx_table = get_gpx_table ();
+        _gpx_info_t *gpx_info = get_gpx_info (gpx_table, "sensorgpio-30");
+        assert (gpx_info);
+        assert (gpx_info->restored);
+        assert (gpx_info->gpx_number == 6);
+        assert (gpx_info->normal_state == GPIO_STATE_CLOSED);
+        assert (streq (gpx_info->alarm_message, "Door has been $status"));
+
+        // The asset agent takes precedence over the snapshot
+        rv = add_sensor(assets_self, "inventory",
+            "Eaton", "sensorgpio-30", "GPIO-Sensor-Door3",
+            "DCS001", "door-contact-sensor",
+            "opened", "6",
+            "GPI", "IPC1", "Rack1", "",
+            "Door has been $status", "WARNING");
+        assert (rv == 0);
+        gpx_table = get_gpx_table ();
+        gpx_info = get_gpx_info (gpx_table, "sensorgpio-30");
+        assert (gpx_info);
+        assert (!gpx_info->restored);
+        assert (gpx_info->normal_state == GPIO_STATE_OPENED);
+
+        zstr_sendx (self, "UPDATE", NULL);
+        zclock_sleep (500);
+        snapshot = zconfig_load (snapshot_file.c_str ());
+        assert (snapshot);
+        assert (streq (zconfig_get (snapshot, "hw_cap/gpo/mapping/p4", ""), "502"));
+        assert (streq (zconfig_get (snapshot, "sensors/sensorgpio-30/normal_state", ""), "opened"));
+        assert (streq (zconfig_get (snapshot, "sensors/gpo-11/gpx_direction", ""), "GPO"));
+        assert (streq (zconfig_get (snapshot, "sensors/gpo-11/gpx_number", ""), "2"));
+        zconfig_destroy (&snapshot);
+    }
+
+    // Test #10: GPIO jobs are run by the I/O worker, urgent ones going ahead
+    // of the bulk ones queued before, alone or in batch
+    {
+        fty_sensor_gpio_server_t *server = fty_sensor_gpio_server_new ("gpio-io-test");
+        assert (server);
+        libgpio_set_test_mode (server->gpio_lib, true);
+
+        // Hold the GPIO access, while queuing the jobs
+        pthread_mutex_lock (&server->gpio_lock);
+        for (int i = 0; i < 3; i++) {
+            zmsg_t *context = s_gpio_context ("STATUS", "bulk");
+            s_gpio_submit (server, false, "READ", 1, GPIO_DIRECTION_IN, &context);
+        }
+        zmsg_t *context = s_gpio_context ("STATUS", "urgent");
+        s_gpio_submit (server, true, "READ", 1, GPIO_DIRECTION_IN, &context);
+        zclock_sleep (100);
+        pthread_mutex_unlock (&server->gpio_lock);
+
+        // At most the bulk job in progress is run before the urgent one
+        int urgent_rank = -1;
+        for (int i = 0; i < 4; i++) {
+            zmsg_t *result = zmsg_recv (server->gpio_worker);
+            assert (result);
+            char *value = zmsg_popstr (result);
+            char *kind = zmsg_popstr (result);
+            char *asset_name = zmsg_popstr (result);
+            assert (streq (kind, "STATUS"));
+            if (streq (asset_name, "urgent"))
+                urgent_rank = i;
+            zstr_free (&value);
+            zstr_free (&kind);
+            zstr_free (&asset_name);
+            zmsg_destroy (&result);
+        }
+        assert ((urgent_rank == 0) || (urgent_rank == 1));
+
+        // A batch job returns the contexts of its jobs, in order
+        gpio_batch_t batch;
+        for (int gpo_number = 1; gpo_number <= 2; gpo_number++) {
+            context = s_gpio_context ("CLOSE", "batch");
+            zmsg_addstrf (context, "%d", gpo_number);
+            s_gpio_batch_add (&batch, gpo_number, GPIO_STATE_CLOSED, &context);
+        }
+        s_gpio_batch_submit (server, true, "WRITE_MANY", &batch);
+        assert (batch.numbers.empty () && !batch.contexts);
+        s_gpio_batch_submit (server, true, "READ_MANY", &batch);
+        zmsg_t *result = zmsg_recv (server->gpio_worker);
+        assert (result);
+        assert (zmsg_size (result) == 2 + 2 * 4);
+        char *marker = zmsg_popstr (result);
+        assert (streq (marker, "MANY"));
+        zstr_free (&marker);
+        zframe_t *results = zmsg_first (result);
+        assert (zframe_size (results) == 2 * sizeof (int));
+        zframe_t *frame = zmsg_next (result);
+        assert (zframe_streq (frame, "3"));
+        frame = zmsg_next (result);
+        assert (zframe_streq (frame, "CLOSE"));
+        frame = zmsg_last (result);
+        assert (zframe_streq (frame, "2"));
+        zmsg_pushstr (result, "MANY");
+        s_handle_gpio_results (server, result);
+        zmsg_destroy (&result);
+        // The empty batch was not queued
+        zpoller_t *poller = zpoller_new (server->gpio_worker, NULL);
+        assert (zpoller_wait (poller, 200) == NULL);
+        zpoller_destroy (&poller);
+
+        // A snapshot job reports all its GPx as changed the first time
+        uint64_t snapshot_pins = 0x2;
+        zmsg_t *job = zmsg_new ();
+        zmsg_addstr (job, "URGENT");
+        zmsg_addstr (job, "READ_SNAPSHOT");
+        zmsg_addstrf (job, "%d", GPIO_DIRECTION_IN);
+        zmsg_addmem (job, &snapshot_pins, sizeof (snapshot_pins));
+        zmsg_addmem (job, &snapshot_pins, sizeof (snapshot_pins));
+        zmsg_addstr (job, "0");
+        assert (zmsg_send (&job, server->gpio_worker) == 0);
+        result = zmsg_recv (server->gpio_worker);
+        assert (result);
+        assert (zmsg_size (result) == 6);
+        frame = zmsg_first (result);
+        assert (zframe_streq (frame, "SNAPSHOT"));
+        frame = zmsg_next (result);
+        assert (*(uint64_t *) zframe_data (frame) == snapshot_pins);
+        frame = zmsg_next (result);
+        frame = zmsg_next (result);
+        frame = zmsg_next (result);
+        assert (zframe_size (frame) == sizeof (uint64_t));
+        assert (*(uint64_t *) zframe_data (frame) == snapshot_pins);
+        // followed by its context
+        frame = zmsg_last (result);
+        assert (zframe_streq (frame, "0"));
+        zmsg_destroy (&result);
+
+        fty_sensor_gpio_server_destroy (&server);
+    }
+
+    // Test #11: Polling schedule, with missed ticks coalesced and cycles
+    // skipped while the previous one is in progress
+    {
+        // SIGUSR1 only dumps the statistics, the server still answers
+        assert (kill (getpid (), SIGUSR1) == 0);
+        // UPDATE requests were processed as polling cycles, or as overruns
+        zstr_sendx (self, "STATS", NULL);
+        char *cycles = NULL, *overruns = NULL, *missed = NULL, *time_last = NULL, *time_max = NULL;
+        int rv = zstr_recvx (self, &cycles, &overruns, &missed, &time_last, &time_max, NULL);
+        assert (rv == 5);
+        assert (atoi (cycles) + atoi (overruns) >= 2);
+        // and the signal was consumed by the server
+        sigset_t pending;
+        for (int i = 0; i < 100; i++) {
+            sigpending (&pending);
+            if (!sigismember (&pending, SIGUSR1))
+                break;
+            zclock_sleep (10);
+        }
+        assert (!sigismember (&pending, SIGUSR1));
+        zstr_free (&cycles);
+        zstr_free (&overruns);
+        zstr_free (&missed);
+        zstr_free (&time_last);
+        zstr_free (&time_max);
+
+        fty_sensor_gpio_server_t *server = fty_sensor_gpio_server_new ("gpio-poll-test");
+        assert (server);
+        int64_t now = zclock_mono ();
+        server->poll_interval = 100;
+        server->poll_next = now - 350;
+        // A read of the previous cycle is still in progress
+        server->cycle_start = now - 400;
+        server->cycle_pending = 1;
+        s_poll_if_due (server);
+        assert (server->cycle_missed == 3);
+        assert (server->cycle_overruns == 1);
+        assert (server->cycle_count == 0);
+        // The schedule goes on, from the original time
+        assert (server->poll_next == now + 50);
+
+        // Once done, the next tick starts a new cycle
+        server->cycle_pending = 0;
+        s_poll_cycle_check_end (server);
+        assert (server->cycle_start == 0);
+        assert (server->cycle_time_last >= 400);
+        assert (server->cycle_time_max == server->cycle_time_last);
+        server->poll_next = zclock_mono ();
+        s_poll_if_due (server);
+        assert (server->cycle_count == 1);
+        assert (server->cycle_overruns == 1);
+
+        // Only the results of the jobs queued by the cycle are accounted
+        server->cycle_start = zclock_mono ();
+        server->cycle_pending = 1;
+        for (int cycle = 0; cycle <= 1; cycle++) {
+            zmsg_t *result = zmsg_new ();
+            zmsg_addstr (result, "1");
+            zmsg_addstr (result, "STATUS");
+            zmsg_addstr (result, "gone");
+            zmsg_addstrf (result, "%d", cycle);
+            s_handle_gpio_result (server, result);
+            zmsg_destroy (&result);
+            assert (server->cycle_pending == 1 - cycle);
+        }
+        fty_sensor_gpio_server_destroy (&server);
+    }
+
+    // Test #12: HW_CAP replies are matched to the requests by their zuuid
+    {
+        fty_sensor_gpio_server_t *server = fty_sensor_gpio_server_new ("gpio-hwcap-test");
+        assert (server);
+        zhashx_insert (server->hw_cap_requests, "gpi-request", strdup ("gpi"));
+        zhashx_insert (server->hw_cap_requests, "gpo-request", strdup ("gpo"));
+        server->hw_cap_retry = zclock_mono () + HW_CAP_RETRY_MIN;
+
+        // Not a reply of ours, left to the mailbox handling
+        zmsg_t *reply = zmsg_new ();
+        zmsg_addstr (reply, "other-request");
+        zmsg_addstr (reply, "OK");
+        assert (!s_hw_cap_handle_reply (server, reply));
+        zmsg_destroy (&reply);
+
+        // The replies may come in any order
+        reply = zmsg_new ();
+        zmsg_addstr (reply, "gpo-request");
+        zmsg_addstr (reply, "OK");
+        zmsg_addstr (reply, "gpo");
+        zmsg_addstr (reply, "5");
+        zmsg_addstr (reply, "488");
+        zmsg_addstr (reply, "15");
+        assert (s_hw_cap_handle_reply (server, reply));
+        zmsg_destroy (&reply);
+        assert (server->hw_cap_gpo_ok && !server->hw_cap_gpi_ok);
+        assert (streq (zconfig_get (server->hw_cap_gpo, "offset", ""), "15"));
+        assert (server->hw_cap_retry != 0);
+
+        // An error waits for the next round
+        reply = zmsg_new ();
+        zmsg_addstr (reply, "gpi-request");
+        zmsg_addstr (reply, "ERROR");
+        zmsg_addstr (reply, "not ready");
+        assert (s_hw_cap_handle_reply (server, reply));
+        zmsg_destroy (&reply);
+        assert (!server->hw_cap_gpi_ok);
+
+        // A late reply of an earlier round is still accepted
+        zhashx_insert (server->hw_cap_requests, "gpi-request-2", strdup ("gpi"));
+        reply = zmsg_new ();
+        zmsg_addstr (reply, "gpi-request-2");
+        zmsg_addstr (reply, "OK");
+        zmsg_addstr (reply, "gpi");
+        zmsg_addstr (reply, "10");
+        zmsg_addstr (reply, "488");
+        zmsg_addstr (reply, "-1");
+        assert (s_hw_cap_handle_reply (server, reply));
+        zmsg_destroy (&reply);
+        assert (server->hw_cap_gpi_ok);
+        assert (streq (zconfig_get (server->hw_cap_gpi, "count", ""), "10"));
+        // Negotiation done, no more retry
+        assert (server->hw_cap_retry == 0);
+        assert (zhashx_size (server->hw_cap_requests) == 0);
+        fty_sensor_gpio_server_destroy (&server);
+    }
+
+    // Test #13: The local hardware profile configures libgpio, and HW_CAP
+    // replies only reconfigure it when they differ
+    {
+        fty_sensor_gpio_server_t *server = fty_sensor_gpio_server_new ("gpio-profile-test");
+        assert (server);
+        zmsg_t *profile = zmsg_new ();
+        zmsg_addstr (profile, "gpo");
+        zmsg_addstr (profile, "5");
+        zmsg_addstr (profile, "488");
+        zmsg_addstr (profile, "20");
+        zmsg_addstr (profile, "p4");
+        zmsg_addstr (profile, "502");
+        zmsg_t *reply = zmsg_dup (profile);
+        assert (s_hw_cap_apply_reply (server, "gpo", profile) == 0);
+        zmsg_destroy (&profile);
+        assert (streq (zconfig_get (server->hw_cap_gpo, "mapping/p4", ""), "502"));
+        assert (server->snapshot_generation == (uint64_t) -1);
+
+        // Same capabilities from fty-info: nothing to do
+        server->snapshot_generation = 0;
+        assert (s_hw_cap_apply_reply (server, "gpo", reply) == 0);
+        zmsg_destroy (&reply);
+        assert (server->snapshot_generation == 0);
+
+        // Different ones replace the profile
+        reply = zmsg_new ();
+        zmsg_addstr (reply, "gpo");
+        zmsg_addstr (reply, "5");
+        zmsg_addstr (reply, "488");
+        zmsg_addstr (reply, "15");
+        assert (s_hw_cap_apply_reply (server, "gpo", reply) == 0);
+        zmsg_destroy (&reply);
+        assert (streq (zconfig_get (server->hw_cap_gpo, "offset", ""), "15"));
+        assert (zconfig_locate (server->hw_cap_gpo, "mapping") == NULL);
+        assert (server->snapshot_generation == (uint64_t) -1);
+        fty_sensor_gpio_server_destroy (&server);
+    }
+
+    // Test #14: GPO states are restored as last driven, and their changes
+    // are journaled
+    {
+        std::string state_file = str_SELFTEST_DIR_RW + "/journal-server-state";
+        FILE *f_state = fopen (state_file.c_str (), "w");
+        assert (f_state);
+        fprintf (f_state, "gpo-20 3 %d %d\n", GPIO_STATE_CLOSED, GPIO_STATE_OPENED);
+        fclose (f_state);
+
+        fty_sensor_gpio_server_t *server = fty_sensor_gpio_server_new ("gpio-journal-test");
+        assert (server);
+        server->test_mode = true;
+        libgpio_set_test_mode (server->gpio_lib, true);
+        s_load_state_file (server, state_file.c_str ());
+        gpo_state_t *state = (gpo_state_t *) zhashx_lookup (server->gpo_states, "gpo-20");
+        assert (state);
+        assert (state->last_action == GPIO_STATE_OPENED);
+        assert (state->in_alert);
+        assert (fty_sensor_gpio_journal_sync_deadline (server->journal) == 0);
+
+        state->last_action = GPIO_STATE_CLOSED;
+        s_journal_gpo_state (server, "gpo-20", state);
+        assert (fty_sensor_gpio_journal_sync_deadline (server->journal) != 0);
+        fty_sensor_gpio_server_destroy (&server);
+
+        fty_sensor_gpio_journal_t *journal = fty_sensor_gpio_journal_new (state_file.c_str ());
+        fty_sensor_gpio_gpo_record_t *record = (fty_sensor_gpio_gpo_record_t *)
+            zhashx_lookup (fty_sensor_gpio_journal_states (journal), "gpo-20");
+        assert (record);
+        assert (record->last_action == GPIO_STATE_CLOSED);
+        fty_sensor_gpio_journal_destroy (&journal);
+        zsys_file_delete (state_file.c_str ());
+        zsys_file_delete ((state_file + ".journal").c_str ());
+    }
+
+    // Test #15: Timed GPO actions are stepped through the timing wheel, and
+    // resumed from the snapshot
+    {
+        std::string snapshot_file = str_SELFTEST_DIR_RW + "/timed.snapshot";
+        zsys_file_delete (snapshot_file.c_str ());
+        fty_sensor_gpio_server_t *server = fty_sensor_gpio_server_new ("gpio-timed-test");
+        assert (server);
+        server->test_mode = true;
+        libgpio_set_test_mode (server->gpio_lib, true);
+        server->snapshot_path = strdup (snapshot_file.c_str ());
+
+        // Blink 'gpo-11', closed by default, for 120 msec
+        int64_t now = zclock_mono ();
+        s_gpo_timed_schedule (server, "gpo-11", GPIO_STATE_OPENED, 50, now + 120, now);
+        s_gpo_timed_run_due (server);
+        gpo_timed_t *timed = (gpo_timed_t *) zhashx_lookup (server->timed, "gpo-11");
+        assert (timed);
+        assert (timed->state == GPIO_STATE_CLOSED);
+        assert (timed->next == now + 50);
+        assert (fty_sensor_gpio_wheel_size (server->wheel) == 1);
+        // Saved once the changes of the timed actions are gathered
+        assert (server->snapshot_save > now);
+        s_save_snapshot_if_due (server);
+        assert (!zsys_file_exists (snapshot_file.c_str ()));
+        server->snapshot_save = zclock_mono ();
+        s_save_snapshot_if_due (server);
+        assert (server->snapshot_save == 0);
+        zconfig_t *snapshot = zconfig_load (snapshot_file.c_str ());
+        assert (snapshot);
+        assert (streq (zconfig_get (snapshot, "gpo_timed/gpo-11/period", ""), "50"));
+        zconfig_destroy (&snapshot);
+
+        // Toggled, then driven back to its default state at the end
+        while (zhashx_size (server->timed) > 0) {
+            zclock_sleep (GPO_TIMED_TICK);
+            s_gpo_timed_run_due (server);
+        }
+        assert (fty_sensor_gpio_wheel_size (server->wheel) == 0);
+        zpoller_t *poller = zpoller_new (server->gpio_worker, NULL);
+        int steps = 0;
+        char *last_state = NULL;
+        while (zpoller_wait (poller, 500)) {
+            zmsg_t *result = zmsg_recv (server->gpio_worker);
+            assert (result);
+            char *value = zmsg_popstr (result);
+            char *kind = zmsg_popstr (result);
+            char *asset_name = zmsg_popstr (result);
+            assert (streq (kind, "TIMED"));
+            assert (streq (asset_name, "gpo-11"));
+            zstr_free (&last_state);
+            last_state = zmsg_popstr (result);
+            steps++;
+            zstr_free (&value);
+            zstr_free (&kind);
+            zstr_free (&asset_name);
+            zmsg_destroy (&result);
+        }
+        zpoller_destroy (&poller);
+        assert (steps >= 2);
+        assert (atoi (last_state) == GPIO_STATE_CLOSED);
+        zstr_free (&last_state);
+        fty_sensor_gpio_server_destroy (&server);
+
+        // After a restart, a blink which ended meanwhile only drives the GPO
+        // back to its default state, while a delayed action is still pending
+        int64_t wall = zclock_time ();
+        snapshot = zconfig_new ("root", NULL);
+        zconfig_put (snapshot, "gpo_timed/gpo-11/state", "opened");
+        zconfig_put (snapshot, "gpo_timed/gpo-11/period", "1000");
+        zconfig_put (snapshot, "gpo_timed/gpo-11/end", std::to_string (wall - 1000).c_str ());
+        zconfig_put (snapshot, "gpo_timed/gpo-11/next", std::to_string (wall - 2000).c_str ());
+        zconfig_put (snapshot, "gpo_timed/gpo-12/state", "opened");
+        zconfig_put (snapshot, "gpo_timed/gpo-12/period", "0");
+        zconfig_put (snapshot, "gpo_timed/gpo-12/end", "0");
+        zconfig_put (snapshot, "gpo_timed/gpo-12/next", std::to_string (wall + 60000).c_str ());
+        rv = zconfig_save (snapshot, snapshot_file.c_str ());
+        assert (rv == 0);
+        zconfig_destroy (&snapshot);
+
+        server = fty_sensor_gpio_server_new ("gpio-timed-test");
+        assert (server);
+        server->test_mode = true;
+        libgpio_set_test_mode (server->gpio_lib, true);
+        server->snapshot_path = strdup (snapshot_file.c_str ());
+        assert (s_load_snapshot (server) == 0);
+        assert (zhashx_size (server->timed) == 2);
+        s_gpo_timed_run_due (server);
+        assert (zhashx_lookup (server->timed, "gpo-11") == NULL);
+        timed = (gpo_timed_t *) zhashx_lookup (server->timed, "gpo-12");
+        assert (timed);
+        assert (timed->end == 0);
+        assert (timed->next > zclock_mono () + 50000);
+
+        zmsg_t *result = zmsg_recv (server->gpio_worker);
+        assert (result);
+        zframe_t *frame = zmsg_last (result);
+        assert (frame && zframe_streq (frame, "0"));
+        zmsg_destroy (&result);
+
+        // A new action replaces the pending one
+        assert (s_gpo_timed_cancel (server, "gpo-12"));
+        assert (!s_gpo_timed_cancel (server, "gpo-12"));
+        assert (fty_sensor_gpio_wheel_size (server->wheel) == 0);
+
+        // A failed save is retried later, backing off
+        zstr_free (&server->snapshot_path);
+        server->snapshot_path = strdup ((str_SELFTEST_DIR_RW + "/missing/timed.snapshot").c_str ());
+        server->snapshot_save = zclock_mono ();
+        s_save_snapshot_if_due (server);
+        int64_t retry = server->snapshot_save;
+        assert (retry > zclock_mono ());
+        assert (server->snapshot_backoff == 2 * SNAPSHOT_SAVE_DELAY);
+        s_save_snapshot_if_due (server);
+        assert (server->snapshot_save == retry);
+        fty_sensor_gpio_server_destroy (&server);
+        zsys_file_delete (snapshot_file.c_str ());
+    }
+
+    // Test #16: GPI changes run the reflex rules right away, by asset or
+    // ext name, when their condition holds
+    {
+        zconfig_t *config = zconfig_new ("rules", NULL);
+        zconfig_put (config, "door-open/gpi", "GPIO-Sensor-Door1");
+        zconfig_put (config, "door-open/on", "opened");
+        zconfig_put (config, "door-open/gpo", "gpo-11");
+        zconfig_put (config, "door-open/action", "open");
+        zconfig_put (config, "door-pulse/gpi", "sensorgpio-10");
+        zconfig_put (config, "door-pulse/on", "opened");
+        zconfig_put (config, "door-pulse/gpo", "GPIO-Test-GPO2");
+        zconfig_put (config, "door-pulse/action", "pulse");
+        zconfig_put (config, "door-pulse/duration", "1000");
+        zconfig_put (config, "door-pulse/if_gpi", "sensorgpio-10");
+        zconfig_put (config, "door-pulse/if_state", "opened");
+        zconfig_put (config, "door-closed/gpi", "sensorgpio-10");
+        zconfig_put (config, "door-closed/gpo", "gpo-11");
+        zconfig_put (config, "door-closed/action", "close");
+        zconfig_put (config, "door-closed/if_gpi", "sensorgpio-10");
+        zconfig_put (config, "door-closed/if_state", "closed");
+
+        fty_sensor_gpio_server_t *server = fty_sensor_gpio_server_new ("gpio-reflex-test");
+        assert (server);
+        server->test_mode = true;
+        libgpio_set_test_mode (server->gpio_lib, true);
+        server->rules = fty_sensor_gpio_rules_new (config);
+        zconfig_destroy (&config);
+        assert (fty_sensor_gpio_rules_size (server->rules) == 4);
+
+        _gpx_info_t *gpi_info = get_gpx_info (get_gpx_table (), "sensorgpio-10");
+        assert (gpi_info);
+        int saved_state = gpi_info->state->current_state;
+        zpoller_t *poller = zpoller_new (server->gpio_worker, NULL);
+
+        // The first read triggers nothing
+        gpi_info->state->current_state = GPIO_STATE_UNKNOWN;
+        zmsg_t *result = zmsg_new ();
+        zmsg_addstrf (result, "%d", GPIO_STATE_CLOSED);
+        zmsg_addstr (result, "STATUS");
+        zmsg_addstr (result, "sensorgpio-10");
+        zmsg_addstr (result, "0");
+        s_handle_gpio_result (server, result);
+        zmsg_destroy (&result);
+        assert (zpoller_wait (poller, 200) == NULL);
+
+        // The door opens: 'gpo-11' opened, 'gpo-12' pulsed
+        result = zmsg_new ();
+        zmsg_addstrf (result, "%d", GPIO_STATE_OPENED);
+        zmsg_addstr (result, "STATUS");
+        zmsg_addstr (result, "sensorgpio-10");
+        zmsg_addstr (result, "0");
+        s_handle_gpio_result (server, result);
+        zmsg_destroy (&result);
+        assert (gpi_info->state->current_state == GPIO_STATE_OPENED);
+        for (int i = 0; i < 2; i++) {
+            assert (zpoller_wait (poller, 1000) == server->gpio_worker);
+            result = zmsg_recv (server->gpio_worker);
+            assert (result);
+            char *value = zmsg_popstr (result);
+            char *kind = zmsg_popstr (result);
+            char *asset_name = zmsg_popstr (result);
+            char *written = zmsg_popstr (result);
+            assert (streq (kind, "TIMED"));
+            assert (streq (asset_name, "gpo-11") || streq (asset_name, "gpo-12"));
+            assert (atoi (written) == GPIO_STATE_OPENED);
+            zstr_free (&value);
+            zstr_free (&kind);
+            zstr_free (&asset_name);
+            zstr_free (&written);
+            zmsg_destroy (&result);
+        }
+        assert (zpoller_wait (poller, 200) == NULL);
+        // The end of the pulse is timed by the wheel
+        gpo_timed_t *timed = (gpo_timed_t *) zhashx_lookup (server->timed, "gpo-12");
+        assert (timed);
+        assert (timed->state == GPIO_STATE_CLOSED);
+        assert (timed->next == timed->end);
+        assert (zhashx_lookup (server->timed, "gpo-11") == NULL);
+
+        zpoller_destroy (&poller);
+        gpi_info->state->current_state = saved_state;
+        fty_sensor_gpio_server_destroy (&server);
+    }
+
+    // Test #17: Request GPIO_STATS, which accounts the previous requests
+    // and the sensors read
+    {
+        zmsg_t *msg = zmsg_new ();
+        zuuid_t *zuuid = zuuid_new ();
+        zmsg_addstr (msg, zuuid_str_canonical (zuuid));
+        int rv = mlm_client_sendto (mb_client, FTY_SENSOR_GPIO_AGENT, "GPIO_STATS", NULL, 5000, &msg);
+        assert ( rv == 0 );
+
+        zmsg_t *recv = mlm_client_recv (mb_client);
+        assert (recv);
+        assert (streq (mlm_client_subject (mb_client), "GPIO_STATS"));
+        char *recv_str = zmsg_popstr (recv);
+        assert (streq (zuuid_str_canonical (zuuid), recv_str));
+        zstr_free (&recv_str);
+        recv_str = zmsg_popstr (recv);
+        assert ( streq ( recv_str, "OK") );
+        zstr_free (&recv_str);
+        assert ((zmsg_size (recv) % 2) == 0);
+        int found = 0;
+        char *name = zmsg_popstr (recv);
+        while (name) {
+            char *value = zmsg_popstr (recv);
+            assert (value);
+            if (streq (name, "mailbox.GPIO_MANIFEST_SUMMARY.count")
+                || streq (name, "sensor_reads")
+                || streq (name, "gpio.syscalls")) {
+                assert (atoi (value) > 0);
+                found++;
+            }
+            zstr_free (&name);
+            zstr_free (&value);
+            name = zmsg_popstr (recv);
+        }
+        assert (found == 3);
+
+        zuuid_destroy (&zuuid);
+        zmsg_destroy (&recv);
+    }
+
+    // The server unexports its pins and saves its snapshot when leaving,
+    // so stop it first
+    zactor_destroy (&self);
+    zsys_file_delete ((str_SELFTEST_DIR_RW + "/state.snapshot").c_str ());
+
     zsys_dir_delete (template_dir.c_str());
     // Delete all test files
     zdir_t *dir = zdir_new (template_dir.c_str(), NULL);
@@ -1526,7 +4152,6 @@ fty_sensor_gpio_server_test (bool verbose)
 
     // And connections / actors
     mlm_client_destroy (&mb_client);
-    zactor_destroy (&self);
     zactor_destroy (&server);
     //  @end
     printf ("OK\n");
@@ -0,0 +1,425 @@
+/*  =========================================================================
+    fty_sensor_gpio_sim - Simulated in-memory GPIO chipset
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_sim - Simulated in-memory GPIO chipset
+@discuss
+    Backs the GPIO_BACKEND_SIM backend of libgpio, to load the agent with
+    thousands of pins without any hardware nor file system access. Each
+    virtual pin holds a level, and an optional scripted waveform: toggles
+    at a fixed rate, possibly grouped in bursts, plus random glitches.
+    Waveforms are computed from the clock when the pin is read, so that an
+    idle simulation costs nothing, whatever its size.
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+#include <limits.h>
+
+//  Virtual pin
+
+typedef struct {
+    int64_t  origin;        // time at which the waveform starts (msec)
+    int      toggle;        // msec between two toggles, 0 for a constant level
+    int      burst;         // toggles per burst, 0 for a continuous toggling
+    int      gap;           // msec of quiet time between two bursts
+    int      noise;         // chance of a glitch on read (permil)
+    int      level;         // initial value of the waveform, or written value
+    bool     watched;       // edges accounted in the events
+    int64_t  edges;         // edges already accounted in the events
+} sim_pin_t;
+
+//  Structure of our class
+
+struct _fty_sensor_gpio_sim_t {
+    int         size;       // number of virtual pins
+    sim_pin_t   *pins;
+    int         *watched;   // watched pins
+    int         watched_count;
+    int         written_edges;  // edges of the watched pins due to writes
+    int64_t     clock;      // fixed clock (msec), -1 to follow zclock_mono ()
+    uint64_t    random;     // glitches generator state
+};
+
+
+//  --------------------------------------------------------------------------
+//  Create a simulated chipset
+
+fty_sensor_gpio_sim_t *
+fty_sensor_gpio_sim_new (int pins)
+{
+    assert (pins > 0);
+    fty_sensor_gpio_sim_t *self = (fty_sensor_gpio_sim_t *) zmalloc (sizeof (fty_sensor_gpio_sim_t));
+    assert (self);
+    self->size = pins;
+    self->pins = (sim_pin_t *) zmalloc (pins * sizeof (sim_pin_t));
+    assert (self->pins);
+    self->watched = (int *) zmalloc (pins * sizeof (int));
+    assert (self->watched);
+    self->watched_count = 0;
+    self->written_edges = 0;
+    self->clock = -1;
+    self->random = 0x9E3779B97F4A7C15ULL;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destroy the simulated chipset
+
+void
+fty_sensor_gpio_sim_destroy (fty_sensor_gpio_sim_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        fty_sensor_gpio_sim_t *self = *self_p;
+        free (self->pins);
+        free (self->watched);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of virtual pins
+
+int
+fty_sensor_gpio_sim_size (fty_sensor_gpio_sim_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the clock driving the waveforms
+
+void
+fty_sensor_gpio_sim_set_clock (fty_sensor_gpio_sim_t *self, int64_t now)
+{
+    assert (self);
+    self->clock = now;
+}
+
+static int64_t
+s_now (fty_sensor_gpio_sim_t *self)
+{
+    return (self->clock >= 0) ? self->clock : zclock_mono ();
+}
+
+
+//  --------------------------------------------------------------------------
+//  Number of toggles of the waveform of a pin, from its start until now
+
+static int64_t
+s_toggles (sim_pin_t *pin, int64_t now)
+{
+    if ((pin->toggle <= 0) || (now < pin->origin))
+        return 0;
+    int64_t elapsed = now - pin->origin;
+    if (pin->burst <= 0)
+        return elapsed / pin->toggle;
+    int64_t cycle = (int64_t) pin->burst * pin->toggle + pin->gap;
+    int64_t toggles = elapsed % cycle / pin->toggle;
+    if (toggles > pin->burst)
+        toggles = pin->burst;
+    return (elapsed / cycle) * pin->burst + toggles;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Parse a positive number, return -1 if invalid
+
+static int
+s_number (const char *value)
+{
+    char *end;
+    long number = strtol (value, &end, 10);
+    if ((*value == '\0') || (*end != '\0') || (number < 0) || (number > INT_MAX))
+        return -1;
+    return (int) number;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Script the waveform of the pins first to last
+
+int
+fty_sensor_gpio_sim_waveform (fty_sensor_gpio_sim_t *self, int first, int last,
+    const char *spec)
+{
+    assert (self);
+    assert (spec);
+    if ((first < 0) || (last < first) || (last >= self->size))
+        return -1;
+
+    sim_pin_t waveform;
+    memset (&waveform, 0, sizeof (waveform));
+    int phase = 0;
+    int stagger = 0;
+
+    char *buffer = strdup (spec);
+    assert (buffer);
+    int rv = 0;
+    char *saveptr = NULL;
+    for (char *token = strtok_r (buffer, " \t", &saveptr); token && (rv == 0);
+         token = strtok_r (NULL, " \t", &saveptr)) {
+        char *equal = strchr (token, '=');
+        if (!equal) {
+            rv = -1;
+            break;
+        }
+        *equal = '\0';
+        int value = s_number (equal + 1);
+        if (value == -1)
+            rv = -1;
+        else if (streq (token, "level") && (value <= 1))
+            waveform.level = value;
+        else if (streq (token, "toggle"))
+            waveform.toggle = value;
+        else if (streq (token, "burst"))
+            waveform.burst = value;
+        else if (streq (token, "gap"))
+            waveform.gap = value;
+        else if (streq (token, "noise") && (value <= 1000))
+            waveform.noise = value;
+        else if (streq (token, "phase"))
+            phase = value;
+        else if (streq (token, "stagger"))
+            stagger = value;
+        else
+            rv = -1;
+    }
+    free (buffer);
+    if (rv == -1) {
+        log_error ("Invalid simulated waveform '%s'", spec);
+        return -1;
+    }
+
+    int64_t now = s_now (self);
+    for (int i = first; i <= last; i++) {
+        sim_pin_t *pin = &self->pins [i];
+        pin->origin = now + phase + (int64_t) stagger * (i - first);
+        pin->toggle = waveform.toggle;
+        pin->burst = waveform.burst;
+        pin->gap = waveform.gap;
+        pin->noise = waveform.noise;
+        pin->level = waveform.level;
+        pin->edges = 0;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read a virtual pin
+
+int
+fty_sensor_gpio_sim_read (fty_sensor_gpio_sim_t *self, int pin_number)
+{
+    assert (self);
+    if ((pin_number < 0) || (pin_number >= self->size))
+        return -1;
+
+    sim_pin_t *pin = &self->pins [pin_number];
+    int value = pin->level ^ (int) (s_toggles (pin, s_now (self)) & 1);
+    if (pin->noise > 0) {
+        // xorshift64
+        self->random ^= self->random << 13;
+        self->random ^= self->random >> 7;
+        self->random ^= self->random << 17;
+        if ((int) (self->random % 1000) < pin->noise)
+            value ^= 1;
+    }
+    return value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write a virtual pin, which stops its waveform
+
+int
+fty_sensor_gpio_sim_write (fty_sensor_gpio_sim_t *self, int pin_number, int value)
+{
+    assert (self);
+    if ((pin_number < 0) || (pin_number >= self->size))
+        return -1;
+
+    sim_pin_t *pin = &self->pins [pin_number];
+    int previous = pin->level ^ (int) (s_toggles (pin, s_now (self)) & 1);
+    pin->level = value ? 1 : 0;
+    pin->toggle = 0;
+    pin->noise = 0;
+    pin->edges = 0;
+    if (pin->watched && (previous != pin->level))
+        self->written_edges++;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Account the edges of a virtual pin in the events
+
+int
+fty_sensor_gpio_sim_watch (fty_sensor_gpio_sim_t *self, int pin_number)
+{
+    assert (self);
+    if ((pin_number < 0) || (pin_number >= self->size))
+        return -1;
+
+    sim_pin_t *pin = &self->pins [pin_number];
+    if (!pin->watched) {
+        pin->watched = true;
+        pin->edges = s_toggles (pin, s_now (self));
+        self->watched [self->watched_count++] = pin_number;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of edges of the watched pins since the previous call
+
+int
+fty_sensor_gpio_sim_events (fty_sensor_gpio_sim_t *self)
+{
+    assert (self);
+    int64_t now = s_now (self);
+    int64_t events = self->written_edges;
+    self->written_edges = 0;
+    for (int i = 0; i < self->watched_count; i++) {
+        sim_pin_t *pin = &self->pins [self->watched [i]];
+        int64_t edges = s_toggles (pin, now);
+        events += edges - pin->edges;
+        pin->edges = edges;
+    }
+    return (events > INT_MAX) ? INT_MAX : (int) events;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_sensor_gpio_sim_test (bool verbose)
+{
+    printf (" * fty_sensor_gpio_sim: ");
+
+    //  @selftest
+    fty_sensor_gpio_sim_t *self = fty_sensor_gpio_sim_new (64);
+    assert (self);
+    assert (fty_sensor_gpio_sim_size (self) == 64);
+    fty_sensor_gpio_sim_set_clock (self, 1000);
+
+    // Pins are closed, and keep what is written
+    assert (fty_sensor_gpio_sim_read (self, 0) == 0);
+    assert (fty_sensor_gpio_sim_read (self, 64) == -1);
+    assert (fty_sensor_gpio_sim_read (self, -1) == -1);
+    assert (fty_sensor_gpio_sim_write (self, 5, 1) == 0);
+    assert (fty_sensor_gpio_sim_read (self, 5) == 1);
+    assert (fty_sensor_gpio_sim_write (self, 64, 1) == -1);
+
+    // Invalid waveforms
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 64, "toggle=10") == -1);
+    assert (fty_sensor_gpio_sim_waveform (self, 3, 2, "toggle=10") == -1);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 0, "toggle=-1") == -1);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 0, "level=2") == -1);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 0, "noise=1001") == -1);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 0, "toggle") == -1);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 0, "foo=1") == -1);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 0, "") == 0);
+
+    // Continuous toggling, staggered between pins
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 3, "toggle=10 stagger=5") == 0);
+    assert (fty_sensor_gpio_sim_read (self, 0) == 0);
+    fty_sensor_gpio_sim_set_clock (self, 1010);
+    assert (fty_sensor_gpio_sim_read (self, 0) == 1);
+    assert (fty_sensor_gpio_sim_read (self, 1) == 0);
+    fty_sensor_gpio_sim_set_clock (self, 1015);
+    assert (fty_sensor_gpio_sim_read (self, 1) == 1);
+    fty_sensor_gpio_sim_set_clock (self, 1020);
+    assert (fty_sensor_gpio_sim_read (self, 0) == 0);
+    assert (fty_sensor_gpio_sim_read (self, 3) == 0);
+
+    // Bursts of 2 toggles every 120 msec, from opened
+    fty_sensor_gpio_sim_set_clock (self, 1000);
+    assert (fty_sensor_gpio_sim_waveform (self, 10, 10, "level=1 toggle=10 burst=2 gap=100") == 0);
+    int64_t times [] = { 1000, 1010, 1020, 1050, 1119, 1130, 1140, 1200 };
+    int values [] = { 1, 0, 1, 1, 1, 0, 1, 1 };
+    for (int i = 0; i < 8; i++) {
+        fty_sensor_gpio_sim_set_clock (self, times [i]);
+        assert (fty_sensor_gpio_sim_read (self, 10) == values [i]);
+    }
+
+    // Edges of the watched pins: pin 0 toggles again every 10 msec since
+    // 1000, pin 10 twice per burst
+    fty_sensor_gpio_sim_set_clock (self, 1000);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, 0, "toggle=10") == 0);
+    assert (fty_sensor_gpio_sim_waveform (self, 10, 10, "toggle=10 burst=2 gap=100") == 0);
+    assert (fty_sensor_gpio_sim_watch (self, 0) == 0);
+    assert (fty_sensor_gpio_sim_watch (self, 10) == 0);
+    assert (fty_sensor_gpio_sim_watch (self, 10) == 0);
+    assert (fty_sensor_gpio_sim_watch (self, 64) == -1);
+    assert (fty_sensor_gpio_sim_events (self) == 0);
+    fty_sensor_gpio_sim_set_clock (self, 1100);
+    assert (fty_sensor_gpio_sim_events (self) == 12);
+    assert (fty_sensor_gpio_sim_events (self) == 0);
+    fty_sensor_gpio_sim_set_clock (self, 1240);
+    assert (fty_sensor_gpio_sim_events (self) == 14 + 2);
+
+    // Writing stops the waveform, and is an edge of a watched pin
+    assert (fty_sensor_gpio_sim_read (self, 0) == 0);
+    assert (fty_sensor_gpio_sim_write (self, 0, 1) == 0);
+    fty_sensor_gpio_sim_set_clock (self, 5000);
+    assert (fty_sensor_gpio_sim_read (self, 0) == 1);
+    // Pin 10 is in its 34th burst
+    assert (fty_sensor_gpio_sim_events (self) == 1 + 33 * 2 + 2 - 4);
+
+    // Glitches on a constant level
+    assert (fty_sensor_gpio_sim_waveform (self, 20, 20, "noise=500") == 0);
+    int glitches = 0;
+    for (int i = 0; i < 1000; i++)
+        glitches += fty_sensor_gpio_sim_read (self, 20);
+    assert ((glitches > 300) && (glitches < 700));
+    assert (fty_sensor_gpio_sim_waveform (self, 21, 21, "level=1 noise=0") == 0);
+    for (int i = 0; i < 1000; i++)
+        assert (fty_sensor_gpio_sim_read (self, 21) == 1);
+    fty_sensor_gpio_sim_destroy (&self);
+    assert (self == NULL);
+
+    // Thousands of pins, on the real clock
+    self = fty_sensor_gpio_sim_new (FTY_SENSOR_GPIO_SIM_PINS);
+    assert (fty_sensor_gpio_sim_waveform (self, 0, FTY_SENSOR_GPIO_SIM_PINS - 1,
+        "toggle=1 burst=10 gap=50 noise=10 stagger=1") == 0);
+    for (int i = 0; i < FTY_SENSOR_GPIO_SIM_PINS; i++) {
+        int value = fty_sensor_gpio_sim_read (self, i);
+        assert ((value == 0) || (value == 1));
+        assert (fty_sensor_gpio_sim_watch (self, i) == 0);
+    }
+    zclock_sleep (20);
+    assert (fty_sensor_gpio_sim_events (self) > 0);
+    fty_sensor_gpio_sim_destroy (&self);
+    //  @end
+
+    printf ("OK\n");
+}
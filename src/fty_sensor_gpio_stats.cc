@@ -0,0 +1,321 @@
+/*  =========================================================================
+    fty_sensor_gpio_stats - 42ITy GPIO runtime statistics
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_stats - 42ITy GPIO runtime statistics
+@discuss
+    Counters, latency histograms and gauges, updated with relaxed atomic
+    operations so that they cost next to nothing on the hot paths of the
+    server and of its GPIO I/O worker. The histograms have one bucket per
+    power of 2 of usec, from which the percentiles are estimated.
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+#include <atomic>
+#include <thread>
+
+// Buckets of the histograms: bucket N holds the latencies below 2^N usec
+#define STATS_BUCKETS 32
+
+static const char *s_counter_names [STATS_COUNTERS] = {
+    "sensor_reads", "sensor_read_failures", "gpo_writes", "gpo_write_failures",
+    "published", "publish_failures", "gpio_events"
+};
+
+static const char *s_histogram_names [STATS_HISTOGRAMS] = {
+    "poll_cycle", "sensor_read", "gpo_write", "gpio_lock_wait", "publish",
+    "mailbox.GPO_INTERACTION", "mailbox.GPIO_MANIFEST", "mailbox.GPIO_MANIFEST_SUMMARY",
+    "mailbox.GPIO_TEMPLATE_ADD", "mailbox.GPOSTATE", "mailbox.GPIO_STATS", "mailbox.other"
+};
+
+static const char *s_gauge_names [STATS_GAUGES] = {
+    "urgent_queue", "bulk_queue", "timed_actions"
+};
+
+typedef struct {
+    std::atomic<uint64_t> buckets [STATS_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;      // usec
+    std::atomic<uint64_t> max;      // usec
+} stats_histogram_t;
+
+typedef struct {
+    std::atomic<int64_t> value;
+    std::atomic<int64_t> max;
+} stats_gauge_t;
+
+//  Structure of our class
+
+struct _fty_sensor_gpio_stats_t {
+    std::atomic<uint64_t> counters [STATS_COUNTERS];
+    stats_histogram_t     histograms [STATS_HISTOGRAMS];
+    stats_gauge_t         gauges [STATS_GAUGES];
+};
+
+
+//  --------------------------------------------------------------------------
+//  Raise an atomic maximum to value
+
+template <typename T> static void
+s_raise (std::atomic<T> &max, T value)
+{
+    T current = max.load (std::memory_order_relaxed);
+    while ((value > current)
+        && !max.compare_exchange_weak (current, value, std::memory_order_relaxed))
+        ;
+}
+
+//  --------------------------------------------------------------------------
+//  Create new statistics
+
+fty_sensor_gpio_stats_t *
+fty_sensor_gpio_stats_new (void)
+{
+    // Value-initialized, i.e. all zero
+    fty_sensor_gpio_stats_t *self = new fty_sensor_gpio_stats_t ();
+    assert (self);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destroy the statistics
+
+void
+fty_sensor_gpio_stats_destroy (fty_sensor_gpio_stats_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        delete *self_p;
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add value to a counter
+
+void
+fty_sensor_gpio_stats_count (fty_sensor_gpio_stats_t *self, int counter, uint64_t value)
+{
+    assert (self);
+    assert ((counter >= 0) && (counter < STATS_COUNTERS));
+    self->counters [counter].fetch_add (value, std::memory_order_relaxed);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Record a latency in a histogram
+
+void
+fty_sensor_gpio_stats_record (fty_sensor_gpio_stats_t *self, int histogram, int64_t usec)
+{
+    assert (self);
+    assert ((histogram >= 0) && (histogram < STATS_HISTOGRAMS));
+    uint64_t value = (usec > 0) ? (uint64_t) usec : 0;
+    int bucket = 0;
+    while ((bucket < STATS_BUCKETS - 1) && (value >= ((uint64_t) 1 << bucket)))
+        bucket++;
+    stats_histogram_t *h = &self->histograms [histogram];
+    h->buckets [bucket].fetch_add (1, std::memory_order_relaxed);
+    h->count.fetch_add (1, std::memory_order_relaxed);
+    h->sum.fetch_add (value, std::memory_order_relaxed);
+    s_raise (h->max, value);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the current value of a gauge
+
+void
+fty_sensor_gpio_stats_gauge (fty_sensor_gpio_stats_t *self, int gauge, int64_t value)
+{
+    assert (self);
+    assert ((gauge >= 0) && (gauge < STATS_GAUGES));
+    self->gauges [gauge].value.store (value, std::memory_order_relaxed);
+    s_raise (self->gauges [gauge].max, value);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the value of a counter
+
+uint64_t
+fty_sensor_gpio_stats_counter (fty_sensor_gpio_stats_t *self, int counter)
+{
+    assert (self);
+    assert ((counter >= 0) && (counter < STATS_COUNTERS));
+    return self->counters [counter].load (std::memory_order_relaxed);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of latencies recorded in a histogram
+
+uint64_t
+fty_sensor_gpio_stats_samples (fty_sensor_gpio_stats_t *self, int histogram)
+{
+    assert (self);
+    assert ((histogram >= 0) && (histogram < STATS_HISTOGRAMS));
+    return self->histograms [histogram].count.load (std::memory_order_relaxed);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the latency below which percent % of the latencies are
+
+int64_t
+fty_sensor_gpio_stats_percentile (fty_sensor_gpio_stats_t *self, int histogram, int percent)
+{
+    assert (self);
+    assert ((histogram >= 0) && (histogram < STATS_HISTOGRAMS));
+    stats_histogram_t *h = &self->histograms [histogram];
+    uint64_t count = h->count.load (std::memory_order_relaxed);
+    if (count == 0)
+        return 0;
+    // Rank of the sample, rounded up
+    uint64_t rank = (count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+        seen += h->buckets [bucket].load (std::memory_order_relaxed);
+        if ((seen >= rank) && (seen > 0)) {
+            // Not above the highest latency seen
+            int64_t bound = (int64_t) 1 << bucket;
+            int64_t max = (int64_t) h->max.load (std::memory_order_relaxed);
+            return (bound < max) ? bound : max;
+        }
+    }
+    return (int64_t) h->max.load (std::memory_order_relaxed);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append the statistics to msg, as name / value frames
+
+void
+fty_sensor_gpio_stats_report (fty_sensor_gpio_stats_t *self, zmsg_t *msg)
+{
+    assert (self);
+    assert (msg);
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        zmsg_addstr (msg, s_counter_names [i]);
+        zmsg_addstr (msg, std::to_string (fty_sensor_gpio_stats_counter (self, i)).c_str ());
+    }
+    for (int i = 0; i < STATS_HISTOGRAMS; i++) {
+        stats_histogram_t *h = &self->histograms [i];
+        uint64_t count = h->count.load (std::memory_order_relaxed);
+        uint64_t sum = h->sum.load (std::memory_order_relaxed);
+        zmsg_addstrf (msg, "%s.count", s_histogram_names [i]);
+        zmsg_addstr (msg, std::to_string (count).c_str ());
+        zmsg_addstrf (msg, "%s.mean_us", s_histogram_names [i]);
+        zmsg_addstr (msg, std::to_string (count ? sum / count : 0).c_str ());
+        zmsg_addstrf (msg, "%s.p50_us", s_histogram_names [i]);
+        zmsg_addstr (msg, std::to_string (fty_sensor_gpio_stats_percentile (self, i, 50)).c_str ());
+        zmsg_addstrf (msg, "%s.p99_us", s_histogram_names [i]);
+        zmsg_addstr (msg, std::to_string (fty_sensor_gpio_stats_percentile (self, i, 99)).c_str ());
+        zmsg_addstrf (msg, "%s.max_us", s_histogram_names [i]);
+        zmsg_addstr (msg, std::to_string (h->max.load (std::memory_order_relaxed)).c_str ());
+    }
+    for (int i = 0; i < STATS_GAUGES; i++) {
+        zmsg_addstr (msg, s_gauge_names [i]);
+        zmsg_addstr (msg, std::to_string (self->gauges [i].value.load (std::memory_order_relaxed)).c_str ());
+        zmsg_addstrf (msg, "%s.max", s_gauge_names [i]);
+        zmsg_addstr (msg, std::to_string (self->gauges [i].max.load (std::memory_order_relaxed)).c_str ());
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_sensor_gpio_stats_test (bool verbose)
+{
+    printf (" * fty_sensor_gpio_stats: ");
+
+    //  @selftest
+    fty_sensor_gpio_stats_t *self = fty_sensor_gpio_stats_new ();
+    assert (self);
+    assert (fty_sensor_gpio_stats_counter (self, STATS_SENSOR_READS) == 0);
+    assert (fty_sensor_gpio_stats_percentile (self, STATS_SENSOR_READ, 50) == 0);
+
+    fty_sensor_gpio_stats_count (self, STATS_SENSOR_READS, 1);
+    fty_sensor_gpio_stats_count (self, STATS_SENSOR_READS, 2);
+    assert (fty_sensor_gpio_stats_counter (self, STATS_SENSOR_READS) == 3);
+
+    // 98 fast reads, 2 slow ones
+    for (int i = 0; i < 98; i++)
+        fty_sensor_gpio_stats_record (self, STATS_SENSOR_READ, 100);
+    fty_sensor_gpio_stats_record (self, STATS_SENSOR_READ, 5000);
+    fty_sensor_gpio_stats_record (self, STATS_SENSOR_READ, 6000);
+    assert (fty_sensor_gpio_stats_samples (self, STATS_SENSOR_READ) == 100);
+    assert (fty_sensor_gpio_stats_percentile (self, STATS_SENSOR_READ, 50) == 128);
+    assert (fty_sensor_gpio_stats_percentile (self, STATS_SENSOR_READ, 99) == 6000);
+    assert (fty_sensor_gpio_stats_percentile (self, STATS_SENSOR_READ, 100) == 6000);
+    // Negative latencies, from a clock step, count as 0
+    fty_sensor_gpio_stats_record (self, STATS_PUBLISH, -5);
+    assert (fty_sensor_gpio_stats_percentile (self, STATS_PUBLISH, 50) == 0);
+
+    fty_sensor_gpio_stats_gauge (self, STATS_URGENT_QUEUE, 7);
+    fty_sensor_gpio_stats_gauge (self, STATS_URGENT_QUEUE, 2);
+
+    // Updated from several threads at once
+    std::thread threads [4];
+    for (int t = 0; t < 4; t++)
+        threads [t] = std::thread ([self] () {
+            for (int i = 0; i < 10000; i++) {
+                fty_sensor_gpio_stats_count (self, STATS_GPO_WRITES, 1);
+                fty_sensor_gpio_stats_record (self, STATS_GPO_WRITE, i);
+            }
+        });
+    for (int t = 0; t < 4; t++)
+        threads [t].join ();
+    assert (fty_sensor_gpio_stats_counter (self, STATS_GPO_WRITES) == 40000);
+    assert (fty_sensor_gpio_stats_samples (self, STATS_GPO_WRITE) == 40000);
+
+    zmsg_t *msg = zmsg_new ();
+    fty_sensor_gpio_stats_report (self, msg);
+    assert (zmsg_size (msg) == 2 * (STATS_COUNTERS + 5 * STATS_HISTOGRAMS + 2 * STATS_GAUGES));
+    bool found = false;
+    char *name = zmsg_popstr (msg);
+    while (name) {
+        char *value = zmsg_popstr (msg);
+        assert (value);
+        if (streq (name, "urgent_queue.max")) {
+            assert (streq (value, "7"));
+            found = true;
+        }
+        if (streq (name, "sensor_read.max_us"))
+            assert (streq (value, "6000"));
+        zstr_free (&name);
+        zstr_free (&value);
+        name = zmsg_popstr (msg);
+    }
+    assert (found);
+    zmsg_destroy (&msg);
+
+    fty_sensor_gpio_stats_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
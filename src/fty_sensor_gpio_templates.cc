@@ -0,0 +1,540 @@
+/*  =========================================================================
+    fty_sensor_gpio_templates - 42ITy GPIO sensors templates cache
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_templates - 42ITy GPIO sensors templates cache
+@discuss
+    Sensors templates (<part number>.tpl files of the template directory)
+    are parsed once, and kept in memory for both the assets and the server
+    actors. The template directory is watched through inotify, so that
+    the cache follows the changes made on disk: pending changes are applied
+    on the next access, and accesses don't touch the filesystem otherwise.
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define TEMPLATE_SUFFIX ".tpl"
+
+//  Structure of our class
+
+struct _fty_sensor_gpio_templates_t {
+    char            *template_dir; // Location of the template files
+    zhashx_t        *templates;    // part number -> fty_sensor_gpio_template_t
+    int             inotify_fd;    // template_dir watch, -1 if not watched
+    int             refs;          // number of users of the shared cache
+    uint64_t        generation;    // incremented on every change of the cache
+    pthread_mutex_t mutex;         // protect the cache, shared by the actors
+    fty_sensor_gpio_templates_t *next; // next shared cache
+};
+
+// Shared caches, one per template directory
+static fty_sensor_gpio_templates_t *s_shared = NULL;
+static pthread_mutex_t s_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+//  --------------------------------------------------------------------------
+//  Destroy a template
+
+void
+fty_sensor_gpio_template_destroy (fty_sensor_gpio_template_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        fty_sensor_gpio_template_t *self = *self_p;
+        zstr_free (&self->part_number);
+        zstr_free (&self->manufacturer);
+        zstr_free (&self->type);
+        zstr_free (&self->normal_state);
+        zstr_free (&self->gpx_direction);
+        zstr_free (&self->power_source);
+        zstr_free (&self->alarm_severity);
+        zstr_free (&self->alarm_message);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  zhashx / zlistx handling -- destroy / duplicate a template
+
+static void
+s_template_free (void **item)
+{
+    fty_sensor_gpio_template_destroy ((fty_sensor_gpio_template_t **) item);
+}
+
+static void *
+s_template_dup (const void *item)
+{
+    const fty_sensor_gpio_template_t *tpl = (const fty_sensor_gpio_template_t *) item;
+    fty_sensor_gpio_template_t *copy = (fty_sensor_gpio_template_t *) zmalloc (sizeof (fty_sensor_gpio_template_t));
+    if (!copy)
+        return NULL;
+
+    copy->part_number = strdup (tpl->part_number);
+    copy->manufacturer = strdup (tpl->manufacturer);
+    copy->type = strdup (tpl->type);
+    copy->normal_state = strdup (tpl->normal_state);
+    copy->gpx_direction = strdup (tpl->gpx_direction);
+    copy->power_source = strdup (tpl->power_source);
+    copy->alarm_severity = strdup (tpl->alarm_severity);
+    copy->alarm_message = strdup (tpl->alarm_message);
+    return copy;
+}
+
+static int
+s_template_cmp (const void *item1, const void *item2)
+{
+    return strcmp (((const fty_sensor_gpio_template_t *) item1)->part_number,
+                   ((const fty_sensor_gpio_template_t *) item2)->part_number);
+}
+
+//  --------------------------------------------------------------------------
+//  Create a template from its parsed file
+
+static fty_sensor_gpio_template_t *
+s_template_new (const char *part_number, zconfig_t *config)
+{
+    fty_sensor_gpio_template_t tpl;
+
+    tpl.part_number = (char *) part_number;
+    tpl.manufacturer = zconfig_get (config, "manufacturer", "");
+    tpl.type = zconfig_get (config, "type", "");
+    tpl.normal_state = zconfig_get (config, "normal-state", "");
+    tpl.gpx_direction = zconfig_get (config, "gpx-direction", "");
+    tpl.power_source = zconfig_get (config, "power-source", "");
+    tpl.alarm_severity = zconfig_get (config, "alarm-severity", "");
+    tpl.alarm_message = zconfig_get (config, "alarm-message", "");
+
+    return (fty_sensor_gpio_template_t *) s_template_dup (&tpl);
+}
+
+//  --------------------------------------------------------------------------
+//  (Re)load the template file of part_number, or forget it if there is none
+
+static void
+s_load (fty_sensor_gpio_templates_t *self, const char *part_number)
+{
+    std::string template_filename = std::string (self->template_dir) + part_number + TEMPLATE_SUFFIX;
+
+    zconfig_t *config = zconfig_load (template_filename.c_str ());
+    if (!config) {
+        log_debug ("Template config file %s doesn't exist!", template_filename.c_str ());
+        if (zhashx_lookup (self->templates, part_number)) {
+            zhashx_delete (self->templates, part_number);
+            self->generation++;
+        }
+        return;
+    }
+    fty_sensor_gpio_template_t *tpl = s_template_new (part_number, config);
+    if (tpl) {
+        zhashx_update (self->templates, part_number, tpl);
+        self->generation++;
+    }
+    zconfig_destroy (&config);
+}
+
+//  --------------------------------------------------------------------------
+//  Return the part number of a template file name, or an empty string if
+//  this is not a template
+
+static std::string
+s_part_number (const char *filename)
+{
+    size_t length = strlen (filename);
+    size_t suffix_length = strlen (TEMPLATE_SUFFIX);
+
+    if ((length <= suffix_length) || !streq (filename + length - suffix_length, TEMPLATE_SUFFIX))
+        return "";
+    return std::string (filename, length - suffix_length);
+}
+
+//  --------------------------------------------------------------------------
+//  (Re)load all the templates of the directory
+
+static void
+s_scan (fty_sensor_gpio_templates_t *self)
+{
+    zhashx_purge (self->templates);
+    self->generation++;
+
+    zdir_t *dir = zdir_new (self->template_dir, "-");
+    if (!dir) {
+        log_debug ("Can't read templates directory %s", self->template_dir);
+        return;
+    }
+    zlist_t *files = zdir_list (dir);
+    zfile_t *item = files ? (zfile_t *) zlist_first (files) : NULL;
+    while (item) {
+        std::string part_number = s_part_number (zfile_filename (item, self->template_dir));
+        if (part_number != "")
+            s_load (self, part_number.c_str ());
+        item = (zfile_t *) zlist_next (files);
+    }
+    zlist_destroy (&files);
+    zdir_destroy (&dir);
+    log_debug ("%zu templates loaded from %s", zhashx_size (self->templates), self->template_dir);
+}
+
+//  --------------------------------------------------------------------------
+//  Apply the pending changes of the template directory to the cache.
+//  Caller must hold the mutex
+
+static void
+s_refresh (fty_sensor_gpio_templates_t *self)
+{
+#ifdef __linux__
+    if (self->inotify_fd == -1)
+        return;
+
+    char buffer [4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    ssize_t length;
+    while ((length = read (self->inotify_fd, buffer, sizeof (buffer))) > 0) {
+        bool rescan = false;
+        for (char *ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event *) ptr;
+            ptr += sizeof (struct inotify_event) + event->len;
+
+            if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+                rescan = true;
+                continue;
+            }
+            if (!event->len)
+                continue;
+            std::string part_number = s_part_number (event->name);
+            if (part_number == "")
+                continue;
+            log_debug ("Template %s%s changed", self->template_dir, event->name);
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                zhashx_delete (self->templates, part_number.c_str ());
+                self->generation++;
+            }
+            else
+                s_load (self, part_number.c_str ());
+        }
+        if (rescan) {
+            // Events were lost, or the directory itself went away
+            log_warning ("Templates directory %s changes lost, reloading", self->template_dir);
+            if (inotify_add_watch (self->inotify_fd, self->template_dir,
+                    IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1) {
+                close (self->inotify_fd);
+                self->inotify_fd = -1;
+            }
+            s_scan (self);
+            break;
+        }
+    }
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Create a new fty_sensor_gpio_templates, or share the existing one of
+//  template_dir
+
+fty_sensor_gpio_templates_t *
+fty_sensor_gpio_templates_new (const char *template_dir)
+{
+    assert (template_dir);
+
+    pthread_mutex_lock (&s_shared_mutex);
+    for (fty_sensor_gpio_templates_t *shared = s_shared; shared; shared = shared->next) {
+        if (streq (shared->template_dir, template_dir)) {
+            shared->refs++;
+            pthread_mutex_unlock (&s_shared_mutex);
+            return shared;
+        }
+    }
+
+    fty_sensor_gpio_templates_t *self = (fty_sensor_gpio_templates_t *) zmalloc (sizeof (fty_sensor_gpio_templates_t));
+    assert (self);
+    //  Initialize class properties
+    self->template_dir = strdup (template_dir);
+    self->templates = zhashx_new ();
+    assert (self->templates);
+    zhashx_set_destructor (self->templates, s_template_free);
+    self->inotify_fd = -1;
+    self->refs = 1;
+    pthread_mutex_init (&self->mutex, NULL);
+#ifdef __linux__
+    self->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (self->inotify_fd != -1
+        && inotify_add_watch (self->inotify_fd, self->template_dir,
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1) {
+        log_warning ("Can't watch templates directory %s (%s), templates will be read on demand",
+            self->template_dir, strerror (errno));
+        close (self->inotify_fd);
+        self->inotify_fd = -1;
+    }
+#endif
+    s_scan (self);
+
+    self->next = s_shared;
+    s_shared = self;
+    pthread_mutex_unlock (&s_shared_mutex);
+
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destroy the fty_sensor_gpio_templates, once released by all its users
+
+void
+fty_sensor_gpio_templates_destroy (fty_sensor_gpio_templates_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        fty_sensor_gpio_templates_t *self = *self_p;
+        *self_p = NULL;
+
+        pthread_mutex_lock (&s_shared_mutex);
+        if (--self->refs > 0) {
+            pthread_mutex_unlock (&s_shared_mutex);
+            return;
+        }
+        fty_sensor_gpio_templates_t **shared_p = &s_shared;
+        while (*shared_p != self)
+            shared_p = &(*shared_p)->next;
+        *shared_p = self->next;
+        pthread_mutex_unlock (&s_shared_mutex);
+
+        //  Free class properties
+        if (self->inotify_fd != -1)
+            close (self->inotify_fd);
+        zhashx_destroy (&self->templates);
+        zstr_free (&self->template_dir);
+        pthread_mutex_destroy (&self->mutex);
+        //  Free object itself
+        free (self);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a copy of the template of part_number, or NULL if there is none
+
+fty_sensor_gpio_template_t *
+fty_sensor_gpio_templates_lookup (fty_sensor_gpio_templates_t *self, const char *part_number)
+{
+    assert (self);
+    if (!part_number || streq (part_number, "") || strchr (part_number, '/'))
+        return NULL;
+
+    pthread_mutex_lock (&self->mutex);
+    s_refresh (self);
+    fty_sensor_gpio_template_t *tpl = (fty_sensor_gpio_template_t *) zhashx_lookup (self->templates, part_number);
+    // Without a directory watch, changes on disk are only caught on misses
+    if (!tpl && (self->inotify_fd == -1)) {
+        s_load (self, part_number);
+        tpl = (fty_sensor_gpio_template_t *) zhashx_lookup (self->templates, part_number);
+    }
+    if (tpl)
+        tpl = (fty_sensor_gpio_template_t *) s_template_dup (tpl);
+    pthread_mutex_unlock (&self->mutex);
+
+    return tpl;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a copy of all the templates, sorted by part number
+
+zlistx_t *
+fty_sensor_gpio_templates_list (fty_sensor_gpio_templates_t *self)
+{
+    assert (self);
+
+    zlistx_t *list = zlistx_new ();
+    assert (list);
+    zlistx_set_duplicator (list, s_template_dup);
+    zlistx_set_destructor (list, s_template_free);
+    zlistx_set_comparator (list, s_template_cmp);
+
+    pthread_mutex_lock (&self->mutex);
+    s_refresh (self);
+    if (self->inotify_fd == -1)
+        s_scan (self);
+    fty_sensor_gpio_template_t *tpl = (fty_sensor_gpio_template_t *) zhashx_first (self->templates);
+    while (tpl) {
+        zlistx_add_end (list, tpl);
+        tpl = (fty_sensor_gpio_template_t *) zhashx_next (self->templates);
+    }
+    pthread_mutex_unlock (&self->mutex);
+
+    zlistx_sort (list);
+    return list;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Store the template of part_number, freshly saved from config
+
+void
+fty_sensor_gpio_templates_update (fty_sensor_gpio_templates_t *self, const char *part_number, zconfig_t *config)
+{
+    assert (self);
+    assert (part_number);
+    assert (config);
+
+    fty_sensor_gpio_template_t *tpl = s_template_new (part_number, config);
+    if (!tpl)
+        return;
+
+    pthread_mutex_lock (&self->mutex);
+    zhashx_update (self->templates, part_number, tpl);
+    self->generation++;
+    pthread_mutex_unlock (&self->mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the generation of the cache, which changes with any template, so
+//  that results built from the templates can be kept until it changes
+
+uint64_t
+fty_sensor_gpio_templates_generation (fty_sensor_gpio_templates_t *self)
+{
+    assert (self);
+
+    pthread_mutex_lock (&self->mutex);
+    s_refresh (self);
+    // Without a directory watch, changes on disk can't be told
+    if (self->inotify_fd == -1)
+        self->generation++;
+    uint64_t generation = self->generation;
+    pthread_mutex_unlock (&self->mutex);
+
+    return generation;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_sensor_gpio_templates_test (bool verbose)
+{
+    printf (" * fty_sensor_gpio_templates: ");
+
+    // Note: If your selftest reads SCMed fixture data, please keep it in
+    // src/selftest-ro; if your test creates filesystem objects, please
+    // do so under src/selftest-rw. They are defined below along with a
+    // usecase for the variables (assert) to make compilers happy.
+    const char *SELFTEST_DIR_RO = "src/selftest-ro";
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    assert (SELFTEST_DIR_RO);
+    assert (SELFTEST_DIR_RW);
+    std::string str_SELFTEST_DIR_RO = std::string(SELFTEST_DIR_RO);
+    std::string str_SELFTEST_DIR_RW = std::string(SELFTEST_DIR_RW);
+
+    //  @selftest
+    // Source-provided templates
+    std::string ro_dir = str_SELFTEST_DIR_RO + "/data/";
+    fty_sensor_gpio_templates_t *ro_templates = fty_sensor_gpio_templates_new (ro_dir.c_str ());
+    assert (ro_templates);
+    fty_sensor_gpio_template_t *tpl = fty_sensor_gpio_templates_lookup (ro_templates, "DCS001");
+    assert (tpl);
+    assert (streq (tpl->part_number, "DCS001"));
+    assert (streq (tpl->manufacturer, "Eaton"));
+    assert (streq (tpl->type, "door-contact-sensor"));
+    assert (streq (tpl->normal_state, "closed"));
+    assert (streq (tpl->gpx_direction, "GPI"));
+    assert (streq (tpl->power_source, "internal"));
+    assert (streq (tpl->alarm_severity, "WARNING"));
+    assert (streq (tpl->alarm_message, "Door has been $status"));
+    fty_sensor_gpio_template_destroy (&tpl);
+    assert (tpl == NULL);
+    assert (fty_sensor_gpio_templates_lookup (ro_templates, "NOTEXIST") == NULL);
+    assert (fty_sensor_gpio_templates_lookup (ro_templates, "../data/DCS001") == NULL);
+
+    // Same directory shares the same cache
+    fty_sensor_gpio_templates_t *shared = fty_sensor_gpio_templates_new (ro_dir.c_str ());
+    assert (shared == ro_templates);
+    fty_sensor_gpio_templates_destroy (&shared);
+    assert (shared == NULL);
+    tpl = fty_sensor_gpio_templates_lookup (ro_templates, "WLD012");
+    assert (tpl);
+    fty_sensor_gpio_template_destroy (&tpl);
+
+    zlistx_t *list = fty_sensor_gpio_templates_list (ro_templates);
+    assert (list);
+    assert (zlistx_size (list) == 8);
+    tpl = (fty_sensor_gpio_template_t *) zlistx_first (list);
+    assert (streq (tpl->part_number, "DCS001"));
+    tpl = (fty_sensor_gpio_template_t *) zlistx_last (list);
+    assert (streq (tpl->part_number, "XCELW"));
+    zlistx_destroy (&list);
+    fty_sensor_gpio_templates_destroy (&ro_templates);
+
+    // Changes made on disk and through the cache
+    std::string rw_dir = str_SELFTEST_DIR_RW + "/templates/";
+    zsys_dir_create (rw_dir.c_str ());
+    fty_sensor_gpio_templates_t *self = fty_sensor_gpio_templates_new (rw_dir.c_str ());
+    assert (self);
+    assert (fty_sensor_gpio_templates_lookup (self, "TEST001") == NULL);
+    uint64_t generation = fty_sensor_gpio_templates_generation (self);
+
+    zconfig_t *config = zconfig_new ("root", NULL);
+    zconfig_put (config, "manufacturer", "Eaton");
+    zconfig_put (config, "type", "dummy");
+    zconfig_put (config, "alarm-message", "Dummy has been $status");
+    fty_sensor_gpio_templates_update (self, "TEST001", config);
+    assert (fty_sensor_gpio_templates_generation (self) != generation);
+    generation = fty_sensor_gpio_templates_generation (self);
+#ifdef __linux__
+    assert (fty_sensor_gpio_templates_generation (self) == generation);
+#endif
+    tpl = fty_sensor_gpio_templates_lookup (self, "TEST001");
+    assert (tpl);
+    assert (streq (tpl->type, "dummy"));
+    assert (streq (tpl->normal_state, ""));
+    fty_sensor_gpio_template_destroy (&tpl);
+
+    // Written by someone else
+    zconfig_put (config, "type", "door-contact-sensor");
+    int rv = zconfig_save (config, (rw_dir + "TEST002.tpl").c_str ());
+    assert (rv == 0);
+    zconfig_destroy (&config);
+    assert (fty_sensor_gpio_templates_generation (self) != generation);
+    tpl = fty_sensor_gpio_templates_lookup (self, "TEST002");
+#ifdef __linux__
+    assert (tpl);
+    assert (streq (tpl->type, "door-contact-sensor"));
+#endif
+    fty_sensor_gpio_template_destroy (&tpl);
+
+    // Removed by someone else
+    rv = zsys_file_delete ((rw_dir + "TEST002.tpl").c_str ());
+    assert (rv == 0);
+    assert (fty_sensor_gpio_templates_lookup (self, "TEST002") == NULL);
+
+    fty_sensor_gpio_templates_destroy (&self);
+    assert (self == NULL);
+    zsys_dir_delete (rw_dir.c_str ());
+    //  @end
+    printf ("OK\n");
+}
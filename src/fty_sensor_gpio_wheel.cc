@@ -0,0 +1,386 @@
+/*  =========================================================================
+    fty_sensor_gpio_wheel - 42ITy GPIO hierarchical timing wheel
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_sensor_gpio_wheel - 42ITy GPIO hierarchical timing wheel
+@discuss
+    Timers are kept in 4 levels of 64 slots. Level 0 has one slot per tick,
+    and each upper level one slot per turn of the level below, so that the
+    wheel spans 2^24 ticks (46 hours with 10 msec ticks). Adding and
+    cancelling a timer are O(1), whatever the number of timers. When level 0
+    starts a new turn, the next slot of level 1 is cascaded into it, and so
+    on up the levels. Timers further away are kept in the last slot of
+    level 3, and placed again when cascaded.
+@end
+*/
+
+#include "fty_sensor_gpio_classes.h"
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+//  Timer, linked in its slot or in the expired list
+
+typedef struct _wheel_timer_t {
+    int64_t expires;                // tick at which the timer expires
+    void *item;                     // item of the caller
+    struct _wheel_timer_t *prev;    // previous timer of the list
+    struct _wheel_timer_t *next;    // next timer of the list
+    struct _wheel_timer_t **list;   // head of the list
+} wheel_timer_t;
+
+//  Structure of our class
+
+struct _fty_sensor_gpio_wheel_t {
+    int             tick;           // resolution (msec)
+    int64_t         current;        // next tick to process
+    wheel_timer_t   *slots [WHEEL_LEVELS][WHEEL_SLOTS];
+    wheel_timer_t   *expired;       // expired timers, not returned yet
+    size_t          size;           // number of timers
+};
+
+
+//  --------------------------------------------------------------------------
+//  Link / unlink a timer in a list
+
+static void
+s_link (wheel_timer_t *timer, wheel_timer_t **list)
+{
+    timer->prev = NULL;
+    timer->next = *list;
+    if (*list)
+        (*list)->prev = timer;
+    *list = timer;
+    timer->list = list;
+}
+
+static void
+s_unlink (wheel_timer_t *timer)
+{
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        *timer->list = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+    timer->list = NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Place a timer in the slot of its level, depending on how far it is
+
+static void
+s_place (fty_sensor_gpio_wheel_t *self, wheel_timer_t *timer)
+{
+    int64_t delta = timer->expires - self->current;
+    if (delta < 0) {
+        s_link (timer, &self->expired);
+        return;
+    }
+    int64_t expires = timer->expires;
+    if (delta >= ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)))
+        // Out of reach, to be placed again once cascaded from the last slot
+        expires = self->current + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    int level = 0;
+    while ((level < WHEEL_LEVELS - 1) && (delta >= ((int64_t) 1 << (WHEEL_BITS * (level + 1)))))
+        level++;
+    int index = (int) ((expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    s_link (timer, &self->slots [level][index]);
+}
+
+//  --------------------------------------------------------------------------
+//  Move the timers of a slot down to the lower levels
+
+static void
+s_cascade (fty_sensor_gpio_wheel_t *self, int level, int index)
+{
+    wheel_timer_t *timer = self->slots [level][index];
+    self->slots [level][index] = NULL;
+    while (timer) {
+        wheel_timer_t *next = timer->next;
+        s_place (self, timer);
+        timer = next;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Process the ticks up to target, moving their timers to the expired list
+
+static void
+s_advance (fty_sensor_gpio_wheel_t *self, int64_t target)
+{
+    while (self->current <= target) {
+        if (self->size == 0) {
+            // Nothing to cascade, jump ahead
+            self->current = target + 1;
+            return;
+        }
+        int index = (int) (self->current & WHEEL_MASK);
+        if (index == 0) {
+            // New turn of level 0, and maybe of the upper levels
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                int level_index = (int) ((self->current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+                s_cascade (self, level, level_index);
+                if (level_index != 0)
+                    break;
+            }
+        }
+        else if (!self->slots [0][index]) {
+            // Skip the empty slots, up to the end of the turn
+            int next = index + 1;
+            while ((next < WHEEL_SLOTS) && !self->slots [0][next])
+                next++;
+            int64_t next_tick = self->current - index + next;
+            self->current = (next_tick <= target) ? next_tick : target + 1;
+            continue;
+        }
+        wheel_timer_t *timer = self->slots [0][index];
+        self->slots [0][index] = NULL;
+        while (timer) {
+            wheel_timer_t *next = timer->next;
+            s_link (timer, &self->expired);
+            timer = next;
+        }
+        self->current++;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Create a new timing wheel
+
+fty_sensor_gpio_wheel_t *
+fty_sensor_gpio_wheel_new (int tick, int64_t now)
+{
+    assert (tick > 0);
+    fty_sensor_gpio_wheel_t *self = (fty_sensor_gpio_wheel_t *) zmalloc (sizeof (fty_sensor_gpio_wheel_t));
+    assert (self);
+    self->tick = tick;
+    self->current = now / tick;
+    self->expired = NULL;
+    self->size = 0;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destroy the timing wheel
+
+void
+fty_sensor_gpio_wheel_destroy (fty_sensor_gpio_wheel_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        fty_sensor_gpio_wheel_t *self = *self_p;
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            for (int index = 0; index < WHEEL_SLOTS; index++) {
+                while (self->slots [level][index]) {
+                    wheel_timer_t *timer = self->slots [level][index];
+                    s_unlink (timer);
+                    free (timer);
+                }
+            }
+        }
+        while (self->expired) {
+            wheel_timer_t *timer = self->expired;
+            s_unlink (timer);
+            free (timer);
+        }
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add a timer expiring item at time when
+
+void *
+fty_sensor_gpio_wheel_add (fty_sensor_gpio_wheel_t *self, int64_t when, void *item)
+{
+    assert (self);
+    wheel_timer_t *timer = (wheel_timer_t *) zmalloc (sizeof (wheel_timer_t));
+    assert (timer);
+    // Never expire before when
+    timer->expires = (when + self->tick - 1) / self->tick;
+    timer->item = item;
+    s_place (self, timer);
+    self->size++;
+    return timer;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Cancel a pending timer, and return its item
+
+void *
+fty_sensor_gpio_wheel_cancel (fty_sensor_gpio_wheel_t *self, void **handle_p)
+{
+    assert (self);
+    assert (handle_p);
+    wheel_timer_t *timer = (wheel_timer_t *) *handle_p;
+    if (!timer)
+        return NULL;
+    void *item = timer->item;
+    s_unlink (timer);
+    free (timer);
+    self->size--;
+    *handle_p = NULL;
+    return item;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the item of the next timer expired at time now, or NULL
+
+void *
+fty_sensor_gpio_wheel_expire (fty_sensor_gpio_wheel_t *self, int64_t now)
+{
+    assert (self);
+    if (!self->expired)
+        s_advance (self, now / self->tick);
+    wheel_timer_t *timer = self->expired;
+    if (!timer)
+        return NULL;
+    void *item = timer->item;
+    s_unlink (timer);
+    free (timer);
+    self->size--;
+    return item;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the time by which the wheel needs to be called again, or -1
+
+int64_t
+fty_sensor_gpio_wheel_next (fty_sensor_gpio_wheel_t *self)
+{
+    assert (self);
+    if (self->size == 0)
+        return -1;
+    if (self->expired)
+        return (self->current - 1) * self->tick;
+
+    // The cascade at the start of a turn is due now
+    int index = (int) (self->current & WHEEL_MASK);
+    if (index == 0)
+        return self->current * self->tick;
+    // Next timer of this turn of level 0, or else the next cascade
+    for (int next = index; next < WHEEL_SLOTS; next++) {
+        if (self->slots [0][next])
+            return (self->current - index + next) * self->tick;
+    }
+    return (self->current - index + WHEEL_SLOTS) * self->tick;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of pending timers
+
+size_t
+fty_sensor_gpio_wheel_size (fty_sensor_gpio_wheel_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_sensor_gpio_wheel_test (bool verbose)
+{
+    printf (" * fty_sensor_gpio_wheel: ");
+
+    //  @selftest
+    // Simulated time, from an arbitrary start
+    int64_t now = 123456789;
+    fty_sensor_gpio_wheel_t *self = fty_sensor_gpio_wheel_new (10, now);
+    assert (self);
+    assert (fty_sensor_gpio_wheel_next (self) == -1);
+    assert (fty_sensor_gpio_wheel_expire (self, now) == NULL);
+
+    // Timers on all the levels, and beyond the wheel span
+    const int count = 5000;
+    int64_t *expected = (int64_t *) zmalloc (count * sizeof (int64_t));
+    void **handles = (void **) zmalloc (count * sizeof (void *));
+    for (int i = 0; i < count; i++) {
+        int64_t delay = (i % 4 == 0) ? (i * 7) % 640 :
+                        (i % 4 == 1) ? (i * 997) % 40960 :
+                        (i % 4 == 2) ? (i * 99991) % 2621440 : 200000000 + i;
+        expected [i] = now + delay;
+        handles [i] = fty_sensor_gpio_wheel_add (self, expected [i], &expected [i]);
+    }
+    assert (fty_sensor_gpio_wheel_size (self) == (size_t) count);
+
+    // Cancel one timer out of 3
+    for (int i = 0; i < count; i += 3) {
+        assert (fty_sensor_gpio_wheel_cancel (self, &handles [i]) == &expected [i]);
+        assert (handles [i] == NULL);
+    }
+    size_t pending = fty_sensor_gpio_wheel_size (self);
+
+    // Each timer expires in the tick of its time, never earlier
+    int64_t end = now + 200000000 + count + 10;
+    size_t expired = 0;
+    while (now <= end) {
+        int64_t next = fty_sensor_gpio_wheel_next (self);
+        if (next == -1)
+            break;
+        assert (next >= now - 10);
+        now = (next > now) ? next : now;
+        int64_t *item;
+        while ((item = (int64_t *) fty_sensor_gpio_wheel_expire (self, now))) {
+            assert (*item <= now);
+            assert (now - *item < 10);
+            expired++;
+        }
+    }
+    assert (expired == pending);
+    assert (fty_sensor_gpio_wheel_size (self) == 0);
+
+    // Time jumps, i.e. late calls, expire everything due at once
+    for (int i = 0; i < 100; i++)
+        fty_sensor_gpio_wheel_add (self, now + i * 1000, &now);
+    assert (fty_sensor_gpio_wheel_next (self) <= now);
+    // Already due
+    fty_sensor_gpio_wheel_add (self, now - 5000, &now);
+    now += 50 * 1000;
+    expired = 0;
+    while (fty_sensor_gpio_wheel_expire (self, now))
+        expired++;
+    assert (expired == 52);
+    assert (fty_sensor_gpio_wheel_size (self) == 49);
+    assert (fty_sensor_gpio_wheel_next (self) > now);
+
+    free (expected);
+    free (handles);
+    fty_sensor_gpio_wheel_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -27,6 +27,24 @@
 */
 
 #include "fty_sensor_gpio_classes.h"
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <linux/gpio.h>
+#endif
+
+// GPIO character device (v2 uAPI) is only available on recent kernel headers
+#ifdef GPIO_V2_GET_LINE_IOCTL
+#define LIBGPIO_HAVE_CDEV 1
+#define LIBGPIO_CDEV_LINES_MAX GPIO_V2_LINES_MAX
+#else
+#define LIBGPIO_CDEV_LINES_MAX 64
+#endif
+
+// Interval between two checks of the edges of the watched simulated pins (msec)
+#define LIBGPIO_SIM_EVENT_TICK 10
 
 //  Structure of our class
 
@@ -39,7 +57,52 @@ struct _libgpio_t {
     int  gpi_count;          // number of supported GPI
     zhashx_t *gpi_mapping;   // mapping for GPIs
     zhashx_t *gpo_mapping;   // mapping for GPOs
+    zhashx_t *handles;       // pin -> libgpio_handle_t, pins kept exported
+    int  backend;            // GPIO_BACKEND_SYSFS, GPIO_BACKEND_CDEV or GPIO_BACKEND_SIM
+    char *chip_path;         // GPIO character device of the chipset (cdev)
+    int  chip_fd;            // opened chipset (cdev)
+    int  in_fd;              // line request holding all the GPIs (cdev)
+    int  in_lines[LIBGPIO_CDEV_LINES_MAX];  // chipset offsets of the GPIs (cdev)
+    int  in_count;           // number of requested GPI lines (cdev)
+    int  out_fd;             // line request holding all the GPOs (cdev)
+    int  out_lines[LIBGPIO_CDEV_LINES_MAX]; // chipset offsets of the GPOs (cdev)
+    int  out_count;          // number of requested GPO lines (cdev)
+    uint64_t out_values;     // last values written to the GPO lines (cdev)
+    zhashx_t *out_levels;    // pin -> last value written to the GPO, kept when
+                             // the lines are released (cdev)
+    bool in_edge;            // GPI lines are requested with edge detection (cdev)
+    int  event_fd;           // epoll set of the GPIs watched for edges
+    fty_sensor_gpio_sim_t *sim;  // simulated chipset (sim), NULL until used
+    int  sim_timer_fd;       // timer of the edges checks, in the epoll set (sim)
+    uint64_t *snapshot_pins[2];     // GPx in the last snapshot, by direction
+    uint64_t *snapshot_values[2];   // GPx opened in the last snapshot
+    uint64_t *snapshot_unknown[2];  // GPx which couldn't be read in the last snapshot
+    int  snapshot_words[2];  // size of the snapshot bitmasks, in 64 bits words
+    // Access counters, updated atomically (see s_stats_add)
+    uint64_t syscalls;       // system calls issued to access the GPIOs
+    uint64_t export_failures;    // pins which couldn't be exported
+    uint64_t direction_retries;  // retries to set the direction of a pin
 };
+
+//  Persistent handle on an exported pin, so that we don't have to
+//  export / set direction / open / close / unexport on every access
+
+typedef struct {
+    int  pin;                // HW pin number
+    int  direction;          // direction currently applied to the pin
+    int  fd;                 // 'value' file descriptor, re-read with pread
+    bool edge;               // edge detection enabled, fd is in the epoll set
+} libgpio_handle_t;
+
+//  Add to an access counter, which libgpio_get_stats reads without
+//  serializing with the GPIO accesses
+
+static inline void
+s_stats_add (uint64_t *counter, uint64_t count)
+{
+    __atomic_fetch_add (counter, count, __ATOMIC_RELAXED);
+}
+
 // FIXME: libgpio should be shared with -server and -asset too
 int  _gpo_count = 0;
 int  _gpi_count = 0;
@@ -49,6 +112,17 @@ int  _gpi_count = 0;
 static int libgpio_export(libgpio_t *self, int pin);
 static int libgpio_unexport(libgpio_t *self, int pin);
 static int libgpio_set_direction(libgpio_t *self, int pin, int dir);
+static libgpio_handle_t *libgpio_acquire(libgpio_t *self, int pin, int direction);
+static void libgpio_release(libgpio_t *self, libgpio_handle_t *handle);
+static void libgpio_release_all(libgpio_t *self);
+static int libgpio_cdev_read(libgpio_t *self, int pin, int direction);
+static int libgpio_cdev_write(libgpio_t *self, int pin, int value);
+static void libgpio_cdev_read_many(libgpio_t *self, const int *pins, int count, int direction, int *values);
+static void libgpio_cdev_write_many(libgpio_t *self, const int *pins, const int *values, int count, int *results);
+static int libgpio_cdev_watch(libgpio_t *self, int pin);
+static int libgpio_cdev_get_events(libgpio_t *self, int fd);
+static void libgpio_cdev_release(libgpio_t *self);
+static int libgpio_sim_watch(libgpio_t *self, int pin);
 static int mkpath(char* file_path, mode_t mode);
 // FIXME: use zsys_dir_create (...);
 
@@ -56,6 +130,25 @@ static int mkpath(char* file_path, mode_t mode);
 const char *SELFTEST_DIR_RO = "src/selftest-ro";
 const char *SELFTEST_DIR_RW = "src/selftest-rw";
 
+#ifdef LIBGPIO_HAVE_CDEV
+#define FAKE_CHIP_LINES    256
+#define FAKE_CHIP_REQUESTS 16
+
+//  Emulated chipset, for testing purpose
+static struct {
+    int  values[FAKE_CHIP_LINES];   // current value of each line
+    struct {
+        int fd;                     // line request file descriptor
+        int event_fd;               // write end of the request, to post edges
+        int num_lines;              // number of lines requested
+        int offsets[GPIO_V2_LINES_MAX];
+    } requests[FAKE_CHIP_REQUESTS];
+    int  get_values_count;          // number of GET_VALUES ioctls received
+} s_fake_chip;
+
+static void s_fake_chip_set (int line, int value);
+#endif
+
 void *dup_int_ptr (const void *ptr)
 {
     if (ptr == NULL) {
@@ -67,6 +160,16 @@ void *dup_int_ptr (const void *ptr)
     return (void *)new_ptr;
 }
 
+static size_t int_hash (const void *key)
+{
+    return (size_t) *(const int *) key;
+}
+
+static int int_cmp (const void *key1, const void *key2)
+{
+    return *(const int *) key1 - *(const int *) key2;
+}
+
 static void free_fn (void ** self_ptr)
 {
     if (!self_ptr || !*self_ptr) {
@@ -93,15 +196,46 @@ libgpio_new (void)
     self->gpi_count = 0;
     self->test_mode = false;
     self->gpi_mapping = zhashx_new ();
+    // GPx numbers are ints, not strings: 256 and 512 would collide
+    zhashx_set_key_hasher (self->gpi_mapping, int_hash);
+    zhashx_set_key_comparator (self->gpi_mapping, int_cmp);
     zhashx_set_key_duplicator (self->gpi_mapping, dup_int_ptr);
     zhashx_set_duplicator (self->gpi_mapping, dup_int_ptr);
     zhashx_set_destructor (self->gpi_mapping, free_fn);
     assert (self->gpi_mapping);
     self->gpo_mapping = zhashx_new ();
+    zhashx_set_key_hasher (self->gpo_mapping, int_hash);
+    zhashx_set_key_comparator (self->gpo_mapping, int_cmp);
     zhashx_set_key_duplicator (self->gpo_mapping, dup_int_ptr);
     zhashx_set_duplicator (self->gpo_mapping, dup_int_ptr);
     zhashx_set_destructor (self->gpo_mapping, free_fn);
     assert (self->gpo_mapping);
+    self->handles = zhashx_new ();
+    assert (self->handles);
+    zhashx_set_key_hasher (self->handles, int_hash);
+    zhashx_set_key_comparator (self->handles, int_cmp);
+    zhashx_set_key_duplicator (self->handles, dup_int_ptr);
+    zhashx_set_key_destructor (self->handles, free_fn);
+    zhashx_set_destructor (self->handles, free_fn);
+    self->backend = GPIO_BACKEND_SYSFS;
+    self->chip_path = strdup (GPIO_CHIP_DEFAULT);
+    self->chip_fd = -1;
+    self->in_fd = -1;
+    self->in_count = 0;
+    self->out_fd = -1;
+    self->out_count = 0;
+    self->out_values = 0;
+    self->out_levels = zhashx_new ();
+    assert (self->out_levels);
+    zhashx_set_key_hasher (self->out_levels, int_hash);
+    zhashx_set_key_comparator (self->out_levels, int_cmp);
+    zhashx_set_key_duplicator (self->out_levels, dup_int_ptr);
+    zhashx_set_duplicator (self->out_levels, dup_int_ptr);
+    zhashx_set_destructor (self->out_levels, free_fn);
+    self->in_edge = false;
+    self->event_fd = -1;
+    self->sim = NULL;
+    self->sim_timer_fd = -1;
 
     return self;
 }
@@ -113,6 +247,8 @@ void
 libgpio_set_gpio_base_address (libgpio_t *self, int GPx_base_index)
 {
     log_debug ("setting address to %i", GPx_base_index);
+    if (self->gpio_base_address != GPx_base_index)
+        libgpio_release_all (self);
     self->gpio_base_address = GPx_base_index;
 }
 
@@ -123,6 +259,8 @@ void
 libgpio_set_gpo_offset (libgpio_t *self, int gpo_offset)
 {
     log_debug ("setting GPO offset to %i", gpo_offset);
+    if (self->gpo_offset != gpo_offset)
+        libgpio_release_all (self);
     self->gpo_offset = gpo_offset;
 }
 
@@ -133,6 +271,8 @@ void
 libgpio_set_gpi_offset (libgpio_t *self, int gpi_offset)
 {
     log_debug ("setting GPI offset to %i", gpi_offset);
+    if (self->gpi_offset != gpi_offset)
+        libgpio_release_all (self);
     self->gpi_offset = gpi_offset;
 }
 
@@ -177,8 +317,13 @@ libgpio_get_gpo_count ()
 void
 libgpio_add_gpi_mapping (libgpio_t *self, int port_num, int pin_num)
 {
+    int *found_pin_ptr = (int *) zhashx_lookup (self->gpi_mapping, (const void *)&port_num);
+    // Keep the pins requested when the mapping is unchanged
+    if (found_pin_ptr && (*found_pin_ptr == pin_num))
+        return;
     log_debug ("adding GPI mapping from port %d to pin %d", port_num, pin_num);
-    zhashx_insert (self->gpi_mapping, (void *)&port_num, (void *)&pin_num);
+    libgpio_release_all (self);
+    zhashx_update (self->gpi_mapping, (void *)&port_num, (void *)&pin_num);
 }
 
 //---------------------------------------------------------------------------
@@ -186,8 +331,13 @@ libgpio_add_gpi_mapping (libgpio_t *self, int port_num, int pin_num)
 void
 libgpio_add_gpo_mapping (libgpio_t *self, int port_num, int pin_num)
 {
+    int *found_pin_ptr = (int *) zhashx_lookup (self->gpo_mapping, (const void *)&port_num);
+    // Keep the pins requested when the mapping is unchanged
+    if (found_pin_ptr && (*found_pin_ptr == pin_num))
+        return;
     log_debug ("adding GPIO mapping from port %d to pin %d", port_num, pin_num);
-    zhashx_insert (self->gpo_mapping, (void *)&port_num, (void *)&pin_num);
+    libgpio_release_all (self);
+    zhashx_update (self->gpo_mapping, (void *)&port_num, (void *)&pin_num);
 }
 //  --------------------------------------------------------------------------
 //  Set the test mode
@@ -196,9 +346,219 @@ void
 libgpio_set_test_mode (libgpio_t *self, bool test_mode)
 {
     log_debug ("setting test_mode to '%s'", (test_mode == true)?"True":"False");
+    // Handles were opened under the previous /sys root
+    libgpio_release_all (self);
     self->test_mode = test_mode;
 }
 
+//  --------------------------------------------------------------------------
+//  Set the backend used to access the GPIO chipset
+
+void
+libgpio_set_backend (libgpio_t *self, int backend)
+{
+    log_debug ("setting backend to '%s'", (backend == GPIO_BACKEND_CDEV)?"cdev":
+        (backend == GPIO_BACKEND_SIM)?"sim":"sysfs");
+    if (self->backend != backend)
+        libgpio_release_all (self);
+    self->backend = backend;
+}
+
+//  --------------------------------------------------------------------------
+//  Set the GPIO character device of the chipset (cdev backend)
+
+void
+libgpio_set_chip_path (libgpio_t *self, const char *chip_path)
+{
+    assert (chip_path);
+    log_debug ("setting chip path to '%s'", chip_path);
+    libgpio_release_all (self);
+    zstr_free (&self->chip_path);
+    self->chip_path = strdup (chip_path);
+}
+
+//  --------------------------------------------------------------------------
+//  Get the numeric value for a backend name
+
+int
+libgpio_get_backend_value (const char* backend_name)
+{
+    if (streq (backend_name, "sysfs"))
+        return GPIO_BACKEND_SYSFS;
+    else if (streq (backend_name, "cdev") || streq (backend_name, "gpiochip"))
+        return GPIO_BACKEND_CDEV;
+    else if (streq (backend_name, "sim"))
+        return GPIO_BACKEND_SIM;
+    return -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Get the simulated chipset (sim backend), created on first use
+
+fty_sensor_gpio_sim_t *
+libgpio_get_sim (libgpio_t *self)
+{
+    if (!self->sim) {
+        self->sim = fty_sensor_gpio_sim_new (FTY_SENSOR_GPIO_SIM_PINS);
+        assert (self->sim);
+    }
+    return self->sim;
+}
+
+//  --------------------------------------------------------------------------
+//  Get a file descriptor which becomes readable when a watched GPI changes,
+//  to be added to the caller's poller. Return -1 if not supported
+
+int
+libgpio_get_event_fd (libgpio_t *self)
+{
+#ifdef __linux__
+    if (self->event_fd == -1) {
+        self->event_fd = epoll_create1 (EPOLL_CLOEXEC);
+        if (self->event_fd == -1)
+            log_error ("Failed to create the GPIO events set! %i", errno);
+    }
+#endif
+    return self->event_fd;
+}
+
+//  --------------------------------------------------------------------------
+//  Enable edge detection on a GPI, so that its changes wake up the events
+//  file descriptor. Return 0 on success, -1 otherwise
+
+int
+libgpio_watch (libgpio_t *self, int GPI_number)
+{
+#ifdef __linux__
+    if (libgpio_get_event_fd (self) == -1)
+        return -1;
+
+    // Sanity check
+    if (GPI_number > self->gpi_count) {
+        log_error("Requested GPx is higher than the count of supported GPIO!");
+        return -1;
+    }
+
+    int pin;
+    int *pin_ptr = (int *)(zhashx_lookup (self->gpi_mapping, (const void *)&GPI_number));
+    if (pin_ptr == NULL)
+        pin = libgpio_compute_pin_number (self, GPI_number, GPIO_DIRECTION_IN);
+    else
+        pin = *pin_ptr;
+
+    if (self->backend == GPIO_BACKEND_CDEV)
+        return libgpio_cdev_watch (self, pin);
+    if (self->backend == GPIO_BACKEND_SIM)
+        return libgpio_sim_watch (self, pin);
+
+    libgpio_handle_t *handle = libgpio_acquire (self, pin, GPIO_DIRECTION_IN);
+    if (!handle)
+        return -1;
+    if (handle->edge)
+        return 0;
+
+    // Have the kernel notify both edges on the value file
+    char path[GPIO_VALUE_MAX];
+    snprintf(path, GPIO_VALUE_MAX, "%s/sys/class/gpio/gpio%d/edge",
+        (self->test_mode)?SELFTEST_DIR_RW:"", // trick #1 to allow testing
+        pin);
+    // trick #2 to allow testing
+    if (self->test_mode)
+        mkpath(path, 0777);
+    int fd = open(path, O_WRONLY | ((self->test_mode)?O_CREAT:0), 0777);
+    if (fd == -1) {
+        log_error ("Failed to open %s for writing!", path);
+        return -1;
+    }
+    s_stats_add (&self->syscalls, 3);
+    ssize_t rv = write(fd, "both", 4);
+    close(fd);
+    if (rv != 4) {
+        log_error ("Failed to set edge on pin %d!", pin);
+        return -1;
+    }
+
+    // sysfs signals changes with POLLPRI on the value file
+    struct epoll_event event;
+    memset (&event, 0, sizeof (event));
+    event.events = EPOLLPRI | EPOLLERR;
+    event.data.fd = handle->fd;
+    if (epoll_ctl (self->event_fd, EPOLL_CTL_ADD, handle->fd, &event) == -1) {
+        log_debug ("Can't watch pin %d (%i), it will only be polled", pin, errno);
+        return -1;
+    }
+    handle->edge = true;
+    log_debug ("watching GPI #%i (pin %i)", GPI_number, pin);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+//  --------------------------------------------------------------------------
+//  Acknowledge the pending GPI changes, without blocking.
+//  Return the number of changes, or -1 on error
+
+int
+libgpio_get_events (libgpio_t *self)
+{
+#ifdef __linux__
+    if (self->event_fd == -1)
+        return 0;
+
+    struct epoll_event events[16];
+    int count = 0;
+    int ready = epoll_wait (self->event_fd, events, 16, 0);
+    if (ready == -1) {
+        log_error ("Failed to get GPIO events! %i", errno);
+        return -1;
+    }
+    for (int i = 0; i < ready; i++) {
+        int fd = events[i].data.fd;
+        if (fd == self->sim_timer_fd) {
+            // The edges since the previous check, if any
+            uint64_t expirations;
+            s_stats_add (&self->syscalls, 1);
+            if (read (fd, &expirations, sizeof (expirations)) != sizeof (expirations))
+                log_error ("Failed to acknowledge the simulated GPIO events timer!");
+            if (self->sim)
+                count += fty_sensor_gpio_sim_events (self->sim);
+        }
+        else if (self->backend == GPIO_BACKEND_CDEV) {
+            count += libgpio_cdev_get_events (self, fd);
+        }
+        else {
+            // Re-reading the value file clears the notification
+            char value_str[3];
+            s_stats_add (&self->syscalls, 1);
+            if (pread (fd, value_str, 3, 0) <= 0)
+                log_error ("Failed to acknowledge GPIO event!");
+            count++;
+        }
+    }
+    return count;
+#else
+    return 0;
+#endif
+}
+
+//  --------------------------------------------------------------------------
+//  Get the access counters: system calls issued, pins which couldn't be
+//  exported and retries to set a pin direction. Any pointer may be NULL.
+//  This can be called while the GPIOs are accessed from another thread
+
+void
+libgpio_get_stats (libgpio_t *self, uint64_t *syscalls,
+    uint64_t *export_failures, uint64_t *direction_retries)
+{
+    if (syscalls)
+        *syscalls = __atomic_load_n (&self->syscalls, __ATOMIC_RELAXED);
+    if (export_failures)
+        *export_failures = __atomic_load_n (&self->export_failures, __ATOMIC_RELAXED);
+    if (direction_retries)
+        *direction_retries = __atomic_load_n (&self->direction_retries, __ATOMIC_RELAXED);
+}
+
 //  --------------------------------------------------------------------------
 //  Compute and store HW pin number
 int
@@ -227,169 +587,279 @@ libgpio_compute_pin_number (libgpio_t *self, int GPx_number, int direction)
 }
 
 //  --------------------------------------------------------------------------
-//  Read a GPI or GPO status
-int
-libgpio_read (libgpio_t *self, int GPx_number, int direction)
-{
-    char path[GPIO_VALUE_MAX];
-    char value_str[3];
-    int retvalue = -1;
-    int fd;
-    int retries = GPIO_MAX_RETRY;
-
-    memset(&value_str[0], 0, 3);
+//  Get the HW pin of a GPI or GPO, or -1 if it is not supported
 
+static int
+libgpio_pin (libgpio_t *self, int GPx_number, int direction)
+{
     // Sanity check
     if (GPx_number > ((direction==GPIO_DIRECTION_IN)?self->gpi_count:self->gpo_count)) {
         log_error("Requested GPx is higher than the count of supported GPIO!");
         return -1;
     }
 
-    int pin;
     int *pin_ptr;
     if (direction == GPIO_DIRECTION_IN)
         pin_ptr = (int *)(zhashx_lookup (self->gpi_mapping, (const void *)&GPx_number));
     else
         pin_ptr = (int *)(zhashx_lookup (self->gpo_mapping, (const void *)&GPx_number));
     if (pin_ptr == NULL)
-        pin = libgpio_compute_pin_number (self, GPx_number, direction);
-    else
-        pin = *pin_ptr;
-    log_debug ("reading GPx #%i (pin %i)", GPx_number, pin);
-    // Enable the desired GPIO
-    if (libgpio_export(self, pin) == -1) {
-        log_debug ("Failed to export, aborting...");
-        goto end;
-    }
-
-    // Set its direction, with a possible delay
-    while (libgpio_set_direction(self, pin, direction) == -1) {
-
-        log_warning ("Failed to set direction, retrying...");
+        return libgpio_compute_pin_number (self, GPx_number, direction);
+    return *pin_ptr;
+}
 
-        // Wait a bit for the sysfs to be created and udev rules to be applied
-        // so that we get the right privileges applied
-        zclock_sleep(500);
+//  --------------------------------------------------------------------------
+//  Read a pin through sysfs
 
-        if (retries-- > 0) {
-            continue;
-        }
+static int
+libgpio_sysfs_read (libgpio_t *self, int pin, int direction)
+{
+    char value_str[3];
 
-        log_error("Failed to set direction after %i tries. Aborting!", GPIO_MAX_RETRY);
-        goto end;
-    }
+    memset(&value_str[0], 0, 3);
 
-    snprintf(path, GPIO_VALUE_MAX, "%s/sys/class/gpio/gpio%d/value",
-        (self->test_mode)?SELFTEST_DIR_RW:"", // trick #1 to allow testing
-        pin);
-    // trick #2 to allow testing
-    if (self->test_mode)
-        mkpath(path, 0777);
-    fd = open(path, O_RDONLY | ((self->test_mode)?O_CREAT:0), 0777);
-    if (fd == -1) {
-        log_error("Failed to open gpio '%s' for reading!", path);
-        goto end;
+    // Get the exported and opened pin
+    libgpio_handle_t *handle = libgpio_acquire (self, pin, direction);
+    if (!handle) {
+        log_debug ("Failed to acquire pin %i, aborting...", pin);
+        return -1;
     }
 
-    if (read(fd, value_str, 3) <= 0) {
+    s_stats_add (&self->syscalls, 1);
+    if (pread(handle->fd, value_str, 3, 0) <= 0) {
         log_error("Failed to read value!");
-        close(fd);
-        goto end;
+        // Drop the handle, so that the next access starts from scratch
+        libgpio_release (self, handle);
+        return -1;
     }
-    retvalue = atoi(&value_str[0]);
 
     log_trace ("read value '%c'", value_str[0]);
 
-    close(fd);
-
-end:
-    if (libgpio_unexport(self, pin) == -1) {
-        log_error ("Failed to unexport...");
-        return -1;
-    }
-
-    return retvalue;
+    return atoi(&value_str[0]);
 }
+
 //  --------------------------------------------------------------------------
-//  Write a GPO (to enable or disable it)
-int
-libgpio_write (libgpio_t *self, int GPO_number, int value)
+//  Write a pin through sysfs
+
+static int
+libgpio_sysfs_write (libgpio_t *self, int pin, int value)
 {
     static const char s_values_str[] = "01";
-    char path[GPIO_VALUE_MAX];
-    int fd = -1;
     int retval = -1;
-    int retries = GPIO_MAX_RETRY;
 
-    // Sanity check
-    if (GPO_number > self->gpo_count) {
-        log_error("Requested GPx is higher than the count of supported GPIO!");
+    // Get the exported and opened pin
+    libgpio_handle_t *handle = libgpio_acquire (self, pin, GPIO_DIRECTION_OUT);
+    if (!handle) {
+        log_error ("Failed to acquire pin %i, aborting...", pin);
         return -1;
     }
 
-    int pin;
-    int *pin_ptr = (int *)(zhashx_lookup (self->gpo_mapping, (const void *)&GPO_number));
-    if (pin_ptr == NULL)
-        pin = libgpio_compute_pin_number (self, GPO_number, GPIO_DIRECTION_OUT);
+    s_stats_add (&self->syscalls, 1);
+    if (pwrite(handle->fd, &s_values_str[GPIO_STATE_CLOSED == value ? 0 : 1], 1, 0) != 1) {
+        log_error("Failed to write value!");
+        // Drop the handle, so that the next access starts from scratch
+        libgpio_release (self, handle);
+        retval = -1;
+    }
     else
-        pin = *pin_ptr;
+        retval = 0;
 
+    log_trace ("wrote value '%i' with result %i", value, retval);
+
+    return retval;
+}
+
+//  --------------------------------------------------------------------------
+//  Read a GPI or GPO status
+int
+libgpio_read (libgpio_t *self, int GPx_number, int direction)
+{
+    int pin = libgpio_pin (self, GPx_number, direction);
+    if (pin == -1)
+        return -1;
+    log_debug ("reading GPx #%i (pin %i)", GPx_number, pin);
+
+    if (self->backend == GPIO_BACKEND_CDEV)
+        return libgpio_cdev_read (self, pin, direction);
+    if (self->backend == GPIO_BACKEND_SIM)
+        return fty_sensor_gpio_sim_read (libgpio_get_sim (self), pin);
+    return libgpio_sysfs_read (self, pin, direction);
+}
+
+//  --------------------------------------------------------------------------
+//  Write a GPO (to enable or disable it)
+int
+libgpio_write (libgpio_t *self, int GPO_number, int value)
+{
+    int pin = libgpio_pin (self, GPO_number, GPIO_DIRECTION_OUT);
+    if (pin == -1)
+        return -1;
     log_trace ("writing GPO #%i (pin %i)", GPO_number, pin);
 
-    // Enable the desired GPIO
-    if (libgpio_export(self, pin) == -1) {
-        log_error ("Failed to export, aborting...");
-        goto end;
-    }
+    if (self->backend == GPIO_BACKEND_CDEV)
+        return libgpio_cdev_write (self, pin, value);
+    if (self->backend == GPIO_BACKEND_SIM)
+        return fty_sensor_gpio_sim_write (libgpio_get_sim (self),
+            pin, (GPIO_STATE_CLOSED == value) ? 0 : 1);
+    return libgpio_sysfs_write (self, pin, value);
+}
 
-    // Set its direction, with a possible delay
-    while (libgpio_set_direction(self, pin, GPIO_DIRECTION_OUT) == -1) {
+//  --------------------------------------------------------------------------
+//  Read GPI or GPO statuses at once. The character device reads all the
+//  lines of the direction with a single ioctl, sysfs has one value file
+//  per pin, so it still needs a read per pin
 
-        log_warning ("Failed to set direction, retrying...");
+int
+libgpio_read_many (libgpio_t *self, const int *GPx_numbers, int count,
+                   int direction, int *values)
+{
+    if (count <= 0)
+        return 0;
 
-        // Wait a bit for the sysfs to be created and udev rules to be applied
-        // so that we get the right privileges applied
-        zclock_sleep(500);
+    int *pins = (int *) zmalloc (count * sizeof (int));
+    for (int i = 0; i < count; i++)
+        pins[i] = libgpio_pin (self, GPx_numbers[i], direction);
+    log_debug ("reading %i GPx", count);
 
-        if (retries-- > 0) {
-            continue;
+    if (self->backend == GPIO_BACKEND_CDEV)
+        libgpio_cdev_read_many (self, pins, count, direction, values);
+    else {
+        for (int i = 0; i < count; i++) {
+            if (pins[i] == -1)
+                values[i] = -1;
+            else if (self->backend == GPIO_BACKEND_SIM)
+                values[i] = fty_sensor_gpio_sim_read (libgpio_get_sim (self), pins[i]);
+            else
+                values[i] = libgpio_sysfs_read (self, pins[i], direction);
         }
+    }
+    free (pins);
 
-        log_error("Failed to set direction after %i tries. Aborting!", GPIO_MAX_RETRY);
-        goto end;
+    int read = 0;
+    for (int i = 0; i < count; i++) {
+        if (values[i] != -1)
+            read++;
     }
+    return read;
+}
 
-    // trick #2 to allow testing
-    snprintf(path, GPIO_VALUE_MAX, "%s/sys/class/gpio/gpio%d/value",
-        (self->test_mode)?SELFTEST_DIR_RW:"", // trick #1 to allow testing
-        pin);
-    if (self->test_mode)
-        mkpath(path, 0777);
-    fd = open(path, O_WRONLY | ((self->test_mode)?O_CREAT:0), 0777);
-    if (fd == -1) {
-        log_error("Failed to open gpio value for writing (path: %s)!", path);
-        retval = -1;
-        goto end;
+//  --------------------------------------------------------------------------
+//  Write GPOs at once. The character device sets all the lines with a
+//  single ioctl
+
+int
+libgpio_write_many (libgpio_t *self, const int *GPO_numbers, const int *values,
+                    int count, int *results)
+{
+    if (count <= 0)
+        return 0;
+
+    int *pins = (int *) zmalloc (count * sizeof (int));
+    int *pin_results = (int *) zmalloc (count * sizeof (int));
+    for (int i = 0; i < count; i++)
+        pins[i] = libgpio_pin (self, GPO_numbers[i], GPIO_DIRECTION_OUT);
+    log_trace ("writing %i GPO", count);
+
+    if (self->backend == GPIO_BACKEND_CDEV)
+        libgpio_cdev_write_many (self, pins, values, count, pin_results);
+    else {
+        for (int i = 0; i < count; i++) {
+            if (pins[i] == -1)
+                pin_results[i] = -1;
+            else if (self->backend == GPIO_BACKEND_SIM)
+                pin_results[i] = fty_sensor_gpio_sim_write (libgpio_get_sim (self),
+                    pins[i], (GPIO_STATE_CLOSED == values[i]) ? 0 : 1);
+            else
+                pin_results[i] = libgpio_sysfs_write (self, pins[i], values[i]);
+        }
     }
 
-    if (write(fd, &s_values_str[GPIO_STATE_CLOSED == value ? 0 : 1], 1) != 1) {
-        log_error("Failed to write value!");
-        retval = -1;
+    int written = 0;
+    for (int i = 0; i < count; i++) {
+        if (pin_results[i] == 0)
+            written++;
+        if (results)
+            results[i] = pin_results[i];
     }
-    else
-        retval = 0;
+    free (pins);
+    free (pin_results);
+    return written;
+}
 
-    log_trace ("wrote value '%i' with result %i", value, retval);
+//  --------------------------------------------------------------------------
+//  Read the GPx of a direction as a snapshot, compared to the previous one
+//  64 GPx at a time, so that the caller only looks at the GPx which changed
 
-    close(fd);
-end:
-    if (libgpio_unexport(self, pin) == -1) {
-        retval = -1;
+int
+libgpio_read_snapshot (libgpio_t *self, int direction, const uint64_t *pins,
+                       int words, uint64_t *values, uint64_t *unknown, uint64_t *changed)
+{
+    if (((direction != GPIO_DIRECTION_IN) && (direction != GPIO_DIRECTION_OUT))
+        || (words < 0) || (words && !pins))
+        return -1;
+
+    // The GPx not yet in the snapshot are all seen as changed
+    if (self->snapshot_words[direction] < words) {
+        size_t size = words * sizeof (uint64_t);
+        size_t previous = self->snapshot_words[direction] * sizeof (uint64_t);
+        uint64_t **bitmasks[] = { &self->snapshot_pins[direction],
+            &self->snapshot_values[direction], &self->snapshot_unknown[direction] };
+        for (uint64_t **bitmask : bitmasks) {
+            *bitmask = (uint64_t *) realloc (*bitmask, size);
+            assert (*bitmask);
+            memset ((char *) *bitmask + previous, 0, size - previous);
+        }
+        self->snapshot_words[direction] = words;
     }
-    return retval;
+    uint64_t *last_pins = self->snapshot_pins[direction];
+    uint64_t *last_values = self->snapshot_values[direction];
+    uint64_t *last_unknown = self->snapshot_unknown[direction];
+
+    // Read all the GPx at once
+    int count = 0;
+    for (int word = 0; word < words; word++)
+        count += __builtin_popcountll (pins[word]);
+    int *numbers = (int *) zmalloc ((count + 1) * sizeof (int));
+    int *read_values = (int *) zmalloc ((count + 1) * sizeof (int));
+    int index = 0;
+    for (int word = 0; word < words; word++) {
+        for (uint64_t bits = pins[word]; bits; bits &= bits - 1)
+            numbers[index++] = word * 64 + __builtin_ctzll (bits);
+    }
+    int read = libgpio_read_many (self, numbers, count, direction, read_values);
+
+    // Compare to the previous snapshot, then replace it
+    index = 0;
+    for (int word = 0; word < self->snapshot_words[direction]; word++) {
+        uint64_t word_pins = (word < words) ? pins[word] : 0;
+        uint64_t word_values = 0;
+        uint64_t word_unknown = 0;
+        for (uint64_t bits = word_pins; bits; bits &= bits - 1) {
+            uint64_t bit = bits & -bits;
+            int value = read_values[index++];
+            if (value == -1)
+                word_unknown |= bit;
+            else if (value != 0)
+                word_values |= bit;
+        }
+        if (word < words) {
+            if (values)
+                values[word] = word_values;
+            if (unknown)
+                unknown[word] = word_unknown;
+            if (changed)
+                changed[word] = ((word_values ^ last_values[word])
+                    | (word_unknown ^ last_unknown[word]) | ~last_pins[word]) & word_pins;
+        }
+        last_pins[word] = word_pins;
+        last_values[word] = word_values;
+        last_unknown[word] = word_unknown;
+    }
+    free (numbers);
+    free (read_values);
+    return read;
 }
 
-
 //  --------------------------------------------------------------------------
 //  Get the textual name for a status
 const string
@@ -444,8 +914,22 @@ libgpio_destroy (libgpio_t **self_p)
     if (*self_p) {
         libgpio_t *self = *self_p;
         //  Free class properties here
+        libgpio_release_all (self);
+        zhashx_destroy (&self->handles);
+        zstr_free (&self->chip_path);
+        if (self->event_fd != -1)
+            close (self->event_fd);
+        if (self->sim_timer_fd != -1)
+            close (self->sim_timer_fd);
+        fty_sensor_gpio_sim_destroy (&self->sim);
+        for (int direction = 0; direction < 2; direction++) {
+            free (self->snapshot_pins[direction]);
+            free (self->snapshot_values[direction]);
+            free (self->snapshot_unknown[direction]);
+        }
         zhashx_destroy (&self->gpi_mapping);
         zhashx_destroy (&self->gpo_mapping);
+        zhashx_destroy (&self->out_levels);
         //  Free object itself
         free (self);
         *self_p = NULL;
@@ -509,11 +993,205 @@ libgpio_test (bool verbose)
     // Read test
     assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_CLOSED );
 
+    // Pin handles are kept open, so later changes must be seen on re-read
+    assert( libgpio_write (self, 1, GPIO_STATE_OPENED) == 0);
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_OPENED );
+    assert( libgpio_write (self, 1, GPIO_STATE_CLOSED) == 0);
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_CLOSED );
+
+    // Once the pin is held, a read costs a single system call
+    uint64_t syscalls, syscalls_before, export_failures;
+    libgpio_get_stats (self, &syscalls_before, &export_failures, NULL);
+    assert( syscalls_before > 0 && export_failures == 0 );
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_CLOSED );
+    libgpio_get_stats (self, &syscalls, NULL, NULL);
+    assert( syscalls == syscalls_before + 1 );
+
+    // Batched accesses, with a GPI beyond the supported count
+    int gpo_numbers[] = { 1, 2 };
+    int gpo_values[] = { GPIO_STATE_OPENED, GPIO_STATE_CLOSED };
+    int gpo_results[2];
+    assert( libgpio_write_many (self, gpo_numbers, gpo_values, 2, gpo_results) == 2 );
+    assert( gpo_results[0] == 0 && gpo_results[1] == 0 );
+    int gpi_numbers[] = { 1, 2, 11 };
+    int gpi_values[3];
+    assert( libgpio_read_many (self, gpi_numbers, 3, GPIO_DIRECTION_IN, gpi_values) == 2 );
+    assert( gpi_values[0] == GPIO_STATE_OPENED );
+    assert( gpi_values[1] == GPIO_STATE_CLOSED );
+    assert( gpi_values[2] == -1 );
+
+    // Remapping drops the handles, and accesses still work afterward
+    libgpio_set_gpio_base_address (self, 10);
+    assert( libgpio_write (self, 1, GPIO_STATE_OPENED) == 0);
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_OPENED );
+
+    // Setting the same mapping again keeps the handles, a new one drops them
+    libgpio_add_gpi_mapping (self, 2, 12);
+    assert( libgpio_write (self, 1, GPIO_STATE_CLOSED) == 0);
+    assert( zhashx_size (self->handles) > 0 );
+    libgpio_add_gpi_mapping (self, 2, 12);
+    assert( zhashx_size (self->handles) > 0 );
+    libgpio_add_gpi_mapping (self, 2, 13);
+    assert( zhashx_size (self->handles) == 0 );
+
     // Value resolution test
     assert( libgpio_get_status_value("opened") == GPIO_STATE_OPENED );
     assert( libgpio_get_status_value("closed") == GPIO_STATE_CLOSED );
     assert( libgpio_get_status_value( libgpio_get_status_string(GPIO_STATE_CLOSED).c_str() ) == GPIO_STATE_CLOSED );
 
+    // Unexports the pins, so do it before cleaning up
+    libgpio_destroy (&self);
+
+#ifdef LIBGPIO_HAVE_CDEV
+    // Character device backend, through the emulated chipset
+    self = libgpio_new ();
+    assert (self);
+    libgpio_set_test_mode (self, true);
+    libgpio_set_backend (self, libgpio_get_backend_value ("cdev"));
+    libgpio_set_gpio_base_address (self, 488);
+    libgpio_set_gpi_offset (self, -1);
+    libgpio_set_gpo_offset (self, 20);
+    libgpio_set_gpi_count (self, 10);
+    libgpio_set_gpo_count (self, 5);
+    libgpio_add_gpo_mapping (self, 4, 502);
+
+    s_fake_chip.values[0] = 1;  // GPI 1
+    s_fake_chip.values[1] = 0;  // GPI 2
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_OPENED );
+    assert( libgpio_read (self, 2, GPIO_DIRECTION_IN) == GPIO_STATE_CLOSED );
+    // Each read gets all the GPIs through a single ioctl
+    int get_values_count = s_fake_chip.get_values_count;
+    s_fake_chip.values[1] = 1;
+    assert( libgpio_read (self, 2, GPIO_DIRECTION_IN) == GPIO_STATE_OPENED );
+    assert( s_fake_chip.get_values_count == get_values_count + 1 );
+
+    // GPO 1 is line 21, GPO 4 is mapped to line 14
+    assert( libgpio_write (self, 1, GPIO_STATE_OPENED) == 0 );
+    assert( s_fake_chip.values[21] == 1 );
+    assert( libgpio_write (self, 4, GPIO_STATE_OPENED) == 0 );
+    assert( s_fake_chip.values[14] == 1 );
+    // Adding a line to the request must preserve the previous GPO values
+    assert( s_fake_chip.values[21] == 1 );
+    assert( libgpio_write (self, 1, GPIO_STATE_CLOSED) == 0 );
+    assert( s_fake_chip.values[21] == 0 );
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_OUT) == GPIO_STATE_CLOSED );
+    assert( libgpio_read (self, 4, GPIO_DIRECTION_OUT) == GPIO_STATE_OPENED );
+
+    // Batched accesses: a single ioctl for all the GPOs, once the new GPO 2
+    // (line 22) is requested along with the others
+    int cdev_gpo[] = { 1, 2, 4 };
+    int cdev_gpo_values[] = { GPIO_STATE_OPENED, GPIO_STATE_OPENED, GPIO_STATE_CLOSED };
+    uint64_t cdev_syscalls_before, cdev_syscalls;
+    libgpio_get_stats (self, &cdev_syscalls_before, NULL, NULL);
+    assert( libgpio_write_many (self, cdev_gpo, cdev_gpo_values, 3, NULL) == 3 );
+    libgpio_get_stats (self, &cdev_syscalls, NULL, NULL);
+    assert( cdev_syscalls == cdev_syscalls_before + 2 );
+    assert( s_fake_chip.values[21] == 1 );
+    assert( s_fake_chip.values[22] == 1 );
+    assert( s_fake_chip.values[14] == 0 );
+    // A remapping (GPO 5 to line 15) releases the lines, which are requested
+    // again driven as last written, so reading the GPOs back doesn't close them
+    libgpio_add_gpo_mapping (self, 5, 503);
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_OUT) == GPIO_STATE_OPENED );
+    assert( libgpio_read (self, 2, GPIO_DIRECTION_OUT) == GPIO_STATE_OPENED );
+    assert( libgpio_read (self, 4, GPIO_DIRECTION_OUT) == GPIO_STATE_CLOSED );
+    assert( s_fake_chip.values[21] == 1 );
+    assert( s_fake_chip.values[22] == 1 );
+    // and for all the GPIs, the invalid ones being skipped
+    s_fake_chip.values[2] = 1;  // GPI 3
+    int cdev_gpi[] = { 1, 2, 3, 11 };
+    int cdev_gpi_values[4];
+    get_values_count = s_fake_chip.get_values_count;
+    assert( libgpio_read_many (self, cdev_gpi, 4, GPIO_DIRECTION_IN, cdev_gpi_values) == 3 );
+    assert( s_fake_chip.get_values_count == get_values_count + 1 );
+    assert( cdev_gpi_values[0] == GPIO_STATE_OPENED );
+    assert( cdev_gpi_values[1] == GPIO_STATE_OPENED );
+    assert( cdev_gpi_values[2] == GPIO_STATE_OPENED );
+    assert( cdev_gpi_values[3] == -1 );
+
+    // Edge detection: a GPI change wakes up the events file descriptor
+    int event_fd = libgpio_get_event_fd (self);
+    assert( event_fd != -1 );
+    assert( libgpio_watch (self, 1) == 0 );
+    assert( libgpio_watch (self, 2) == 0 );
+    assert( libgpio_get_events (self) == 0 );
+    struct pollfd pfd = { event_fd, POLLIN, 0 };
+    assert( poll (&pfd, 1, 0) == 0 );
+    s_fake_chip_set (0, 0);
+    assert( poll (&pfd, 1, 1000) == 1 );
+    assert( libgpio_get_events (self) == 1 );
+    assert( poll (&pfd, 1, 0) == 0 );
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_CLOSED );
+
+    libgpio_destroy (&self);
+#endif
+
+    // Simulated backend: no file system access, thousands of pins
+    self = libgpio_new ();
+    assert (self);
+    libgpio_set_backend (self, libgpio_get_backend_value ("sim"));
+    libgpio_set_gpio_base_address (self, 0);
+    libgpio_set_gpi_count (self, 2000);
+    libgpio_set_gpo_count (self, 2000);
+    libgpio_set_gpo_offset (self, 2000);
+    fty_sensor_gpio_sim_t *sim = libgpio_get_sim (self);
+    assert (sim);
+    fty_sensor_gpio_sim_set_clock (sim, 0);
+    // GPI 1 to 1000 toggle every 10 msec, GPI 2000 is opened
+    assert( fty_sensor_gpio_sim_waveform (sim, 1, 1000, "toggle=10") == 0 );
+    assert( fty_sensor_gpio_sim_waveform (sim, 2000, 2000, "level=1") == 0 );
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_IN) == GPIO_STATE_CLOSED );
+    assert( libgpio_read (self, 2000, GPIO_DIRECTION_IN) == GPIO_STATE_OPENED );
+    fty_sensor_gpio_sim_set_clock (sim, 10);
+    for (int i = 1; i <= 1000; i++)
+        assert( libgpio_read (self, i, GPIO_DIRECTION_IN) == GPIO_STATE_OPENED );
+    int sim_gpi[] = { 1, 2000 };
+    int sim_values[2];
+    assert( libgpio_read_many (self, sim_gpi, 2, GPIO_DIRECTION_IN, sim_values) == 2 );
+    assert( sim_values[0] == GPIO_STATE_OPENED && sim_values[1] == GPIO_STATE_OPENED );
+    // Pin snapshots only report the GPx which changed, here GPI 1 and 2
+    // toggling and GPI 2000 opened
+    const int snap_words = GPIO_SNAPSHOT_WORDS (2000);
+    uint64_t snap_pins[snap_words] = { 0x6 };
+    snap_pins[2000 / 64] |= 1ULL << (2000 % 64);
+    uint64_t snap_values[snap_words], snap_unknown[snap_words], snap_changed[snap_words];
+    assert( libgpio_read_snapshot (self, GPIO_DIRECTION_IN, snap_pins, snap_words,
+        snap_values, snap_unknown, snap_changed) == 3 );
+    for (int word = 0; word < snap_words; word++) {
+        assert( snap_values[word] == snap_pins[word] );
+        assert( snap_unknown[word] == 0 );
+        assert( snap_changed[word] == snap_pins[word] );
+    }
+    assert( libgpio_read_snapshot (self, GPIO_DIRECTION_IN, snap_pins, snap_words,
+        NULL, NULL, snap_changed) == 3 );
+    for (int word = 0; word < snap_words; word++)
+        assert( snap_changed[word] == 0 );
+    fty_sensor_gpio_sim_set_clock (sim, 20);
+    assert( libgpio_read_snapshot (self, GPIO_DIRECTION_IN, snap_pins, snap_words,
+        snap_values, NULL, snap_changed) == 3 );
+    assert( snap_values[0] == 0 && snap_changed[0] == 0x6 );
+    assert( snap_values[2000 / 64] == snap_pins[2000 / 64] && snap_changed[2000 / 64] == 0 );
+    fty_sensor_gpio_sim_set_clock (sim, 10);
+    // GPO 1 is pin 2001
+    assert( libgpio_write (self, 1, GPIO_STATE_OPENED) == 0 );
+    assert( fty_sensor_gpio_sim_read (sim, 2001) == 1 );
+    assert( libgpio_read (self, 1, GPIO_DIRECTION_OUT) == GPIO_STATE_OPENED );
+    uint64_t sim_syscalls;
+    libgpio_get_stats (self, &sim_syscalls, NULL, NULL);
+    assert( sim_syscalls == 0 );
+#ifdef __linux__
+    // Edges of the watched pins are checked on a timer
+    int sim_event_fd = libgpio_get_event_fd (self);
+    assert( sim_event_fd != -1 );
+    assert( libgpio_watch (self, 1) == 0 );
+    assert( libgpio_watch (self, 2) == 0 );
+    fty_sensor_gpio_sim_set_clock (sim, 100);
+    struct pollfd sim_pfd = { sim_event_fd, POLLIN, 0 };
+    assert( poll (&sim_pfd, 1, 1000) == 1 );
+    assert( libgpio_get_events (self) == 2 * 9 );
+#endif
+    libgpio_destroy (&self);
+
     // Delete all test files
     std::string sys_fn = string(SELFTEST_DIR_RW) + "/sys";
     zdir_t *dir = zdir_new (sys_fn.c_str(), NULL);
@@ -521,8 +1199,6 @@ libgpio_test (bool verbose)
     zdir_remove (dir, true);
     zdir_destroy (&dir);
 
-    libgpio_destroy (&self);
-
     //  @end
     printf ("OK\n");
 }
@@ -553,6 +1229,7 @@ libgpio_export(libgpio_t *self, int pin)
         return -1;
     }
     log_debug ("exporting pin %d", pin);
+    s_stats_add (&self->syscalls, 3);
 
     bytes_written = snprintf(buffer, GPIO_BUFFER_MAX, "%d", pin);
     if (write(fd, buffer, bytes_written) < bytes_written) {
@@ -587,6 +1264,7 @@ libgpio_unexport(libgpio_t *self, int pin)
       log_error("Failed to open unexport for writing!");
       return -1;
     }
+    s_stats_add (&self->syscalls, 3);
 
     bytes_written = snprintf(buffer, GPIO_BUFFER_MAX, "%d", pin);
     if (write(fd, buffer, bytes_written) < bytes_written) {
@@ -623,6 +1301,7 @@ libgpio_set_direction(libgpio_t *self, int pin, int direction)
         log_error ("Failed to open %s for writing!", path);
         return -1;
     }
+    s_stats_add (&self->syscalls, 3);
 
     if (write(fd, &s_directions_str[GPIO_DIRECTION_IN == direction ? 0 : 3],
       GPIO_DIRECTION_IN == direction ? 2 : 3) == -1) {
@@ -634,6 +1313,580 @@ libgpio_set_direction(libgpio_t *self, int pin, int direction)
     return retval;
 }
 
+//  --------------------------------------------------------------------------
+//  Get a persistent handle on the pin, exporting it, setting its direction
+//  and opening its value file only when needed.
+//  Return NULL on error
+
+static libgpio_handle_t *
+libgpio_acquire(libgpio_t *self, int pin, int direction)
+{
+    char path[GPIO_VALUE_MAX];
+    int retries = GPIO_MAX_RETRY;
+
+    libgpio_handle_t *handle = (libgpio_handle_t *) zhashx_lookup (self->handles, (const void *)&pin);
+    if (handle && handle->direction == direction)
+        return handle;
+
+    if (!handle) {
+        // Enable the desired GPIO
+        if (libgpio_export(self, pin) == -1) {
+            log_debug ("Failed to export, aborting...");
+            s_stats_add (&self->export_failures, 1);
+            libgpio_unexport(self, pin);
+            return NULL;
+        }
+        handle = (libgpio_handle_t *) zmalloc (sizeof (libgpio_handle_t));
+        assert (handle);
+        handle->pin = pin;
+        handle->direction = direction;
+        handle->fd = -1;
+        zhashx_insert (self->handles, (const void *)&pin, (void *)handle);
+    }
+    else {
+        log_debug ("changing direction of pin %d", pin);
+        close(handle->fd);
+        handle->fd = -1;
+        handle->direction = direction;
+    }
+
+    // Set its direction, with a possible delay
+    while (libgpio_set_direction(self, pin, direction) == -1) {
+
+        log_warning ("Failed to set direction, retrying...");
+
+        // Wait a bit for the sysfs to be created and udev rules to be applied
+        // so that we get the right privileges applied
+        zclock_sleep(500);
+
+        if (retries-- > 0) {
+            s_stats_add (&self->direction_retries, 1);
+            continue;
+        }
+
+        log_error("Failed to set direction after %i tries. Aborting!", GPIO_MAX_RETRY);
+        libgpio_release (self, handle);
+        return NULL;
+    }
+
+    snprintf(path, GPIO_VALUE_MAX, "%s/sys/class/gpio/gpio%d/value",
+        (self->test_mode)?SELFTEST_DIR_RW:"", // trick #1 to allow testing
+        pin);
+    // trick #2 to allow testing
+    if (self->test_mode)
+        mkpath(path, 0777);
+    // Outputs are opened read-write, to also allow reading back their state
+    s_stats_add (&self->syscalls, 1);
+    handle->fd = open(path,
+        ((direction == GPIO_DIRECTION_IN)?O_RDONLY:O_RDWR) | ((self->test_mode)?O_CREAT:0), 0777);
+    if (handle->fd == -1) {
+        log_error("Failed to open gpio '%s'!", path);
+        libgpio_release (self, handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+//  --------------------------------------------------------------------------
+//  Close and unexport a pin, and forget its handle
+
+static void
+libgpio_release(libgpio_t *self, libgpio_handle_t *handle)
+{
+    int pin = handle->pin;
+
+    if (handle->fd != -1)
+        close(handle->fd);
+    if (libgpio_unexport(self, pin) == -1)
+        log_error ("Failed to unexport pin %d...", pin);
+    zhashx_delete (self->handles, (const void *)&pin);
+}
+
+//  --------------------------------------------------------------------------
+//  Close and unexport all pins, i.e. on destroy or when the mapping changes
+
+static void
+libgpio_release_all(libgpio_t *self)
+{
+    libgpio_handle_t *handle = (libgpio_handle_t *) zhashx_first (self->handles);
+    while (handle) {
+        if (handle->fd != -1)
+            close(handle->fd);
+        if (libgpio_unexport(self, handle->pin) == -1)
+            log_error ("Failed to unexport pin %d...", handle->pin);
+        handle = (libgpio_handle_t *) zhashx_next (self->handles);
+    }
+    zhashx_purge (self->handles);
+    libgpio_cdev_release (self);
+}
+
+//  --------------------------------------------------------------------------
+//  GPIO character device backend
+//
+//  All the GPIs are held by a single line request, and all the GPOs by
+//  another one, so that a single GPIO_V2_LINE_GET_VALUES ioctl reads every
+//  configured GPI at once. Line offsets are computed from the pin numbers
+//  (base address + offset, or mapping) minus the chipset base address.
+//  In test mode, the chipset is emulated through an ioctl shim.
+
+#ifdef LIBGPIO_HAVE_CDEV
+
+static int
+s_fake_chip_ioctl (int fd, unsigned long request, void *arg)
+{
+    if (request == GPIO_V2_GET_LINE_IOCTL) {
+        struct gpio_v2_line_request *req = (struct gpio_v2_line_request *) arg;
+        // Use a pipe, so that line events can be posted and polled
+        int pipe_fds[2];
+        if (pipe (pipe_fds) == -1)
+            return -1;
+        int req_fd = pipe_fds[0];
+        // File descriptors are recycled once closed, so reuse their slot
+        int slot = -1;
+        for (int i = 0; i < FAKE_CHIP_REQUESTS; i++) {
+            if (s_fake_chip.requests[i].fd == req_fd || s_fake_chip.requests[i].fd <= 0) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot == -1) {
+            close (pipe_fds[0]);
+            close (pipe_fds[1]);
+            errno = ENOMEM;
+            return -1;
+        }
+        if (s_fake_chip.requests[slot].event_fd > 0)
+            close (s_fake_chip.requests[slot].event_fd);
+        s_fake_chip.requests[slot].event_fd =
+            (req->config.flags & GPIO_V2_LINE_FLAG_EDGE_RISING)?pipe_fds[1]:0;
+        if (!(req->config.flags & GPIO_V2_LINE_FLAG_EDGE_RISING))
+            close (pipe_fds[1]);
+        s_fake_chip.requests[slot].fd = req_fd;
+        s_fake_chip.requests[slot].num_lines = req->num_lines;
+        for (unsigned int i = 0; i < req->num_lines; i++) {
+            if (req->offsets[i] >= FAKE_CHIP_LINES) {
+                close (req_fd);
+                if (s_fake_chip.requests[slot].event_fd > 0)
+                    close (s_fake_chip.requests[slot].event_fd);
+                s_fake_chip.requests[slot].event_fd = 0;
+                s_fake_chip.requests[slot].fd = 0;
+                errno = EINVAL;
+                return -1;
+            }
+            s_fake_chip.requests[slot].offsets[i] = req->offsets[i];
+            for (unsigned int a = 0; a < req->config.num_attrs; a++) {
+                if ((req->config.attrs[a].attr.id == GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES)
+                &&  (req->config.attrs[a].mask & (1ULL << i)))
+                    s_fake_chip.values[req->offsets[i]] = (req->config.attrs[a].attr.values >> i) & 1;
+            }
+        }
+        req->fd = req_fd;
+        return 0;
+    }
+
+    for (int i = 0; i < FAKE_CHIP_REQUESTS; i++) {
+        if (s_fake_chip.requests[i].fd != fd)
+            continue;
+        struct gpio_v2_line_values *values = (struct gpio_v2_line_values *) arg;
+        if (request == GPIO_V2_LINE_GET_VALUES_IOCTL) {
+            s_fake_chip.get_values_count++;
+            values->bits = 0;
+            for (int l = 0; l < s_fake_chip.requests[i].num_lines; l++) {
+                if ((values->mask & (1ULL << l))
+                &&  s_fake_chip.values[s_fake_chip.requests[i].offsets[l]])
+                    values->bits |= (1ULL << l);
+            }
+            return 0;
+        }
+        if (request == GPIO_V2_LINE_SET_VALUES_IOCTL) {
+            for (int l = 0; l < s_fake_chip.requests[i].num_lines; l++) {
+                if (values->mask & (1ULL << l))
+                    s_fake_chip.values[s_fake_chip.requests[i].offsets[l]] = (values->bits >> l) & 1;
+            }
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Change a line of the emulated chipset, posting an event to the line
+//  requests watching it
+
+static void
+s_fake_chip_set (int line, int value)
+{
+    s_fake_chip.values[line] = value;
+    for (int i = 0; i < FAKE_CHIP_REQUESTS; i++) {
+        if ((s_fake_chip.requests[i].fd <= 0) || (s_fake_chip.requests[i].event_fd <= 0))
+            continue;
+        for (int l = 0; l < s_fake_chip.requests[i].num_lines; l++) {
+            if (s_fake_chip.requests[i].offsets[l] != line)
+                continue;
+            struct gpio_v2_line_event event;
+            memset (&event, 0, sizeof (event));
+            event.id = value ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+            event.offset = line;
+            if (write (s_fake_chip.requests[i].event_fd, &event, sizeof (event)) != sizeof (event))
+                log_error ("Failed to post fake line event");
+        }
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  ioctl shim, to allow testing without hardware
+
+static int
+libgpio_cdev_ioctl (libgpio_t *self, int fd, unsigned long request, void *arg)
+{
+    s_stats_add (&self->syscalls, 1);
+    if (self->test_mode)
+        return s_fake_chip_ioctl (fd, request, arg);
+    return ioctl (fd, request, arg);
+}
+
+//  --------------------------------------------------------------------------
+//  (Re)Request all the lines of a direction, preserving the GPO values.
+//  Return 0 on success, -1 otherwise
+
+static int
+libgpio_cdev_request (libgpio_t *self, int direction)
+{
+    if (self->chip_fd == -1) {
+        // trick to allow testing
+        self->chip_fd = open ((self->test_mode)?"/dev/null":self->chip_path, O_RDWR | O_CLOEXEC);
+        if (self->chip_fd == -1) {
+            log_error ("Failed to open %s! %i", self->chip_path, errno);
+            return -1;
+        }
+    }
+
+    int *lines = (direction == GPIO_DIRECTION_IN)?self->in_lines:self->out_lines;
+    int count = (direction == GPIO_DIRECTION_IN)?self->in_count:self->out_count;
+    uint64_t mask = (count == GPIO_V2_LINES_MAX)?~0ULL:((1ULL << count) - 1);
+
+    struct gpio_v2_line_request req;
+    memset (&req, 0, sizeof (req));
+    for (int i = 0; i < count; i++)
+        req.offsets[i] = lines[i];
+    req.num_lines = count;
+    snprintf (req.consumer, GPIO_MAX_NAME_SIZE, "%s", FTY_SENSOR_GPIO_AGENT);
+    if (direction == GPIO_DIRECTION_IN) {
+        req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+        if (self->in_edge)
+            req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    }
+    else {
+        req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+        req.config.num_attrs = 1;
+        req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        req.config.attrs[0].attr.values = self->out_values;
+        req.config.attrs[0].mask = mask;
+    }
+
+    // Lines can only be requested once, so release the previous request
+    int *fd = (direction == GPIO_DIRECTION_IN)?&self->in_fd:&self->out_fd;
+    if (*fd != -1) {
+        close (*fd);
+        *fd = -1;
+    }
+    if (libgpio_cdev_ioctl (self, self->chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) == -1) {
+        log_error ("Failed to request %i lines on %s! %i", count, self->chip_path, errno);
+        return -1;
+    }
+    *fd = req.fd;
+
+    // Line events are read from the request itself
+    if ((direction == GPIO_DIRECTION_IN) && self->in_edge && (self->event_fd != -1)) {
+        struct epoll_event event;
+        memset (&event, 0, sizeof (event));
+        event.events = EPOLLIN;
+        event.data.fd = *fd;
+        if (epoll_ctl (self->event_fd, EPOLL_CTL_ADD, *fd, &event) == -1)
+            log_error ("Failed to watch the GPI lines! %i", errno);
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Get the indexes of pins in the line request of their direction, -1 for
+//  the invalid pins (-1 or below the chipset base address), with a single
+//  request for all the missing lines.
+//  Return -1 if the lines couldn't be requested
+
+static int
+libgpio_cdev_lines (libgpio_t *self, const int *pins, int count, int direction, int *indexes)
+{
+    int *lines = (direction == GPIO_DIRECTION_IN)?self->in_lines:self->out_lines;
+    int *lines_count = (direction == GPIO_DIRECTION_IN)?&self->in_count:&self->out_count;
+    int *fd = (direction == GPIO_DIRECTION_IN)?&self->in_fd:&self->out_fd;
+    int added = 0;
+    int valid = 0;
+
+    for (int i = 0; i < count; i++) {
+        indexes[i] = -1;
+        if (pins[i] == -1)
+            continue;
+        int offset = pins[i] - self->gpio_base_address;
+        if (offset < 0) {
+            log_error ("Pin %i is below the chipset base address %i!", pins[i], self->gpio_base_address);
+            continue;
+        }
+        for (int l = 0; l < *lines_count; l++) {
+            if (lines[l] == offset) {
+                indexes[i] = l;
+                break;
+            }
+        }
+        if (indexes[i] == -1) {
+            if (*lines_count == GPIO_V2_LINES_MAX) {
+                log_error ("Too many lines requested!");
+                continue;
+            }
+            lines[*lines_count] = offset;
+            indexes[i] = (*lines_count)++;
+            added++;
+            // Request the GPO driven as it was last written, should its
+            // line have been released meanwhile
+            if (direction == GPIO_DIRECTION_OUT) {
+                int *level = (int *) zhashx_lookup (self->out_levels, (void *) &pins[i]);
+                uint64_t line = 1ULL << indexes[i];
+                self->out_values = (level && (*level != GPIO_STATE_CLOSED)) ?
+                    (self->out_values | line) : (self->out_values & ~line);
+            }
+        }
+        valid++;
+    }
+
+    if ((valid > 0) && ((added > 0) || (*fd == -1))
+    &&  (libgpio_cdev_request (self, direction) == -1)) {
+        *lines_count -= added;
+        if (direction == GPIO_DIRECTION_OUT)
+            self->out_values &= (*lines_count == GPIO_V2_LINES_MAX)?~0ULL:((1ULL << *lines_count) - 1);
+        return -1;
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Get the index of a pin in the line request of its direction, requesting
+//  it if needed.
+//  Return -1 on error
+
+static int
+libgpio_cdev_line (libgpio_t *self, int pin, int direction)
+{
+    int index;
+    if (libgpio_cdev_lines (self, &pin, 1, direction, &index) == -1)
+        return -1;
+    return index;
+}
+
+//  --------------------------------------------------------------------------
+//  Read GPI or GPO statuses through the character device.
+//  All the lines of the direction are read at once.
+
+static void
+libgpio_cdev_read_many (libgpio_t *self, const int *pins, int count, int direction, int *values)
+{
+    int *indexes = (int *) zmalloc (count * sizeof (int));
+    for (int i = 0; i < count; i++)
+        values[i] = -1;
+    int *fd = (direction == GPIO_DIRECTION_IN)?&self->in_fd:&self->out_fd;
+    // Nothing requested when all the pins are invalid
+    if ((libgpio_cdev_lines (self, pins, count, direction, indexes) == -1) || (*fd == -1)) {
+        free (indexes);
+        return;
+    }
+
+    int lines_count = (direction == GPIO_DIRECTION_IN)?self->in_count:self->out_count;
+    struct gpio_v2_line_values line_values;
+    line_values.bits = 0;
+    line_values.mask = (lines_count == GPIO_V2_LINES_MAX)?~0ULL:((1ULL << lines_count) - 1);
+    if (libgpio_cdev_ioctl (self, *fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &line_values) == -1)
+        log_error ("Failed to read values! %i", errno);
+    else {
+        for (int i = 0; i < count; i++) {
+            if (indexes[i] != -1)
+                values[i] = (line_values.bits >> indexes[i]) & 1;
+        }
+    }
+    free (indexes);
+}
+
+//  --------------------------------------------------------------------------
+//  Read a GPI or GPO status through the character device.
+//  All the lines of the direction are read at once.
+
+static int
+libgpio_cdev_read (libgpio_t *self, int pin, int direction)
+{
+    int retvalue;
+    libgpio_cdev_read_many (self, &pin, 1, direction, &retvalue);
+    log_trace ("read value '%i'", retvalue);
+    return retvalue;
+}
+
+//  --------------------------------------------------------------------------
+//  Write GPOs through the character device, all at once
+
+static void
+libgpio_cdev_write_many (libgpio_t *self, const int *pins, const int *values, int count, int *results)
+{
+    int *indexes = (int *) zmalloc (count * sizeof (int));
+    for (int i = 0; i < count; i++)
+        results[i] = -1;
+    if (libgpio_cdev_lines (self, pins, count, GPIO_DIRECTION_OUT, indexes) == -1) {
+        free (indexes);
+        return;
+    }
+
+    struct gpio_v2_line_values line_values;
+    line_values.bits = 0;
+    line_values.mask = 0;
+    for (int i = 0; i < count; i++) {
+        if (indexes[i] == -1)
+            continue;
+        // The last value of a line wins
+        uint64_t line = 1ULL << indexes[i];
+        line_values.mask |= line;
+        line_values.bits = (GPIO_STATE_CLOSED == values[i])?(line_values.bits & ~line):(line_values.bits | line);
+    }
+    // Nothing requested when all the pins are invalid
+    if (line_values.mask == 0) {
+        free (indexes);
+        return;
+    }
+    if (libgpio_cdev_ioctl (self, self->out_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &line_values) == -1)
+        log_error ("Failed to write values! %i", errno);
+    else {
+        self->out_values = (self->out_values & ~line_values.mask) | line_values.bits;
+        for (int i = 0; i < count; i++) {
+            if (indexes[i] == -1)
+                continue;
+            results[i] = 0;
+            int level = ((line_values.bits >> indexes[i]) & 1) ? GPIO_STATE_OPENED : GPIO_STATE_CLOSED;
+            zhashx_update (self->out_levels, (void *) &pins[i], &level);
+        }
+    }
+    free (indexes);
+}
+
+//  --------------------------------------------------------------------------
+//  Write a GPO through the character device
+
+static int
+libgpio_cdev_write (libgpio_t *self, int pin, int value)
+{
+    int retval;
+    libgpio_cdev_write_many (self, &pin, &value, 1, &retval);
+    log_trace ("wrote value '%i' with result %i", value, retval);
+    return retval;
+}
+
+//  --------------------------------------------------------------------------
+//  Enable edge detection on a GPI line
+
+static int
+libgpio_cdev_watch (libgpio_t *self, int pin)
+{
+    if (!self->in_edge) {
+        self->in_edge = true;
+        // Force a new request, with edge detection on all the GPI lines
+        if (self->in_fd != -1) {
+            close (self->in_fd);
+            self->in_fd = -1;
+        }
+    }
+    return (libgpio_cdev_line (self, pin, GPIO_DIRECTION_IN) == -1)?-1:0;
+}
+
+//  --------------------------------------------------------------------------
+//  Read the pending line events of a line request.
+//  Return the number of events read
+
+static int
+libgpio_cdev_get_events (libgpio_t *, int fd)
+{
+    struct gpio_v2_line_event events[16];
+    ssize_t rv = read (fd, events, sizeof (events));
+    if (rv < (ssize_t) sizeof (struct gpio_v2_line_event)) {
+        log_error ("Failed to read line events! %i", errno);
+        return 0;
+    }
+    return (int) (rv / sizeof (struct gpio_v2_line_event));
+}
+
+#else // LIBGPIO_HAVE_CDEV
+
+static int
+libgpio_cdev_read (libgpio_t *, int, int)
+{
+    log_error ("GPIO character device is not supported by this build!");
+    return -1;
+}
+
+static int
+libgpio_cdev_write (libgpio_t *, int, int)
+{
+    log_error ("GPIO character device is not supported by this build!");
+    return -1;
+}
+
+static void
+libgpio_cdev_read_many (libgpio_t *, const int *, int count, int, int *values)
+{
+    log_error ("GPIO character device is not supported by this build!");
+    for (int i = 0; i < count; i++)
+        values[i] = -1;
+}
+
+static void
+libgpio_cdev_write_many (libgpio_t *, const int *, const int *, int count, int *results)
+{
+    log_error ("GPIO character device is not supported by this build!");
+    for (int i = 0; i < count; i++)
+        results[i] = -1;
+}
+
+static int
+libgpio_cdev_watch (libgpio_t *, int)
+{
+    return -1;
+}
+
+static int
+libgpio_cdev_get_events (libgpio_t *, int)
+{
+    return 0;
+}
+
+#endif // LIBGPIO_HAVE_CDEV
+
+//  --------------------------------------------------------------------------
+//  Release the chipset and all the line requests
+
+static void
+libgpio_cdev_release (libgpio_t *self)
+{
+    if (self->in_fd != -1)
+        close (self->in_fd);
+    if (self->out_fd != -1)
+        close (self->out_fd);
+    if (self->chip_fd != -1)
+        close (self->chip_fd);
+    self->in_fd = -1;
+    self->out_fd = -1;
+    self->chip_fd = -1;
+    self->in_count = 0;
+    self->out_count = 0;
+    // out_levels is kept, to request the GPOs driven as they were
+    self->out_values = 0;
+    self->in_edge = false;
+}
+
 //  --------------------------------------------------------------------------
 //  Helper function to recursively create directories
 
@@ -655,3 +1908,39 @@ mkpath(char* file_path, mode_t mode)
     }
     return 0;
 }
+
+//  --------------------------------------------------------------------------
+//  Enable edge detection on a simulated pin. Waveforms are computed on
+//  read, so the edges are checked on a timer, kept in the epoll set
+
+static int
+libgpio_sim_watch (libgpio_t *self, int pin)
+{
+#ifdef __linux__
+    if (self->sim_timer_fd == -1) {
+        self->sim_timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (self->sim_timer_fd == -1) {
+            log_error ("Failed to create the simulated GPIO events timer! %i", errno);
+            return -1;
+        }
+        struct itimerspec interval;
+        memset (&interval, 0, sizeof (interval));
+        interval.it_value.tv_nsec = LIBGPIO_SIM_EVENT_TICK * 1000000L;
+        interval.it_interval.tv_nsec = LIBGPIO_SIM_EVENT_TICK * 1000000L;
+        struct epoll_event event;
+        memset (&event, 0, sizeof (event));
+        event.events = EPOLLIN;
+        event.data.fd = self->sim_timer_fd;
+        if ((timerfd_settime (self->sim_timer_fd, 0, &interval, NULL) == -1)
+        ||  (epoll_ctl (self->event_fd, EPOLL_CTL_ADD, self->sim_timer_fd, &event) == -1)) {
+            log_error ("Failed to start the simulated GPIO events timer! %i", errno);
+            close (self->sim_timer_fd);
+            self->sim_timer_fd = -1;
+            return -1;
+        }
+    }
+    return fty_sensor_gpio_sim_watch (libgpio_get_sim (self), pin);
+#else
+    return -1;
+#endif
+}